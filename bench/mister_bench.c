@@ -0,0 +1,996 @@
+// mister_bench.c: micro-benchmarks for packing, unpacking, printables, UTF-8 validation & VBIs,
+// all through the public API
+
+#define _POSIX_C_SOURCE 200809L // clock_gettime under strict C
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <zlog.h>
+
+#include "mister/mister.h"
+
+#define BENCH_MAX_RESULTS 256
+#define BENCH_MAX_ITERATIONS 1000000000
+#define BENCH_PACK_CAP (1024 * 1024)
+
+typedef int (*bench_fn)(void *arg);
+
+typedef struct bench_result {
+    char name[80];
+    uint64_t iterations;
+    double ns_per_op;
+    double bytes_per_second;
+    double allocs_per_op;
+} bench_result;
+
+typedef struct bench_baseline {
+    char name[80];
+    double ns_per_op;
+} bench_baseline;
+
+// options, google-benchmark style
+static const char *filter = NULL;
+static double min_time = 0.5; // seconds per benchmark
+static bool json_format = false;
+static const char *out_filename = NULL;
+static const char *baseline_filename = NULL; // an earlier run's --benchmark_out, to compare with
+
+static bench_result results[BENCH_MAX_RESULTS];
+static size_t result_count = 0;
+static bench_baseline baselines[BENCH_MAX_RESULTS];
+static size_t baseline_count = 0;
+static int error_count = 0;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t get_allocs(void) {
+    uint64_t allocs, frees;
+    mr_get_alloc_stats(&allocs, &frees);
+    return allocs;
+}
+
+// read the name & real_time of each result in a JSON file written by print_json
+static int read_baselines(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+
+    if (!fp) {
+        fprintf(stderr, "cannot open baseline file: %s\n", filename);
+        return -1;
+    }
+
+    char line[160];
+    char name[80] = "";
+
+    while (fgets(line, sizeof(line), fp) && baseline_count < BENCH_MAX_RESULTS) {
+        double ns_per_op;
+
+        if (sscanf(line, " \"name\": \"%79[^\"]\"", name) == 1) continue;
+
+        if (*name && sscanf(line, " \"real_time\": %lf", &ns_per_op) == 1) {
+            bench_baseline *pb = baselines + baseline_count++;
+            snprintf(pb->name, sizeof(pb->name), "%s", name);
+            pb->ns_per_op = ns_per_op;
+            *name = '\0';
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+static const bench_baseline *find_baseline(const char *name) {
+    for (size_t i = 0; i < baseline_count; i++) {
+        if (!strcmp(baselines[i].name, name)) return baselines + i;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Time fn(arg) & record ns/op, bytes/s & heap allocations/op.
+ *
+ * Like google-benchmark, the iteration count grows until one timed run lasts at least min_time.
+ */
+static void run_bench(const char *name, bench_fn fn, void *arg, const size_t bytes_per_op) {
+    if (filter && !strstr(name, filter)) return;
+
+    if (result_count == BENCH_MAX_RESULTS || fn(arg)) { // the untimed call also warms up caches & pools
+        fprintf(stderr, "%s: benchmark failed\n", name);
+        error_count++;
+        return;
+    }
+
+    uint64_t iterations = 1;
+    double elapsed;
+    uint64_t allocs;
+
+    while (true) {
+        allocs = get_allocs();
+        double start = now_ns();
+
+        for (uint64_t i = 0; i < iterations; i++) {
+            if (fn(arg)) {
+                fprintf(stderr, "%s: benchmark failed\n", name);
+                error_count++;
+                return;
+            }
+        }
+
+        elapsed = now_ns() - start;
+        allocs = get_allocs() - allocs;
+        if (elapsed >= min_time * 1e9 || iterations >= BENCH_MAX_ITERATIONS) break;
+
+        // aim 40% past min_time but grow at most tenfold
+        double multiplier = elapsed > 0 ? min_time * 1e9 * 1.4 / elapsed : 10;
+        if (multiplier > 10) multiplier = 10;
+        uint64_t next = (uint64_t)(iterations * multiplier);
+        iterations = next > iterations ? next : iterations + 1;
+        if (iterations > BENCH_MAX_ITERATIONS) iterations = BENCH_MAX_ITERATIONS;
+    }
+
+    bench_result *pr = results + result_count++;
+    snprintf(pr->name, sizeof(pr->name), "%s", name);
+    pr->iterations = iterations;
+    pr->ns_per_op = elapsed / iterations;
+    pr->bytes_per_second = bytes_per_op ? bytes_per_op * 1e9 / pr->ns_per_op : 0;
+    pr->allocs_per_op = (double)allocs / iterations;
+
+    if (!json_format) {
+        printf(
+            "%-48s %12.1f ns %12lu %10.1f MB/s %8.2f allocs/op",
+            pr->name, pr->ns_per_op, pr->iterations, pr->bytes_per_second / 1e6, pr->allocs_per_op
+        );
+
+        const bench_baseline *pb = find_baseline(pr->name);
+        if (pb) printf(" %8.2fx baseline", pb->ns_per_op / pr->ns_per_op); // > 1 is faster
+        printf("\n");
+    }
+}
+
+static void print_json(FILE *fp, const char *executable) {
+    char date[32];
+    time_t t = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&t));
+
+    fprintf(fp, "{\n  \"context\": {\n");
+    fprintf(fp, "    \"date\": \"%s\",\n", date);
+    fprintf(fp, "    \"executable\": \"%s\",\n", executable);
+    fprintf(fp, "    \"min_time\": %g\n  },\n", min_time);
+    fprintf(fp, "  \"benchmarks\": [\n");
+
+    for (size_t i = 0; i < result_count; i++) {
+        bench_result *pr = results + i;
+        fprintf(fp, "    {\n");
+        fprintf(fp, "      \"name\": \"%s\",\n", pr->name);
+        fprintf(fp, "      \"iterations\": %lu,\n", pr->iterations);
+        fprintf(fp, "      \"real_time\": %.3f,\n", pr->ns_per_op);
+        fprintf(fp, "      \"time_unit\": \"ns\",\n");
+        fprintf(fp, "      \"bytes_per_second\": %.1f,\n", pr->bytes_per_second);
+        fprintf(fp, "      \"allocs_per_iter\": %.3f\n", pr->allocs_per_op);
+        fprintf(fp, "    }%s\n", i + 1 < result_count ? "," : "");
+    }
+
+    fprintf(fp, "  ]\n}\n");
+}
+
+// packets: fixtures & synthetic PUBLISH packets
+
+typedef struct bench_packet {
+    char name[48];
+    uint8_t *u8v0;
+    size_t u8vlen;
+    mr_packet_ctx *pctx; // unpacked once for the pack & printable benchmarks
+    uint8_t *pack_u8v0;
+    mr_publish_fanout *pfo;
+    uint8_t *batch_u8v0; // BENCH_BATCH_PACKETS copies of the packet, as from one read
+} bench_packet;
+
+#define BENCH_BATCH_PACKETS 64
+
+static int bench_unpack(void *arg) {
+    bench_packet *pbp = (bench_packet *)arg;
+    mr_packet_ctx *pctx;
+    if (mr_init_unpack_any_packet(&pctx, pbp->u8v0, pbp->u8vlen, MR_UNPACK_COPY)) return -1;
+    return mr_free_any_packet(pctx);
+}
+
+// the fast path: pooled contexts & byte vectors borrowed from the packet buffer
+static int bench_unpack_borrow_pooled(void *arg) {
+    bench_packet *pbp = (bench_packet *)arg;
+    mr_packet_ctx *pctx;
+    if (mr_init_unpack_any_packet(&pctx, pbp->u8v0, pbp->u8vlen, MR_UNPACK_BORROW)) return -1;
+    return mr_free_any_packet(pctx);
+}
+
+// properties decoded only when read: here, never
+static int bench_unpack_lazy(void *arg) {
+    bench_packet *pbp = (bench_packet *)arg;
+    mr_packet_ctx *pctx;
+    if (mr_init_unpack_any_packet(&pctx, pbp->u8v0, pbp->u8vlen, MR_UNPACK_LAZY)) return -1;
+    return mr_free_any_packet(pctx);
+}
+
+// a read of packets unpacked one at a time: compare with unpack_batch
+static int bench_unpack_each(void *arg) {
+    bench_packet *pbp = (bench_packet *)arg;
+    mr_packet_ctx *pctxv[BENCH_BATCH_PACKETS];
+
+    for (size_t i = 0; i < BENCH_BATCH_PACKETS; i++) {
+        if (mr_init_unpack_any_packet(pctxv + i, pbp->batch_u8v0 + i * pbp->u8vlen, pbp->u8vlen, MR_UNPACK_COPY)) {
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < BENCH_BATCH_PACKETS; i++) mr_free_any_packet(pctxv[i]);
+    return 0;
+}
+
+// the same read unpacked as a batch, the per-type setup done once
+static int bench_unpack_batch(void *arg) {
+    bench_packet *pbp = (bench_packet *)arg;
+    mr_packet_ctx *pctxv[BENCH_BATCH_PACKETS];
+    size_t count, consumed;
+    uint8_t reason_code;
+
+    int rc = mr_init_unpack_packets(
+        pctxv, BENCH_BATCH_PACKETS, pbp->batch_u8v0, BENCH_BATCH_PACKETS * pbp->u8vlen, MR_UNPACK_COPY,
+        &count, &consumed, &reason_code
+    );
+
+    for (size_t i = 0; i < count; i++) mr_free_any_packet(pctxv[i]);
+    return rc || count != BENCH_BATCH_PACKETS ? -1 : 0;
+}
+
+// validate-only: the unpack checks without a packet context: compare with unpack
+static int bench_validate(void *arg) {
+    bench_packet *pbp = (bench_packet *)arg;
+    uint8_t reason_code;
+    return mr_validate_packet_bytes(pbp->u8v0, pbp->u8vlen, &reason_code);
+}
+
+// a PUBLISH with a wildcard topic name: rejecting it must fail fast & log nothing
+static const uint8_t REJECT_PUBLISH[] = {0x30, 0x06, 0x00, 0x03, 'a', '/', '#', 0x00};
+
+static int bench_reject_unpack(void *arg) {
+    (void)arg;
+    mr_packet_ctx *pctx = NULL;
+    int rc = mr_init_unpack_any_packet(&pctx, REJECT_PUBLISH, sizeof(REJECT_PUBLISH), MR_UNPACK_COPY);
+    if (pctx) mr_free_any_packet(pctx);
+    return rc ? 0 : -1;
+}
+
+static int bench_reject_validate(void *arg) {
+    (void)arg;
+    uint8_t reason_code;
+    return mr_validate_packet_bytes(REJECT_PUBLISH, sizeof(REJECT_PUBLISH), &reason_code) ? 0 : -1;
+}
+
+static int run_reject_benches(void) {
+    if (mr_set_error_log_rate(0)) return -1;
+    run_bench("reject_unpack/wildcard_publish", bench_reject_unpack, NULL, sizeof(REJECT_PUBLISH));
+    run_bench("reject_validate/wildcard_publish", bench_reject_validate, NULL, sizeof(REJECT_PUBLISH));
+    return 0;
+}
+
+static int bench_peek_publish(void *arg) {
+    bench_packet *pbp = (bench_packet *)arg;
+    mr_publish_peek peek;
+    return mr_peek_publish(pbp->u8v0, pbp->u8vlen, &peek);
+}
+
+// unpack, pack & free: less unpack_borrow_pooled, packing with its count phase, as for a new packet
+static int bench_repack(void *arg) {
+    bench_packet *pbp = (bench_packet *)arg;
+    mr_packet_ctx *pctx;
+    size_t u8vlen;
+    if (mr_init_unpack_any_packet(&pctx, pbp->u8v0, pbp->u8vlen, MR_UNPACK_BORROW)) return -1;
+    int rc = mr_pack_any_packet_into(pctx, pbp->pack_u8v0, BENCH_PACK_CAP, &u8vlen);
+    return mr_free_any_packet(pctx) || rc;
+}
+
+// one subscriber's copy of a PUBLISH encoded once: compare with pack
+static int bench_fanout(void *arg) {
+    bench_packet *pbp = (bench_packet *)arg;
+    static const uint32_t subscription_identifiers[] = {42};
+    mr_publish_target target = {1, false, false, 1, 0, false, subscription_identifiers, 1};
+    struct iovec iov[2];
+    int iovcnt;
+    return mr_pack_publish_fanout(pbp->pfo, &target, pbp->pack_u8v0, BENCH_PACK_CAP, iov, &iovcnt);
+}
+
+static int bench_printable(void *arg) {
+    bench_packet *pbp = (bench_packet *)arg;
+    char *cv;
+
+    switch (pbp->u8v0[0] >> 4) {
+        case MQTT_CONNECT: return mr_get_connect_printable(pbp->pctx, false, &cv);
+        case MQTT_CONNACK: return mr_get_connack_printable(pbp->pctx, false, &cv);
+        case MQTT_PUBLISH: return mr_get_publish_printable(pbp->pctx, false, &cv);
+        case MQTT_PUBACK: return mr_get_puback_printable(pbp->pctx, false, &cv);
+        case MQTT_SUBSCRIBE: return mr_get_subscribe_printable(pbp->pctx, false, &cv);
+        case MQTT_SUBACK: return mr_get_suback_printable(pbp->pctx, false, &cv);
+        default: return -1;
+    }
+}
+
+static int run_packet_benches(bench_packet *pbp) {
+    if (mr_init_unpack_any_packet(&pbp->pctx, pbp->u8v0, pbp->u8vlen, MR_UNPACK_COPY)) return -1;
+    if (!(pbp->pack_u8v0 = malloc(BENCH_PACK_CAP))) return -1;
+
+    char name[80];
+    snprintf(name, sizeof(name), "unpack/%s", pbp->name);
+    run_bench(name, bench_unpack, pbp, pbp->u8vlen);
+
+    if (!(pbp->batch_u8v0 = malloc(BENCH_BATCH_PACKETS * pbp->u8vlen))) return -1;
+    for (size_t i = 0; i < BENCH_BATCH_PACKETS; i++) {
+        memcpy(pbp->batch_u8v0 + i * pbp->u8vlen, pbp->u8v0, pbp->u8vlen);
+    }
+
+    snprintf(name, sizeof(name), "unpack_each/%s", pbp->name);
+    run_bench(name, bench_unpack_each, pbp, BENCH_BATCH_PACKETS * pbp->u8vlen);
+    snprintf(name, sizeof(name), "unpack_batch/%s", pbp->name);
+    run_bench(name, bench_unpack_batch, pbp, BENCH_BATCH_PACKETS * pbp->u8vlen);
+    free(pbp->batch_u8v0);
+
+    snprintf(name, sizeof(name), "unpack_lazy/%s", pbp->name);
+    run_bench(name, bench_unpack_lazy, pbp, pbp->u8vlen);
+
+    snprintf(name, sizeof(name), "validate/%s", pbp->name);
+    run_bench(name, bench_validate, pbp, pbp->u8vlen);
+
+    if (pbp->u8v0[0] >> 4 == MQTT_PUBLISH) {
+        snprintf(name, sizeof(name), "peek/%s", pbp->name);
+        run_bench(name, bench_peek_publish, pbp, pbp->u8vlen);
+
+        if (mr_init_publish_fanout(&pbp->pfo, pbp->pctx)) return -1;
+        snprintf(name, sizeof(name), "fanout/%s", pbp->name);
+        run_bench(name, bench_fanout, pbp, pbp->u8vlen);
+        if (mr_free_publish_fanout(pbp->pfo)) return -1;
+    }
+
+    if (mr_set_packet_pool_depth(1)) return -1;
+    snprintf(name, sizeof(name), "unpack_borrow_pooled/%s", pbp->name);
+    run_bench(name, bench_unpack_borrow_pooled, pbp, pbp->u8vlen);
+    snprintf(name, sizeof(name), "repack_pooled/%s", pbp->name);
+    run_bench(name, bench_repack, pbp, pbp->u8vlen);
+    if (mr_set_packet_pool_depth(0)) return -1;
+
+    snprintf(name, sizeof(name), "printable/%s", pbp->name);
+    run_bench(name, bench_printable, pbp, pbp->u8vlen);
+
+    free(pbp->pack_u8v0);
+    return mr_free_any_packet(pbp->pctx);
+}
+
+static int get_fixture(const char *fixture_name, bench_packet *pbp) {
+    char filename[80];
+    snprintf(filename, sizeof(filename), "fixtures/%s_packet.bin", fixture_name);
+    FILE *fp = fopen(filename, "r");
+
+    if (!fp) {
+        fprintf(stderr, "cannot open fixture: %s\n", filename);
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    pbp->u8vlen = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (!(pbp->u8v0 = malloc(pbp->u8vlen))) return -1;
+    size_t len = fread(pbp->u8v0, 1, pbp->u8vlen, fp);
+    fclose(fp);
+    snprintf(pbp->name, sizeof(pbp->name), "%s", fixture_name);
+    return len == pbp->u8vlen ? 0 : -1;
+}
+
+static int get_synthetic_publish(const size_t payload_len, bench_packet *pbp) {
+    mr_packet_ctx *pctx;
+    uint8_t *payload;
+    uint8_t *u8v0;
+    if (mr_init_publish_packet(&pctx)) return -1;
+    if (!(payload = malloc(payload_len ? payload_len : 1))) return -1;
+    memset(payload, 'x', payload_len);
+    if (mr_set_publish_topic_name(pctx, "bench/synthetic/topic")) return -1;
+    if (mr_set_publish_payload(pctx, payload, payload_len)) return -1;
+    if (mr_pack_publish_packet(pctx, &u8v0, &pbp->u8vlen)) return -1;
+    if (!(pbp->u8v0 = malloc(pbp->u8vlen))) return -1;
+    memcpy(pbp->u8v0, u8v0, pbp->u8vlen);
+    snprintf(pbp->name, sizeof(pbp->name), "publish_payload_%lu", payload_len);
+    free(payload);
+    return mr_free_publish_packet(pctx);
+}
+
+static const char *FIXTURE_NAMES[] = {
+    "default_connect", "will_connect", "complex_connect",
+    "default_connack", "complex_connack",
+    "default_publish", "complex_publish",
+    "default_puback", "complex_puback",
+    "default_subscribe", "complex_subscribe",
+    "default_suback", "complex_suback"
+};
+
+static const size_t PAYLOAD_LENS[] = {0, 64, 1024, 16384, 262144};
+
+// UTF-8 validation over ASCII & mixed multibyte strings: a PUBLISH's topic name, validated
+
+typedef struct bench_utf8 {
+    uint8_t *u8v0;          ///< the packed PUBLISH
+    size_t u8vlen;
+} bench_utf8;
+
+static int bench_utf8_validation(void *arg) {
+    bench_utf8 *pbu = (bench_utf8 *)arg;
+    uint8_t reason_code;
+    return mr_validate_packet_bytes(pbu->u8v0, pbu->u8vlen, &reason_code);
+}
+
+static const size_t UTF8_LENS[] = {16, 256, 4096, 65535};
+
+// fill with whole copies of pattern, padding the remainder with ASCII
+static void fill_utf8(char *cv, const size_t len, const char *pattern) {
+    size_t plen = strlen(pattern);
+    size_t i = 0;
+    for (; i + plen <= len; i += plen) memcpy(cv + i, pattern, plen);
+    for (; i < len; i++) cv[i] = 'a';
+    cv[len] = '\0';
+}
+
+static int run_utf8_benches(void) {
+    const char *patterns[][2] = {
+        {"ascii", "the quick brown fox jumps over the lazy dog "},
+        {"multibyte", "na\xC3\xAFve \xE2\x82\xAC\xF0\x9F\x98\x80 caf\xC3\xA9 "}
+    };
+
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        for (size_t l = 0; l < sizeof(UTF8_LENS) / sizeof(UTF8_LENS[0]); l++) {
+            char *topic_name = malloc(UTF8_LENS[l] + 1);
+            mr_packet_ctx *pctx;
+            bench_utf8 bu;
+            if (!topic_name || mr_init_publish_packet(&pctx)) return -1;
+            fill_utf8(topic_name, UTF8_LENS[l], patterns[p][1]);
+            if (mr_set_publish_topic_name(pctx, topic_name)) return -1;
+            if (mr_pack_publish_packet(pctx, &bu.u8v0, &bu.u8vlen)) return -1;
+
+            char name[80];
+            snprintf(name, sizeof(name), "utf8_validation/%s/%lu", patterns[p][0], UTF8_LENS[l]);
+            run_bench(name, bench_utf8_validation, &bu, UTF8_LENS[l]);
+            free(topic_name);
+            if (mr_free_publish_packet(pctx)) return -1;
+        }
+    }
+
+    return 0;
+}
+
+// VBI encode & decode: a PUBLISH's subscription identifiers, each a VBI after its property id; for
+// a VBI change, compare 1 to 4 byte values with --benchmark_baseline against the build before it
+
+#define BENCH_VBI_COUNT 1024
+
+typedef struct bench_vbi {
+    uint32_t u32v[BENCH_VBI_COUNT];
+    mr_packet_ctx *pctx;
+    uint8_t *u8v0;          ///< the packed PUBLISH, to decode
+    size_t u8vlen;
+    uint8_t *pack_u8v0;
+} bench_vbi;
+
+// setting the identifiers has the pack count them again
+static int bench_vbi_encode(void *arg) {
+    bench_vbi *pbv = (bench_vbi *)arg;
+    size_t u8vlen;
+    if (mr_set_publish_subscription_identifiers(pbv->pctx, pbv->u32v, BENCH_VBI_COUNT)) return -1;
+    return mr_pack_any_packet_into(pbv->pctx, pbv->pack_u8v0, BENCH_PACK_CAP, &u8vlen);
+}
+
+static int bench_vbi_decode(void *arg) {
+    bench_vbi *pbv = (bench_vbi *)arg;
+    uint8_t reason_code;
+    return mr_validate_packet_bytes(pbv->u8v0, pbv->u8vlen, &reason_code);
+}
+
+static int run_vbi_benches(void) {
+    // values of 1 to 4 bytes, then a mix weighted to short VBIs as in real packets
+    const char *mixes[] = {"1byte", "2byte", "3byte", "4byte", "mixed"};
+    const uint32_t bases[] = {1, 128, 16384, 2097152};
+    const uint32_t spans[] = {127, 16256, 2080768, 266338304};
+    bench_vbi *pbv = calloc(1, sizeof(bench_vbi));
+    if (!pbv || !(pbv->pack_u8v0 = malloc(BENCH_PACK_CAP))) return -1;
+    if (mr_init_publish_packet(&pbv->pctx) || mr_set_publish_topic_name(pbv->pctx, "bench/vbi")) return -1;
+    uint32_t seed = 12345;
+
+    for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+        for (size_t i = 0; i < BENCH_VBI_COUNT; i++) {
+            seed = seed * 1103515245 + 12345;
+            size_t w = m < 4 ? m : (seed >> 8) % 8 < 5 ? 0 : (seed >> 8) % 8 < 7 ? 1 : (seed >> 8) % 8 - 5;
+            pbv->u32v[i] = bases[w] + (seed >> 4) % spans[w];
+        }
+
+        if (mr_set_publish_subscription_identifiers(pbv->pctx, pbv->u32v, BENCH_VBI_COUNT)) return -1;
+        if (mr_pack_publish_packet(pbv->pctx, &pbv->u8v0, &pbv->u8vlen)) return -1;
+
+        char name[80];
+        snprintf(name, sizeof(name), "vbi_encode/%s", mixes[m]);
+        run_bench(name, bench_vbi_encode, pbv, pbv->u8vlen);
+        snprintf(name, sizeof(name), "vbi_decode/%s", mixes[m]);
+        run_bench(name, bench_vbi_decode, pbv, pbv->u8vlen);
+    }
+
+    free(pbv->pack_u8v0);
+    int rc = mr_free_publish_packet(pbv->pctx);
+    free(pbv);
+    return rc;
+}
+
+static void usage(const char *executable) {
+    fprintf(
+        stderr,
+        "usage: %s [--benchmark_filter=<substring>] [--benchmark_min_time=<seconds>]\n"
+        "       [--benchmark_format=console|json] [--benchmark_out=<json filename>]\n"
+        "       [--benchmark_baseline=<json filename from an earlier --benchmark_out>]\n",
+        executable
+    );
+}
+
+// subscription index: matching a topic name, and a subscribe/unsubscribe pair, against n filters
+
+static const size_t SUBSCRIPTION_COUNTS[] = {10000, 1000000};
+
+typedef struct bench_subscriptions {
+    mr_subscription_index *psi;
+    size_t filter_count;
+    size_t next;            ///< rotates the topic name matched
+    size_t match_count;
+} bench_subscriptions;
+
+static int count_match(const mr_subscription *psub, void *arg) {
+    (void)psub;
+    ((bench_subscriptions *)arg)->match_count++;
+    return 0;
+}
+
+static int bench_subscription_match(void *arg) {
+    bench_subscriptions *pbs = (bench_subscriptions *)arg;
+    char topic_name[64];
+    pbs->next = (pbs->next + 7919) % pbs->filter_count;
+    int len = snprintf(topic_name, sizeof(topic_name), "devices/%lu/temperature", pbs->next);
+    pbs->match_count = 0;
+    if (mr_match_subscriptions(pbs->psi, topic_name, len, NULL, count_match, pbs)) return -1;
+    return pbs->match_count == 4 ? 0 : -1; // its own filter, devices/+/temperature, devices/# & #
+}
+
+static int bench_subscription_churn(void *arg) {
+    bench_subscriptions *pbs = (bench_subscriptions *)arg;
+    mr_subscription sub = {(void *)pbs, 1, 0, 0, 0, 0};
+    bool flag;
+    if (mr_add_subscription(pbs->psi, "devices/new/humidity", 20, &sub, &flag)) return -1;
+    return mr_remove_subscription(pbs->psi, "devices/new/humidity", 20, pbs, &flag);
+}
+
+// matching on several threads while this one subscribes & unsubscribes: ns/op is per round of
+// BENCH_MATCHES_PER_THREAD matches on every thread, so flat ns/op across thread counts is linear scaling
+
+#define BENCH_MATCHES_PER_THREAD 1000
+
+typedef struct bench_match_thread {
+    bench_subscriptions bs; ///< each thread its own rotation & count, sharing the index
+    pthread_t thread;
+    int rc;
+} bench_match_thread;
+
+typedef struct bench_match_threads {
+    bench_subscriptions *pbs;
+    size_t thread_count;
+    bench_match_thread threads[16];
+} bench_match_threads;
+
+static void *match_thread(void *arg) {
+    bench_match_thread *pmt = (bench_match_thread *)arg;
+
+    for (size_t i = 0; i < BENCH_MATCHES_PER_THREAD && !pmt->rc; i++) {
+        pmt->rc = bench_subscription_match(&pmt->bs);
+    }
+
+    return NULL;
+}
+
+static int bench_subscription_match_threads(void *arg) {
+    bench_match_threads *pmts = (bench_match_threads *)arg;
+    int rc = 0;
+
+    for (size_t i = 0; i < pmts->thread_count; i++) {
+        bench_match_thread *pmt = pmts->threads + i;
+        pmt->bs = *pmts->pbs;
+        pmt->bs.next = i * 104729;
+        pmt->rc = 0;
+        if (pthread_create(&pmt->thread, NULL, match_thread, pmt)) return -1;
+    }
+
+    for (size_t i = 0; i < 64; i++) rc |= bench_subscription_churn(pmts->pbs);
+
+    for (size_t i = 0; i < pmts->thread_count; i++) {
+        pthread_join(pmts->threads[i].thread, NULL);
+        rc |= pmts->threads[i].rc;
+    }
+
+    return rc;
+}
+
+static int run_subscription_benches(void) {
+    for (size_t c = 0; c < sizeof(SUBSCRIPTION_COUNTS) / sizeof(SUBSCRIPTION_COUNTS[0]); c++) {
+        bench_subscriptions bs = {.filter_count = SUBSCRIPTION_COUNTS[c]};
+        if (mr_init_subscription_index(&bs.psi)) return -1;
+        const char *wildcard_filters[] = {"devices/+/temperature", "devices/#", "#", "+/+/humidity"};
+        char filter[64];
+        bool replaced;
+
+        for (size_t i = 0; i < bs.filter_count; i++) {
+            mr_subscription sub = {(void *)(uintptr_t)(i + 1), 0, 0, 0, 0, 0};
+            int len = snprintf(filter, sizeof(filter), "devices/%lu/temperature", i);
+            if (mr_add_subscription(bs.psi, filter, len, &sub, &replaced)) return -1;
+        }
+
+        for (size_t i = 0; i < sizeof(wildcard_filters) / sizeof(wildcard_filters[0]); i++) {
+            mr_subscription sub = {(void *)(uintptr_t)(bs.filter_count + i + 1), 0, 0, 0, 0, 0};
+            if (mr_add_subscription(bs.psi, wildcard_filters[i], strlen(wildcard_filters[i]), &sub, &replaced)) return -1;
+        }
+
+        char name[80];
+        snprintf(name, sizeof(name), "subscription_match/%lu", bs.filter_count);
+        run_bench(name, bench_subscription_match, &bs, 0);
+        snprintf(name, sizeof(name), "subscription_churn/%lu", bs.filter_count);
+        run_bench(name, bench_subscription_churn, &bs, 0);
+
+        for (size_t t = 1; t <= 8; t *= 2) {
+            bench_match_threads mts = {&bs, t};
+            snprintf(name, sizeof(name), "subscription_match_threads/%lu/%lu", bs.filter_count, t);
+            run_bench(name, bench_subscription_match_threads, &mts, 0);
+        }
+
+        if (mr_free_subscription_index(bs.psi)) return -1;
+    }
+
+    return 0;
+}
+
+// retained store: a subscribe's lookup of n retained messages, grouped 100 to a site, and replacing one
+
+static const size_t RETAINED_COUNTS[] = {10000, 1000000};
+
+typedef struct bench_retained {
+    mr_retained_store *prs;
+    mr_packet_ctx *pctx;    ///< the PUBLISH retained, its topic name rotated
+    size_t message_count;
+    size_t next;
+    size_t match_count;
+} bench_retained;
+
+static int count_retained(const mr_retained_message *prm, void *arg) {
+    (void)prm;
+    ((bench_retained *)arg)->match_count++;
+    return 0;
+}
+
+static int bench_retained_match_site(void *arg) {
+    bench_retained *pbr = (bench_retained *)arg;
+    char topic_filter[64];
+    pbr->next = (pbr->next + 7919) % pbr->message_count;
+    int len = snprintf(topic_filter, sizeof(topic_filter), "sites/%lu/devices/+", pbr->next / 100);
+    pbr->match_count = 0;
+    if (mr_match_retained(pbr->prs, topic_filter, len, 0, count_retained, pbr)) return -1;
+    return pbr->match_count == 100 ? 0 : -1;
+}
+
+static int bench_retained_match_topic(void *arg) {
+    bench_retained *pbr = (bench_retained *)arg;
+    char topic_filter[64];
+    pbr->next = (pbr->next + 7919) % pbr->message_count;
+    int len = snprintf(topic_filter, sizeof(topic_filter), "sites/%lu/devices/%lu", pbr->next / 100, pbr->next);
+    pbr->match_count = 0;
+    if (mr_match_retained(pbr->prs, topic_filter, len, 0, count_retained, pbr)) return -1;
+    return pbr->match_count == 1 ? 0 : -1;
+}
+
+static int retain_next(bench_retained *pbr) {
+    char topic_name[64];
+    snprintf(topic_name, sizeof(topic_name), "sites/%lu/devices/%lu", pbr->next / 100, pbr->next);
+    bool removed;
+    if (mr_set_publish_topic_name(pbr->pctx, topic_name)) return -1;
+    return mr_retain_publish_packet(pbr->prs, pbr->pctx, 0, &removed);
+}
+
+static int bench_retained_replace(void *arg) {
+    bench_retained *pbr = (bench_retained *)arg;
+    pbr->next = (pbr->next + 7919) % pbr->message_count;
+    return retain_next(pbr);
+}
+
+static int run_retained_benches(void) {
+    const uint8_t payload[] = "{\"temperature\": 21.5}";
+
+    for (size_t c = 0; c < sizeof(RETAINED_COUNTS) / sizeof(RETAINED_COUNTS[0]); c++) {
+        bench_retained br = {.message_count = RETAINED_COUNTS[c]};
+        if (mr_init_retained_store(&br.prs)) return -1;
+        if (mr_init_publish_packet(&br.pctx)) return -1;
+        if (mr_set_publish_payload(br.pctx, payload, sizeof(payload) - 1)) return -1;
+
+        for (br.next = 0; br.next < br.message_count; br.next++) {
+            if (retain_next(&br)) return -1;
+        }
+
+        char name[80];
+        snprintf(name, sizeof(name), "retained_match_site/%lu", br.message_count);
+        run_bench(name, bench_retained_match_site, &br, 0);
+        snprintf(name, sizeof(name), "retained_match_topic/%lu", br.message_count);
+        run_bench(name, bench_retained_match_topic, &br, 0);
+        snprintf(name, sizeof(name), "retained_replace/%lu", br.message_count);
+        run_bench(name, bench_retained_replace, &br, 0);
+
+        if (mr_free_publish_packet(br.pctx)) return -1;
+        if (mr_free_retained_store(br.prs)) return -1;
+    }
+
+    return 0;
+}
+
+// retained store cold start: opening a persistent store of n messages, against replaying their
+// frames through unpack & retain as a restart without persistence does
+
+static const size_t COLD_START_COUNTS[] = {10000, 100000, 1000000};
+
+typedef struct bench_cold_start {
+    char dir[64];
+    uint8_t *frames;        ///< every retained frame, back to back, for the replay
+    size_t frames_len;
+    size_t frames_cap;
+} bench_cold_start;
+
+static int bench_retained_cold_start(void *arg) {
+    bench_cold_start *pbcs = (bench_cold_start *)arg;
+    mr_retained_store *prs;
+    if (mr_open_retained_store(&prs, pbcs->dir, 0, 0)) return -1;
+    return mr_free_retained_store(prs);
+}
+
+static int bench_retained_replay(void *arg) {
+    bench_cold_start *pbcs = (bench_cold_start *)arg;
+    mr_retained_store *prs;
+    if (mr_init_retained_store(&prs)) return -1;
+
+    for (size_t pos = 0; pos < pbcs->frames_len;) {
+        mr_packet_ctx *pctxv[64];
+        size_t count, consumed;
+        uint8_t reason_code;
+        bool removed;
+
+        if (mr_init_unpack_packets(
+            pctxv, 64, pbcs->frames + pos, pbcs->frames_len - pos, MR_UNPACK_COPY, &count, &consumed, &reason_code
+        )) return -1;
+
+        for (size_t i = 0; i < count; i++) {
+            if (mr_retain_publish_packet(prs, pctxv[i], 0, &removed) || mr_free_publish_packet(pctxv[i])) return -1;
+        }
+
+        pos += consumed;
+    }
+
+    return mr_free_retained_store(prs);
+}
+
+static int collect_frame(const mr_retained_message *prm, void *arg) {
+    bench_cold_start *pbcs = (bench_cold_start *)arg;
+
+    if (pbcs->frames_len + prm->u8vlen > pbcs->frames_cap) {
+        pbcs->frames_cap = (pbcs->frames_len + prm->u8vlen) * 2;
+        uint8_t *u8v = realloc(pbcs->frames, pbcs->frames_cap);
+        if (!u8v) return -1;
+        pbcs->frames = u8v;
+    }
+
+    memcpy(pbcs->frames + pbcs->frames_len, prm->u8v0, prm->u8vlen);
+    pbcs->frames_len += prm->u8vlen;
+    return 0;
+}
+
+static void remove_dir(const char *dir) {
+    DIR *pdir = opendir(dir);
+    struct dirent *de;
+    char path[512];
+
+    while (pdir && (de = readdir(pdir))) {
+        if (de->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        unlink(path);
+    }
+
+    if (pdir) closedir(pdir);
+    rmdir(dir);
+}
+
+static int run_cold_start_benches(void) {
+    const uint8_t payload[] = "{\"temperature\": 21.5}";
+
+    for (size_t c = 0; c < sizeof(COLD_START_COUNTS) / sizeof(COLD_START_COUNTS[0]); c++) {
+        bench_cold_start bcs = {.dir = "/tmp/mister-bench-XXXXXX"};
+        if (!mkdtemp(bcs.dir)) return -1;
+        bench_retained br = {.message_count = COLD_START_COUNTS[c]};
+        int rc = mr_open_retained_store(&br.prs, bcs.dir, 0, 0) || mr_init_publish_packet(&br.pctx);
+        rc = rc || mr_set_publish_payload(br.pctx, payload, sizeof(payload) - 1);
+
+        for (br.next = 0; !rc && br.next < br.message_count; br.next++) rc = retain_next(&br);
+
+        size_t log_bytes = 0;
+        rc = rc || mr_get_retained_log_size(br.prs, &log_bytes);
+        rc = rc || mr_match_retained(br.prs, "#", 1, 0, collect_frame, &bcs);
+        if (br.pctx) mr_free_publish_packet(br.pctx);
+        if (br.prs) mr_free_retained_store(br.prs);
+
+        if (!rc) {
+            char name[80];
+            snprintf(name, sizeof(name), "retained_cold_start/%lu", br.message_count);
+            run_bench(name, bench_retained_cold_start, &bcs, log_bytes);
+            snprintf(name, sizeof(name), "retained_replay/%lu", br.message_count);
+            run_bench(name, bench_retained_replay, &bcs, bcs.frames_len);
+        }
+
+        free(bcs.frames);
+        remove_dir(bcs.dir);
+        if (rc) return -1;
+    }
+
+    return 0;
+}
+
+// topic aliases: a connection's copies of PUBLISHes to 64 topic names, framed by fan-out, without
+// aliases & with aliases for all or a quarter of the names; also the bytes on the wire per message
+
+#define BENCH_ALIAS_TOPICS 64
+
+static const uint16_t ALIAS_MAXIMA[] = {0, 64, 16};
+
+typedef struct bench_topic_alias {
+    mr_topic_aliases *pta;  ///< NULL: no aliases
+    mr_packet_ctx *pctxs[BENCH_ALIAS_TOPICS];
+    mr_publish_fanout *pfos[BENCH_ALIAS_TOPICS];
+    char topic_names[BENCH_ALIAS_TOPICS][64];
+    size_t topic_name_lens[BENCH_ALIAS_TOPICS];
+    uint8_t buf[256];
+    size_t wire_bytes;      ///< of the last batch
+} bench_topic_alias;
+
+static int bench_topic_alias_fanout(void *arg) {
+    bench_topic_alias *pbta = (bench_topic_alias *)arg;
+    struct iovec iov[2];
+    int iovcnt;
+    pbta->wire_bytes = 0;
+
+    for (size_t i = 0; i < BENCH_ALIAS_TOPICS; i++) {
+        mr_publish_target target = {1, false, false, 1, 0, false, NULL, 0};
+        if (pbta->pta && mr_assign_topic_alias(pbta->pta, pbta->topic_names[i], pbta->topic_name_lens[i], &target)) {
+            return -1;
+        }
+
+        if (mr_pack_publish_fanout(pbta->pfos[i], &target, pbta->buf, sizeof(pbta->buf), iov, &iovcnt)) return -1;
+        pbta->wire_bytes += iov[0].iov_len + (iovcnt == 2 ? iov[1].iov_len : 0);
+    }
+
+    return 0;
+}
+
+static int run_topic_alias_benches(void) {
+    const uint8_t payload[] = "{\"temperature\": 21.5}";
+    bench_topic_alias *pbta = calloc(1, sizeof(bench_topic_alias));
+    if (!pbta) return -1;
+
+    for (size_t i = 0; i < BENCH_ALIAS_TOPICS; i++) {
+        pbta->topic_name_lens[i] = snprintf(
+            pbta->topic_names[i], sizeof(pbta->topic_names[i]), "sites/%lu/devices/%lu/temperature", i / 8, i
+        );
+
+        if (mr_init_publish_packet(pbta->pctxs + i)) return -1;
+        if (mr_set_publish_topic_name(pbta->pctxs[i], pbta->topic_names[i])) return -1;
+        if (mr_set_publish_payload(pbta->pctxs[i], payload, sizeof(payload) - 1)) return -1;
+        if (mr_init_publish_fanout(pbta->pfos + i, pbta->pctxs[i])) return -1;
+    }
+
+    for (size_t m = 0; m < sizeof(ALIAS_MAXIMA) / sizeof(ALIAS_MAXIMA[0]); m++) {
+        pbta->pta = NULL;
+        if (ALIAS_MAXIMA[m] && mr_init_topic_aliases(&pbta->pta, 0, ALIAS_MAXIMA[m])) return -1;
+        if (bench_topic_alias_fanout(pbta)) return -1; // the aliases set up: the bytes of a later batch
+
+        char name[80];
+        snprintf(name, sizeof(name), "topic_alias_fanout/%u", ALIAS_MAXIMA[m]);
+        run_bench(name, bench_topic_alias_fanout, pbta, pbta->wire_bytes);
+
+        if (!json_format && (!filter || strstr(name, filter))) {
+            printf("%-48s %12.1f wire bytes/message\n", name, (double)pbta->wire_bytes / BENCH_ALIAS_TOPICS);
+        }
+
+        if (pbta->pta && mr_free_topic_aliases(pbta->pta)) return -1;
+    }
+
+    for (size_t i = 0; i < BENCH_ALIAS_TOPICS; i++) {
+        if (mr_free_publish_fanout(pbta->pfos[i]) || mr_free_publish_packet(pbta->pctxs[i])) return -1;
+    }
+
+    free(pbta);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--benchmark_filter=", 19)) {
+            filter = argv[i] + 19;
+        }
+        else if (!strncmp(argv[i], "--benchmark_min_time=", 21)) {
+            min_time = atof(argv[i] + 21);
+        }
+        else if (!strcmp(argv[i], "--benchmark_format=json")) {
+            json_format = true;
+        }
+        else if (!strcmp(argv[i], "--benchmark_format=console")) {
+            json_format = false;
+        }
+        else if (!strncmp(argv[i], "--benchmark_out=", 16)) {
+            out_filename = argv[i] + 16;
+        }
+        else if (!strncmp(argv[i], "--benchmark_baseline=", 21)) {
+            baseline_filename = argv[i] + 21;
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (baseline_filename && read_baselines(baseline_filename)) return 2;
+    dzlog_init("", "mr_init");
+
+    for (size_t i = 0; i < sizeof(FIXTURE_NAMES) / sizeof(FIXTURE_NAMES[0]); i++) {
+        bench_packet bp = {0};
+        if (get_fixture(FIXTURE_NAMES[i], &bp) || run_packet_benches(&bp)) error_count++;
+        free(bp.u8v0);
+    }
+
+    for (size_t i = 0; i < sizeof(PAYLOAD_LENS) / sizeof(PAYLOAD_LENS[0]); i++) {
+        bench_packet bp = {0};
+        if (get_synthetic_publish(PAYLOAD_LENS[i], &bp) || run_packet_benches(&bp)) error_count++;
+        free(bp.u8v0);
+    }
+
+    if (run_utf8_benches()) error_count++;
+    if (run_vbi_benches()) error_count++;
+    if (run_reject_benches()) error_count++;
+    if (run_subscription_benches()) error_count++;
+    if (run_retained_benches()) error_count++;
+    if (run_cold_start_benches()) error_count++;
+    if (run_topic_alias_benches()) error_count++;
+
+    if (json_format) print_json(stdout, argv[0]);
+
+    if (out_filename) {
+        FILE *fp = fopen(out_filename, "w");
+
+        if (!fp) {
+            fprintf(stderr, "cannot open output file: %s\n", out_filename);
+            error_count++;
+        }
+        else {
+            print_json(fp, argv[0]);
+            fclose(fp);
+        }
+    }
+
+    zlog_fini();
+    return error_count ? 1 : 0;
+}
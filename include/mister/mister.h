@@ -9,6 +9,7 @@ extern "C" {
 
 #include <stdbool.h>
 #include <stdlib.h>
+#include <sys/uio.h>
 /*
 // MisteR Commands understood by the Redis mister module
 #define MR_CONNECT          "mr.connect"
@@ -27,6 +28,30 @@ extern "C" {
 #define MR_DISCONNECT       "mr.disconnect"
 #define MR_AUTH             "mr.auth"
  */
+
+/**
+ * @brief MQTT5 packet types.
+ *
+ */
+enum mqtt_packet_type {
+    MQTT_RESERVED,
+    MQTT_CONNECT,
+    MQTT_CONNACK,
+    MQTT_PUBLISH,
+    MQTT_PUBACK,
+    MQTT_PUBREC,
+    MQTT_PUBREL,
+    MQTT_PUBCOMP,
+    MQTT_SUBSCRIBE,
+    MQTT_SUBACK,
+    MQTT_UNSUBSCRIBE,
+    MQTT_UNSUBACK,
+    MQTT_PINGREQ,
+    MQTT_PINGRESP,
+    MQTT_DISCONNECT,
+    MQTT_AUTH
+};
+
 // spec & mosquitto
 enum mqtt_reason_codes {
     MQTT_RC_SUCCESS = 0,                                    ///< CONNACK, PUBACK, PUBREC, PUBREL, PUBCOMP, UNSUBACK, AUTH
@@ -76,7 +101,39 @@ enum mqtt_reason_codes {
     MQTT_RC_WILDCARD_SUBSCRIPTIONS_NOT_SUPPORTED = 162,     ///< SUBACK, DISCONNECT
 };
 
-extern int mr_errno;
+// per-thread errno-style value, e.g. ENOBUFS from mr_pack_packet_into
+int *mr_errno_location(void);
+#define mr_errno (*mr_errno_location())
+
+// per-thread structured errors: the last failure's code, MQTT reason code & location, recorded
+// without formatting; error log lines are rate limited per thread by mr_set_error_log_rate
+enum mr_error_codes {
+    MR_ERR_NONE = 0,
+    MR_ERR_NOMEM,                   ///< a heap allocation failed
+    MR_ERR_NOBUFS,                  ///< the caller's buffer is too small
+    MR_ERR_PACKET_TYPE,             ///< reserved or unsupported packet type, or a context of another type
+    MR_ERR_TRUNCATED,               ///< a field runs past its packet or property block
+    MR_ERR_LENGTH,                  ///< a length disagrees with the bytes present
+    MR_ERR_VBI,                     ///< malformed variable byte integer
+    MR_ERR_PROPERTY_ID,             ///< property id not allowed in the packet
+    MR_ERR_DUPLICATE,               ///< a property that must appear at most once is repeated
+    MR_ERR_UTF8,                    ///< invalid UTF-8 or a disallowed code point
+    MR_ERR_VALUE,                   ///< a value out of range or inconsistent with another field
+    MR_ERR_IO                       ///< a file operation failed; mr_errno holds its errno
+};
+
+typedef struct mr_error {
+    int code;                       ///< mr_error_codes
+    uint8_t reason_code;            ///< mqtt_reason_codes, e.g. MQTT_RC_MALFORMED_PACKET
+    uint8_t packet_type;            ///< mqtt_packet_types; MQTT_RESERVED if unknown
+    int field_idx;                  ///< the packet's *_MDATA_FIELDS value; -1 if none
+    size_t offset;                  ///< byte offset in the packet or stream
+} mr_error;
+
+int mr_get_error(mr_error *perr);
+int mr_clear_error(void);
+int mr_get_error_name(const int code, const char **pcv0);
+int mr_set_error_log_rate(const uint32_t lines_per_second);
 
 typedef struct mr_packet_ctx mr_packet_ctx;
 
@@ -93,6 +150,133 @@ typedef struct mr_topic_filter {
     uint8_t retain_handling;        // packed into bits 4-5 (6-7 are reserved and set to 0)
 } mr_topic_filter;
 
+// unpack options: MR_UNPACK_BORROW leaves binary & payload values pointing into the caller's buffer,
+// which must then outlive the packet context; strings are always copied so they can be NUL-terminated.
+// MR_UNPACK_ARENA carves all copied values from one arena owned by the packet context.
+// MR_UNPACK_LAZY only locates vector properties (strings, binary data, user properties &
+// subscription identifiers) at unpack; each is decoded & validated on its first get, or when the
+// packet is packed or printed. The caller's buffer must then outlive the packet context.
+enum mr_unpack_flags {
+    MR_UNPACK_COPY = 0,
+    MR_UNPACK_BORROW = 1 << 0,
+    MR_UNPACK_ARENA = 1 << 1,
+    MR_UNPACK_LAZY = 1 << 2
+};
+
+// field masks for unpacking only some fields: the MR_FIELD of each wanted *_MDATA_FIELDS value
+#define MR_FIELD(idx) (UINT64_C(1) << (idx))
+
+// frame decoder: finds packet boundaries in a byte stream without copying it
+
+typedef struct mr_frame_decoder mr_frame_decoder;
+
+typedef struct mr_frame {
+    uint8_t packet_type;            // fixed header bits 4-7
+    uint8_t flags;                  // fixed header bits 0-3
+    size_t offset;                  // stream offset of the first byte of the packet
+    uint8_t header_len;             // fixed header length: 1 + remaining length VBI bytes
+    uint32_t remaining_length;
+    size_t length;                  // header_len + remaining_length
+} mr_frame;
+
+int mr_init_frame_decoder(mr_frame_decoder **ppfd, const size_t maximum_packet_size);
+int mr_reset_frame_decoder(mr_frame_decoder *pfd);
+int mr_free_frame_decoder(mr_frame_decoder *pfd);
+int mr_get_frame_decoder_offset(mr_frame_decoder *pfd, size_t *poffset);
+int mr_decode_frames(
+    mr_frame_decoder *pfd,
+    const uint8_t *u8v0,
+    const size_t u8vlen,
+    mr_frame *frames,
+    const size_t frames_len,
+    size_t *pframe_count,
+    size_t *pconsumed
+);
+
+// subscription index: topic filters with their subscribers, matched against PUBLISH topic names;
+// matching is lock-free & may run on any number of threads alongside subscribes & unsubscribes
+
+typedef struct mr_subscription_index mr_subscription_index;
+
+typedef struct mr_subscription {
+    void *subscriber;               // the caller's handle, e.g. its session
+    uint8_t maximum_qos;
+    uint8_t no_local;
+    uint8_t retain_as_published;
+    uint8_t retain_handling;
+    uint32_t subscription_identifier; // 0 for none
+} mr_subscription;
+
+// called per matching subscription; a nonzero return stops the match
+typedef int (*mr_subscription_fn)(const mr_subscription *psub, void *arg);
+
+int mr_init_subscription_index(mr_subscription_index **ppsi);
+int mr_free_subscription_index(mr_subscription_index *psi);
+int mr_get_subscription_index_counts(mr_subscription_index *psi, size_t *psubscription_count, size_t *pnode_count);
+int mr_synchronize_subscription_index(mr_subscription_index *psi);
+int mr_add_subscription(
+    mr_subscription_index *psi,
+    const char *topic_filter,
+    const size_t len,
+    const mr_subscription *psub,
+    bool *preplaced
+);
+int mr_remove_subscription(
+    mr_subscription_index *psi, const char *topic_filter, const size_t len, const void *subscriber, bool *premoved
+);
+int mr_add_subscribe_packet(
+    mr_subscription_index *psi,
+    mr_packet_ctx *pctx,
+    void *subscriber,
+    uint8_t *reason_codes,
+    const size_t reason_codes_len
+);
+int mr_match_subscriptions(
+    mr_subscription_index *psi,
+    const char *topic_name,
+    const size_t len,
+    const void *publisher,
+    mr_subscription_fn fn,
+    void *arg
+);
+
+// retained store: the last retained PUBLISH per topic name, packed for resending & found by topic
+// filter; not thread-safe
+
+typedef struct mr_retained_store mr_retained_store;
+
+typedef struct mr_retained_message {
+    const uint8_t *u8v0;            // the packed PUBLISH, retain set
+    size_t u8vlen;
+    const char *topic_name;         // not NUL-terminated
+    size_t topic_name_len;
+} mr_retained_message;
+
+// called per matching retained message; a nonzero return stops the match
+typedef int (*mr_retained_fn)(const mr_retained_message *prm, void *arg);
+
+int mr_init_retained_store(mr_retained_store **pprs);
+int mr_free_retained_store(mr_retained_store *prs);
+int mr_get_retained_store_counts(
+    mr_retained_store *prs, size_t *pmessage_count, size_t *pnode_count, size_t *pbyte_count
+);
+int mr_retain_publish_packet(mr_retained_store *prs, mr_packet_ctx *pctx, const uint64_t now, bool *premoved);
+int mr_expire_retained(mr_retained_store *prs, const uint64_t now, size_t *pexpired_count);
+int mr_match_retained(
+    mr_retained_store *prs,
+    const char *topic_filter,
+    const size_t len,
+    const uint64_t now,
+    mr_retained_fn fn,
+    void *arg
+);
+
+// persistent retained store: changes appended to segment files in a directory, mapped when reopened
+int mr_open_retained_store(mr_retained_store **pprs, const char *dir, const size_t segment_size, const uint64_t now);
+int mr_sync_retained_store(mr_retained_store *prs);
+int mr_get_retained_log_size(mr_retained_store *prs, size_t *plog_bytes);
+int mr_compact_retained_store(mr_retained_store *prs, const uint64_t now);
+
 // utilities
 
 int mr_print_hexdump(uint8_t *u8v, const size_t u8vlen);
@@ -101,10 +285,115 @@ void mr_compress_spaces_lines(char *cv);
 size_t u64tobase62cv(uint64_t u64, char* cv);
 void get_uuidbase62cv(char *uuidbase62cv);
 
+// MQTT UTF-8 strings: well-formed, at most 65535 bytes & without U+0000 or control characters; on
+// failure set the 1-based position of the first bad byte. Runs of printable ASCII are scanned by the
+// widest implementation the CPU supports, or by the one this thread selects, e.g. to test each.
+enum mr_utf8_impls {
+    MR_UTF8_AUTO = 0,
+    MR_UTF8_SWAR,                   ///< portable, 8 bytes at a time in a uint64_t
+    MR_UTF8_SSE2,                   ///< x86 only
+    MR_UTF8_AVX2                    ///< x86 with AVX2 only
+};
+
+int mr_validate_utf8_string(const uint8_t *u8v, const size_t len, size_t *perr_pos);
+int mr_set_utf8_impl(const int impl);
+
+// per-thread packet context pool: off until a depth is set
+
+int mr_set_packet_pool_depth(const size_t depth);
+int mr_drain_packet_pool(void);
+int mr_get_packet_pool_stats(uint64_t *phits, uint64_t *pmisses);
+int mr_get_packet_arena_size(mr_packet_ctx *pctx, size_t *psize);
+
+// per-thread heap allocation counts: calloc, malloc & realloc calls; frees of non-NULL pointers
+
+int mr_get_alloc_stats(uint64_t *pallocs, uint64_t *pfrees);
+
+// any packet: dispatched on the packet type in the first byte
+
+int mr_init_unpack_any_packet(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+);
+int mr_init_unpack_any_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+);
+int mr_init_unpack_packets(
+    mr_packet_ctx **pctxv,
+    const size_t pctxv_len,
+    const uint8_t *u8v0,
+    const size_t u8vlen,
+    const int unpack_flags,
+    size_t *ppacket_count,
+    size_t *pconsumed,
+    uint8_t *preason_code
+);
+int mr_get_any_packet_type(mr_packet_ctx *pctx, uint8_t *pu8);
+int mr_free_any_packet(mr_packet_ctx *pctx);
+
+// validate-only: check a packet's bytes as unpacking would, without allocating; on failure set the
+// MQTT reason code, e.g. MQTT_RC_MALFORMED_PACKET or MQTT_RC_PROTOCOL_ERROR
+int mr_validate_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code);
+
+// packing a packet of any type: into a new buffer owned by the packet context; into the caller's
+// buffer; or for writev, as a header segment plus the uncopied payload
+int mr_get_packed_size(mr_packet_ctx *pctx, size_t *pu8vlen);
+int mr_pack_any_packet(mr_packet_ctx *pctx, uint8_t **pu8v0, size_t *pu8vlen);
+int mr_pack_any_packet_into(mr_packet_ctx *pctx, uint8_t *u8v0, const size_t u8vcap, size_t *pu8vlen);
+int mr_pack_any_packet_iov(mr_packet_ctx *pctx, struct iovec *iov, int *piovcnt);
+
 // connect packet
 
+enum MR_CONNECT_MDATA_FIELDS { // Same order as CONNECT_MDATA_TEMPLATE; bit positions in a field mask
+    CONNECT_PACKET_TYPE,
+    CONNECT_RESERVED_HEADER,
+    CONNECT_MR_HEADER,
+    CONNECT_REMAINING_LENGTH,
+    CONNECT_PROTOCOL_NAME,
+    CONNECT_PROTOCOL_VERSION,
+    CONNECT_RESERVED,
+    CONNECT_CLEAN_START,
+    CONNECT_WILL_FLAG,
+    CONNECT_WILL_QOS,
+    CONNECT_WILL_RETAIN,
+    CONNECT_PASSWORD_FLAG,
+    CONNECT_USERNAME_FLAG,
+    CONNECT_MR_FLAGS,
+    CONNECT_KEEP_ALIVE,
+    CONNECT_PROPERTY_LENGTH,
+    CONNECT_MR_PROPERTIES,
+    CONNECT_SESSION_EXPIRY_INTERVAL,
+    CONNECT_RECEIVE_MAXIMUM,
+    CONNECT_MAXIMUM_PACKET_SIZE,
+    CONNECT_TOPIC_ALIAS_MAXIMUM,
+    CONNECT_REQUEST_RESPONSE_INFORMATION,
+    CONNECT_REQUEST_PROBLEM_INFORMATION,
+    CONNECT_USER_PROPERTIES,
+    CONNECT_AUTHENTICATION_METHOD,
+    CONNECT_AUTHENTICATION_DATA,
+    CONNECT_CLIENT_IDENTIFIER,
+    CONNECT_WILL_PROPERTY_LENGTH,
+    CONNECT_MR_WILL_PROPERTIES,
+    CONNECT_WILL_DELAY_INTERVAL,
+    CONNECT_PAYLOAD_FORMAT_INDICATOR,
+    CONNECT_MESSAGE_EXPIRY_INTERVAL,
+    CONNECT_CONTENT_TYPE,
+    CONNECT_RESPONSE_TOPIC,
+    CONNECT_CORRELATION_DATA,
+    CONNECT_WILL_USER_PROPERTIES,
+    CONNECT_WILL_TOPIC,
+    CONNECT_WILL_PAYLOAD,
+    CONNECT_USER_NAME,
+    CONNECT_PASSWORD
+};
+
 int mr_init_connect_packet(mr_packet_ctx **ppctx);
 int mr_init_unpack_connect_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen);
+int mr_init_unpack_connect_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+);
+int mr_init_unpack_connect_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+);
 int mr_pack_connect_packet(mr_packet_ctx *pctx, uint8_t **pu8v0, size_t *pu8vlen);
 int mr_free_connect_packet(mr_packet_ctx *pctx);
 
@@ -224,8 +513,44 @@ int mr_get_connect_printable(mr_packet_ctx *pctx, const bool all_flag, char **pc
 
 // connack packet
 
+enum CONNACK_MDATA_FIELDS { // Same order as CONNACK_MDATA_TEMPLATE; bit positions in a field mask
+    CONNACK_PACKET_TYPE,
+    CONNACK_RESERVED_HEADER,
+    CONNACK_MR_HEADER,
+    CONNACK_REMAINING_LENGTH,
+    CONNACK_SESSION_PRESENT,
+    CONNACK_RESERVED,
+    CONNACK_MR_FLAGS,
+    CONNACK_CONNECT_REASON_CODE,
+    CONNACK_PROPERTY_LENGTH,
+    CONNACK_MR_PROPERTIES,
+    CONNACK_SESSION_EXPIRY_INTERVAL,
+    CONNACK_RECEIVE_MAXIMUM,
+    CONNACK_MAXIMUM_QOS,
+    CONNACK_RETAIN_AVAILABLE,
+    CONNACK_MAXIMUM_PACKET_SIZE,
+    CONNACK_ASSIGNED_CLIENT_IDENTIFIER,
+    CONNACK_TOPIC_ALIAS_MAXIMUM,
+    CONNACK_REASON_STRING,
+    CONNACK_USER_PROPERTIES,
+    CONNACK_WILDCARD_SUBSCRIPTION_AVAILABLE,
+    CONNACK_SUBSCRIPTION_IDENTIFIERS_AVAILABLE,
+    CONNACK_SHARED_SUBSCRIPTION_AVAILABLE,
+    CONNACK_SERVER_KEEP_ALIVE,
+    CONNACK_RESPONSE_INFORMATION,
+    CONNACK_SERVER_REFERENCE,
+    CONNACK_AUTHENTICATION_METHOD,
+    CONNACK_AUTHENTICATION_DATA,
+};
+
 int mr_init_connack_packet(mr_packet_ctx **ppctx);
 int mr_init_unpack_connack_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen);
+int mr_init_unpack_connack_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+);
+int mr_init_unpack_connack_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+);
 int mr_pack_connack_packet(mr_packet_ctx *pctx, uint8_t **pu8v0, size_t *pu8vlen);
 int mr_free_connack_packet(mr_packet_ctx *pctx);
 
@@ -315,8 +640,90 @@ int mr_get_connack_printable(mr_packet_ctx *pctx, const bool all_flag, char **pc
 
 // PUBLISH
 
+enum PUBLISH_MDATA_FIELDS { // Same order as PUBLISH_MDATA_TEMPLATE; bit positions in a field mask
+    PUBLISH_PACKET_TYPE,
+    PUBLISH_DUP,
+    PUBLISH_QOS,
+    PUBLISH_RETAIN,
+    PUBLISH_MR_HEADER,
+    PUBLISH_REMAINING_LENGTH,
+    PUBLISH_TOPIC_NAME,
+    PUBLISH_PACKET_IDENTIFIER,
+    PUBLISH_PROPERTY_LENGTH,
+    PUBLISH_MR_PROPERTIES,
+    PUBLISH_PAYLOAD_FORMAT_INDICATOR,
+    PUBLISH_MESSAGE_EXPIRY_INTERVAL,
+    PUBLISH_TOPIC_ALIAS,
+    PUBLISH_RESPONSE_TOPIC,
+    PUBLISH_CORRELATION_DATA,
+    PUBLISH_USER_PROPERTIES,
+    PUBLISH_SUBSCRIPTION_IDENTIFIERS,
+    PUBLISH_CONTENT_TYPE,
+    PUBLISH_PAYLOAD
+};
+
+// routing fields of a raw PUBLISH: views into the packet bytes, nothing is copied or allocated
+typedef struct mr_publish_peek {
+    uint8_t qos;
+    bool dup;
+    bool retain;
+    const char *topic_name;         // not NUL-terminated; empty when a topic alias stands in
+    size_t topic_name_len;
+    uint16_t packet_identifier;     // 0 for qos 0
+    size_t properties_offset;       // start of the property block (after the property length VBI)
+    uint32_t property_length;
+    size_t payload_offset;
+    size_t payload_len;
+} mr_publish_peek;
+
+int mr_peek_publish(const uint8_t *u8v0, const size_t u8vlen, mr_publish_peek *ppeek);
+
+// new header fields for a packed PUBLISH
+typedef struct mr_publish_rewrite {
+    uint8_t qos;                    // at most the packet's qos
+    bool dup;                       // cleared for qos 0
+    bool retain;
+    uint16_t packet_identifier;     // 0 keeps the packet's; unused for qos 0
+} mr_publish_rewrite;
+
+int mr_rewrite_publish(
+    uint8_t *u8v0, const size_t u8vlen, const mr_publish_rewrite *prw, size_t *poffset, size_t *pu8vlen
+);
+
+// fan-out: a PUBLISH encoded once, framed per subscriber
+typedef struct mr_publish_fanout mr_publish_fanout;
+
+// the fields of one subscriber's copy
+typedef struct mr_publish_target {
+    uint8_t qos;
+    bool dup;                       // qos > 0 only
+    bool retain;
+    uint16_t packet_identifier;     // required for qos > 0
+    uint16_t topic_alias;           // 0 for none
+    bool topic_alias_only;          // send an empty topic name; the topic_alias stands in
+    const uint32_t *subscription_identifiers;
+    size_t subscription_identifiers_len;
+} mr_publish_target;
+
+int mr_init_publish_fanout(mr_publish_fanout **ppfo, mr_packet_ctx *pctx);
+int mr_free_publish_fanout(mr_publish_fanout *pfo);
+int mr_pack_publish_fanout(
+    mr_publish_fanout *pfo,
+    const mr_publish_target *ptarget,
+    uint8_t *u8v0,
+    const size_t u8vcap,
+    struct iovec *iov,
+    int *piovcnt
+);
+
 int mr_init_publish_packet(mr_packet_ctx **ppctx);
 int mr_init_unpack_publish_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen);
+int mr_init_unpack_publish_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+);
+int mr_init_unpack_publish_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+);
 int mr_pack_publish_packet(mr_packet_ctx *pctx, uint8_t **pu8v0, size_t *pu8vlen);
 int mr_free_publish_packet(mr_packet_ctx *pctx);
 
@@ -380,10 +787,44 @@ int mr_set_publish_payload(mr_packet_ctx *pctx, const uint8_t *u8v0, const size_
 
 int mr_get_publish_printable(mr_packet_ctx *pctx, const bool all_flag, char **pcv);
 
+// topic aliases: one connection's, each direction bounded by a topic_alias_maximum
+
+typedef struct mr_topic_aliases mr_topic_aliases;
+
+int mr_init_topic_aliases(mr_topic_aliases **ppta, const uint16_t inbound_maximum, const uint16_t outbound_maximum);
+int mr_init_topic_aliases_handshake(
+    mr_topic_aliases **ppta, mr_packet_ctx *pconnect, mr_packet_ctx *pconnack, const bool server_flag
+);
+int mr_free_topic_aliases(mr_topic_aliases *pta);
+int mr_resolve_topic_alias(mr_topic_aliases *pta, mr_packet_ctx *pctx);
+int mr_assign_topic_alias(
+    mr_topic_aliases *pta, const char *topic_name, const size_t len, mr_publish_target *ptarget
+);
+int mr_alias_publish_packet(mr_topic_aliases *pta, mr_packet_ctx *pctx);
+
 // PUBACK
 
+enum PUBACK_MDATA_FIELDS { // Same order as PUBACK_MDATA_TEMPLATE; bit positions in a field mask
+    PUBACK_PACKET_TYPE,
+    PUBACK_RESERVED_HEADER,
+    PUBACK_MR_HEADER,
+    PUBACK_REMAINING_LENGTH,
+    PUBACK_PACKET_IDENTIFIER,
+    PUBACK_PUBACK_REASON_CODE,
+    PUBACK_PROPERTY_LENGTH,
+    PUBACK_MR_PROPERTIES,
+    PUBACK_REASON_STRING,
+    PUBACK_USER_PROPERTIES
+};
+
 int mr_init_puback_packet(mr_packet_ctx **ppctx);
 int mr_init_unpack_puback_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen);
+int mr_init_unpack_puback_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+);
+int mr_init_unpack_puback_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+);
 int mr_pack_puback_packet(mr_packet_ctx *pctx, uint8_t **pu8v0, size_t *pu8vlen);
 int mr_free_puback_packet(mr_packet_ctx *pctx);
 
@@ -412,8 +853,27 @@ int mr_get_puback_printable(mr_packet_ctx *pctx, const bool all_flag, char **pcv
 
 // SUBSCRIBE
 
+enum SUBSCRIBE_MDATA_FIELDS { // Same order as SUBSCRIBE_MDATA_TEMPLATE; bit positions in a field mask
+    SUBSCRIBE_PACKET_TYPE,
+    SUBSCRIBE_RESERVED_HEADER,
+    SUBSCRIBE_MR_HEADER,
+    SUBSCRIBE_REMAINING_LENGTH,
+    SUBSCRIBE_PACKET_IDENTIFIER,
+    SUBSCRIBE_PROPERTY_LENGTH,
+    SUBSCRIBE_MR_PROPERTIES,
+    SUBSCRIBE_SUBSCRIPTION_IDENTIFIER,
+    SUBSCRIBE_USER_PROPERTIES,
+    SUBSCRIBE_TOPIC_FILTERS
+};
+
 int mr_init_subscribe_packet(mr_packet_ctx **ppctx);
 int mr_init_unpack_subscribe_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen);
+int mr_init_unpack_subscribe_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+);
+int mr_init_unpack_subscribe_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+);
 int mr_pack_subscribe_packet(mr_packet_ctx *pctx, uint8_t **pu8v0, size_t *pu8vlen);
 int mr_free_subscribe_packet(mr_packet_ctx *pctx);
 
@@ -441,8 +901,26 @@ int mr_get_subscribe_printable(mr_packet_ctx *pctx, const bool all_flag, char **
 
 // SUBACK
 
+enum SUBACK_MDATA_FIELDS { // Same order as SUBACK_MDATA_TEMPLATE; bit positions in a field mask
+    SUBACK_PACKET_TYPE,
+    SUBACK_RESERVED_HEADER,
+    SUBACK_MR_HEADER,
+    SUBACK_REMAINING_LENGTH,
+    SUBACK_PROPERTY_LENGTH,
+    SUBACK_MR_PROPERTIES,
+    SUBACK_REASON_STRING,
+    SUBACK_USER_PROPERTIES,
+    SUBACK_SUBSCRIBE_REASON_CODES
+};
+
 int mr_init_suback_packet(mr_packet_ctx **ppctx);
 int mr_init_unpack_suback_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen);
+int mr_init_unpack_suback_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+);
+int mr_init_unpack_suback_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+);
 int mr_pack_suback_packet(mr_packet_ctx *pctx, uint8_t **pu8v0, size_t *pu8vlen);
 int mr_free_suback_packet(mr_packet_ctx *pctx);
 
@@ -8,85 +8,51 @@
 
 #include "mister_internal.h"
 
-enum CONNACK_MDATA_FIELDS { // Same order as CONNACK_MDATA_TEMPLATE
-    CONNACK_PACKET_TYPE,
-    CONNACK_RESERVED_HEADER,
-    CONNACK_MR_HEADER,
-    CONNACK_REMAINING_LENGTH,
-    CONNACK_SESSION_PRESENT,
-    CONNACK_RESERVED,
-    CONNACK_MR_FLAGS,
-    CONNACK_CONNECT_REASON_CODE,
-    CONNACK_PROPERTY_LENGTH,
-    CONNACK_MR_PROPERTIES,
-    CONNACK_SESSION_EXPIRY_INTERVAL,
-    CONNACK_RECEIVE_MAXIMUM,
-    CONNACK_MAXIMUM_QOS,
-    CONNACK_RETAIN_AVAILABLE,
-    CONNACK_MAXIMUM_PACKET_SIZE,
-    CONNACK_ASSIGNED_CLIENT_IDENTIFIER,
-    CONNACK_TOPIC_ALIAS_MAXIMUM,
-    CONNACK_REASON_STRING,
-    CONNACK_USER_PROPERTIES,
-    CONNACK_WILDCARD_SUBSCRIPTION_AVAILABLE,
-    CONNACK_SUBSCRIPTION_IDENTIFIERS_AVAILABLE,
-    CONNACK_SHARED_SUBSCRIPTION_AVAILABLE,
-    CONNACK_SERVER_KEEP_ALIVE,
-    CONNACK_RESPONSE_INFORMATION,
-    CONNACK_SERVER_REFERENCE,
-    CONNACK_AUTHENTICATION_METHOD,
-    CONNACK_AUTHENTICATION_DATA,
+static const bool VALID_CONNECT_REASON_CODES[256] = { // indexed by reason code
+    [MQTT_RC_SUCCESS]                      = true,
+    [MQTT_RC_UNSPECIFIED]                  = true,
+    [MQTT_RC_MALFORMED_PACKET]             = true,
+    [MQTT_RC_PROTOCOL_ERROR]               = true,
+    [MQTT_RC_IMPLEMENTATION_SPECIFIC]      = true,
+    [MQTT_RC_UNSUPPORTED_PROTOCOL_VERSION] = true,
+    [MQTT_RC_CLIENTID_NOT_VALID]           = true,
+    [MQTT_RC_BAD_USERNAME_OR_PASSWORD]     = true,
+    [MQTT_RC_NOT_AUTHORIZED]               = true,
+    [MQTT_RC_SERVER_UNAVAILABLE]           = true,
+    [MQTT_RC_SERVER_BUSY]                  = true,
+    [MQTT_RC_BANNED]                       = true,
+    [MQTT_RC_BAD_AUTHENTICATION_METHOD]    = true,
+    [MQTT_RC_TOPIC_NAME_INVALID]           = true,
+    [MQTT_RC_PACKET_TOO_LARGE]             = true,
+    [MQTT_RC_QUOTA_EXCEEDED]               = true,
+    [MQTT_RC_PAYLOAD_FORMAT_INVALID]       = true,
+    [MQTT_RC_RETAIN_NOT_SUPPORTED]         = true,
+    [MQTT_RC_QOS_NOT_SUPPORTED]            = true,
+    [MQTT_RC_USE_ANOTHER_SERVER]           = true,
+    [MQTT_RC_SERVER_MOVED]                 = true,
+    [MQTT_RC_CONNECTION_RATE_EXCEEDED]     = true
 };
 
-static const uint8_t VALID_CONNECT_REASON_CODES[] = {
-    MQTT_RC_SUCCESS,
-    MQTT_RC_UNSPECIFIED,
-    MQTT_RC_MALFORMED_PACKET,
-    MQTT_RC_PROTOCOL_ERROR,
-    MQTT_RC_IMPLEMENTATION_SPECIFIC,
-    MQTT_RC_UNSUPPORTED_PROTOCOL_VERSION,
-    MQTT_RC_CLIENTID_NOT_VALID,
-    MQTT_RC_BAD_USERNAME_OR_PASSWORD,
-    MQTT_RC_NOT_AUTHORIZED,
-    MQTT_RC_SERVER_UNAVAILABLE,
-    MQTT_RC_SERVER_BUSY,
-    MQTT_RC_BANNED,
-    MQTT_RC_BAD_AUTHENTICATION_METHOD,
-    MQTT_RC_TOPIC_NAME_INVALID,
-    MQTT_RC_PACKET_TOO_LARGE,
-    MQTT_RC_QUOTA_EXCEEDED,
-    MQTT_RC_PAYLOAD_FORMAT_INVALID,
-    MQTT_RC_RETAIN_NOT_SUPPORTED,
-    MQTT_RC_QOS_NOT_SUPPORTED,
-    MQTT_RC_USE_ANOTHER_SERVER,
-    MQTT_RC_SERVER_MOVED,
-    MQTT_RC_CONNECTION_RATE_EXCEEDED
+static const uint8_t PROP_IDX[256] = { // property id -> mdata idx; 0: not a CONNACK property
+    [MQTT_PROP_SESSION_EXPIRY_INTERVAL]            = CONNACK_SESSION_EXPIRY_INTERVAL,
+    [MQTT_PROP_RECEIVE_MAXIMUM]                    = CONNACK_RECEIVE_MAXIMUM,
+    [MQTT_PROP_MAXIMUM_QOS]                        = CONNACK_MAXIMUM_QOS,
+    [MQTT_PROP_RETAIN_AVAILABLE]                   = CONNACK_RETAIN_AVAILABLE,
+    [MQTT_PROP_MAXIMUM_PACKET_SIZE]                = CONNACK_MAXIMUM_PACKET_SIZE,
+    [MQTT_PROP_ASSIGNED_CLIENT_IDENTIFIER]         = CONNACK_ASSIGNED_CLIENT_IDENTIFIER,
+    [MQTT_PROP_TOPIC_ALIAS_MAXIMUM]                = CONNACK_TOPIC_ALIAS_MAXIMUM,
+    [MQTT_PROP_REASON_STRING]                      = CONNACK_REASON_STRING,
+    [MQTT_PROP_USER_PROPERTY]                      = CONNACK_USER_PROPERTIES,
+    [MQTT_PROP_WILDCARD_SUBSCRIPTION_AVAILABLE]    = CONNACK_WILDCARD_SUBSCRIPTION_AVAILABLE,
+    [MQTT_PROP_SUBSCRIPTION_IDENTIFIERS_AVAILABLE] = CONNACK_SUBSCRIPTION_IDENTIFIERS_AVAILABLE,
+    [MQTT_PROP_SHARED_SUBSCRIPTION_AVAILABLE]      = CONNACK_SHARED_SUBSCRIPTION_AVAILABLE,
+    [MQTT_PROP_SERVER_KEEP_ALIVE]                  = CONNACK_SERVER_KEEP_ALIVE,
+    [MQTT_PROP_RESPONSE_INFORMATION]               = CONNACK_RESPONSE_INFORMATION,
+    [MQTT_PROP_SERVER_REFERENCE]                   = CONNACK_SERVER_REFERENCE,
+    [MQTT_PROP_AUTHENTICATION_METHOD]              = CONNACK_AUTHENTICATION_METHOD,
+    [MQTT_PROP_AUTHENTICATION_DATA]                = CONNACK_AUTHENTICATION_DATA
 };
 
-static const size_t CCRCSZ = sizeof(VALID_CONNECT_REASON_CODES) / sizeof(VALID_CONNECT_REASON_CODES[0]);
-
-static const uint8_t PROPS[] = {
-    MQTT_PROP_SESSION_EXPIRY_INTERVAL,
-    MQTT_PROP_RECEIVE_MAXIMUM,
-    MQTT_PROP_MAXIMUM_QOS,
-    MQTT_PROP_RETAIN_AVAILABLE,
-    MQTT_PROP_MAXIMUM_PACKET_SIZE,
-    MQTT_PROP_ASSIGNED_CLIENT_IDENTIFIER,
-    MQTT_PROP_TOPIC_ALIAS_MAXIMUM,
-    MQTT_PROP_REASON_STRING,
-    MQTT_PROP_USER_PROPERTY,
-    MQTT_PROP_WILDCARD_SUBSCRIPTION_AVAILABLE,
-    MQTT_PROP_SUBSCRIPTION_IDENTIFIERS_AVAILABLE,
-    MQTT_PROP_SHARED_SUBSCRIPTION_AVAILABLE,
-    MQTT_PROP_SERVER_KEEP_ALIVE,
-    MQTT_PROP_RESPONSE_INFORMATION,
-    MQTT_PROP_SERVER_REFERENCE,
-    MQTT_PROP_AUTHENTICATION_METHOD,
-    MQTT_PROP_AUTHENTICATION_DATA
-};
-
-static const size_t PSZ = sizeof(PROPS) / sizeof(PROPS[0]);
-
 #define NA 0
 
 static const uintptr_t MR_CONNACK_HEADER = MQTT_CONNACK << 4;
@@ -102,7 +68,7 @@ static const mr_mdata CONNACK_MDATA_TEMPLATE[] = {
     {"mr_flags",                            MR_BITFLD_DTYPE,    0,                  NA,     1,      1,      true,   NA,                             NA,                                             NA,     CONNACK_MR_FLAGS,                           NULL},
     {"connect_reason_code",                 MR_U8_DTYPE,        0,                  NA,     1,      1,      true,   NA,                             NA,                                             NA,     CONNACK_CONNECT_REASON_CODE,                NULL},
     {"property_length",                     MR_VBI_DTYPE,       0,                  NA,     0,      0,      true,   CONNACK_AUTHENTICATION_DATA,    NA,                                             NA,     CONNACK_PROPERTY_LENGTH,                    NULL},
-    {"mr_properties",                       MR_PROPERTIES_DTYPE,(uintptr_t)PROPS,   NA,     PSZ,    NA,     true,   NA,                             NA,                                             NA,     CONNACK_MR_PROPERTIES,                      NULL},
+    {"mr_properties",                       MR_PROPERTIES_DTYPE,(uintptr_t)PROP_IDX,NA,     NA,     NA,     true,   NA,                             NA,                                             NA,     CONNACK_MR_PROPERTIES,                      NULL},
     {"session_expiry_interval",             MR_U32_DTYPE,       0,                  NA,     4,      5,      false,  NA,                             MQTT_PROP_SESSION_EXPIRY_INTERVAL,              NA,     CONNACK_SESSION_EXPIRY_INTERVAL,            NULL},
     {"receive_maximum",                     MR_U16_DTYPE,       0,                  NA,     2,      3,      false,  NA,                             MQTT_PROP_RECEIVE_MAXIMUM,                      NA,     CONNACK_RECEIVE_MAXIMUM,                    NULL},
     {"maximum_qos",                         MR_U8_DTYPE,        0,                  NA,     1,      2,      false,  NA,                             MQTT_PROP_MAXIMUM_QOS,                          NA,     CONNACK_MAXIMUM_QOS,                        NULL},
@@ -113,7 +79,7 @@ static const mr_mdata CONNACK_MDATA_TEMPLATE[] = {
     {"reason_string",                       MR_STR_DTYPE,       (uintptr_t)NULL,    false,  0,      0,      false,  NA,                             MQTT_PROP_REASON_STRING,                        NA,     CONNACK_REASON_STRING,                      NULL},
     {"user_properties",                     MR_SPV_DTYPE,       (uintptr_t)NULL,    false,  0,      0,      false,  NA,                             MQTT_PROP_USER_PROPERTY,                        NA,     CONNACK_USER_PROPERTIES,                    NULL},
     {"wildcard_subscription_available",     MR_U8_DTYPE,        0,                  NA,     1,      2,      false,  NA,                             MQTT_PROP_WILDCARD_SUBSCRIPTION_AVAILABLE,      NA,     CONNACK_WILDCARD_SUBSCRIPTION_AVAILABLE,    NULL},
-    {"subscription_identifiers_available",  MR_U8_DTYPE,        0,                  NA,     1,      2,      false,  NA,                             MQTT_PROP_SUBSCRIPTION_IDENTIFIERS_AVAILABLE,   NA,     CONNACK_WILDCARD_SUBSCRIPTION_AVAILABLE,    NULL},
+    {"subscription_identifiers_available",  MR_U8_DTYPE,        0,                  NA,     1,      2,      false,  NA,                             MQTT_PROP_SUBSCRIPTION_IDENTIFIERS_AVAILABLE,   NA,     CONNACK_SUBSCRIPTION_IDENTIFIERS_AVAILABLE, NULL},
     {"shared_subscription_available",       MR_U8_DTYPE,        0,                  NA,     1,      2,      false,  NA,                             MQTT_PROP_SHARED_SUBSCRIPTION_AVAILABLE,        NA,     CONNACK_SHARED_SUBSCRIPTION_AVAILABLE,      NULL},
     {"server_keep_alive",                   MR_U16_DTYPE,       0,                  NA,     2,      3,      false,  NA,                             MQTT_PROP_SERVER_KEEP_ALIVE,                    NA,     CONNACK_SERVER_KEEP_ALIVE,                  NULL},
     {"response_information",                MR_STR_DTYPE,       (uintptr_t)NULL,    false,  0,      0,      false,  NA,                             MQTT_PROP_RESPONSE_INFORMATION,                 NA,     CONNACK_RESPONSE_INFORMATION,               NULL},
@@ -130,7 +96,25 @@ int mr_init_connack_packet(mr_packet_ctx **ppctx) {
 }
 
 int mr_init_unpack_connack_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen) {
-    return mr_init_unpack_packet(ppctx, CONNACK_MDATA_TEMPLATE, CONNACK_MDATA_COUNT, u8v0, u8vlen);
+    return mr_init_unpack_packet(ppctx, CONNACK_MDATA_TEMPLATE, CONNACK_MDATA_COUNT, u8v0, u8vlen, MR_UNPACK_COPY, 0);
+}
+
+int mr_init_unpack_connack_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+) {
+    return mr_init_unpack_packet(ppctx, CONNACK_MDATA_TEMPLATE, CONNACK_MDATA_COUNT, u8v0, u8vlen, unpack_flags, 0);
+}
+
+int mr_init_unpack_connack_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+) {
+    return mr_init_unpack_packet(
+        ppctx, CONNACK_MDATA_TEMPLATE, CONNACK_MDATA_COUNT, u8v0, u8vlen, unpack_flags, field_mask
+    );
+}
+
+int mr_validate_connack_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code) {
+    return mr_validate_packet(CONNACK_MDATA_TEMPLATE, CONNACK_MDATA_COUNT, u8v0, u8vlen, preason_code);
 }
 
 static int mr_check_connack_packet(mr_packet_ctx *pctx) {
@@ -138,8 +122,8 @@ static int mr_check_connack_packet(mr_packet_ctx *pctx) {
         return 0;
     }
     else {
-        dzlog_info("Packet Context is not a CONNACK packet");
-        return -1;
+        mr_log_error("Packet Context is not a CONNACK packet:: packet name: %s", pctx->mqtt_packet_name);
+        return mr_set_error(MR_ERR_PACKET_TYPE, MQTT_RC_UNSPECIFIED, pctx->mqtt_packet_type, -1, 0);
     }
 }
 
@@ -202,8 +186,8 @@ int mr_get_connack_connect_reason_code(mr_packet_ctx *pctx, uint8_t *pu8) {
 }
 
 static int mr_validate_connack_connect_reason_code(const uint8_t u8) {
-    if (!memchr(VALID_CONNECT_REASON_CODES, u8, CCRCSZ)) {
-        dzlog_error("invalid connect_reason_code: %u", u8);
+    if (!VALID_CONNECT_REASON_CODES[u8]) {
+        mr_log_error("invalid connect_reason_code: %u", u8);
         return -1;
     }
 
@@ -247,7 +231,7 @@ int mr_get_connack_receive_maximum(mr_packet_ctx *pctx, uint16_t *pu16, bool *pe
 
 static int mr_validate_connack_receive_maximum(const uint16_t u16) {
     if (u16 == 0) {
-        dzlog_error("receive_maximum must be > 0");
+        mr_log_error("receive_maximum must be > 0");
         return -1;
     }
 
@@ -273,7 +257,7 @@ int mr_get_connack_maximum_qos(mr_packet_ctx *pctx, uint8_t *pu8, bool *pexists_
 
 static int mr_validate_connack_maximum_qos(const uint8_t u8) {
     if (u8 > 1) {
-        dzlog_error("maximum_qos must be in range (0..1): %u", u8);
+        mr_log_error("maximum_qos must be in range (0..1): %u", u8);
         return -1;
     }
 
@@ -299,7 +283,7 @@ int mr_get_connack_retain_available(mr_packet_ctx *pctx, uint8_t *pu8, bool *pex
 
 static int mr_validate_connack_retain_available(const uint8_t u8) {
     if (u8 > 1) {
-        dzlog_error("retain_available must be in range (0..1): %u", u8);
+        mr_log_error("retain_available must be in range (0..1): %u", u8);
         return -1;
     }
 
@@ -325,7 +309,7 @@ int mr_get_connack_maximum_packet_size(mr_packet_ctx *pctx, uint32_t *pu32, bool
 
 static int mr_validate_connack_maximum_packet_size(const uint32_t u32) {
     if (u32 == 0) {
-        dzlog_error("maximum_packet_size must be > 0");
+        mr_log_error("maximum_packet_size must be > 0");
         return -1;
     }
 
@@ -415,7 +399,7 @@ int mr_get_connack_wildcard_subscription_available(mr_packet_ctx *pctx, uint8_t
 
 static int mr_validate_connack_wildcard_subscription_available(const uint8_t u8) {
     if (u8 > 1) {
-        dzlog_error("wildcard_subscription_available out of range (0..1): %u", u8);
+        mr_log_error("wildcard_subscription_available out of range (0..1): %u", u8);
         return -1;
     }
 
@@ -441,7 +425,7 @@ int mr_get_connack_subscription_identifiers_available(mr_packet_ctx *pctx, uint8
 
 static int mr_validate_connack_subscription_identifiers_available(const uint8_t u8) {
     if (u8 > 1) {
-        dzlog_error("subscription_identifiers_available out of range (0..1): %u", u8);
+        mr_log_error("subscription_identifiers_available out of range (0..1): %u", u8);
         return -1;
     }
 
@@ -467,7 +451,7 @@ int mr_get_connack_shared_subscription_available(mr_packet_ctx *pctx, uint8_t *p
 
 static int mr_validate_connack_shared_subscription_available(const uint8_t u8) {
     if (u8 > 1) {
-        dzlog_error("shared_subscription_available out of range (0..1): %u", u8);
+        mr_log_error("shared_subscription_available out of range (0..1): %u", u8);
         return -1;
     }
 
@@ -566,7 +550,7 @@ int mr_reset_connack_authentication_data(mr_packet_ctx *pctx) {
 
 // validation
 
-static int mr_validate_connack_pack(mr_packet_ctx *pctx) {
+int mr_validate_connack_pack(mr_packet_ctx *pctx) {
     return 0;
 }
 
@@ -578,28 +562,28 @@ int mr_validate_connack_unpack(mr_packet_ctx *pctx) {
     bool exists_flag;
 
     if (mr_get_connack_connect_reason_code(pctx, &u8)) return -1;
-    if (mr_validate_connack_connect_reason_code(u8)) return -1;
+    if (mr_validate_connack_connect_reason_code(u8)) return mr_reject(pctx, CONNACK_CONNECT_REASON_CODE, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_connack_receive_maximum(pctx, &u16, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connack_receive_maximum(u16)) return -1;
+    if (exists_flag && mr_validate_connack_receive_maximum(u16)) return mr_reject(pctx, CONNACK_RECEIVE_MAXIMUM, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_connack_maximum_qos(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connack_maximum_qos(u8)) return -1;
+    if (exists_flag && mr_validate_connack_maximum_qos(u8)) return mr_reject(pctx, CONNACK_MAXIMUM_QOS, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_connack_retain_available(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connack_retain_available(u8)) return -1;
+    if (exists_flag && mr_validate_connack_retain_available(u8)) return mr_reject(pctx, CONNACK_RETAIN_AVAILABLE, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_connack_maximum_packet_size(pctx, &u32, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connack_maximum_packet_size(u32)) return -1;
+    if (exists_flag && mr_validate_connack_maximum_packet_size(u32)) return mr_reject(pctx, CONNACK_MAXIMUM_PACKET_SIZE, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_connack_wildcard_subscription_available(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connack_wildcard_subscription_available(u8)) return -1;
+    if (exists_flag && mr_validate_connack_wildcard_subscription_available(u8)) return mr_reject(pctx, CONNACK_WILDCARD_SUBSCRIPTION_AVAILABLE, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_connack_subscription_identifiers_available(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connack_subscription_identifiers_available(u8)) return -1;
+    if (exists_flag && mr_validate_connack_subscription_identifiers_available(u8)) return mr_reject(pctx, CONNACK_SUBSCRIPTION_IDENTIFIERS_AVAILABLE, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_connack_shared_subscription_available(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connack_shared_subscription_available(u8)) return -1;
+    if (exists_flag && mr_validate_connack_shared_subscription_available(u8)) return mr_reject(pctx, CONNACK_SHARED_SUBSCRIPTION_AVAILABLE, MQTT_RC_PROTOCOL_ERROR);
 
     return 0;
 }
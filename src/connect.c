@@ -17,79 +17,33 @@
 
 #include "mister_internal.h"
 
-enum MR_CONNECT_MDATA_FIELDS { // Same order as CONNECT_MDATA_TEMPLATE
-    CONNECT_PACKET_TYPE,
-    CONNECT_RESERVED_HEADER,
-    CONNECT_MR_HEADER,
-    CONNECT_REMAINING_LENGTH,
-    CONNECT_PROTOCOL_NAME,
-    CONNECT_PROTOCOL_VERSION,
-    CONNECT_RESERVED,
-    CONNECT_CLEAN_START,
-    CONNECT_WILL_FLAG,
-    CONNECT_WILL_QOS,
-    CONNECT_WILL_RETAIN,
-    CONNECT_PASSWORD_FLAG,
-    CONNECT_USERNAME_FLAG,
-    CONNECT_MR_FLAGS,
-    CONNECT_KEEP_ALIVE,
-    CONNECT_PROPERTY_LENGTH,
-    CONNECT_MR_PROPERTIES,
-    CONNECT_SESSION_EXPIRY_INTERVAL,
-    CONNECT_RECEIVE_MAXIMUM,
-    CONNECT_MAXIMUM_PACKET_SIZE,
-    CONNECT_TOPIC_ALIAS_MAXIMUM,
-    CONNECT_REQUEST_RESPONSE_INFORMATION,
-    CONNECT_REQUEST_PROBLEM_INFORMATION,
-    CONNECT_USER_PROPERTIES,
-    CONNECT_AUTHENTICATION_METHOD,
-    CONNECT_AUTHENTICATION_DATA,
-    CONNECT_CLIENT_IDENTIFIER,
-    CONNECT_WILL_PROPERTY_LENGTH,
-    CONNECT_MR_WILL_PROPERTIES,
-    CONNECT_WILL_DELAY_INTERVAL,
-    CONNECT_PAYLOAD_FORMAT_INDICATOR,
-    CONNECT_MESSAGE_EXPIRY_INTERVAL,
-    CONNECT_CONTENT_TYPE,
-    CONNECT_RESPONSE_TOPIC,
-    CONNECT_CORRELATION_DATA,
-    CONNECT_WILL_USER_PROPERTIES,
-    CONNECT_WILL_TOPIC,
-    CONNECT_WILL_PAYLOAD,
-    CONNECT_USER_NAME,
-    CONNECT_PASSWORD
-};
-
 static const uint8_t PS[] = {'M', 'Q', 'T', 'T'};  // protocol signature
 static const size_t PSSZ = sizeof(PS) / sizeof(PS[0]);
 
 #define NA 0
 
-static const uint8_t PROPS[] = { // connect property values
-    MQTT_PROP_SESSION_EXPIRY_INTERVAL,
-    MQTT_PROP_RECEIVE_MAXIMUM,
-    MQTT_PROP_MAXIMUM_PACKET_SIZE,
-    MQTT_PROP_TOPIC_ALIAS_MAXIMUM,
-    MQTT_PROP_REQUEST_RESPONSE_INFORMATION,
-    MQTT_PROP_REQUEST_PROBLEM_INFORMATION,
-    MQTT_PROP_USER_PROPERTY,
-    MQTT_PROP_AUTHENTICATION_METHOD,
-    MQTT_PROP_AUTHENTICATION_DATA
+static const uint8_t PROP_IDX[256] = { // property id -> mdata idx; 0: not a CONNECT property
+    [MQTT_PROP_SESSION_EXPIRY_INTERVAL]      = CONNECT_SESSION_EXPIRY_INTERVAL,
+    [MQTT_PROP_RECEIVE_MAXIMUM]              = CONNECT_RECEIVE_MAXIMUM,
+    [MQTT_PROP_MAXIMUM_PACKET_SIZE]          = CONNECT_MAXIMUM_PACKET_SIZE,
+    [MQTT_PROP_TOPIC_ALIAS_MAXIMUM]          = CONNECT_TOPIC_ALIAS_MAXIMUM,
+    [MQTT_PROP_REQUEST_RESPONSE_INFORMATION] = CONNECT_REQUEST_RESPONSE_INFORMATION,
+    [MQTT_PROP_REQUEST_PROBLEM_INFORMATION]  = CONNECT_REQUEST_PROBLEM_INFORMATION,
+    [MQTT_PROP_USER_PROPERTY]                = CONNECT_USER_PROPERTIES,
+    [MQTT_PROP_AUTHENTICATION_METHOD]        = CONNECT_AUTHENTICATION_METHOD,
+    [MQTT_PROP_AUTHENTICATION_DATA]          = CONNECT_AUTHENTICATION_DATA
 };
 
-static const size_t PSZ = sizeof(PROPS) / sizeof(PROPS[0]);
-
-static const uint8_t WPROPS[] = { // connect will property values
-    MQTT_PROP_WILL_DELAY_INTERVAL,
-    MQTT_PROP_PAYLOAD_FORMAT_INDICATOR,
-    MQTT_PROP_MESSAGE_EXPIRY_INTERVAL,
-    MQTT_PROP_CONTENT_TYPE,
-    MQTT_PROP_RESPONSE_TOPIC,
-    MQTT_PROP_CORRELATION_DATA,
-    MQTT_PROP_USER_PROPERTY
+static const uint8_t WPROP_IDX[256] = { // will property id -> mdata idx; 0: not a will property
+    [MQTT_PROP_WILL_DELAY_INTERVAL]      = CONNECT_WILL_DELAY_INTERVAL,
+    [MQTT_PROP_PAYLOAD_FORMAT_INDICATOR] = CONNECT_PAYLOAD_FORMAT_INDICATOR,
+    [MQTT_PROP_MESSAGE_EXPIRY_INTERVAL]  = CONNECT_MESSAGE_EXPIRY_INTERVAL,
+    [MQTT_PROP_CONTENT_TYPE]             = CONNECT_CONTENT_TYPE,
+    [MQTT_PROP_RESPONSE_TOPIC]           = CONNECT_RESPONSE_TOPIC,
+    [MQTT_PROP_CORRELATION_DATA]         = CONNECT_CORRELATION_DATA,
+    [MQTT_PROP_USER_PROPERTY]            = CONNECT_WILL_USER_PROPERTIES
 };
 
-static const size_t WPSZ = sizeof(WPROPS) / sizeof(WPROPS[0]);
 static const char S0L[] = "";
 static const uintptr_t MR_CONNECT_HEADER = MQTT_CONNECT << 4;
 
@@ -111,7 +65,7 @@ static const mr_mdata CONNECT_MDATA_TEMPLATE[] = { // Same order as enum CONNECT
     {"mr_flags",                    MR_BITFLD_DTYPE,    0,                  NA,     1,      1,      true,   NA,                             NA,                                     NA,                     CONNECT_MR_FLAGS,                       NULL},
     {"keep_alive",                  MR_U16_DTYPE,       0,                  NA,     2,      2,      true,   NA,                             NA,                                     NA,                     CONNECT_KEEP_ALIVE,                     NULL},
     {"property_length",             MR_VBI_DTYPE,       0,                  NA,     0,      0,      true,   CONNECT_AUTHENTICATION_DATA,    NA,                                     NA,                     CONNECT_PROPERTY_LENGTH,                NULL},
-    {"mr_properties",               MR_PROPERTIES_DTYPE,(uintptr_t)PROPS,   NA,     PSZ,    NA,     true,   NA,                             NA,                                     NA,                     CONNECT_MR_PROPERTIES,                  NULL},
+    {"mr_properties",               MR_PROPERTIES_DTYPE,(uintptr_t)PROP_IDX,NA,     NA,     NA,     true,   NA,                             NA,                                     NA,                     CONNECT_MR_PROPERTIES,                  NULL},
     {"session_expiry_interval",     MR_U32_DTYPE,       0,                  NA,     4,      5,      false,  NA,                             MQTT_PROP_SESSION_EXPIRY_INTERVAL,      NA,                     CONNECT_SESSION_EXPIRY_INTERVAL,        NULL},
     {"receive_maximum",             MR_U16_DTYPE,       0,                  NA,     2,      3,      false,  NA,                             MQTT_PROP_RECEIVE_MAXIMUM,              NA,                     CONNECT_RECEIVE_MAXIMUM,                NULL},
     {"maximum_packet_size",         MR_U32_DTYPE,       0,                  NA,     4,      5,      false,  NA,                             MQTT_PROP_MAXIMUM_PACKET_SIZE,          NA,                     CONNECT_MAXIMUM_PACKET_SIZE,            NULL},
@@ -123,7 +77,7 @@ static const mr_mdata CONNECT_MDATA_TEMPLATE[] = { // Same order as enum CONNECT
     {"authentication_data",         MR_U8V_DTYPE,       (uintptr_t)NULL,    false,  0,      0,      false,  NA,                             MQTT_PROP_AUTHENTICATION_DATA,          NA,                     CONNECT_AUTHENTICATION_DATA,            NULL},
     {"client_identifier",           MR_STR_DTYPE,       (uintptr_t)S0L,     false,  1,      2,      true,   NA,                             NA,                                     NA,                     CONNECT_CLIENT_IDENTIFIER,              NULL},
     {"will_property_length",        MR_VBI_DTYPE,       0,                  NA,     0,      0,      false,  CONNECT_WILL_USER_PROPERTIES,   NA,                                     CONNECT_WILL_FLAG,      CONNECT_WILL_PROPERTY_LENGTH,           NULL},
-    {"mr_will_properties",          MR_PROPERTIES_DTYPE,(uintptr_t)WPROPS,  NA,     WPSZ,   NA,     false,  NA,                             NA,                                     NA,                     CONNECT_MR_WILL_PROPERTIES,             NULL},
+    {"mr_will_properties",          MR_PROPERTIES_DTYPE,(uintptr_t)WPROP_IDX,NA,     NA,     NA,     false,  NA,                             NA,                                     NA,                     CONNECT_MR_WILL_PROPERTIES,             NULL},
     {"will_delay_interval",         MR_U32_DTYPE,       0,                  NA,     4,      5,      false,  NA,                             MQTT_PROP_WILL_DELAY_INTERVAL,          CONNECT_WILL_FLAG,      CONNECT_WILL_DELAY_INTERVAL,            NULL},
     {"payload_format_indicator",    MR_U8_DTYPE,        0,                  NA,     1,      2,      false,  NA,                             MQTT_PROP_PAYLOAD_FORMAT_INDICATOR,     CONNECT_WILL_FLAG,      CONNECT_PAYLOAD_FORMAT_INDICATOR,       NULL},
     {"message_expiry_interval",     MR_U32_DTYPE,       0,                  NA,     4,      5,      false,  NA,                             MQTT_PROP_MESSAGE_EXPIRY_INTERVAL,      CONNECT_WILL_FLAG,      CONNECT_MESSAGE_EXPIRY_INTERVAL,        NULL},
@@ -159,7 +113,32 @@ int mr_init_connect_packet(mr_packet_ctx **ppctx) {
  * values and metadata. Set the address of the packet context.
  */
 int mr_init_unpack_connect_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen) {
-    return mr_init_unpack_packet(ppctx, CONNECT_MDATA_TEMPLATE, CONNECT_MDATA_COUNT, u8v0, u8vlen);
+    return mr_init_unpack_packet(ppctx, CONNECT_MDATA_TEMPLATE, CONNECT_MDATA_COUNT, u8v0, u8vlen, MR_UNPACK_COPY, 0);
+}
+
+/**
+ * @brief Unpack a binary CONNECT packet as mr_init_unpack_connect_packet does, per unpack_flags.
+ *
+ * With MR_UNPACK_BORROW binary values (password, will payload, correlation & authentication data)
+ * are views into u8v0 rather than copies: the caller must keep u8v0 alive and unchanged for the
+ * life of the packet context. Strings are still copied since they are returned NUL-terminated.
+ */
+int mr_init_unpack_connect_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+) {
+    return mr_init_unpack_packet(ppctx, CONNECT_MDATA_TEMPLATE, CONNECT_MDATA_COUNT, u8v0, u8vlen, unpack_flags, 0);
+}
+
+int mr_init_unpack_connect_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+) {
+    return mr_init_unpack_packet(
+        ppctx, CONNECT_MDATA_TEMPLATE, CONNECT_MDATA_COUNT, u8v0, u8vlen, unpack_flags, field_mask
+    );
+}
+
+int mr_validate_connect_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code) {
+    return mr_validate_packet(CONNECT_MDATA_TEMPLATE, CONNECT_MDATA_COUNT, u8v0, u8vlen, preason_code);
 }
 
 static int mr_check_connect_packet(mr_packet_ctx *pctx) {
@@ -167,8 +146,8 @@ static int mr_check_connect_packet(mr_packet_ctx *pctx) {
         return 0;
     }
     else {
-        dzlog_error("Packet Context is not a CONNECT packet");
-        return -1;
+        mr_log_error("Packet Context is not a CONNECT packet:: packet name: %s", pctx->mqtt_packet_name);
+        return mr_set_error(MR_ERR_PACKET_TYPE, MQTT_RC_UNSPECIFIED, pctx->mqtt_packet_type, -1, 0);
     }
 }
 
@@ -295,7 +274,7 @@ int mr_get_connect_will_qos(mr_packet_ctx *pctx, uint8_t *pu8) {
 
 static int mr_validate_connect_will_qos(const uint8_t u8) {
     if (u8 > 2) {
-        dzlog_error("will_qos out of range (0..2): %u", u8);
+        mr_log_error("will_qos out of range (0..2): %u", u8);
         return -1;
     }
 
@@ -379,7 +358,7 @@ int mr_get_connect_receive_maximum(mr_packet_ctx *pctx, uint16_t *pu16, bool *pe
 
 static int mr_validate_connect_receive_maximum(const uint16_t u16) {
     if (u16 == 0) {
-        dzlog_error("receive_maximum must be > 0");
+        mr_log_error("receive_maximum must be > 0");
         return -1;
     }
 
@@ -405,7 +384,7 @@ int mr_get_connect_maximum_packet_size(mr_packet_ctx *pctx, uint32_t *pu32, bool
 
 static int mr_validate_connect_maximum_packet_size(const uint32_t u32) {
     if (u32 == 0) {
-        dzlog_error("if present, maximum_packet_size must be > 0");
+        mr_log_error("if present, maximum_packet_size must be > 0");
         return -1;
     }
 
@@ -447,7 +426,7 @@ int mr_get_connect_request_response_information(mr_packet_ctx *pctx, uint8_t *pu
 
 static int mr_validate_connect_request_response_information(const uint8_t u8) {
     if (u8 > 1) {
-        dzlog_error("request_response_information out of range (0..1): %u", u8);
+        mr_log_error("request_response_information out of range (0..1): %u", u8);
         return -1;
     }
 
@@ -473,7 +452,7 @@ int mr_get_connect_request_problem_information(mr_packet_ctx *pctx, uint8_t *pu8
 
 static int mr_validate_connect_request_problem_information(const uint8_t u8) {
     if (u8 > 1) {
-        dzlog_error("request_problem_information out of range (0..1): %u", u8);
+        mr_log_error("request_problem_information out of range (0..1): %u", u8);
         return -1;
     }
 
@@ -582,7 +561,7 @@ int mr_get_connect_payload_format_indicator(mr_packet_ctx *pctx, uint8_t *pu8, b
 
 static int mr_validate_connect_payload_format_indicator(const uint8_t u8) {
     if (u8 > 1) {
-        dzlog_error("payload_format_indicator out of range (0..1): %u", u8);
+        mr_log_error("payload_format_indicator out of range (0..1): %u", u8);
         return -1;
     }
 
@@ -767,7 +746,9 @@ static int mr_validate_connect_cross(mr_packet_ctx *pctx) {
 
     // payload_format_indicator & will_payload
     if (mr_get_connect_payload_format_indicator(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && u8 && mr_validate_u8v_utf8(pctx, CONNECT_WILL_PAYLOAD)) return -1;
+    if (exists_flag && u8 && mr_validate_u8v_utf8(pctx, CONNECT_WILL_PAYLOAD)) {
+        return mr_reject(pctx, CONNECT_WILL_PAYLOAD, MQTT_RC_PAYLOAD_FORMAT_INVALID);
+    }
 
     // authentication_method & authentication_data
     if (mr_get_connect_authentication_data(pctx, &u8v0, &len, &exists_flag)) return -1;
@@ -776,15 +757,15 @@ static int mr_validate_connect_cross(mr_packet_ctx *pctx) {
         if (mr_get_connect_authentication_method(pctx, &cv0, &exists_flag)) return -1;
 
         if (!exists_flag) {
-            dzlog_error("authentication_method must exist since authentication_data exists");
-            return -1;
+            mr_log_error("authentication_method must exist since authentication_data exists");
+            return mr_reject(pctx, CONNECT_AUTHENTICATION_METHOD, MQTT_RC_PROTOCOL_ERROR);
         }
     }
 
     return 0;
 }
 
-static int mr_validate_connect_pack(mr_packet_ctx *pctx) {
+int mr_validate_connect_pack(mr_packet_ctx *pctx) {
     bool exists_flag;
     bool will_flag;
     if (mr_get_boolean(pctx, CONNECT_WILL_FLAG, &will_flag, &exists_flag)) return -1;
@@ -794,7 +775,7 @@ static int mr_validate_connect_pack(mr_packet_ctx *pctx) {
         if (mdata->flagid == CONNECT_WILL_FLAG && !will_flag) { // governed by will_flag AND will_flag is false
             if (mdata->dtype == MR_BITS_DTYPE) { // MR_BITS_DTYPE always exist so check value
                 if (mdata->value) {
-                    dzlog_error("will_flag is false but '%s' has a value", mdata->name);
+                    mr_log_error("will_flag is false but '%s' has a value", mdata->name);
                     return -1;
                 }
                 else {
@@ -802,7 +783,7 @@ static int mr_validate_connect_pack(mr_packet_ctx *pctx) {
                 }
             }
             else if (mdata->vexists) { // check existence for other dtypes
-                dzlog_error("will_flag is false but '%s' exists", mdata->name);
+                mr_log_error("will_flag is false but '%s' exists", mdata->name);
                 return -1;
             }
             else {
@@ -823,22 +804,22 @@ int mr_validate_connect_unpack(mr_packet_ctx *pctx) {
     bool exists_flag;
 
     if (mr_get_connect_will_qos(pctx, &u8)) return -1;
-    if (mr_validate_connect_will_qos(u8)) return -1;
+    if (mr_validate_connect_will_qos(u8)) return mr_reject(pctx, CONNECT_WILL_QOS, MQTT_RC_MALFORMED_PACKET);
 
     if (mr_get_connect_receive_maximum(pctx, &u16, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connect_receive_maximum(u16)) return -1;
+    if (exists_flag && mr_validate_connect_receive_maximum(u16)) return mr_reject(pctx, CONNECT_RECEIVE_MAXIMUM, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_connect_maximum_packet_size(pctx, &u32, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connect_maximum_packet_size(u32)) return -1;
+    if (exists_flag && mr_validate_connect_maximum_packet_size(u32)) return mr_reject(pctx, CONNECT_MAXIMUM_PACKET_SIZE, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_connect_request_response_information(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connect_request_response_information(u8)) return -1;
+    if (exists_flag && mr_validate_connect_request_response_information(u8)) return mr_reject(pctx, CONNECT_REQUEST_RESPONSE_INFORMATION, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_connect_request_problem_information(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connect_request_problem_information(u8)) return -1;
+    if (exists_flag && mr_validate_connect_request_problem_information(u8)) return mr_reject(pctx, CONNECT_REQUEST_PROBLEM_INFORMATION, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_connect_payload_format_indicator(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_connect_payload_format_indicator(u8)) return -1;
+    if (exists_flag && mr_validate_connect_payload_format_indicator(u8)) return mr_reject(pctx, CONNECT_PAYLOAD_FORMAT_INDICATOR, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_validate_connect_cross(pctx)) return -1;
     return 0;
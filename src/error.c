@@ -0,0 +1,119 @@
+// error.c
+
+#define _POSIX_C_SOURCE 200809L // clock_gettime under strict C
+
+/**
+ * @file
+ * @brief Per-thread error state and the rate limit on error log lines.
+ *
+ * A failure records its code, MQTT reason code and location with a few stores, so rejecting a bad
+ * packet costs no formatting; a log line is only formatted while the thread is under its rate.
+*/
+
+#include <time.h>
+
+#include <zlog.h>
+
+#include "mister_internal.h"
+
+#define MR_ERROR_LOG_RATE 100 // default lines per second per thread
+#define MR_NO_ERROR {MR_ERR_NONE, MQTT_RC_SUCCESS, MQTT_RESERVED, -1, 0}
+
+static _Thread_local int errno_value;
+static _Thread_local mr_error last_error = MR_NO_ERROR;
+
+typedef struct mr_error_log_limit {
+    uint32_t rate;          ///< lines per second; 0 disables logging
+    time_t window;          ///< the current second
+    uint32_t count;         ///< lines logged or suppressed in the window
+} mr_error_log_limit;
+
+static _Thread_local mr_error_log_limit log_limit = {MR_ERROR_LOG_RATE, 0, 0};
+
+static const char *ERROR_NAMES[] = { // same order as mr_error_codes
+    "no error",
+    "out of memory",
+    "buffer too small",
+    "unsupported or wrong packet type",
+    "field beyond its block",
+    "length mismatch",
+    "malformed VBI",
+    "property id not allowed",
+    "duplicate property",
+    "invalid utf8",
+    "invalid value",
+    "I/O error"
+};
+
+int *mr_errno_location(void) {
+    return &errno_value;
+}
+
+/**
+ * @brief Record this thread's last error, then return -1.
+ */
+int mr_set_error(
+    const int code, const uint8_t reason_code, const uint8_t packet_type, const int field_idx, const size_t offset
+) {
+    last_error.code = code;
+    last_error.reason_code = reason_code;
+    last_error.packet_type = packet_type;
+    last_error.field_idx = field_idx;
+    last_error.offset = offset;
+    return -1;
+}
+
+int mr_get_error(mr_error *perr) {
+    *perr = last_error;
+    return 0;
+}
+
+int mr_clear_error(void) {
+    last_error = (mr_error)MR_NO_ERROR;
+    return 0;
+}
+
+int mr_get_error_name(const int code, const char **pcv0) {
+    if (code < MR_ERR_NONE || code > MR_ERR_IO) {
+        mr_log_error("unknown error code: %d", code);
+        return mr_set_error(MR_ERR_VALUE, MQTT_RC_UNSPECIFIED, MQTT_RESERVED, -1, 0);
+    }
+
+    *pcv0 = ERROR_NAMES[code];
+    return 0;
+}
+
+/**
+ * @brief Set how many error lines per second this thread may log; 0 disables error logging.
+ *
+ * Lines over the rate are dropped and counted; the count is logged when the next second starts.
+ */
+int mr_set_error_log_rate(const uint32_t lines_per_second) {
+    log_limit.rate = lines_per_second;
+    log_limit.count = 0;
+    return 0;
+}
+
+/**
+ * @brief Return whether an error line may be logged now, charging it to the thread's rate.
+ */
+bool mr_error_log_allowed(void) {
+    if (!log_limit.rate) return false;
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts); // tick resolution is plenty for a per-second window
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+
+    if (ts.tv_sec != log_limit.window) {
+        if (log_limit.count > log_limit.rate) {
+            dzlog_warn("error lines suppressed: %u", log_limit.count - log_limit.rate);
+        }
+
+        log_limit.window = ts.tv_sec;
+        log_limit.count = 0;
+    }
+
+    return log_limit.count++ < log_limit.rate;
+}
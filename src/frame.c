@@ -0,0 +1,196 @@
+// frame.c
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <zlog.h>
+
+#include "mister_internal.h"
+
+#define MR_MAXIMUM_PACKET_SIZE (1 + 4 + 268435455) // fixed header byte + 4 byte VBI + max remaining length
+
+/**
+ * @brief Initialize a streaming frame decoder, setting its address.
+ *
+ * The decoder finds MQTT packet boundaries in a byte stream delivered in arbitrary pieces, e.g. by
+ * read(). It keeps only the state needed to resume a partial fixed header or to skip the rest of a
+ * partial packet; it never copies stream bytes. A maximum_packet_size of 0 means the MQTT maximum.
+ */
+int mr_init_frame_decoder(mr_frame_decoder **ppfd, const size_t maximum_packet_size) {
+    mr_frame_decoder *pfd;
+    if (mr_calloc((void **)&pfd, 1, sizeof(mr_frame_decoder))) return -1;
+    pfd->maximum_packet_size = maximum_packet_size ? maximum_packet_size : MR_MAXIMUM_PACKET_SIZE;
+    pfd->state = MR_FRAME_TYPE;
+    *ppfd = pfd;
+    return 0;
+}
+
+/**
+ * @brief Reset the decoder to the start of a new stream, e.g. after a malformed packet.
+ */
+int mr_reset_frame_decoder(mr_frame_decoder *pfd) {
+    size_t maximum_packet_size = pfd->maximum_packet_size;
+    memset(pfd, 0, sizeof(mr_frame_decoder));
+    pfd->maximum_packet_size = maximum_packet_size;
+    pfd->state = MR_FRAME_TYPE;
+    return 0;
+}
+
+int mr_free_frame_decoder(mr_frame_decoder *pfd) {
+    return mr_free(pfd);
+}
+
+/**
+ * @brief Get the count of stream bytes consumed so far: the stream offset of the next byte to decode.
+ */
+int mr_get_frame_decoder_offset(mr_frame_decoder *pfd, size_t *poffset) {
+    *poffset = pfd->stream_pos;
+    return 0;
+}
+
+/**
+ * @brief Get the length of the packet at the start of u8v0 without decoding state.
+ *
+ * Set *plength to the packet length, or to 0 if u8v0 does not yet hold the whole packet. Return -1
+ * if the fixed header is malformed.
+ */
+int mr_get_frame_length(const uint8_t *u8v0, const size_t u8vlen, size_t *plength) {
+    *plength = 0;
+    if (u8vlen < 2) return 0; // incomplete fixed header
+    uint32_t remaining_length;
+    int vbilen = mr_extract_VBI(&remaining_length, u8v0 + 1, u8vlen - 1);
+
+    if (vbilen < 0) {
+        mr_log_error("malformed packet: remaining length VBI overflow");
+        return mr_set_error(MR_ERR_VBI, MQTT_RC_MALFORMED_PACKET, u8v0[0] >> 4, -1, 1);
+    }
+
+    size_t length = 1 + vbilen + remaining_length;
+    if (vbilen && length <= u8vlen) *plength = length;
+    return 0;
+}
+
+static int mr_frame_malformed(mr_frame_decoder *pfd, const int code, const uint8_t reason_code, const char *reason) {
+    mr_log_error("malformed packet:: stream offset: %lu; %s", pfd->frame.offset, reason);
+    pfd->state = MR_FRAME_MALFORMED;
+    return mr_set_error(code, reason_code, pfd->frame.packet_type, -1, pfd->frame.offset);
+}
+
+// finish the frame in progress; set *pfull if the frames vector is now full
+static void mr_frame_complete(
+    mr_frame_decoder *pfd, mr_frame *frames, const size_t frames_len, size_t *pframe_count, bool *pfull
+) {
+    frames[(*pframe_count)++] = pfd->frame;
+    pfd->state = MR_FRAME_TYPE;
+    *pfull = *pframe_count == frames_len;
+}
+
+// the fixed header is complete: check the packet size & start skipping its body
+static int mr_frame_header_complete(
+    mr_frame_decoder *pfd, mr_frame *frames, const size_t frames_len, size_t *pframe_count, bool *pfull
+) {
+    mr_frame *pf = &pfd->frame;
+    pf->length = pf->header_len + pf->remaining_length;
+    if (pf->length > pfd->maximum_packet_size) {
+        return mr_frame_malformed(pfd, MR_ERR_LENGTH, MQTT_RC_PACKET_TOO_LARGE, "packet exceeds maximum packet size");
+    }
+
+    pfd->body_remaining = pf->remaining_length;
+    pfd->state = MR_FRAME_BODY;
+    if (!pfd->body_remaining) mr_frame_complete(pfd, frames, frames_len, pframe_count, pfull);
+    return 0;
+}
+
+/**
+ * @brief Decode the next piece of a byte stream into complete frames.
+ *
+ * Consume u8v0 until it is exhausted or frames_len frames are complete, setting the count of frames
+ * and of bytes consumed. A frame is reported once its last byte has been consumed; its offset is
+ * relative to the whole stream so a packet split across reads can be located in the caller's own
+ * buffer. When frames fills up, call again with the unconsumed remainder. Fixed headers whose
+ * remaining length VBI spans reads are resumed byte by byte.
+ *
+ * Return -1 on a malformed fixed header or an oversize packet; the decoder must then be reset.
+ */
+int mr_decode_frames(
+    mr_frame_decoder *pfd,
+    const uint8_t *u8v0,
+    const size_t u8vlen,
+    mr_frame *frames,
+    const size_t frames_len,
+    size_t *pframe_count,
+    size_t *pconsumed
+) {
+    *pframe_count = 0;
+    *pconsumed = 0;
+    if (pfd->state == MR_FRAME_MALFORMED) return -1;
+    if (!frames_len) return 0;
+
+    const uint8_t *pu8 = u8v0;
+    const uint8_t *pu8end = u8v0 + u8vlen;
+    mr_frame *pf = &pfd->frame;
+    bool full = false;
+    int rc = 0;
+
+    while (pu8 < pu8end && !full && !rc) {
+        size_t avail = pu8end - pu8;
+
+        switch (pfd->state) {
+            case MR_FRAME_TYPE:
+                pf->offset = pfd->stream_pos + (pu8 - u8v0);
+                pf->packet_type = *pu8 >> 4;
+                pf->flags = *pu8 & 0x0F;
+                pf->remaining_length = 0;
+                pf->header_len = 1;
+
+                if (pf->packet_type == MQTT_RESERVED) {
+                    rc = mr_frame_malformed(pfd, MR_ERR_PACKET_TYPE, MQTT_RC_MALFORMED_PACKET, "reserved packet type");
+                }
+                else { // fast path: the whole VBI is in the buffer
+                    uint32_t u32;
+                    int vbilen = mr_extract_VBI(&u32, pu8 + 1, avail - 1);
+
+                    if (vbilen == -1) {
+                        rc = mr_frame_malformed(pfd, MR_ERR_VBI, MQTT_RC_MALFORMED_PACKET, "remaining length VBI overflow");
+                    }
+                    else if (vbilen) {
+                        pf->remaining_length = u32;
+                        pf->header_len += vbilen;
+                        pu8 += pf->header_len;
+                        rc = mr_frame_header_complete(pfd, frames, frames_len, pframe_count, &full);
+                    }
+                    else { // resume byte by byte
+                        pfd->vbi_count = 0;
+                        pfd->state = MR_FRAME_LENGTH;
+                        pu8++;
+                    }
+                }
+
+                break;
+            case MR_FRAME_LENGTH:
+                pf->remaining_length += (uint32_t)(*pu8 & 0x7F) << (7 * pfd->vbi_count++);
+                pf->header_len++;
+
+                if (!(*pu8++ & 0x80)) {
+                    rc = mr_frame_header_complete(pfd, frames, frames_len, pframe_count, &full);
+                }
+                else if (pfd->vbi_count == 4) { // byte[3] has a continuation bit
+                    rc = mr_frame_malformed(pfd, MR_ERR_VBI, MQTT_RC_MALFORMED_PACKET, "remaining length VBI overflow");
+                }
+
+                break;
+            case MR_FRAME_BODY: {
+                size_t skip = avail < pfd->body_remaining ? avail : pfd->body_remaining;
+                pu8 += skip;
+                pfd->body_remaining -= skip;
+                if (!pfd->body_remaining) mr_frame_complete(pfd, frames, frames_len, pframe_count, &full);
+                break;
+            }
+        }
+    }
+
+    *pconsumed = pu8 - u8v0;
+    pfd->stream_pos += *pconsumed;
+    return rc;
+}
@@ -2,8 +2,6 @@
 
 #include "mister_internal.h"
 
-int mr_errno = 0;
-
 int mr_init(void) {
     return 0;
 }
\ No newline at end of file
@@ -8,28 +8,57 @@
 
 #include "mister_internal.h"
 
+// per-thread counts of heap allocations & frees, e.g. for allocations per operation in benchmarks
+static _Thread_local uint64_t alloc_count;
+static _Thread_local uint64_t free_count;
+
+int mr_get_alloc_stats(uint64_t *pallocs, uint64_t *pfrees) {
+    *pallocs = alloc_count;
+    *pfrees = free_count;
+    return 0;
+}
+
 int mr_calloc(void **ppv, size_t count, size_t size) {
     if (!count) count = 1; // always allocate something even if size is 0
     if (!size) size = 1;
     *ppv = calloc(count, size);
+    alloc_count++;
 
     if (!*ppv) {
         mr_errno = errno;
-        dzlog_error("calloc error: %d %s", errno, strerror(errno));
-        return -1;
+        mr_log_error("calloc error: %d %s", errno, strerror(errno));
+        return mr_set_error(MR_ERR_NOMEM, MQTT_RC_UNSPECIFIED, MQTT_RESERVED, -1, 0);
     }
 
     return 0;
 }
 
+// zeroed & aligned, e.g. to a cache line, for a struct with _Alignas members
+int mr_aligned_calloc(void **ppv, size_t alignment, size_t size) {
+    size = (size + alignment - 1) / alignment * alignment; // aligned_alloc wants a multiple
+    if (!size) size = alignment;
+    *ppv = aligned_alloc(alignment, size);
+    alloc_count++;
+
+    if (!*ppv) {
+        mr_errno = errno;
+        mr_log_error("aligned_alloc error: %d %s", errno, strerror(errno));
+        return mr_set_error(MR_ERR_NOMEM, MQTT_RC_UNSPECIFIED, MQTT_RESERVED, -1, 0);
+    }
+
+    memset(*ppv, 0, size);
+    return 0;
+}
+
 int mr_malloc(void **ppv, size_t size) {
     if (!size) size = 1; // always allocate something even if size is 0
     *ppv = malloc(size);
+    alloc_count++;
 
     if (!*ppv) {
         mr_errno = errno;
-        dzlog_error("malloc error: %d %s\n", errno, strerror(errno));
-        return -1;
+        mr_log_error("malloc error: %d %s\n", errno, strerror(errno));
+        return mr_set_error(MR_ERR_NOMEM, MQTT_RC_UNSPECIFIED, MQTT_RESERVED, -1, 0);
     }
 
     uint8_t *pu8 = (uint8_t *)*ppv;
@@ -39,18 +68,100 @@ int mr_malloc(void **ppv, size_t size) {
 
 int mr_realloc(void **ppv, size_t size) {
     *ppv = realloc(*ppv, size);
+    alloc_count++;
 
     if (!*ppv) {
         mr_errno = errno;
-        dzlog_error("realloc error: %d %s", errno, strerror(errno));
-        return -1;
+        mr_log_error("realloc error: %d %s", errno, strerror(errno));
+        return mr_set_error(MR_ERR_NOMEM, MQTT_RC_UNSPECIFIED, MQTT_RESERVED, -1, 0);
     }
 
     return 0;
 }
 
 int mr_free(void *pv) {
+    if (pv) free_count++;
     free(pv);
     pv = NULL;
     return 0;
-}
\ No newline at end of file
+}
+// arena: bump allocation from a chain of blocks, released all at once
+
+#define MR_ARENA_ALIGN sizeof(uintptr_t)
+#define MR_ARENA_MIN_SIZE 256
+
+static int mr_add_arena_block(mr_arena **pparena, size_t size) {
+    if (size < MR_ARENA_MIN_SIZE) size = MR_ARENA_MIN_SIZE;
+    mr_arena *parena;
+    if (mr_malloc((void **)&parena, sizeof(mr_arena) + size)) return -1;
+    parena->next = *pparena;
+    parena->size = size;
+    parena->pos = 0;
+    parena->last_pos = 0;
+    *pparena = parena;
+    return 0;
+}
+
+int mr_init_arena(mr_arena **pparena, size_t size) {
+    *pparena = NULL;
+    return mr_add_arena_block(pparena, size);
+}
+
+int mr_arena_alloc(mr_arena **pparena, void **ppv, size_t size) {
+    mr_arena *parena = *pparena;
+    size_t pos = (parena->pos + MR_ARENA_ALIGN - 1) & ~(MR_ARENA_ALIGN - 1);
+
+    if (pos + size > parena->size) { // new block at the head of the chain
+        size_t block_size = parena->size * 2;
+        if (mr_add_arena_block(pparena, block_size > size ? block_size : size)) return -1;
+        parena = *pparena;
+        pos = 0;
+    }
+
+    parena->last_pos = pos;
+    parena->pos = pos + size;
+    *ppv = parena->u8v0 + pos;
+    return 0;
+}
+
+// grow in place when *ppv is the most recent allocation & there is room, otherwise copy
+int mr_arena_realloc(mr_arena **pparena, void **ppv, size_t old_size, size_t size) {
+    mr_arena *parena = *pparena;
+
+    if (*ppv == parena->u8v0 + parena->last_pos && parena->last_pos + size <= parena->size) {
+        parena->pos = parena->last_pos + size;
+        return 0;
+    }
+
+    void *pv;
+    if (mr_arena_alloc(pparena, &pv, size)) return -1;
+    if (*ppv) memcpy(pv, *ppv, old_size < size ? old_size : size);
+    *ppv = pv;
+    return 0;
+}
+
+// keep the newest, largest block for reuse
+int mr_reset_arena(mr_arena *parena) {
+    mr_arena *pnext = parena->next;
+
+    while (pnext) {
+        mr_arena *pfree = pnext;
+        pnext = pnext->next;
+        if (mr_free(pfree)) return -1;
+    }
+
+    parena->next = NULL;
+    parena->pos = 0;
+    parena->last_pos = 0;
+    return 0;
+}
+
+int mr_free_arena(mr_arena *parena) {
+    while (parena) {
+        mr_arena *pfree = parena;
+        parena = parena->next;
+        if (mr_free(pfree)) return -1;
+    }
+
+    return 0;
+}
@@ -7,32 +7,11 @@ extern "C" {
 
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include "mister/mister.h"
 
-/**
- * @brief MQTT5 packet types.
- *
- */
-enum mqtt_packet_type {
-    MQTT_RESERVED,
-    MQTT_CONNECT,
-    MQTT_CONNACK,
-    MQTT_PUBLISH,
-    MQTT_PUBACK,
-    MQTT_PUBREC,
-    MQTT_PUBREL,
-    MQTT_PUBCOMP,
-    MQTT_SUBSCRIBE,
-    MQTT_SUBACK,
-    MQTT_UNSUBSCRIBE,
-    MQTT_UNSUBACK,
-    MQTT_PINGREQ,
-    MQTT_PINGRESP,
-    MQTT_DISCONNECT,
-    MQTT_AUTH
-};
-
 // from mosquitto & spec
 enum mqtt_property {
     MQTT_PROP_PAYLOAD_FORMAT_INDICATOR = 1,             ///< Byte :               PUBLISH, Will Properties
@@ -96,8 +75,18 @@ typedef struct mr_mdata {
     const int flagid;       ///< controlling flag id if any
     const int idx;          ///< offset of this mdata instance in the packet's mdata0 vector
     char *printable;        ///< c-string printable version of the value
+    size_t lazy_pos;        ///< MR_UNPACK_LAZY: packet offset of the first undecoded occurrence, else 0
+    size_t lazy_end;        ///< MR_UNPACK_LAZY: end of the enclosing property block
 } mr_mdata;
 
+typedef struct mr_arena {
+    struct mr_arena *next;  ///< older, full block
+    size_t size;
+    size_t pos;             ///< next free byte
+    size_t last_pos;        ///< start of the most recent allocation, which can grow in place
+    uint8_t u8v0[];
+} mr_arena;
+
 typedef struct mr_packet_ctx {
     uint8_t mqtt_packet_type;
     const char *mqtt_packet_name;
@@ -106,27 +95,276 @@ typedef struct mr_packet_ctx {
     bool u8valloc;
     size_t u8vlen;
     size_t u8vpos;
-    struct mr_mdata *mdata0;
+    size_t u8vend;          ///< unpack limit for u8vpos: the end of the packet or of its property block
+    struct mr_mdata *mdata0; ///< in the same allocation as the context
     size_t mdata_count;
+    const struct mr_mdata *mdata_template; ///< the module's template mdata0 was copied from
+    int unpack_flags;       ///< mr_unpack_flags in effect for the last unpack
+    struct mr_packet_ctx *next_free; ///< link while in the context pool
+    struct mr_packet_slab *slab; ///< the batch allocation holding this context, if any
+    mr_arena *arena;        ///< field storage when unpacking with MR_UNPACK_ARENA
+    bool counted;           ///< u8vlen & the length VBIs are current for packing
+    const uint8_t *lazy_u8v0; ///< MR_UNPACK_LAZY: the unpacked buffer
+    size_t lazy_u8vlen;
+    size_t lazy_count;      ///< MR_UNPACK_LAZY: properties not yet decoded
+    uint64_t field_mask;    ///< MR_FIELD bits of the fields decoded by the last unpack; 0 for all
+    uint8_t reason_code;    ///< MQTT reason code of the first unpack failure that records one
 } mr_packet_ctx;
 
+// internal unpack option for mr_validate_packet_bytes: vector fields are checked in place and left
+// as views into the packet, strings without a NUL
+#define MR_UNPACK_VALIDATE (1 << 8)
+
+// an mdata vector on the stack for mr_validate_packet_bytes: a field mask has a bit per row
+#define MR_MDATA_MAX 64
+
+enum mr_frame_decoder_states {
+    MR_FRAME_TYPE,          ///< expecting the first byte of a fixed header
+    MR_FRAME_LENGTH,        ///< accumulating the remaining length VBI
+    MR_FRAME_BODY,          ///< skipping the variable header & payload
+    MR_FRAME_MALFORMED      ///< unrecoverable until reset
+};
+
+typedef struct mr_frame_decoder {
+    int state;
+    size_t stream_pos;      ///< count of bytes consumed since init or reset
+    size_t maximum_packet_size;
+    mr_frame frame;         ///< frame in progress
+    int vbi_count;          ///< remaining length bytes seen so far
+    size_t body_remaining;  ///< bytes left to skip in the current frame
+} mr_frame_decoder;
+
+typedef struct mr_publish_fanout {
+    uint8_t *u8v0;          ///< the topic name with its length prefix, then the shared properties
+    size_t topic_len;
+    size_t props_len;
+    size_t topic_alias_pos; ///< offset in the shared properties where a topic_alias goes
+    size_t subscription_identifiers_pos;
+    const uint8_t *payload; ///< the packet context's payload, uncopied
+    size_t payload_len;
+} mr_publish_fanout;
+
+// subscription index
+
+#define MR_TOPIC_LEVELS_MAX 128 // bounds the trie depth & so the recursion when matching
+#define MR_READER_STRIPES 64    // reader counters, each on its own cache line
+#define MR_CACHE_LINE 64
+#define MR_RETIRE_BATCH 256     // retired blocks a writer holds before waiting out the readers
+
+typedef struct mr_slots {   ///< replaced whole when it grows, so readers never see a torn cap
+    size_t cap;             ///< a power of 2
+    _Atomic(void *) slots[];
+} mr_slots;
+
+typedef struct mr_slot_table {  ///< open addressing, linear probing; removed slots hold a tombstone
+    _Atomic(mr_slots *) pslots; ///< NULL when empty
+    size_t count;           ///< live entries; written & read by writers only
+    size_t used;            ///< live entries + tombstones
+    bool by_subscriber;     ///< slots hold mr_subscription * keyed by subscriber, else mr_topic_node *
+} mr_slot_table;
+
+typedef struct mr_topic_node {
+    struct mr_topic_node *parent;
+    mr_slot_table children; ///< literal levels
+    _Atomic(struct mr_topic_node *) plus;
+    _Atomic(struct mr_topic_node *) hash;
+    mr_slot_table subscriptions;
+    uint32_t level_hash;
+    size_t level_len;
+    char level[];           ///< not NUL-terminated
+} mr_topic_node;
+
+typedef struct mr_reader_stripe { // aligned, so padded, to a cache line of its own
+    /// readers matching, by the parity of the epoch they entered under
+    _Alignas(MR_CACHE_LINE) atomic_uint_fast64_t active[2];
+} mr_reader_stripe;
+
+typedef struct mr_subscription_index {
+    mr_topic_node *root;
+    pthread_mutex_t writer_lock;
+    size_t subscription_count;
+    size_t node_count;
+    /// read twice by every match: a cache line apart from the writer's fields & the stripes readers write
+    _Alignas(MR_CACHE_LINE) atomic_uint_fast64_t epoch;
+    mr_reader_stripe stripes[MR_READER_STRIPES];
+    void *retired[MR_RETIRE_BATCH]; ///< unlinked blocks waiting for the readers that may see them
+    size_t retired_count;
+} mr_subscription_index;
+
+typedef struct mr_match_ctx {
+    const mr_topic_node *root;
+    const char *end;        ///< end of the topic name
+    const void *publisher;
+    mr_subscription_fn fn;
+    void *arg;
+} mr_match_ctx;
+
+// retained store
+
+typedef struct mr_retained_node {
+    struct mr_retained_node *parent;
+    struct mr_retained_node **children; ///< open addressing, linear probing, backward-shift deletion
+    size_t children_cap;    ///< 0 or a power of 2
+    size_t children_count;
+    struct mr_retained_entry *pentry; ///< the topic's retained message, if any
+    uint32_t level_hash;
+    size_t level_len;
+    char level[];           ///< not NUL-terminated
+} mr_retained_node;
+
+typedef int (*mr_retained_visit_fn)(const mr_retained_node *node, void *arg);
+
+typedef struct mr_retained_entry {
+    mr_retained_node *node;
+    uint8_t *u8v0;          ///< the packed PUBLISH
+    size_t u8vlen;
+    size_t topic_name_pos;
+    size_t topic_name_len;
+    size_t expiry_pos;      ///< of the message_expiry_interval value; 0 for none
+    uint64_t expiry;        ///< on the caller's clock, in seconds
+    size_t heap_idx;        ///< in the expiry heap
+    uint8_t u8v[];
+} mr_retained_entry;
+
+#define MR_RETAINED_SEGMENT_SIZE (64 * 1024 * 1024) // by default a segment is sealed once this big
+
+typedef struct mr_retained_segment_header { ///< starts each segment file; files are in native byte order
+    char magic[8];          ///< "MRRETSEG"
+    uint32_t version;
+    uint32_t flags;         ///< MR_SEGMENT_SEALED, MR_SEGMENT_BASE
+    uint64_t seq;           ///< also the file name, in 16 hex digits
+    uint64_t data_len;      ///< of the records, set when sealed
+} mr_retained_segment_header;
+
+typedef struct mr_retained_record { ///< precedes each frame in a segment; frames are padded to 8 bytes
+    uint32_t magic;
+    uint32_t u8vlen;        ///< of the frame
+    uint64_t expiry;        ///< on the caller's clock, in seconds
+    uint32_t expiry_pos;    ///< of the frame's message_expiry_interval value; 0 for none
+    uint32_t crc;           ///< CRC-32C of the record with crc 0, then of the frame
+} mr_retained_record;
+
+typedef struct mr_retained_mapping {
+    uint8_t *u8v0;          ///< a mapped segment; its frames are referenced by the store's messages
+    size_t u8vlen;
+} mr_retained_mapping;
+
+typedef struct mr_retained_log {
+    int dirfd;
+    int fd;                 ///< the active segment, appended to; -1 until the next append starts one
+    uint64_t seq;           ///< of the active segment
+    size_t size;            ///< of the active segment
+    size_t segment_size;
+    uint64_t first_seq;     ///< the oldest segment in force
+    size_t log_bytes;       ///< of the segments in force
+    mr_retained_mapping *mappings;
+    size_t mapping_count;
+} mr_retained_log;
+
+typedef struct mr_retained_compaction {
+    mr_retained_log *plog;
+    int fd;                 ///< the output segment being written
+    uint64_t seq;
+    size_t size;
+    uint32_t flags;
+    size_t log_bytes;       ///< of the output segments
+} mr_retained_compaction;
+
+typedef struct mr_retained_repoint { ///< follows the records a compaction wrote, as they were written
+    mr_retained_store *prs;
+    const mr_retained_mapping *mappings;
+    size_t mapping_idx;
+    size_t pos;
+} mr_retained_repoint;
+
+typedef struct mr_retained_store {
+    mr_retained_node *root;
+    mr_retained_log *plog;  ///< NULL unless persistent
+    mr_retained_entry **heap; ///< the messages that expire, soonest first
+    size_t heap_len;
+    size_t heap_cap;
+    size_t message_count;
+    size_t node_count;
+    size_t byte_count;      ///< of the packed messages
+} mr_retained_store;
+
+typedef struct mr_retained_match_ctx {
+    const mr_retained_node *root;
+    const char *end;        ///< end of the topic filter
+    uint64_t now;
+    mr_retained_fn fn;
+    void *arg;
+} mr_retained_match_ctx;
+
+// topic aliases
+
+typedef struct mr_inbound_alias {
+    char *topic_name;       ///< NULL until the peer sets the alias
+    size_t topic_name_len;
+} mr_inbound_alias;
+
+typedef struct mr_outbound_alias {
+    char *topic_name;
+    size_t topic_name_len;
+    uint32_t hash;
+    bool referenced;        ///< sent since the clock hand last passed
+} mr_outbound_alias;
+
+typedef struct mr_topic_aliases {
+    uint16_t inbound_maximum;   ///< the topic_alias_maximum this side sent
+    uint16_t outbound_maximum;  ///< the peer's topic_alias_maximum
+    mr_inbound_alias *inbound;  ///< by alias - 1, grown to the highest alias set
+    size_t inbound_cap;
+    mr_outbound_alias *outbound; ///< by alias - 1, assigned in order
+    size_t outbound_count;
+    size_t outbound_cap;
+    uint16_t *table;        ///< outbound aliases by topic name hash: open addressing, linear probing,
+                            ///< backward-shift deletion; 0 is empty
+    size_t table_cap;       ///< 0 or a power of 2
+    size_t hand;            ///< the clock hand: the next outbound alias index considered for reuse
+    uint8_t *sketch;        ///< saturating counters of recent sends by topic name hash
+    size_t sketch_cap;      ///< a power of 2
+    size_t sketch_sends;    ///< since the counters were last halved
+} mr_topic_aliases;
+
 int mr_init_packet(
     mr_packet_ctx **ppctx, const mr_mdata *MDATA_TEMPLATE, const size_t mdata_count
 );
 
 static int mr_unpack_packet(mr_packet_ctx *pctx);
+static int mr_unpack_check(mr_packet_ctx *pctx, mr_mdata *mdata, const size_t len);
 
 int mr_init_unpack_packet(
     mr_packet_ctx **ppctx,
     const mr_mdata *MDATA_TEMPLATE,
     const size_t mdata_count,
     const uint8_t *u8v0,
-    const size_t ulen
+    const size_t ulen,
+    const int unpack_flags,
+    const uint64_t field_mask
+);
+
+int mr_unpack_error(mr_packet_ctx *pctx, const mr_mdata *mdata, const int code, const uint8_t reason_code);
+int mr_reject(mr_packet_ctx *pctx, const int idx, const uint8_t reason_code);
+int mr_validate_packet(
+    const mr_mdata *MDATA_TEMPLATE,
+    const size_t mdata_count,
+    const uint8_t *u8v0,
+    const size_t u8vlen,
+    uint8_t *preason_code
 );
 
+static int mr_count_packet(mr_packet_ctx *pctx);
+static int mr_emit_packet(mr_packet_ctx *pctx, const size_t mdata_end);
 int mr_pack_packet(mr_packet_ctx *pctx, uint8_t **pu8v0, size_t *pu8vlen);
+int mr_pack_packet_into(mr_packet_ctx *pctx, uint8_t *u8v0, const size_t u8vcap, size_t *pu8vlen);
+int mr_pack_packet_iov(mr_packet_ctx *pctx, struct iovec *iov, int *piovcnt);
 int mr_free_packet_context(mr_packet_ctx *pctx);
 
+static int mr_alloc_field(mr_packet_ctx *pctx, void **ppv, size_t size);
+static int mr_realloc_field(mr_packet_ctx *pctx, void **ppv, size_t old_size, size_t size);
+static int mr_free_field(mr_packet_ctx *pctx, void *pv);
+
 static int mr_get_scalar(mr_packet_ctx *pctx, const int idx, uintptr_t *pvalue, bool *pexists);
 int mr_set_scalar(mr_packet_ctx *pctx, const int idx, const uintptr_t value);
 int mr_reset_scalar(mr_packet_ctx *pctx, const int idx);
@@ -156,12 +394,15 @@ static int mr_unpack_bits(mr_packet_ctx *pctx, mr_mdata *mdata);
 
 static int mr_get_vector(mr_packet_ctx *pctx, const int idx, uintptr_t *ppvoid, size_t *plen, bool *pexists);
 int mr_set_vector(mr_packet_ctx *pctx, const int idx, const void *pvoid, const size_t len);
+int mr_set_vector_copy(mr_packet_ctx *pctx, const int idx, const void *pvoid, const size_t len);
 int mr_reset_vector(mr_packet_ctx *pctx, const int idx);
 static int mr_free_vector(mr_packet_ctx *pctx, mr_mdata *mdata);
 
 int mr_get_u8v(mr_packet_ctx *pctx, const int idx, uint8_t **pu8v0, size_t *plen, bool *pexists);
+int mr_get_str_view(mr_packet_ctx *pctx, const int idx, const char **pcv0, size_t *plen, bool *pexists);
 static int mr_count_u8v(mr_packet_ctx *pctx, mr_mdata *mdata);
 static int mr_pack_u8v(mr_packet_ctx *pctx, mr_mdata *mdata);
+static int mr_unpack_check_nul(mr_packet_ctx *pctx, mr_mdata *mdata, const uint8_t *u8v, const size_t len);
 static int mr_unpack_u8v(mr_packet_ctx *pctx, mr_mdata *mdata);
 int mr_validate_u8v_utf8(mr_packet_ctx *pctx, const int idx);
 
@@ -195,6 +436,11 @@ static int mr_validate_tfv(mr_packet_ctx *pctx, mr_mdata *mdata);
 static int mr_free_tfv(mr_packet_ctx *pctx, mr_mdata *mdata);
 
 static int mr_unpack_properties(mr_packet_ctx *pctx, mr_mdata *mdata);
+static int mr_skip_field(mr_packet_ctx *pctx, mr_mdata *mdata, const size_t end_pos);
+static int mr_check_utf8(mr_packet_ctx *pctx, mr_mdata *mdata, const uint8_t *u8v, const size_t len);
+static int mr_check_field(mr_packet_ctx *pctx, mr_mdata *mdata);
+static int mr_unpack_lazy_property(mr_packet_ctx *pctx, mr_mdata *mdata);
+static int mr_unpack_lazy_properties(mr_packet_ctx *pctx);
 
 static int mr_printable_scalar(mr_packet_ctx *pctx, mr_mdata *mdata);
 static int mr_printable_hexvalue(mr_packet_ctx *pctx, mr_mdata *mdata);
@@ -216,8 +462,9 @@ static int mr_validate_connect_request_response_information(const uint8_t u8);
 static int mr_validate_connect_request_problem_information(const uint8_t u8);
 
 static int mr_validate_connect_cross(mr_packet_ctx *pctx);
-static int mr_validate_connect_pack(mr_packet_ctx *pctx);
+int mr_validate_connect_pack(mr_packet_ctx *pctx);
 int mr_validate_connect_unpack(mr_packet_ctx *pctx);
+int mr_validate_connect_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code);
 
 // CONNACK
 
@@ -232,23 +479,29 @@ static int mr_validate_connack_wildcard_subscription_available(const uint8_t u8)
 static int mr_validate_connack_subscription_identifiers_available(const uint8_t u8);
 static int mr_validate_connack_shared_subscription_available(const uint8_t u8);
 
-static int mr_validate_connack_pack(mr_packet_ctx *pctx);
+int mr_validate_connack_pack(mr_packet_ctx *pctx);
 int mr_validate_connack_unpack(mr_packet_ctx *pctx);
+int mr_validate_connack_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code);
 
 // PUBLISH
 
 static int mr_check_publish_packet(mr_packet_ctx *pctx);
 
 static int mr_validate_publish_qos(const uint8_t u8);
-static int mr_validate_publish_topic_name(const char *cv0);
+static int mr_validate_publish_topic_name(const char *cv0, const size_t len);
 static int mr_validate_publish_packet_identifier(const uint16_t u16);
 static int mr_validate_publish_payload_format_indicator(const uint8_t u8);
 static int mr_validate_publish_topic_alias(const uint16_t u16);
-static int mr_validate_publish_response_topic(const char *cv0);
+static int mr_validate_publish_response_topic(const char *cv0, const size_t len);
 
 static int mr_validate_publish_cross(mr_packet_ctx *pctx);
-static int mr_validate_publish_pack(mr_packet_ctx *pctx);
+int mr_validate_publish_pack(mr_packet_ctx *pctx);
 int mr_validate_publish_unpack(mr_packet_ctx *pctx);
+int mr_validate_publish_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code);
+
+static size_t mr_fanout_value_len(const int dtype, const uint8_t *u8v);
+static int mr_validate_publish_target(const mr_publish_target *ptarget);
+int mr_find_publish_property(const uint8_t *u8v0, const size_t u8vlen, const uint8_t propid, size_t *pvalue_pos);
 
 // PUBACK
 
@@ -257,8 +510,9 @@ static int mr_check_puback_packet(mr_packet_ctx *pctx);
 static int mr_validate_puback_puback_reason_code(const uint8_t u8);
 
 static int mr_validate_puback_cross(mr_packet_ctx *pctx);
-static int mr_validate_puback_pack(mr_packet_ctx *pctx);
+int mr_validate_puback_pack(mr_packet_ctx *pctx);
 int mr_validate_puback_unpack(mr_packet_ctx *pctx);
+int mr_validate_puback_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code);
 
 // SUBSCRIBE
 
@@ -267,8 +521,9 @@ static int mr_check_subscribe_packet(mr_packet_ctx *pctx);
 static int mr_validate_subscribe_subscription_identifier(const uint32_t u32);
 
 static int mr_validate_subscribe_cross(mr_packet_ctx *pctx);
-static int mr_validate_subscribe_pack(mr_packet_ctx *pctx);
+int mr_validate_subscribe_pack(mr_packet_ctx *pctx);
 int mr_validate_subscribe_unpack(mr_packet_ctx *pctx);
+int mr_validate_subscribe_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code);
 
 // SUBACK
 
@@ -277,23 +532,176 @@ static int mr_check_suback_packet(mr_packet_ctx *pctx);
 static int mr_validate_suback_subscribe_reason_codes(const uint8_t *u8v0, const size_t len);
 
 // static int mr_validate_suback_cross(mr_packet_ctx *pctx);
-static int mr_validate_suback_pack(mr_packet_ctx *pctx);
+int mr_validate_suback_pack(mr_packet_ctx *pctx);
 int mr_validate_suback_unpack(mr_packet_ctx *pctx);
+int mr_validate_suback_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code);
+
+// subscription index
+
+static uint32_t mr_subscriber_hash(const void *subscriber);
+static uint32_t mr_slot_hash(const mr_slot_table *pst, const void *pv);
+static atomic_uint_fast64_t *mr_read_enter(mr_subscription_index *psi);
+static void mr_read_exit(atomic_uint_fast64_t *pactive);
+static void mr_synchronize(mr_subscription_index *psi);
+static void mr_retire(mr_subscription_index *psi, void *pv);
+static int mr_grow_slot_table(mr_subscription_index *psi, mr_slot_table *pst);
+static int mr_slot_insert(mr_subscription_index *psi, mr_slot_table *pst, void *pv);
+static void mr_slot_remove(mr_subscription_index *psi, mr_slot_table *pst, const size_t i);
+static mr_topic_node *mr_find_child(
+    const mr_topic_node *node, const char *level, const size_t len, const uint32_t hash, size_t *pi
+);
+static mr_subscription *mr_find_subscription(const mr_topic_node *node, const void *subscriber, size_t *pi);
+static int mr_init_topic_node(
+    mr_subscription_index *psi, mr_topic_node **pnode, mr_topic_node *parent, const char *level, const size_t len
+);
+static void mr_free_topic_node(mr_subscription_index *psi, mr_topic_node *node);
+static void mr_prune_topic_nodes(mr_subscription_index *psi, mr_topic_node *node);
+static mr_topic_node *mr_make_filter_node(mr_subscription_index *psi, const char *topic_filter, const size_t len);
+static int mr_add_subscription_locked(
+    mr_subscription_index *psi,
+    const char *topic_filter,
+    const size_t len,
+    const mr_subscription *psub,
+    bool *preplaced
+);
+static void mr_remove_subscription_locked(
+    mr_subscription_index *psi, const char *topic_filter, const size_t len, const void *subscriber, bool *premoved
+);
+static int mr_topic_filter_invalid(const size_t offset, const uint8_t reason_code, const char *reason);
+int mr_check_topic_filter(const char *cv, const size_t len);
+static int mr_match_subscriptions_of(const mr_match_ctx *pmc, const mr_topic_node *node);
+static int mr_match_topic_node(const mr_match_ctx *pmc, const mr_topic_node *node, const char *level);
+
+// retained store
+
+static int mr_retained_invalid(const int field_idx, const uint8_t reason_code, const char *reason);
+static mr_retained_node *mr_find_retained_child(
+    const mr_retained_node *node, const char *level, const size_t len, const uint32_t hash, size_t *pi
+);
+static void mr_put_retained_child(mr_retained_node **children, const size_t cap, mr_retained_node *child);
+static int mr_insert_retained_child(mr_retained_node *node, mr_retained_node *child);
+static void mr_remove_retained_child(mr_retained_node *node, size_t i);
+static int mr_init_retained_node(
+    mr_retained_store *prs, mr_retained_node **pnode, mr_retained_node *parent, const char *level, const size_t len
+);
+static void mr_prune_retained_nodes(mr_retained_store *prs, mr_retained_node *node);
+static void mr_place_retained_entry(mr_retained_store *prs, mr_retained_entry *pre, const size_t i);
+static void mr_sift_retained_entry(mr_retained_store *prs, size_t i);
+static int mr_reserve_retained_heap(mr_retained_store *prs);
+static void mr_remove_retained_entry(mr_retained_store *prs, mr_retained_entry *pre);
+static mr_retained_node *mr_make_retained_node(mr_retained_store *prs, const char *topic_name, const size_t len);
+static mr_retained_node *mr_find_retained_node(mr_retained_store *prs, const char *topic_name, const size_t len);
+static int mr_pack_retained_entry(mr_packet_ctx *pctx, mr_retained_entry **ppre);
+int mr_put_retained_entry(
+    mr_retained_store *prs, const char *topic_name, const size_t len, mr_retained_entry *pre, bool *premoved
+);
+void mr_drop_retained_topic(mr_retained_store *prs, const char *topic_name, const size_t len, bool *premoved);
+int mr_walk_retained_nodes(
+    const mr_retained_node *top, const bool skip_dollar, mr_retained_visit_fn visit, void *arg
+);
+static int mr_match_retained_entry(const mr_retained_match_ctx *pmc, const mr_retained_node *node);
+static int mr_match_retained_visit(const mr_retained_node *node, void *arg);
+static int mr_match_retained_node(
+    const mr_retained_match_ctx *pmc, const mr_retained_node *node, const char *level
+);
+
+// retained log
+
+static int mr_retained_io_error(const char *op, const uint64_t seq);
+static int mr_retained_corrupt(const char *reason, const uint64_t seq, const size_t offset);
+static int mr_retained_not_persistent(void);
+static void mr_segment_name(char *name, const uint64_t seq, const bool tmp);
+static bool mr_parse_segment_name(const char *name, uint64_t *pseq, bool *ptmp);
+static int mr_create_retained_segment(
+    mr_retained_log *plog, const uint64_t seq, const bool tmp, int *pfd
+);
+static int mr_start_retained_segment(mr_retained_log *plog, const uint64_t seq);
+static int mr_seal_retained_segment(const int fd, const uint64_t seq, const uint32_t flags, const size_t size);
+static int mr_write_retained_record(const int fd, const uint64_t seq, const mr_retained_entry *pre, size_t *psize);
+int mr_append_retained_record(mr_retained_store *prs, const mr_retained_entry *pre);
+static int mr_check_retained_record(
+    const uint8_t *u8v0, const size_t pos, const size_t end, const bool verify, mr_retained_record *prec,
+    mr_publish_peek *ppeek
+);
+static int mr_replay_retained_record(
+    mr_retained_store *prs, uint8_t *frame, const mr_retained_record *prec, const mr_publish_peek *ppeek,
+    const uint64_t now
+);
+static int mr_add_retained_mapping(mr_retained_log *plog, uint8_t *u8v0, const size_t u8vlen);
+static int mr_load_retained_segment(mr_retained_store *prs, const uint64_t seq, const bool last, const uint64_t now);
+static int mr_list_retained_segments(mr_retained_log *plog, uint64_t **pseqs, size_t *pseq_count);
+static uint32_t mr_retained_segment_flags(mr_retained_log *plog, const uint64_t seq);
+void mr_close_retained_log(mr_retained_store *prs);
+static int mr_compact_retained_visit(const mr_retained_node *node, void *arg);
+static int mr_repoint_retained_visit(const mr_retained_node *node, void *arg);
+static int mr_map_retained_segments(
+    mr_retained_log *plog, const uint64_t first_seq, const uint64_t last_seq, mr_retained_mapping **pmappings
+);
+static void mr_unlink_retained_segments(
+    mr_retained_log *plog, const uint64_t first_seq, const uint64_t last_seq, const bool tmp
+);
+
+// topic aliases
+
+static int mr_copy_topic_name(char **pcv, const char *topic_name, const size_t len);
+static int mr_init_topic_alias_sketch(mr_topic_aliases *pta);
+static int mr_set_inbound_alias(mr_topic_aliases *pta, const uint16_t alias, const char *topic_name, const size_t len);
+static uint16_t *mr_find_outbound_slot(
+    mr_topic_aliases *pta, const char *topic_name, const size_t len, const uint32_t hash
+);
+static void mr_put_outbound_slot(mr_topic_aliases *pta, const uint16_t alias);
+static void mr_remove_outbound_slot(mr_topic_aliases *pta, uint16_t *pslot);
+static int mr_add_outbound_alias(
+    mr_topic_aliases *pta, const char *topic_name, const size_t len, const uint32_t hash, uint16_t *palias
+);
+static uint8_t mr_count_topic_send(mr_topic_aliases *pta, const uint32_t hash);
+static mr_outbound_alias *mr_sweep_outbound_aliases(mr_topic_aliases *pta);
+
+// frame decoder
+
+int mr_get_frame_length(const uint8_t *u8v0, const size_t u8vlen, size_t *plength);
+static int mr_frame_malformed(mr_frame_decoder *pfd, const int code, const uint8_t reason_code, const char *reason);
+static void mr_frame_complete(
+    mr_frame_decoder *pfd, mr_frame *frames, const size_t frames_len, size_t *pframe_count, bool *pfull
+);
+static int mr_frame_header_complete(
+    mr_frame_decoder *pfd, mr_frame *frames, const size_t frames_len, size_t *pframe_count, bool *pfull
+);
+
+// errors
+
+int mr_set_error(
+    const int code, const uint8_t reason_code, const uint8_t packet_type, const int field_idx, const size_t offset
+);
+bool mr_error_log_allowed(void);
+
+// error log lines through the per-thread rate limit; the arguments are only evaluated when logged
+#define mr_log_error(...) do { if (mr_error_log_allowed()) dzlog_error(__VA_ARGS__); } while (0)
 
 // memory
 
 int mr_calloc(void **ppv, size_t count, size_t sz);
+int mr_aligned_calloc(void **ppv, size_t alignment, size_t sz);
 int mr_malloc(void **ppv, size_t sz);
 int mr_realloc(void **ppv, size_t sz);
 int mr_free(void *pv);
 
+int mr_init_arena(mr_arena **pparena, size_t size);
+int mr_arena_alloc(mr_arena **pparena, void **ppv, size_t size);
+int mr_arena_realloc(mr_arena **pparena, void **ppv, size_t old_size, size_t size);
+int mr_reset_arena(mr_arena *parena);
+int mr_free_arena(mr_arena *parena);
+
 // util
 
 int mr_utf8_validation(const uint8_t *u8v, size_t len);
-int mr_wildcard_found(const char *cv);
+int mr_utf8_payload_validation(const uint8_t *u8v, size_t len);
+int mr_wildcard_found(const char *cv, const size_t cvlen);
+uint32_t mr_level_hash(const char *cv, const size_t len);
+uint32_t mr_crc32c(uint32_t crc, const uint8_t *u8v, const size_t len);
 int mr_bytecount_VBI(uint32_t u32);
 int mr_make_VBI(uint32_t u32, uint8_t *u8v0);
-int mr_extract_VBI(uint32_t *pu32, uint8_t *u8v);
+int mr_extract_VBI(uint32_t *pu32, const uint8_t *u8v, const size_t avail);
 
 #ifdef __cplusplus
 }
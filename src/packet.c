@@ -38,11 +38,24 @@ typedef struct mr_dtype {
 } mr_dtype;
 
 typedef int (*mr_ptype_fn)(struct mr_packet_ctx *pctx);
+typedef int (*mr_init_unpack_fn)(
+    struct mr_packet_ctx **ppctx,
+    const uint8_t *u8v0,
+    const size_t u8vlen,
+    const int unpack_flags,
+    const uint64_t field_mask
+);
+
+typedef int (*mr_validate_bytes_fn)(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code);
 
 typedef struct mr_ptype {
     const int mqtt_packet_type;
     const char *mqtt_packet_name;
     const mr_ptype_fn ptype_fn;
+    const mr_init_unpack_fn init_unpack_fn;
+    const mr_ptype_fn validate_pack_fn;
+    const mr_validate_bytes_fn validate_bytes_fn;
+    const int remaining_length_idx;
 } mr_ptype;
 
 /**
@@ -50,26 +63,30 @@ typedef struct mr_ptype {
  *
  * This vector has the same order as mqtt_packet_type.
  *
- * The ptype_fn is invoked at the end of unpacking the packet
+ * The ptype_fn is invoked at the end of unpacking the packet; the init_unpack_fn is the
+ * packet-specific entry point used by mr_init_unpack_any_packet; the validate_pack_fn is invoked
+ * before packing by the mr_pack_any_packet functions; the validate_bytes_fn is the packet-specific
+ * entry point used by mr_validate_packet_bytes. The remaining_length_idx names the template's
+ * remaining length, which unpack checks against the packet length.
  */
 static const mr_ptype PACKET_TYPE[] = {
-//   mqtt_packet_type   mqtt_packet_name    ptype_fn
-    {MQTT_RESERVED,     "RESERVED",         NULL},
-    {MQTT_CONNECT,      "CONNECT",          mr_validate_connect_unpack},
-    {MQTT_CONNACK,      "CONNACK",          mr_validate_connack_unpack},
-    {MQTT_PUBLISH,      "PUBLISH",          mr_validate_publish_unpack},
-    {MQTT_PUBACK,       "PUBACK",           NULL},
-    {MQTT_PUBREC,       "PUBREC",           NULL},
-    {MQTT_PUBREL,       "PUBREL",           NULL},
-    {MQTT_PUBCOMP,      "PUBCOMP",          NULL},
-    {MQTT_SUBSCRIBE,    "SUBSCRIBE",        NULL},
-    {MQTT_SUBACK,       "SUBACK",           NULL},
-    {MQTT_UNSUBSCRIBE,  "UNSUBSCRIBE",      NULL},
-    {MQTT_UNSUBACK,     "UNSUBACK",         NULL},
-    {MQTT_PINGREQ,      "PINGREQ",          NULL},
-    {MQTT_PINGRESP,     "PINGRESP",         NULL},
-    {MQTT_DISCONNECT,   "DISCONNECT",       NULL},
-    {MQTT_AUTH,         "AUTH",             NULL}
+//   mqtt_packet_type   mqtt_packet_name    ptype_fn                        init_unpack_fn                          validate_pack_fn                validate_bytes_fn                      remaining_length_idx
+    {MQTT_RESERVED,     "RESERVED",         NULL,                           NULL,                                   NULL,                           NULL,                                  0},
+    {MQTT_CONNECT,      "CONNECT",          mr_validate_connect_unpack,     mr_init_unpack_connect_packet_fields,   mr_validate_connect_pack,       mr_validate_connect_packet_bytes,      CONNECT_REMAINING_LENGTH},
+    {MQTT_CONNACK,      "CONNACK",          mr_validate_connack_unpack,     mr_init_unpack_connack_packet_fields,   mr_validate_connack_pack,       mr_validate_connack_packet_bytes,      CONNACK_REMAINING_LENGTH},
+    {MQTT_PUBLISH,      "PUBLISH",          mr_validate_publish_unpack,     mr_init_unpack_publish_packet_fields,   mr_validate_publish_pack,       mr_validate_publish_packet_bytes,      PUBLISH_REMAINING_LENGTH},
+    {MQTT_PUBACK,       "PUBACK",           mr_validate_puback_unpack,      mr_init_unpack_puback_packet_fields,    mr_validate_puback_pack,        mr_validate_puback_packet_bytes,       PUBACK_REMAINING_LENGTH},
+    {MQTT_PUBREC,       "PUBREC",           NULL,                           NULL,                                   NULL,                           NULL,                                  0},
+    {MQTT_PUBREL,       "PUBREL",           NULL,                           NULL,                                   NULL,                           NULL,                                  0},
+    {MQTT_PUBCOMP,      "PUBCOMP",          NULL,                           NULL,                                   NULL,                           NULL,                                  0},
+    {MQTT_SUBSCRIBE,    "SUBSCRIBE",        mr_validate_subscribe_unpack,   mr_init_unpack_subscribe_packet_fields, mr_validate_subscribe_pack,     mr_validate_subscribe_packet_bytes,    SUBSCRIBE_REMAINING_LENGTH},
+    {MQTT_SUBACK,       "SUBACK",           mr_validate_suback_unpack,      mr_init_unpack_suback_packet_fields,    mr_validate_suback_pack,        mr_validate_suback_packet_bytes,       SUBACK_REMAINING_LENGTH},
+    {MQTT_UNSUBSCRIBE,  "UNSUBSCRIBE",      NULL,                           NULL,                                   NULL,                           NULL,                                  0},
+    {MQTT_UNSUBACK,     "UNSUBACK",         NULL,                           NULL,                                   NULL,                           NULL,                                  0},
+    {MQTT_PINGREQ,      "PINGREQ",          NULL,                           NULL,                                   NULL,                           NULL,                                  0},
+    {MQTT_PINGRESP,     "PINGRESP",         NULL,                           NULL,                                   NULL,                           NULL,                                  0},
+    {MQTT_DISCONNECT,   "DISCONNECT",       NULL,                           NULL,                                   NULL,                           NULL,                                  0},
+    {MQTT_AUTH,         "AUTH",             NULL,                           NULL,                                   NULL,                           NULL,                                  0}
 };
 
 static const mr_dtype DATA_TYPE[] = { // same order as mr_data_types enum
@@ -89,20 +106,178 @@ static const mr_dtype DATA_TYPE[] = { // same order as mr_data_types enum
     {MR_PROPERTIES_DTYPE,   "properties",               NULL,               NULL,               mr_unpack_properties,   NULL,                  NULL,               NULL}
 };
 
+/**
+ * @brief Per-thread pool of released packet contexts, kept per packet type.
+ *
+ * A pooled context keeps its mdata vector, so reuse is a memcpy of the template rather than
+ * an allocation. The pool is off until mr_set_packet_pool_depth sets a depth.
+ */
+typedef struct mr_packet_pool {
+    size_t depth;                           ///< maximum contexts kept per packet type
+    mr_packet_ctx *free[MQTT_AUTH + 1];     ///< free lists linked by next_free
+    size_t count[MQTT_AUTH + 1];
+    uint64_t hits;
+    uint64_t misses;
+} mr_packet_pool;
+
+static _Thread_local mr_packet_pool packet_pool;
+
 int mr_init_packet(mr_packet_ctx **ppctx, const mr_mdata *MDATA_TEMPLATE, size_t mdata_count) {
-    mr_packet_ctx *pctx;
-    if (mr_calloc((void **)&pctx, 1, sizeof(mr_packet_ctx))) return -1;
-    pctx->mdata_count = mdata_count;
+    const uint8_t mqtt_packet_type = MDATA_TEMPLATE->value; // always the value of the 0th mdata row
+    mr_packet_ctx *pctx = packet_pool.free[mqtt_packet_type];
     mr_mdata *mdata0;
-    if (mr_malloc((void **)&mdata0, mdata_count * sizeof(mr_mdata))) return -1;
+
+    if (pctx) { // reset a pooled context in place
+        packet_pool.free[mqtt_packet_type] = pctx->next_free;
+        packet_pool.count[mqtt_packet_type]--;
+        packet_pool.hits++;
+        mdata0 = pctx->mdata0;
+        mr_arena *arena = pctx->arena;
+        memset(pctx, 0, sizeof(mr_packet_ctx));
+        pctx->arena = arena;
+    }
+    else {
+        if (packet_pool.depth) packet_pool.misses++;
+        // one allocation for the context & its mdata vector
+        if (mr_malloc((void **)&pctx, sizeof(mr_packet_ctx) + mdata_count * sizeof(mr_mdata))) return -1;
+        memset(pctx, 0, sizeof(mr_packet_ctx));
+        mdata0 = (mr_mdata *)(pctx + 1);
+    }
+
     memcpy(mdata0, MDATA_TEMPLATE, mdata_count * sizeof(mr_mdata));
+    pctx->mdata_count = mdata_count;
     pctx->mdata0 = mdata0;
-    pctx->mqtt_packet_type = mdata0->value; // always the value of the 0th mdata row
+    pctx->mdata_template = MDATA_TEMPLATE;
+    pctx->mqtt_packet_type = mqtt_packet_type;
     pctx->mqtt_packet_name = PACKET_TYPE[pctx->mqtt_packet_type].mqtt_packet_name;
     *ppctx = pctx;
     return 0;
 }
 
+/**
+ * @brief The contexts of a run of same-type packets in a batch unpack, allocated & set up together.
+ *
+ * The slab holds count contexts followed by their mdata vectors: the template is copied once &
+ * doubled across the vectors. A slab context is never pooled; the slab is freed with the last of
+ * its contexts.
+ */
+typedef struct mr_packet_slab {
+    size_t count;                           ///< contexts not yet freed
+    mr_packet_ctx pctxv[];
+} mr_packet_slab;
+
+static int mr_init_packet_slab(
+    mr_packet_ctx **pctxv, const mr_mdata *MDATA_TEMPLATE, const size_t mdata_count, const size_t count
+) {
+    const size_t ctx_size = sizeof(mr_packet_slab) + count * sizeof(mr_packet_ctx);
+    const size_t row_count = count * mdata_count;
+    mr_packet_slab *pslab;
+    if (mr_malloc((void **)&pslab, ctx_size + row_count * sizeof(mr_mdata))) return -1;
+    memset(pslab, 0, ctx_size);
+    pslab->count = count;
+    mr_mdata *mdata0 = (mr_mdata *)(pslab->pctxv + count);
+
+    memcpy(mdata0, MDATA_TEMPLATE, mdata_count * sizeof(mr_mdata));
+    for (size_t copied = mdata_count; copied < row_count; copied *= 2) {
+        const size_t rows = copied < row_count - copied ? copied : row_count - copied;
+        memcpy(mdata0 + copied, mdata0, rows * sizeof(mr_mdata));
+    }
+
+    const uint8_t mqtt_packet_type = MDATA_TEMPLATE->value;
+    for (size_t i = 0; i < count; i++) {
+        mr_packet_ctx *pctx = pslab->pctxv + i;
+        pctx->mqtt_packet_type = mqtt_packet_type;
+        pctx->mqtt_packet_name = PACKET_TYPE[mqtt_packet_type].mqtt_packet_name;
+        pctx->mdata0 = mdata0 + i * mdata_count;
+        pctx->mdata_count = mdata_count;
+        pctx->mdata_template = MDATA_TEMPLATE;
+        pctx->slab = pslab;
+        pctxv[i] = pctx;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Set how many released contexts per packet type this thread keeps for reuse.
+ *
+ * A depth of 0, the default, disables pooling and drains the pool.
+ */
+int mr_set_packet_pool_depth(const size_t depth) {
+    packet_pool.depth = depth;
+    if (!depth) return mr_drain_packet_pool();
+    return 0;
+}
+
+/**
+ * @brief Free this thread's pooled contexts, e.g. before the thread exits.
+ */
+int mr_drain_packet_pool(void) {
+    for (int i = 0; i <= MQTT_AUTH; i++) {
+        while (packet_pool.free[i]) {
+            mr_packet_ctx *pctx = packet_pool.free[i];
+            packet_pool.free[i] = pctx->next_free;
+            if (pctx->arena && mr_free_arena(pctx->arena)) return -1;
+            if (mr_free(pctx)) return -1;
+        }
+
+        packet_pool.count[i] = 0;
+    }
+
+    return 0;
+}
+
+int mr_get_packet_pool_stats(uint64_t *phits, uint64_t *pmisses) {
+    *phits = packet_pool.hits;
+    *pmisses = packet_pool.misses;
+    return 0;
+}
+
+/**
+ * @brief Set the bytes in the blocks of the arena of a packet unpacked with MR_UNPACK_ARENA, else 0.
+ */
+int mr_get_packet_arena_size(mr_packet_ctx *pctx, size_t *psize) {
+    size_t size = 0;
+    for (mr_arena *parena = pctx->arena; parena; parena = parena->next) size += parena->size;
+    *psize = size;
+    return 0;
+}
+
+/**
+ * Fail unless len more bytes remain before pctx->u8vend. Every unpack_fn checks before reading or
+ * allocating, so u8vpos never passes u8vend & a malformed length is rejected up front.
+ */
+static int mr_unpack_check(mr_packet_ctx *pctx, mr_mdata *mdata, const size_t len) {
+    if (len <= pctx->u8vend - pctx->u8vpos) return 0;
+
+    mr_log_error(
+        "field beyond the %s:: packet: %s; name: %s; u8vpos: %lu; len: %lu",
+        pctx->u8vend == pctx->u8vlen ? "packet" : "property block",
+        pctx->mqtt_packet_name, mdata->name, pctx->u8vpos, len
+    );
+
+    return mr_unpack_error(pctx, mdata, MR_ERR_TRUNCATED, MQTT_RC_MALFORMED_PACKET);
+}
+
+/**
+ * @brief Record an unpack error as this thread's error & its reason code in pctx, then return -1.
+ *
+ * The field is mdata's, or none if mdata is NULL; the offset is the unpack position. A check that
+ * fails after an inner one, knowing more, records over it.
+ */
+int mr_unpack_error(mr_packet_ctx *pctx, const mr_mdata *mdata, const int code, const uint8_t reason_code) {
+    pctx->reason_code = reason_code;
+    int field_idx = mdata ? mdata - pctx->mdata0 : -1;
+    return mr_set_error(code, reason_code, pctx->mqtt_packet_type, field_idx, pctx->u8vpos);
+}
+
+/**
+ * @brief Record a packet-level check's failure of field idx with its MQTT reason code, then return -1.
+ */
+int mr_reject(mr_packet_ctx *pctx, const int idx, const uint8_t reason_code) {
+    return mr_unpack_error(pctx, pctx->mdata0 + idx, MR_ERR_VALUE, reason_code);
+}
+
 static int mr_unpack_packet(mr_packet_ctx *pctx) {
     mr_mdata *mdata = pctx->mdata0;
     for (int i = 0; i < pctx->mdata_count; mdata++, i++) {
@@ -118,103 +293,516 @@ static int mr_unpack_packet(mr_packet_ctx *pctx) {
             //    puts("");
             //}
 
+            if (pctx->field_mask && DATA_TYPE[mdata->dtype].free_fn && !(pctx->field_mask & MR_FIELD(i))) {
+                mdata->vexists = false; // an unrequested vector reads as absent
+                if (mr_skip_field(pctx, mdata, pctx->u8vlen)) return -1;
+                continue;
+            }
+
+            if ((pctx->unpack_flags & MR_UNPACK_VALIDATE) && DATA_TYPE[mdata->dtype].free_fn) {
+                if (mr_check_field(pctx, mdata)) return -1;
+                continue;
+            }
+
             // printf("start::packet: %s; name: %s; pctx->u8vpos: %lu\n", pctx->mqtt_packet_name, mdata->name, pctx->u8vpos);
             mr_mdata_fn unpack_fn = DATA_TYPE[mdata->dtype].unpack_fn;
             if (unpack_fn && unpack_fn(pctx, mdata)) return -1;
             mr_mdata_fn validate_fn = DATA_TYPE[mdata->dtype].validate_fn;
             if (validate_fn && validate_fn(pctx, mdata)) return -1;
+
+            if ( // the remaining length frames the packet
+                i == PACKET_TYPE[pctx->mqtt_packet_type].remaining_length_idx &&
+                pctx->u8vpos + mdata->value != pctx->u8vlen
+            ) {
+                mr_log_error(
+                    "remaining length does not match the packet length:: packet: %s; remaining_length: %lu; u8vlen: %lu",
+                    pctx->mqtt_packet_name, mdata->value, pctx->u8vlen
+                );
+
+                return mr_unpack_error(pctx, mdata, MR_ERR_LENGTH, MQTT_RC_MALFORMED_PACKET);
+            }
+
             // printf("finish::packet: %s; name: %s; pctx->u8vpos: %lu\n", pctx->mqtt_packet_name, mdata->name, pctx->u8vpos);
         }
     }
 
     mr_ptype_fn ptype_fn = PACKET_TYPE[pctx->mqtt_packet_type].ptype_fn;
-    if (ptype_fn && ptype_fn(pctx)) return -1;
+
+    if (ptype_fn && ptype_fn(pctx)) {
+        if (!pctx->reason_code) mr_unpack_error(pctx, NULL, MR_ERR_VALUE, MQTT_RC_MALFORMED_PACKET);
+        return -1;
+    }
 
     if (pctx->u8vpos == pctx->u8vlen) {
         return 0;
     }
     else if (pctx->u8vpos < pctx->u8vlen) {
         // printf("*****************here\n");
-        dzlog_error(
+        mr_log_error(
             "unparsed bytes in the packet:: packet name: %s; u8vlen: %lu, u8vpos: %lu",
             pctx->mqtt_packet_name, pctx->u8vlen, pctx->u8vpos
         );
 
-        return -1;
+        return mr_unpack_error(pctx, NULL, MR_ERR_LENGTH, MQTT_RC_MALFORMED_PACKET);
     }
     else { // pctx->u8vpos > pctx->u8vlen
-        dzlog_error(
+        mr_log_error(
             "parsed beyond the packet:: packet name: %s; u8vlen: %lu, u8vpos: %lu",
             pctx->mqtt_packet_name, pctx->u8vlen, pctx->u8vpos
         );
 
-        return -1;
+        return mr_unpack_error(pctx, NULL, MR_ERR_LENGTH, MQTT_RC_MALFORMED_PACKET);
     }
 }
 
-int mr_init_unpack_packet(
-    mr_packet_ctx **ppctx,
-    const mr_mdata *MDATA_TEMPLATE,
-    const size_t mdata_count,
-    const uint8_t *u8v0,
-    const size_t u8vlen
+// unpack into a context fresh from mr_init_packet
+static int mr_unpack_packet_bytes(
+    mr_packet_ctx *pctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
 ) {
-    if (mr_init_packet(ppctx, MDATA_TEMPLATE, mdata_count)) return -1;
-    mr_packet_ctx *pctx = *ppctx;
     pctx->u8v0 = (uint8_t *)u8v0; // override const
     pctx->u8vlen = u8vlen;
+    pctx->u8vend = u8vlen;
     pctx->u8valloc = false;
+    pctx->unpack_flags = unpack_flags;
+    pctx->field_mask = field_mask;
+    if (unpack_flags & MR_UNPACK_LAZY) {
+        pctx->lazy_u8v0 = u8v0;
+        pctx->lazy_u8vlen = u8vlen;
+    }
+
     if (mr_unpack_packet(pctx)) return -1;
     pctx->u8v0 = NULL; // dereference - caller is responsible for freeing
     pctx->u8vlen = 0;
     return 0;
 }
 
-int mr_pack_packet(mr_packet_ctx *pctx, uint8_t **pu8v0, size_t *pu8vlen) {
-    if (pctx->u8valloc && mr_free(pctx->u8v0)) return -1;
+int mr_init_unpack_packet(
+    mr_packet_ctx **ppctx,
+    const mr_mdata *MDATA_TEMPLATE,
+    const size_t mdata_count,
+    const uint8_t *u8v0,
+    const size_t u8vlen,
+    const int unpack_flags,
+    const uint64_t field_mask
+) {
+    if (mr_init_packet(ppctx, MDATA_TEMPLATE, mdata_count)) return -1;
+    return mr_unpack_packet_bytes(*ppctx, u8v0, u8vlen, unpack_flags, field_mask);
+}
+
+static int mr_empty_packet(void) {
+    mr_log_error("empty packet");
+    return mr_set_error(MR_ERR_TRUNCATED, MQTT_RC_MALFORMED_PACKET, MQTT_RESERVED, -1, 0);
+}
+
+// no module for the packet type: the reserved type is malformed, the others not implemented here
+static int mr_unsupported_packet_type(const mr_ptype *ptype) {
+    mr_log_error("unsupported packet type:: packet name: %s", ptype->mqtt_packet_name);
+    uint8_t reason_code = ptype->mqtt_packet_type == MQTT_RESERVED ?
+        MQTT_RC_MALFORMED_PACKET : MQTT_RC_IMPLEMENTATION_SPECIFIC;
+    return mr_set_error(MR_ERR_PACKET_TYPE, reason_code, ptype->mqtt_packet_type, -1, 0);
+}
+
+/**
+ * @brief Unpack a binary packet of any supported type, selecting the packet module from its first byte.
+ */
+int mr_init_unpack_any_packet(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+) {
+    return mr_init_unpack_any_packet_fields(ppctx, u8v0, u8vlen, unpack_flags, 0);
+}
+
+/**
+ * @brief Unpack only the fields in field_mask, as MR_FIELD bits of the packet's *_MDATA_FIELDS.
+ *
+ * Fixed-size fields outside the property block are always decoded. Other unrequested fields are
+ * skipped by length, without allocation or validation, and read as absent; framing is still
+ * verified. A field_mask of 0 unpacks every field. A packet unpacked with a field mask cannot be
+ * packed.
+ */
+int mr_init_unpack_any_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+) {
+    if (!u8vlen) return mr_empty_packet();
+    const mr_ptype *ptype = PACKET_TYPE + (u8v0[0] >> 4);
+    if (!ptype->init_unpack_fn) return mr_unsupported_packet_type(ptype);
+
+    return ptype->init_unpack_fn(ppctx, u8v0, u8vlen, unpack_flags, field_mask);
+}
+
+// count the whole packets of type mqtt_packet_type at the start of u8v0, up to max
+static size_t mr_count_packet_run(
+    const uint8_t *u8v0, const size_t u8vlen, const uint8_t mqtt_packet_type, const size_t max
+) {
+    size_t pos = 0;
+    size_t run = 0;
+
+    while (run < max && u8vlen - pos >= 2 && u8v0[pos] >> 4 == mqtt_packet_type) {
+        uint32_t remaining_length;
+        int vbilen = mr_extract_VBI(&remaining_length, u8v0 + pos + 1, u8vlen - pos - 1);
+        if (vbilen <= 0 || 1 + vbilen + remaining_length > u8vlen - pos) break; // left to the frame check
+        pos += 1 + vbilen + remaining_length;
+        run++;
+    }
+
+    return run;
+}
+
+/**
+ * @brief Unpack consecutive packets from one buffer into the vector of packet contexts pctxv.
+ *
+ * Each packet is framed & unpacked as by mr_init_unpack_any_packet, but the per-type setup is done
+ * once per run of consecutive packets of the same type: the first packet of a run resolves the
+ * packet module & its mdata template, then the contexts for the rest of the run are allocated &
+ * initialized together from that template, see mr_packet_slab, & each is unpacked in turn. Each
+ * context is still freed on its own. Stop at the end of the buffer, at a partial
+ * trailing packet or when pctxv is full, setting the count of packets unpacked and of bytes
+ * consumed; the caller keeps any remainder for the next read. On a malformed or unsupported packet
+ * set its reason code, e.g. for a DISCONNECT, & return -1: the counts then cover the packets before
+ * it, which the caller still owns.
+ */
+int mr_init_unpack_packets(
+    mr_packet_ctx **pctxv,
+    const size_t pctxv_len,
+    const uint8_t *u8v0,
+    const size_t u8vlen,
+    const int unpack_flags,
+    size_t *ppacket_count,
+    size_t *pconsumed,
+    uint8_t *preason_code
+) {
+    size_t pos = 0;
+    size_t count = 0;
+    size_t run_left = 0; // contexts set up for the rest of the current run, from pctxv + count
+    int rc = 0;
+
+    while (count < pctxv_len && pos < u8vlen) {
+        size_t length;
+        mr_packet_ctx *pctx = NULL;
+        int failed = mr_get_frame_length(u8v0 + pos, u8vlen - pos, &length);
+
+        if (!failed && length && run_left) {
+            pctx = pctxv[count];
+            run_left--;
+            failed = mr_unpack_packet_bytes(pctx, u8v0 + pos, length, unpack_flags, 0);
+        }
+        else if (!failed && length) {
+            failed = mr_init_unpack_any_packet(&pctx, u8v0 + pos, length, unpack_flags);
+            const size_t next = pos + length;
+            size_t run = 0;
+
+            if (!failed) {
+                run = mr_count_packet_run(u8v0 + next, u8vlen - next, pctx->mqtt_packet_type, pctxv_len - count - 1);
+            }
+
+            if (run) { // the rest of the run
+                failed = mr_init_packet_slab(pctxv + count + 1, pctx->mdata_template, pctx->mdata_count, run);
+                if (!failed) run_left = run;
+            }
+        }
+
+        if (failed) {
+            mr_error err;
+            mr_get_error(&err);
+            *preason_code = pctx && pctx->reason_code ? pctx->reason_code : err.reason_code;
+            if (pctx) mr_free_packet_context(pctx);
+            for (size_t i = 1; i <= run_left; i++) mr_free_packet_context(pctxv[count + i]); // never unpacked
+            rc = -1;
+            break;
+        }
+
+        if (!length) break; // partial trailing packet
+        pctxv[count++] = pctx;
+        pos += length;
+    }
+
+    *ppacket_count = count;
+    *pconsumed = pos;
+    return rc;
+}
+
+/**
+ * @brief Validate a packet of any supported type without allocating, as unpacking it would.
+ *
+ * The packet is walked with its module's mdata template on the stack: framing, lengths, UTF-8,
+ * property ids & uniqueness, flag-dependent fields and the packet's own value & reason code checks
+ * all apply, but no value is copied. Set *preason_code to MQTT_RC_SUCCESS, or on failure to the
+ * reason code a receiver should report, MQTT_RC_MALFORMED_PACKET unless a check is more specific.
+ */
+int mr_validate_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code) {
+    const mr_ptype *ptype = PACKET_TYPE + (u8vlen ? u8v0[0] >> 4 : MQTT_RESERVED);
+    int rc;
+
+    if (!u8vlen) {
+        rc = mr_empty_packet();
+    }
+    else if (!ptype->validate_bytes_fn) {
+        rc = mr_unsupported_packet_type(ptype);
+    }
+    else {
+        return ptype->validate_bytes_fn(u8v0, u8vlen, preason_code);
+    }
+
+    mr_error err;
+    mr_get_error(&err);
+    *preason_code = err.reason_code;
+    return rc;
+}
+
+int mr_validate_packet(
+    const mr_mdata *MDATA_TEMPLATE,
+    const size_t mdata_count,
+    const uint8_t *u8v0,
+    const size_t u8vlen,
+    uint8_t *preason_code
+) {
+    if (mdata_count > MR_MDATA_MAX) {
+        mr_log_error("mdata vector too long to validate:: mdata_count: %lu", mdata_count);
+        *preason_code = MQTT_RC_IMPLEMENTATION_SPECIFIC;
+        return mr_set_error(MR_ERR_VALUE, *preason_code, MDATA_TEMPLATE->value, -1, 0);
+    }
+
+    mr_mdata mdata0[MR_MDATA_MAX];
+    memcpy(mdata0, MDATA_TEMPLATE, mdata_count * sizeof(mr_mdata));
+    mr_packet_ctx ctx = {0};
+    ctx.mqtt_packet_type = MDATA_TEMPLATE->value;
+    ctx.mqtt_packet_name = PACKET_TYPE[ctx.mqtt_packet_type].mqtt_packet_name;
+    ctx.mdata0 = mdata0;
+    ctx.mdata_count = mdata_count;
+    ctx.u8v0 = (uint8_t *)u8v0; // override const: only read
+    ctx.u8vlen = u8vlen;
+    ctx.u8vend = u8vlen;
+    ctx.unpack_flags = MR_UNPACK_VALIDATE;
+
+    if (mr_unpack_packet(&ctx)) {
+        *preason_code = ctx.reason_code;
+        return -1;
+    }
+
+    *preason_code = MQTT_RC_SUCCESS;
+    return 0;
+}
+
+int mr_get_any_packet_type(mr_packet_ctx *pctx, uint8_t *pu8) {
+    *pu8 = pctx->mqtt_packet_type;
+    return 0;
+}
+
+int mr_free_any_packet(mr_packet_ctx *pctx) {
+    return mr_free_packet_context(pctx);
+}
+
+static int mr_validate_any_packet_pack(mr_packet_ctx *pctx) {
+    mr_ptype_fn validate_pack_fn = PACKET_TYPE[pctx->mqtt_packet_type].validate_pack_fn;
+    return validate_pack_fn ? validate_pack_fn(pctx) : 0;
+}
+
+/**
+ * @brief Validate & count a packet of any type as packing would, setting its packed length.
+ *
+ * The count is kept so a following pack does not repeat it. Values changed other than through
+ * the setters, e.g. by writing into a vector in place, are not seen until a setter is called.
+ */
+int mr_get_packed_size(mr_packet_ctx *pctx, size_t *pu8vlen) {
+    if (mr_validate_any_packet_pack(pctx)) return -1;
+    if (mr_count_packet(pctx)) return -1;
+    *pu8vlen = pctx->u8vlen;
+    return 0;
+}
+
+int mr_pack_any_packet(mr_packet_ctx *pctx, uint8_t **pu8v0, size_t *pu8vlen) {
+    if (mr_validate_any_packet_pack(pctx)) return -1;
+    return mr_pack_packet(pctx, pu8v0, pu8vlen);
+}
+
+int mr_pack_any_packet_into(mr_packet_ctx *pctx, uint8_t *u8v0, const size_t u8vcap, size_t *pu8vlen) {
+    if (mr_validate_any_packet_pack(pctx)) return -1;
+    return mr_pack_packet_into(pctx, u8v0, u8vcap, pu8vlen);
+}
+
+int mr_pack_any_packet_iov(mr_packet_ctx *pctx, struct iovec *iov, int *piovcnt) {
+    if (mr_validate_any_packet_pack(pctx)) return -1;
+    return mr_pack_packet_iov(pctx, iov, piovcnt);
+}
+
+// count phase: set each mdata u8vlen & the packet u8vlen, going in reverse to calculate VBIs;
+// the result stands until a setter changes the packet
+static int mr_count_packet(mr_packet_ctx *pctx) {
+    if (pctx->field_mask) {
+        mr_log_error("packet unpacked with a field mask cannot be packed:: packet: %s", pctx->mqtt_packet_name);
+        return -1;
+    }
+
+    if (pctx->lazy_count && mr_unpack_lazy_properties(pctx)) return -1;
+    if (pctx->counted) return 0;
     const mr_mdata_fn vbi_count_fn = DATA_TYPE[MR_VBI_DTYPE].count_fn;
     mr_mdata *mdata = pctx->mdata0 + pctx->mdata_count - 1; // last one
+    pctx->u8vlen = 0;
 
-    for (int i = pctx->mdata_count - 1; i > -1; mdata--, i--) { // go in reverse to calculate VBIs
+    for (int i = pctx->mdata_count - 1; i > -1; mdata--, i--) {
         if (mdata->vexists && mdata->dtype != MR_BITS_DTYPE) {
             if (mdata->dtype == MR_VBI_DTYPE && vbi_count_fn(pctx, mdata)) return -1;
             pctx->u8vlen += mdata->u8vlen;
         }
     }
 
-    if (mr_malloc((void **)&pctx->u8v0, pctx->u8vlen)) return -1;
-    pctx->u8valloc = true;
+    pctx->counted = true;
+    return 0;
+}
+
+// emit phase: pack mdata rows [0, mdata_end) into pctx->u8v0 which must be large enough
+static int mr_emit_packet(mr_packet_ctx *pctx, const size_t mdata_end) {
     pctx->u8vpos = 0;
+    mr_mdata *mdata = pctx->mdata0;
 
-    mdata = pctx->mdata0;
-    for (int i = 0; i < pctx->mdata_count; mdata++, i++) {
+    for (int i = 0; i < mdata_end; mdata++, i++) {
         if (mdata->vexists) {
             mr_mdata_fn pack_fn = DATA_TYPE[mdata->dtype].pack_fn;
-            // printf("\npack:start::packet: %s; name: %s; pctx->u8vpos: %lu\n", pctx->mqtt_packet_name, mdata->name, pctx->u8vpos);
             if (pack_fn && pack_fn(pctx, mdata)) return -1; // each pack_fn increments pctx->u8vpos
-            // printf("pack:finish::packet: %s; name: %s; pctx->u8vpos: %lu\n", pctx->mqtt_packet_name, mdata->name, pctx->u8vpos);
         }
     }
 
+    return 0;
+}
+
+int mr_pack_packet(mr_packet_ctx *pctx, uint8_t **pu8v0, size_t *pu8vlen) {
+    if (pctx->u8valloc && mr_free(pctx->u8v0)) return -1;
+    pctx->u8v0 = NULL;
+    pctx->u8valloc = false;
+    if (mr_count_packet(pctx)) return -1;
+    if (mr_malloc((void **)&pctx->u8v0, pctx->u8vlen)) return -1;
+    pctx->u8valloc = true;
+    if (mr_emit_packet(pctx, pctx->mdata_count)) return -1;
     *pu8v0 = pctx->u8v0;
     *pu8vlen = pctx->u8vlen;
     return 0;
 }
 
+/**
+ * @brief Pack into the caller's buffer u8v0 of u8vcap bytes, setting the packed length.
+ *
+ * If the buffer is too small nothing is packed: set the required length in *pu8vlen, set
+ * mr_errno to ENOBUFS and return -1.
+ */
+int mr_pack_packet_into(mr_packet_ctx *pctx, uint8_t *u8v0, const size_t u8vcap, size_t *pu8vlen) {
+    if (mr_count_packet(pctx)) return -1;
+    *pu8vlen = pctx->u8vlen;
+
+    if (pctx->u8vlen > u8vcap) {
+        mr_errno = ENOBUFS;
+        return mr_set_error(MR_ERR_NOBUFS, MQTT_RC_SUCCESS, pctx->mqtt_packet_type, -1, u8vcap);
+    }
+
+    uint8_t *own_u8v0 = pctx->u8v0; // keep any packet buffer from mr_pack_packet
+    pctx->u8v0 = u8v0;
+    int rc = mr_emit_packet(pctx, pctx->mdata_count);
+    pctx->u8v0 = own_u8v0;
+    return rc;
+}
+
+/**
+ * @brief Pack for writev: everything up to the payload into a buffer owned by the packet context,
+ * the payload as a separate segment pointing at its value, uncopied.
+ *
+ * iov must have room for 2 segments; set the count used, 1 if there is no payload.
+ */
+int mr_pack_packet_iov(mr_packet_ctx *pctx, struct iovec *iov, int *piovcnt) {
+    if (pctx->u8valloc && mr_free(pctx->u8v0)) return -1;
+    pctx->u8v0 = NULL;
+    pctx->u8valloc = false;
+    if (mr_count_packet(pctx)) return -1;
+
+    mr_mdata *payload_mdata = pctx->mdata0 + pctx->mdata_count - 1; // the payload is always last
+    size_t payload_len = 0;
+    size_t mdata_end = pctx->mdata_count;
+    if (payload_mdata->dtype == MR_PAYLOAD_DTYPE && payload_mdata->vexists) {
+        payload_len = payload_mdata->vlen;
+        mdata_end--;
+    }
+
+    if (mr_malloc((void **)&pctx->u8v0, pctx->u8vlen - payload_len)) return -1;
+    pctx->u8valloc = true;
+    if (mr_emit_packet(pctx, mdata_end)) return -1;
+
+    iov[0].iov_base = pctx->u8v0;
+    iov[0].iov_len = pctx->u8vlen - payload_len;
+    *piovcnt = 1;
+
+    if (payload_len) {
+        iov[1].iov_base = (void *)payload_mdata->value;
+        iov[1].iov_len = payload_len;
+        *piovcnt = 2;
+    }
+
+    return 0;
+}
+
 int mr_free_packet_context(mr_packet_ctx *pctx) {
     mr_mdata *mdata = pctx->mdata0;
     for (int i = 0; i < pctx->mdata_count; i++, mdata++) {
-        if (DATA_TYPE[mdata->dtype].free_fn && mr_free(mdata->printable)) return -1;
+        if (mr_free(mdata->printable)) return -1;
+        mdata->printable = NULL;
         mr_mdata_fn free_fn = DATA_TYPE[mdata->dtype].free_fn;
         if (mdata->valloc && free_fn && free_fn(pctx, mdata)) return -1;
     }
 
-    if (pctx->u8valloc & mr_free(pctx->u8v0)) return -1;
+    if (pctx->u8valloc && mr_free(pctx->u8v0)) return -1;
     if (mr_free(pctx->printable)) return -1;
-    if (mr_free(pctx)) return -1;;
+
+    if (pctx->slab) { // freed with the last context of its slab
+        if (pctx->arena && mr_free_arena(pctx->arena)) return -1;
+        if (!--pctx->slab->count && mr_free(pctx->slab)) return -1;
+        return 0;
+    }
+
+    const uint8_t mqtt_packet_type = pctx->mqtt_packet_type;
+    if (packet_pool.count[mqtt_packet_type] < packet_pool.depth) { // release to the pool
+        if (pctx->arena && mr_reset_arena(pctx->arena)) return -1;
+        pctx->next_free = packet_pool.free[mqtt_packet_type];
+        packet_pool.free[mqtt_packet_type] = pctx;
+        packet_pool.count[mqtt_packet_type]++;
+        return 0;
+    }
+
+    if (pctx->arena && mr_free_arena(pctx->arena)) return -1;
+    if (mr_free(pctx)) return -1;
     return 0;
 }
 
+// field storage for unpacked values: from the packet's arena with MR_UNPACK_ARENA, else the heap
+static int mr_alloc_field(mr_packet_ctx *pctx, void **ppv, size_t size) {
+    if (!(pctx->unpack_flags & MR_UNPACK_ARENA)) return mr_malloc(ppv, size);
+    if (!pctx->arena && mr_init_arena(&pctx->arena, 2 * pctx->u8vlen)) return -1;
+    return mr_arena_alloc(&pctx->arena, ppv, size);
+}
+
+static int mr_realloc_field(mr_packet_ctx *pctx, void **ppv, size_t old_size, size_t size) {
+    if (!(pctx->unpack_flags & MR_UNPACK_ARENA)) return mr_realloc(ppv, size);
+    if (!pctx->arena && mr_init_arena(&pctx->arena, 2 * pctx->u8vlen)) return -1;
+    return mr_arena_realloc(&pctx->arena, ppv, old_size, size);
+}
+
+/**
+ * Make room for one more element at mdata->vlen of a vector unpacked an element at a time. The
+ * capacity doubles each time vlen reaches a power of 2, so an arena, where the vector seldom is the
+ * latest allocation & each growth copies it, holds O(n) bytes, not O(n^2).
+ */
+static int mr_grow_field_vector(mr_packet_ctx *pctx, mr_mdata *mdata, void **ppv, const size_t element_size) {
+    if (!mdata->valloc) {
+        mdata->vlen = 0; // incremented by the caller
+        return mr_alloc_field(pctx, ppv, element_size);
+    }
+
+    *ppv = (void *)mdata->value;
+    const size_t vlen = mdata->vlen;
+    if (vlen & (vlen - 1)) return 0; // not full
+    return mr_realloc_field(pctx, ppv, vlen * element_size, 2 * vlen * element_size);
+}
+
+static int mr_free_field(mr_packet_ctx *pctx, void *pv) {
+    if (pctx->unpack_flags & MR_UNPACK_ARENA) return 0; // released with the arena
+    return mr_free(pv);
+}
+
 static int mr_get_scalar(mr_packet_ctx *pctx, const int idx, uintptr_t *pvalue, bool *pexists) {
     mr_mdata *mdata = pctx->mdata0 + idx;
     *pvalue = mdata->value;
@@ -225,7 +813,10 @@ static int mr_get_scalar(mr_packet_ctx *pctx, const int idx, uintptr_t *pvalue,
 int mr_set_scalar(mr_packet_ctx *pctx, const int idx, const uintptr_t value) {
     mr_mdata *mdata = pctx->mdata0 + idx;
     if (mr_free(mdata->printable)) return -1;
+    mdata->printable = NULL;
     mr_mdata_fn validate_fn = DATA_TYPE[mdata->dtype].validate_fn;
+    bool derived = mdata->dtype == MR_VBI_DTYPE && mdata->link; // a length calculated when counting
+    if (!mdata->vexists || (mdata->value != value && !derived)) pctx->counted = false;
     mdata->value = value;
     mdata->vexists = true; // don't update vlen or u8vlen for scalars
     if (validate_fn && validate_fn(pctx, mdata)) return -1;
@@ -236,6 +827,8 @@ int mr_set_scalar(mr_packet_ctx *pctx, const int idx, const uintptr_t value) {
 int mr_reset_scalar(mr_packet_ctx *pctx, const int idx) {
     mr_mdata *mdata = pctx->mdata0 + idx;
     if (mr_free(mdata->printable)) return -1;
+    mdata->printable = NULL;
+    if (mdata->vexists) pctx->counted = false;
     mdata->value = 0;
     mdata->vexists = false;
     return 0;
@@ -263,6 +856,7 @@ static int mr_pack_u8(mr_packet_ctx *pctx, mr_mdata *mdata) {
 }
 
 static int mr_unpack_u8(mr_packet_ctx *pctx, mr_mdata *mdata) {
+    if (mr_unpack_check(pctx, mdata, 1)) return -1;
     mdata->vexists = true;
     mdata->value = pctx->u8v0[pctx->u8vpos++];
     return 0;
@@ -285,6 +879,7 @@ static int mr_pack_u16(mr_packet_ctx *pctx, mr_mdata *mdata) {
 }
 
 static int mr_unpack_u16(mr_packet_ctx *pctx, mr_mdata *mdata) {
+    if (mr_unpack_check(pctx, mdata, 2)) return -1;
     mdata->vexists = true;
     uint8_t *u8v = pctx->u8v0 + pctx->u8vpos;
     mdata->value = (u8v[0] << 8) + u8v[1];
@@ -311,8 +906,9 @@ static int mr_pack_u32(mr_packet_ctx *pctx, mr_mdata *mdata) {
 }
 
 static int mr_unpack_u32(mr_packet_ctx *pctx, mr_mdata *mdata) {
+    if (mr_unpack_check(pctx, mdata, 4)) return -1;
     uint8_t *u8v = pctx->u8v0 + pctx->u8vpos;
-    mdata->value = (u8v[0] << 24) + (u8v[1] << 16) + (u8v[2] << 8) + u8v[3];
+    mdata->value = ((uint32_t)u8v[0] << 24) + (u8v[1] << 16) + (u8v[2] << 8) + u8v[3];
     mdata->vexists = true;
     pctx->u8vpos += 4;
     return 0;
@@ -347,10 +943,8 @@ static int mr_pack_VBI(mr_packet_ctx *pctx, mr_mdata *mdata) {
     // printf("mr_pack_VBI:: name: %s; u8vpos: %lu; propid: %u\n", mdata->name, pctx->u8vpos, propid);
     if (propid) pctx->u8v0[pctx->u8vpos++] = propid;
     uint32_t u32 = mdata->value;
-    uint8_t u8v[4];
-    int rc = mr_make_VBI(u32, u8v);
+    int rc = mr_make_VBI(u32, pctx->u8v0 + pctx->u8vpos);
     if (rc < 0) return rc;
-    memcpy(pctx->u8v0 + pctx->u8vpos, u8v, rc);
     // printf("mr_pack_VBI:: name: %s; value: %u; u8vpos: %lu; rc: %u\n", mdata->name, u32, pctx->u8vpos, rc);
     pctx->u8vpos += rc; // already incremented for propid
     return 0;
@@ -358,8 +952,13 @@ static int mr_pack_VBI(mr_packet_ctx *pctx, mr_mdata *mdata) {
 
 static int mr_unpack_VBI(mr_packet_ctx *pctx, mr_mdata *mdata) {
     uint32_t u32;
-    int rc = mr_extract_VBI(&u32, pctx->u8v0 + pctx->u8vpos);
-    if (rc < 0) return rc;
+    int rc = mr_extract_VBI(&u32, pctx->u8v0 + pctx->u8vpos, pctx->u8vend - pctx->u8vpos);
+
+    if (rc <= 0) {
+        mr_log_error("malformed VBI: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        return mr_unpack_error(pctx, mdata, MR_ERR_VBI, MQTT_RC_MALFORMED_PACKET);
+    }
+
     mdata->value = u32;
     mdata->vlen = rc;
     mdata->u8vlen = rc;
@@ -400,6 +999,7 @@ static int mr_pack_incr1(mr_packet_ctx *pctx, mr_mdata *mdata) { // now advance
 
 static int mr_unpack_bits(mr_packet_ctx *pctx, mr_mdata *mdata) {   // don't advance pctx->u8vpos; unpacking
     uint8_t bitpos = mdata->u8vlen;                                 // the following flags byte will do that
+    if (mr_unpack_check(pctx, mdata, 1)) return -1;
     uint8_t *pu8 = pctx->u8v0 + pctx->u8vpos;
     mdata->value = *pu8 >> bitpos & BIT_MASKS[mdata->vlen];
     mdata->vexists = true;
@@ -408,6 +1008,7 @@ static int mr_unpack_bits(mr_packet_ctx *pctx, mr_mdata *mdata) {   // don't adv
 
 static int mr_get_vector(mr_packet_ctx *pctx, const int idx, uintptr_t *ppvoid, size_t *plen, bool *pexists) {
     mr_mdata *mdata = pctx->mdata0 + idx;
+    if (mdata->lazy_pos && mr_unpack_lazy_property(pctx, mdata)) return -1;
     *ppvoid = mdata->value; // for a vector, value is a pointer to something or NULL
     *plen = mdata->vlen;
     *pexists = mdata->vexists;
@@ -427,15 +1028,42 @@ int mr_set_vector(mr_packet_ctx *pctx, const int idx, const void *pvoid, const s
     return 0;
 }
 
+// set a byte vector to a copy the packet owns, as an unpack does, for a value that may not outlive it
+int mr_set_vector_copy(mr_packet_ctx *pctx, const int idx, const void *pvoid, const size_t len) {
+    void *pv;
+    if (mr_alloc_field(pctx, &pv, len)) return -1;
+    memcpy(pv, pvoid, len);
+
+    int rc = mr_set_vector(pctx, idx, pv, len);
+    mr_mdata *mdata = pctx->mdata0 + idx;
+
+    if (mdata->value == (uintptr_t)pv) {
+        mdata->valloc = true; // freed with pctx, even if invalid
+    }
+    else {
+        mr_free_field(pctx, pv);
+    }
+
+    return rc;
+}
+
 int mr_reset_vector(mr_packet_ctx *pctx, const int idx) {
     mr_mdata *mdata = pctx->mdata0 + idx;
+
+    if (mdata->lazy_pos) { // the undecoded value is replaced
+        mdata->lazy_pos = 0;
+        pctx->lazy_count--;
+    }
+
     if (mr_free(mdata->printable)) return -1;
+    mdata->printable = NULL;
+    pctx->counted = false; // vector contents may change even when the pointer & length do not
     mr_mdata_fn free_fn = DATA_TYPE[mdata->dtype].free_fn;
     return free_fn(pctx, mdata);
 }
 
 static int mr_free_vector(mr_packet_ctx *pctx, mr_mdata *mdata) {
-    if (mdata->valloc && mr_free((void *)mdata->value)) return -1;
+    if (mdata->valloc && mr_free_field(pctx, (void *)mdata->value)) return -1;
     mdata->value = (uintptr_t)NULL;
     mdata->valloc = false;
     mdata->vexists = false;
@@ -446,11 +1074,35 @@ static int mr_free_vector(mr_packet_ctx *pctx, mr_mdata *mdata) {
 
 int mr_get_u8v(mr_packet_ctx *pctx, const int idx, uint8_t **pu8v0, size_t *plen, bool *pexists) {
     uintptr_t pvoid;
-    mr_get_vector(pctx, idx, &pvoid, plen, pexists);
+    if (mr_get_vector(pctx, idx, &pvoid, plen, pexists)) return -1;
     *pu8v0 = (uint8_t *)pvoid;
     return 0;
 }
 
+/**
+ * Get a string's len bytes without a NUL, for the packet-level checks at unpack. A property not yet
+ * decoded by an MR_UNPACK_LAZY unpack is UTF-8 checked in place & left undecoded.
+ */
+int mr_get_str_view(mr_packet_ctx *pctx, const int idx, const char **pcv0, size_t *plen, bool *pexists) {
+    mr_mdata *mdata = pctx->mdata0 + idx;
+
+    if (mdata->lazy_pos) { // mr_skip_field checked that it fits its block
+        const uint8_t *u8v = pctx->lazy_u8v0 + mdata->lazy_pos;
+        const size_t len = (u8v[0] << 8) + u8v[1];
+        if (mr_check_utf8(pctx, mdata, u8v + 2, len)) return -1;
+        *pcv0 = (const char *)u8v + 2;
+        *plen = len;
+        *pexists = true;
+        return 0;
+    }
+
+    uint8_t *u8v0;
+    if (mr_get_u8v(pctx, idx, &u8v0, plen, pexists)) return -1;
+    *pcv0 = (const char *)u8v0;
+    if (*pexists) (*plen)--; // strlen() + 1
+    return 0;
+}
+
 static int mr_count_u8v(mr_packet_ctx *pctx, mr_mdata *mdata) {
     mdata->u8vlen = 2 + mdata->vlen;
     if (mdata->propid) mdata->u8vlen++;
@@ -481,19 +1133,39 @@ static int mr_pack_payload(mr_packet_ctx *pctx, mr_mdata *mdata) {
     return 0;
 }
 
+// strings are NUL-terminated when unpacked so an embedded U+0000, which MQTT forbids, would hide the rest
+static int mr_unpack_check_nul(mr_packet_ctx *pctx, mr_mdata *mdata, const uint8_t *u8v, const size_t len) {
+    if (!memchr(u8v, '\0', len)) return 0;
+    mr_log_error("invalid utf8: U+0000:: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+    return mr_unpack_error(pctx, mdata, MR_ERR_UTF8, MQTT_RC_MALFORMED_PACKET);
+}
+
 static int mr_unpack_u8v(mr_packet_ctx *pctx, mr_mdata *mdata) {
     bool str_flag = mdata->dtype == MR_STR_DTYPE;
+    if (mr_unpack_check(pctx, mdata, 2)) return -1;
     uint8_t *u8v = pctx->u8v0 + pctx->u8vpos;
     size_t u8vlen = (u8v[0] << 8) + u8v[1];
+    if (mr_unpack_check(pctx, mdata, 2 + u8vlen)) return -1;
     u8v += 2;
-    size_t vlen = u8vlen + (str_flag ? 1 : 0);
-    uint8_t *value;
-    if (mr_calloc((void **)&value, vlen, 1)) return -1;
-    memcpy(value, u8v, u8vlen);
-    mdata->value = (uintptr_t)value;
-    mdata->vlen = vlen;
+    if (str_flag && mr_unpack_check_nul(pctx, mdata, u8v, u8vlen)) return -1;
+
+    if (!str_flag && (pctx->unpack_flags & MR_UNPACK_BORROW)) { // view into the caller's buffer
+        mdata->value = (uintptr_t)u8v;
+        mdata->vlen = u8vlen;
+        mdata->valloc = false;
+    }
+    else { // strings need a trailing NUL so are always copied
+        size_t vlen = u8vlen + (str_flag ? 1 : 0);
+        uint8_t *value;
+        if (mr_alloc_field(pctx, (void **)&value, vlen)) return -1;
+        memcpy(value, u8v, u8vlen);
+        if (str_flag) value[u8vlen] = '\0';
+        mdata->value = (uintptr_t)value;
+        mdata->vlen = vlen;
+        mdata->valloc = true;
+    }
+
     mdata->vexists = true;
-    mdata->valloc = true;
     mdata->u8vlen = (mdata->propid ? 1 : 0) + 2 + u8vlen;
     pctx->u8vpos += 2 + u8vlen;
     return 0;
@@ -504,22 +1176,22 @@ static int mr_unpack_payload(mr_packet_ctx *pctx, mr_mdata *mdata) {
     mdata->vexists = true;
     mdata->valloc = false;
     // printf("\npayload:: pctx->u8vlen: %lu; pctx->u8vpos: %lu\n\n", pctx->u8vlen, pctx->u8vpos);
-    mdata->u8vlen = mdata->vlen = pctx->u8vlen - pctx->u8vpos;
+    mdata->u8vlen = mdata->vlen = pctx->u8vend - pctx->u8vpos;
     pctx->u8vpos += mdata->u8vlen;
     return 0;
 }
 
 int mr_validate_u8v_utf8(mr_packet_ctx *pctx, const int idx) {
     mr_mdata *mdata = pctx->mdata0 + idx;
-    int err_pos = mr_utf8_validation((uint8_t *)mdata->value, mdata->vlen);
+    int err_pos = mr_utf8_payload_validation((uint8_t *)mdata->value, mdata->vlen);
 
     if (err_pos) {
-        dzlog_error(
+        mr_log_error(
             "invalid utf8:: packet: %s; name: %s; pos: %d",
             pctx->mqtt_packet_name, mdata->name, err_pos
         );
 
-        return -1;
+        return mr_unpack_error(pctx, mdata, MR_ERR_UTF8, MQTT_RC_MALFORMED_PACKET);
     }
 
     return 0;
@@ -527,14 +1199,14 @@ int mr_validate_u8v_utf8(mr_packet_ctx *pctx, const int idx) {
 
 int mr_get_VBIv(mr_packet_ctx *pctx, const int idx, uint32_t **pu32v0, size_t *plen, bool *pexists) {
     uintptr_t pvoid;
-    mr_get_vector(pctx, idx, &pvoid, plen, pexists);
+    if (mr_get_vector(pctx, idx, &pvoid, plen, pexists)) return -1;
     *pu32v0 = (uint32_t *)pvoid;
     return 0;
 }
 
 static int mr_count_VBIv(mr_packet_ctx *pctx, mr_mdata *mdata) { // VBIv's are properties
     if (!mdata->value) {
-        dzlog_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        mr_log_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
         return -1;
     }
 
@@ -545,7 +1217,7 @@ static int mr_count_VBIv(mr_packet_ctx *pctx, mr_mdata *mdata) { // VBIv's are p
         int bytecount = mr_bytecount_VBI(VBIv0[i]);
 
         if (bytecount < 0) {
-            dzlog_error("VBI too big for 4 bytes: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+            mr_log_error("VBI too big for 4 bytes: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
             return -1;
         }
 
@@ -557,7 +1229,7 @@ static int mr_count_VBIv(mr_packet_ctx *pctx, mr_mdata *mdata) { // VBIv's are p
 
 static int mr_pack_VBIv(mr_packet_ctx *pctx, mr_mdata *mdata) {
     if (!mdata->value) {
-        dzlog_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        mr_log_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
         return -1;
     }
 
@@ -568,7 +1240,7 @@ static int mr_pack_VBIv(mr_packet_ctx *pctx, mr_mdata *mdata) {
         int bytecount = mr_make_VBI(VBIv0[i], &pctx->u8v0[pctx->u8vpos]);
 
         if (bytecount < 0) {
-            dzlog_error("VBI too big for 4 bytes: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+            mr_log_error("VBI too big for 4 bytes: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
             return -1;
         }
 
@@ -579,24 +1251,16 @@ static int mr_pack_VBIv(mr_packet_ctx *pctx, mr_mdata *mdata) {
 }
 
 static int mr_unpack_VBIv(mr_packet_ctx *pctx, mr_mdata *mdata) {
-    uint8_t *pu8 = pctx->u8v0 + pctx->u8vpos;
     uint32_t u32;
-    int bytecount = mr_extract_VBI(&u32, pu8);
+    int bytecount = mr_extract_VBI(&u32, pctx->u8v0 + pctx->u8vpos, pctx->u8vend - pctx->u8vpos);
 
-    if (bytecount < 0) {
-        dzlog_error("VBI too big for 4 bytes: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
-        return -1;
+    if (bytecount <= 0) {
+        mr_log_error("malformed VBI: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        return mr_unpack_error(pctx, mdata, MR_ERR_VBI, MQTT_RC_MALFORMED_PACKET);
     }
 
     uint32_t *VBIv0;
-    if (mdata->valloc) {
-        VBIv0 = (uint32_t *)mdata->value;
-        if (mr_realloc((void **)&VBIv0, (mdata->vlen + 1) * sizeof(uint32_t))) return -1;
-    }
-    else {
-        if (mr_malloc((void **)&VBIv0, sizeof(uint32_t))) return -1;
-        mdata->vlen = 0; // incremented below
-    }
+    if (mr_grow_field_vector(pctx, mdata, (void **)&VBIv0, sizeof(uint32_t))) return -1;
 
     mdata->value = (uintptr_t)VBIv0;
     *(VBIv0 + mdata->vlen) = u32;
@@ -610,7 +1274,7 @@ static int mr_unpack_VBIv(mr_packet_ctx *pctx, mr_mdata *mdata) {
 
 static int mr_validate_VBIv(mr_packet_ctx *pctx, mr_mdata *mdata) {
     if (!mdata->value) {
-        dzlog_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        mr_log_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
         return -1;
     }
 
@@ -620,7 +1284,7 @@ static int mr_validate_VBIv(mr_packet_ctx *pctx, mr_mdata *mdata) {
         int bytecount = mr_bytecount_VBI(VBIv0[i]);
 
         if (bytecount < 0) {
-            dzlog_error("VBI too big for 4 bytes: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+            mr_log_error("VBI too big for 4 bytes: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
             return -1;
         }
     }
@@ -631,7 +1295,7 @@ static int mr_validate_VBIv(mr_packet_ctx *pctx, mr_mdata *mdata) {
 int mr_get_str(mr_packet_ctx *pctx, const int idx, char **pcv0, bool *pexists) {
     uintptr_t pvoid;
     size_t len;
-    mr_get_vector(pctx, idx, &pvoid, &len, pexists);
+    if (mr_get_vector(pctx, idx, &pvoid, &len, pexists)) return -1;
     *pcv0 = (char *)pvoid;
     return 0;
 }
@@ -644,7 +1308,7 @@ static int mr_count_str(mr_packet_ctx *pctx, mr_mdata *mdata) {
 
 static int mr_validate_str(mr_packet_ctx *pctx, mr_mdata *mdata) {
     if (!mdata->value) {
-        dzlog_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        mr_log_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
         return -1;
     }
 
@@ -652,12 +1316,12 @@ static int mr_validate_str(mr_packet_ctx *pctx, mr_mdata *mdata) {
     int err_pos = mr_utf8_validation((uint8_t *)pc, strlen(pc)); // returns error position
 
     if (err_pos) {
-        dzlog_error(
+        mr_log_error(
             "invalid utf8:: packet: %s; name: %s; value: %s, pos: %d",
             pctx->mqtt_packet_name, mdata->name, pc, err_pos
         );
 
-        return -1;
+        return mr_unpack_error(pctx, mdata, MR_ERR_UTF8, MQTT_RC_MALFORMED_PACKET);
     }
 
     return 0;
@@ -665,14 +1329,14 @@ static int mr_validate_str(mr_packet_ctx *pctx, mr_mdata *mdata) {
 
 int mr_get_spv(mr_packet_ctx *pctx, const int idx, mr_string_pair **pspv0, size_t *plen, bool *pexists) {
     uintptr_t pvoid;
-    mr_get_vector(pctx, idx, &pvoid, plen, pexists);
+    if (mr_get_vector(pctx, idx, &pvoid, plen, pexists)) return -1;
     *pspv0 = (mr_string_pair *)pvoid;
     return 0;
 }
 
 static int mr_count_spv(mr_packet_ctx *pctx, mr_mdata *mdata) { // spv's are properties
     if (!mdata->value) {
-        dzlog_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        mr_log_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
         return -1;
     }
 
@@ -688,7 +1352,7 @@ static int mr_count_spv(mr_packet_ctx *pctx, mr_mdata *mdata) { // spv's are pro
 
 static int mr_pack_spv(mr_packet_ctx *pctx, mr_mdata *mdata) {
     if (!mdata->value) {
-        dzlog_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        mr_log_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
         return -1;
     }
 
@@ -716,32 +1380,30 @@ static int mr_pack_spv(mr_packet_ctx *pctx, mr_mdata *mdata) {
 
 static int mr_unpack_spv(mr_packet_ctx *pctx, mr_mdata *mdata) {
     uint8_t *u8v = pctx->u8v0 + pctx->u8vpos;
-
+    if (mr_unpack_check(pctx, mdata, 2)) return -1;
     size_t namelen = (u8v[0] << 8) + u8v[1];
+    if (mr_unpack_check(pctx, mdata, 2 + namelen + 2)) return -1;
+    size_t valuelen = (u8v[2 + namelen] << 8) + u8v[2 + namelen + 1];
+    if (mr_unpack_check(pctx, mdata, 2 + namelen + 2 + valuelen)) return -1;
+    if (mr_unpack_check_nul(pctx, mdata, u8v + 2, namelen)) return -1;
+    if (mr_unpack_check_nul(pctx, mdata, u8v + 2 + namelen + 2, valuelen)) return -1;
+
     u8v += 2;
     char *name;
-    if (mr_malloc((void **)&name, namelen + 1)) return -1;
+    if (mr_alloc_field(pctx, (void **)&name, namelen + 1)) return -1;
     memcpy(name, u8v, namelen);
     u8v += namelen;
     name[namelen] = '\0';
 
-    size_t valuelen = (u8v[0] << 8) + u8v[1];
     u8v += 2;
     char *value;
-    if (mr_malloc((void **)&value, valuelen + 1)) return -1;
+    if (mr_alloc_field(pctx, (void **)&value, valuelen + 1)) return -1;
     memcpy(value, u8v, valuelen);
     u8v += valuelen;
     value[valuelen] = '\0';
 
     mr_string_pair *spv0, *psp;
-    if (mdata->valloc) {
-        spv0 = (mr_string_pair *)mdata->value;
-        if (mr_realloc((void **)&spv0, (mdata->vlen + 1) * sizeof(mr_string_pair))) return -1;
-    }
-    else {
-        if (mr_malloc((void **)&spv0, sizeof(mr_string_pair))) return -1;
-        mdata->vlen = 0; // incremented below
-    }
+    if (mr_grow_field_vector(pctx, mdata, (void **)&spv0, sizeof(mr_string_pair))) return -1;
 
     mdata->value = (uintptr_t)spv0;
     psp = spv0 + mdata->vlen;
@@ -757,7 +1419,7 @@ static int mr_unpack_spv(mr_packet_ctx *pctx, mr_mdata *mdata) {
 
 static int mr_validate_spv(mr_packet_ctx *pctx, mr_mdata *mdata) {
     if (!mdata->value) {
-        dzlog_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        mr_log_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
         return -1;
     }
 
@@ -767,23 +1429,23 @@ static int mr_validate_spv(mr_packet_ctx *pctx, mr_mdata *mdata) {
         int err_pos = mr_utf8_validation((uint8_t *)spv[i].name, strlen(spv[i].name));
 
         if (err_pos) {
-            dzlog_error(
+            mr_log_error(
                 "invalid utf8: packet: %s; mr_string_pair: %d; name: %s; pos: %d",
                 pctx->mqtt_packet_name, i, spv[i].name, err_pos
             );
 
-            return -1;
+            return mr_unpack_error(pctx, mdata, MR_ERR_UTF8, MQTT_RC_MALFORMED_PACKET);
         }
 
         err_pos = mr_utf8_validation((uint8_t *)spv[i].value, strlen(spv[i].value));
 
         if (err_pos) {
-            dzlog_error(
+            mr_log_error(
                 "invalid utf8: packet: %s; mr_string_pair: %d; value: %s; pos: %d",
                 pctx->mqtt_packet_name, i, spv[i].value, err_pos
             );
 
-            return -1;
+            return mr_unpack_error(pctx, mdata, MR_ERR_UTF8, MQTT_RC_MALFORMED_PACKET);
         }
     }
 
@@ -796,8 +1458,8 @@ static int mr_free_spv(mr_packet_ctx *pctx, mr_mdata *mdata) {
     if (mdata->valloc) {
         mr_string_pair *psp = spv0;
         for (int i = 0; i < mdata->vlen; psp++, i++) {
-            if (mr_free(psp->name)) return -1;
-            if (mr_free(psp->value)) return -1;
+            if (mr_free_field(pctx, psp->name)) return -1;
+            if (mr_free_field(pctx, psp->value)) return -1;
         }
     }
 
@@ -806,14 +1468,14 @@ static int mr_free_spv(mr_packet_ctx *pctx, mr_mdata *mdata) {
 
 int mr_get_tfv(mr_packet_ctx *pctx, const int idx, mr_topic_filter **ptfv0, size_t *plen, bool *pexists) {
     uintptr_t pvoid;
-    mr_get_vector(pctx, idx, &pvoid, plen, pexists);
+    if (mr_get_vector(pctx, idx, &pvoid, plen, pexists)) return -1;
     *ptfv0 = (mr_topic_filter *)pvoid;
     return 0;
 }
 
 static int mr_count_tfv(mr_packet_ctx *pctx, mr_mdata *mdata) { // tfv's are in the payload not properties
     if (!mdata->value) {
-        dzlog_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        mr_log_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
         return -1;
     }
 
@@ -829,7 +1491,7 @@ static int mr_count_tfv(mr_packet_ctx *pctx, mr_mdata *mdata) { // tfv's are in
 
 static int mr_pack_tfv(mr_packet_ctx *pctx, mr_mdata *mdata) {
     if (!mdata->value) {
-        dzlog_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        mr_log_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
         return -1;
     }
 
@@ -857,44 +1519,29 @@ static int mr_pack_tfv(mr_packet_ctx *pctx, mr_mdata *mdata) {
     return 0;
 }
 
+// unpack into the next element of a topic filter vector already sized by mr_unpack_tfv
 static int mr_unpack_tfv_single(mr_packet_ctx *pctx, mr_mdata *mdata) {
+    if (mr_unpack_check(pctx, mdata, 2)) return -1;
     uint8_t *u8v = pctx->u8v0 + pctx->u8vpos;
     size_t tflen = (u8v[0] << 8) + u8v[1];
+    if (mr_unpack_check(pctx, mdata, 2 + tflen + 1)) return -1;
     u8v += 2;
+    if (mr_unpack_check_nul(pctx, mdata, u8v, tflen)) return -1;
 
     char *topic_filter;
-    if (mr_malloc((void **)&topic_filter, tflen + 1)) return -1;
+    if (mr_alloc_field(pctx, (void **)&topic_filter, tflen + 1)) return -1;
     memcpy(topic_filter, u8v, tflen);
     topic_filter[tflen] = '\0';
     u8v += tflen;
 
-    uint8_t maximum_qos = *u8v & BIT_MASKS[2];
-    uint8_t no_local = *u8v >> 2 & BIT_MASKS[1];
-    uint8_t retain_as_published = *u8v >> 3 & BIT_MASKS[1];
-    uint8_t retain_handling = *u8v >> 4 & BIT_MASKS[2];
-    u8v++;
-
-    mr_topic_filter *tfv0, *ptf;
-    if (mdata->valloc) {
-        tfv0 = (mr_topic_filter *)mdata->value;
-        if (mr_realloc((void **)&tfv0, (mdata->vlen + 1) * sizeof(mr_topic_filter))) return -1;
-    }
-    else {
-        if (mr_malloc((void **)&tfv0, sizeof(mr_topic_filter))) return -1;
-        mdata->vlen = 0; // incremented below
-    }
-
-    mdata->value = (uintptr_t)tfv0;
-    ptf = tfv0 + mdata->vlen;
+    mr_topic_filter *ptf = (mr_topic_filter *)mdata->value + mdata->vlen;
     ptf->topic_filter = topic_filter;
-    ptf->maximum_qos = maximum_qos;
-    ptf->no_local = no_local;
-    ptf->retain_as_published = retain_as_published;
-    ptf->retain_handling = retain_handling;
+    ptf->maximum_qos = *u8v & BIT_MASKS[2];
+    ptf->no_local = *u8v >> 2 & BIT_MASKS[1];
+    ptf->retain_as_published = *u8v >> 3 & BIT_MASKS[1];
+    ptf->retain_handling = *u8v >> 4 & BIT_MASKS[2];
 
     mdata->vlen++;
-    mdata->vexists = true;
-    mdata->valloc = true;
     mdata->u8vlen += 2 + tflen + 1;
     pctx->u8vpos += 2 + tflen + 1;
     return 0;
@@ -906,8 +1553,30 @@ static int mr_unpack_tfv(mr_packet_ctx *pctx, mr_mdata *mdata) {
     mdata->valloc = false;
     mdata->u8vlen = 0;
 
-    while (pctx->u8vpos < pctx->u8vlen) {
-        mr_unpack_tfv_single(pctx, mdata);
+    size_t tfcount = 0; // count the topic filters so the vector is allocated once
+    size_t pos = pctx->u8vpos;
+    for (; pos + 2 <= pctx->u8vend; tfcount++) {
+        pos += 2 + ((pctx->u8v0[pos] << 8) + pctx->u8v0[pos + 1]) + 1;
+    }
+
+    if (pos != pctx->u8vend) { // the last topic filter is cut short
+        mr_log_error(
+            "field beyond the packet:: packet: %s; name: %s; u8vpos: %lu",
+            pctx->mqtt_packet_name, mdata->name, pctx->u8vpos
+        );
+
+        return mr_unpack_error(pctx, mdata, MR_ERR_TRUNCATED, MQTT_RC_MALFORMED_PACKET);
+    }
+
+    if (!tfcount) return 0;
+    mr_topic_filter *tfv0;
+    if (mr_alloc_field(pctx, (void **)&tfv0, tfcount * sizeof(mr_topic_filter))) return -1;
+    mdata->value = (uintptr_t)tfv0;
+    mdata->vexists = true;
+    mdata->valloc = true;
+
+    while (mdata->vlen < tfcount) {
+        if (mr_unpack_tfv_single(pctx, mdata)) return -1;
     }
 
     return 0;
@@ -915,8 +1584,8 @@ static int mr_unpack_tfv(mr_packet_ctx *pctx, mr_mdata *mdata) {
 
 static int mr_validate_tfv(mr_packet_ctx *pctx, mr_mdata *mdata) {
     if (!mdata->value) {
-        dzlog_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
-        return -1;
+        mr_log_error("NULL pointer: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+        return mr_unpack_error(pctx, mdata, MR_ERR_VALUE, MQTT_RC_PROTOCOL_ERROR);
     }
 
     mr_topic_filter *tfv = (mr_topic_filter *)mdata->value;
@@ -925,30 +1594,30 @@ static int mr_validate_tfv(mr_packet_ctx *pctx, mr_mdata *mdata) {
         int err_pos = mr_utf8_validation((uint8_t *)tfv[i].topic_filter, strlen(tfv[i].topic_filter));
 
         if (err_pos) {
-            dzlog_error(
+            mr_log_error(
                 "invalid utf8: packet: %s; mr_topic_filter: %d; topic_filter: %s; pos: %d",
                 pctx->mqtt_packet_name, i, tfv[i].topic_filter, err_pos
             );
 
-            return -1;
+            return mr_unpack_error(pctx, mdata, MR_ERR_UTF8, MQTT_RC_MALFORMED_PACKET);
         }
 
         if (tfv[i].maximum_qos > 2) {
-            dzlog_error(
+            mr_log_error(
                 "maximum_qos out of range (0..2): packet: %s; mr_topic_filter: %d; maximum_qos: %u",
                 pctx->mqtt_packet_name, i, tfv[i].maximum_qos
             );
 
-            return -1;
+            return mr_unpack_error(pctx, mdata, MR_ERR_VALUE, MQTT_RC_PROTOCOL_ERROR);
         }
 
         if (tfv[i].retain_handling > 2) {
-            dzlog_error(
+            mr_log_error(
                 "retain_handling out of range (0..2): packet: %s; mr_topic_filter: %d; retain_handling: %u",
                 pctx->mqtt_packet_name, i, tfv[i].retain_handling
             );
 
-            return -1;
+            return mr_unpack_error(pctx, mdata, MR_ERR_VALUE, MQTT_RC_PROTOCOL_ERROR);
         }
     }
 
@@ -959,57 +1628,265 @@ static int mr_free_tfv(mr_packet_ctx *pctx, mr_mdata *mdata) {
     if (mdata->valloc) {
         mr_topic_filter *ptf = (mr_topic_filter *)mdata->value;
         for (int i = 0; i < mdata->vlen; ptf++, i++) {
-            if (mr_free(ptf->topic_filter)) return -1;
+            if (mr_free_field(pctx, ptf->topic_filter)) return -1;
         }
     }
 
     return mr_free_vector(pctx, mdata);
 }
 
+// mdata->value is the packet's 256-entry table mapping each allowed property id to its mdata idx
 static int mr_unpack_properties(mr_packet_ctx *pctx, mr_mdata *mdata) {
     mdata->vexists = true;
+    if (mr_unpack_check(pctx, mdata - 1, (mdata - 1)->value)) return -1;
     size_t end_pos = pctx->u8vpos + (mdata - 1)->value; // use property_length
+    pctx->u8vend = end_pos; // properties stay within the block
     // printf("mr_unpack_properties:: pctx->u8vpos: %lu; end_pos: %lu\n", pctx->u8vpos, end_pos);
-    uint8_t *pu8, *pprop_index;
-    int prop_index;
+    const uint8_t *prop_idx = (uint8_t *)mdata->value;
+    uint8_t *pu8;
     mr_mdata *prop_mdata;
     mr_mdata_fn unpack_fn;
     mr_mdata_fn validate_fn;
 
     for (; pctx->u8vpos < end_pos;) {
         pu8 = pctx->u8v0 + pctx->u8vpos++;
-        pprop_index = memchr((uint8_t *)mdata->value, *pu8, mdata->vlen);
 
-        if (!pprop_index) {
-            // printf("*************here\n");
-            dzlog_error(
+        if (!prop_idx[*pu8]) {
+            mr_log_error(
                 "property id not found:: packet: %s; name: %s; propid: %d",
                 pctx->mqtt_packet_name, mdata->name, *pu8
             );
 
-            return -1;
+            pctx->u8vpos--; // report the offset of the property id
+            return mr_unpack_error(pctx, mdata, MR_ERR_PROPERTY_ID, MQTT_RC_MALFORMED_PACKET);
         }
 
-        prop_index = pprop_index - (uint8_t *)mdata->value;
-        prop_mdata = mdata + prop_index + 1;
+        prop_mdata = pctx->mdata0 + prop_idx[*pu8];
+
+        if (pctx->field_mask && !(pctx->field_mask & MR_FIELD(prop_idx[*pu8]))) {
+            if (mr_skip_field(pctx, prop_mdata, end_pos)) return -1;
+            continue;
+        }
 
         if (
-            prop_mdata->vexists &&
+            (prop_mdata->vexists || prop_mdata->lazy_pos) &&
             prop_mdata->dtype != MR_SPV_DTYPE &&
             prop_mdata->dtype != MR_VBIV_DTYPE
         ) {
-            dzlog_error(
+            mr_log_error(
                 "duplicate property value:: packet: %s; name: %s",
                 pctx->mqtt_packet_name, prop_mdata->name
             );
 
-            return -1;
+            pctx->u8vpos--; // report the offset of the property id
+            return mr_unpack_error(pctx, prop_mdata, MR_ERR_DUPLICATE, MQTT_RC_PROTOCOL_ERROR);
+        }
+
+        if ((pctx->unpack_flags & MR_UNPACK_VALIDATE) && DATA_TYPE[prop_mdata->dtype].free_fn) {
+            if (mr_check_field(pctx, prop_mdata)) return -1;
+            continue;
+        }
+
+        if ((pctx->unpack_flags & MR_UNPACK_LAZY) && DATA_TYPE[prop_mdata->dtype].free_fn) { // a vector
+            if (!prop_mdata->lazy_pos) {
+                prop_mdata->lazy_pos = pctx->u8vpos;
+                prop_mdata->lazy_end = end_pos;
+                pctx->lazy_count++;
+            }
+
+            if (mr_skip_field(pctx, prop_mdata, end_pos)) return -1;
+            continue;
         }
 
         unpack_fn = DATA_TYPE[prop_mdata->dtype].unpack_fn;
         if (unpack_fn(pctx, prop_mdata)) return -1;
-        validate_fn = DATA_TYPE[mdata->dtype].validate_fn;
-        if (validate_fn && validate_fn(pctx, mdata)) return -1;
+        validate_fn = DATA_TYPE[prop_mdata->dtype].validate_fn;
+        if (validate_fn && validate_fn(pctx, prop_mdata)) return -1;
+    }
+
+    pctx->u8vend = pctx->u8vlen;
+    return 0;
+}
+
+// advance past a field value, for a property after its propid, without decoding it
+static int mr_skip_field(mr_packet_ctx *pctx, mr_mdata *mdata, const size_t end_pos) {
+    uint8_t *u8v = pctx->u8v0;
+    size_t pos = pctx->u8vpos;
+
+    switch (mdata->dtype) {
+        case MR_PAYLOAD_DTYPE:
+            pos = end_pos;
+            break;
+        case MR_TFV_DTYPE: // topic filters, each with an options byte, to the end of the packet
+            while (pos + 2 <= end_pos) pos += 2 + (u8v[pos] << 8) + u8v[pos + 1] + 1;
+            if (pos < end_pos) pos = end_pos + 1; // a partial length prefix
+            break;
+        case MR_U8_DTYPE:
+        case MR_U16_DTYPE:
+        case MR_U32_DTYPE:
+            pos += mdata->vlen;
+            break;
+        case MR_VBI_DTYPE:
+        case MR_VBIV_DTYPE:
+            for (int i = 0; ; i++) {
+                if (i == 4 || pos == end_pos) {
+                    mr_log_error("malformed VBI: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+                    return mr_unpack_error(pctx, mdata, MR_ERR_VBI, MQTT_RC_MALFORMED_PACKET);
+                }
+
+                if (!(u8v[pos++] & 0x80)) break;
+            }
+
+            break;
+        case MR_SPV_DTYPE: // name then value
+            if (pos + 2 > end_pos) { pos = end_pos + 1; break; } // a partial length prefix
+            pos += 2 + (u8v[pos] << 8) + u8v[pos + 1];
+            // fall through
+        default: // MR_STR_DTYPE & MR_U8V_DTYPE
+            if (pos + 2 > end_pos) {
+                pos += 2;
+                break;
+            }
+
+            pos += 2 + (u8v[pos] << 8) + u8v[pos + 1];
+    }
+
+    if (pos > end_pos) {
+        mr_log_error(
+            "field beyond its block:: packet: %s; name: %s",
+            pctx->mqtt_packet_name, mdata->name
+        );
+
+        return mr_unpack_error(pctx, mdata, MR_ERR_TRUNCATED, MQTT_RC_MALFORMED_PACKET);
+    }
+
+    pctx->u8vpos = pos;
+    return 0;
+}
+
+static int mr_check_utf8(mr_packet_ctx *pctx, mr_mdata *mdata, const uint8_t *u8v, const size_t len) {
+    int err_pos = mr_utf8_validation(u8v, len); // returns error position
+
+    if (err_pos) {
+        mr_log_error(
+            "invalid utf8:: packet: %s; name: %s; pos: %d",
+            pctx->mqtt_packet_name, mdata->name, err_pos
+        );
+
+        return mr_unpack_error(pctx, mdata, MR_ERR_UTF8, MQTT_RC_MALFORMED_PACKET);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Check a vector value in place for mr_validate_packet_bytes, leaving a view of it in mdata.
+ *
+ * Apply the checks of the dtype's unpack_fn & validate_fn without copying. Binary data, payloads &
+ * strings point into the packet, strings with the vlen they would have if copied but no NUL; the
+ * repeatable user properties, subscription identifiers & topic filters are only counted.
+ */
+static int mr_check_field(mr_packet_ctx *pctx, mr_mdata *mdata) {
+    const uint8_t *u8v = pctx->u8v0 + pctx->u8vpos;
+    if (mr_skip_field(pctx, mdata, pctx->u8vend)) return -1; // the value fits its block
+    size_t len = pctx->u8v0 + pctx->u8vpos - u8v;
+
+    switch (mdata->dtype) {
+        case MR_PAYLOAD_DTYPE:
+            mdata->value = (uintptr_t)u8v;
+            mdata->vlen = len;
+            break;
+        case MR_U8V_DTYPE:
+            mdata->value = (uintptr_t)(u8v + 2);
+            mdata->vlen = len - 2;
+            break;
+        case MR_STR_DTYPE:
+            if (mr_check_utf8(pctx, mdata, u8v + 2, len - 2)) return -1;
+            mdata->value = (uintptr_t)(u8v + 2);
+            mdata->vlen = len - 2 + 1; // strlen() + 1
+            break;
+        case MR_SPV_DTYPE: {
+            size_t namelen = (u8v[0] << 8) + u8v[1];
+            if (mr_check_utf8(pctx, mdata, u8v + 2, namelen)) return -1;
+            if (mr_check_utf8(pctx, mdata, u8v + 2 + namelen + 2, len - 2 - namelen - 2)) return -1;
+            mdata->vlen++;
+            break;
+        }
+        case MR_TFV_DTYPE:
+            if (!len) {
+                mr_log_error("no topic filters:: packet: %s; name: %s", pctx->mqtt_packet_name, mdata->name);
+                return mr_unpack_error(pctx, mdata, MR_ERR_VALUE, MQTT_RC_PROTOCOL_ERROR);
+            }
+
+            for (const uint8_t *pu8 = u8v; pu8 < u8v + len; mdata->vlen++) { // mr_skip_field checked the lengths
+                size_t tflen = (pu8[0] << 8) + pu8[1];
+                if (mr_check_utf8(pctx, mdata, pu8 + 2, tflen)) return -1;
+                uint8_t options = pu8[2 + tflen];
+
+                if ((options & BIT_MASKS[2]) > 2 || (options >> 4 & BIT_MASKS[2]) > 2) {
+                    mr_log_error(
+                        "maximum_qos or retain_handling out of range (0..2): packet: %s; mr_topic_filter: %lu",
+                        pctx->mqtt_packet_name, mdata->vlen
+                    );
+
+                    return mr_unpack_error(pctx, mdata, MR_ERR_VALUE, MQTT_RC_PROTOCOL_ERROR);
+                }
+
+                pu8 += 2 + tflen + 1;
+            }
+
+            break;
+        default: // MR_VBIV_DTYPE: mr_skip_field checked the VBI
+            mdata->vlen++;
+    }
+
+    mdata->vexists = true;
+    return 0;
+}
+
+/**
+ * @brief Decode a property located by an MR_UNPACK_LAZY unpack, then validate it.
+ *
+ * Repeatable properties, i.e. user properties & subscription identifiers, are decoded from each
+ * of their occurrences, skipping the properties between them.
+ */
+static int mr_unpack_lazy_property(mr_packet_ctx *pctx, mr_mdata *mdata) {
+    uint8_t *u8v0 = pctx->u8v0; // keep any packet buffer from mr_pack_packet or an unpack in progress
+    size_t u8vlen = pctx->u8vlen;
+    size_t u8vpos = pctx->u8vpos;
+    size_t u8vend = pctx->u8vend;
+    pctx->u8v0 = (uint8_t *)pctx->lazy_u8v0; // override const
+    pctx->u8vlen = pctx->lazy_u8vlen;
+    pctx->u8vpos = mdata->lazy_pos;
+    pctx->u8vend = mdata->lazy_end;
+    mdata->lazy_pos = 0;
+    pctx->lazy_count--;
+
+    mr_mdata *props_mdata = mdata - 1;
+    while (props_mdata->dtype != MR_PROPERTIES_DTYPE) props_mdata--;
+    const uint8_t *prop_idx = (uint8_t *)props_mdata->value;
+    bool repeatable = mdata->dtype == MR_SPV_DTYPE || mdata->dtype == MR_VBIV_DTYPE;
+    mr_mdata_fn unpack_fn = DATA_TYPE[mdata->dtype].unpack_fn;
+    int rc = unpack_fn(pctx, mdata);
+
+    while (!rc && repeatable && pctx->u8vpos < mdata->lazy_end) { // the ids were checked at unpack
+        mr_mdata *prop_mdata = pctx->mdata0 + prop_idx[pctx->u8v0[pctx->u8vpos++]];
+        rc = prop_mdata == mdata ? unpack_fn(pctx, mdata) : mr_skip_field(pctx, prop_mdata, mdata->lazy_end);
+    }
+
+    mr_mdata_fn validate_fn = DATA_TYPE[mdata->dtype].validate_fn;
+    if (!rc && validate_fn) rc = validate_fn(pctx, mdata);
+    pctx->u8v0 = u8v0;
+    pctx->u8vlen = u8vlen;
+    pctx->u8vpos = u8vpos;
+    pctx->u8vend = u8vend;
+    return rc;
+}
+
+static int mr_unpack_lazy_properties(mr_packet_ctx *pctx) {
+    mr_mdata *mdata = pctx->mdata0;
+    for (int i = 0; i < pctx->mdata_count && pctx->lazy_count; mdata++, i++) {
+        if (mdata->lazy_pos && mr_unpack_lazy_property(pctx, mdata)) return -1;
     }
 
     return 0;
@@ -1073,7 +1950,7 @@ static int mr_printable_spv(mr_packet_ctx *pctx, mr_mdata *mdata) {
         sz += strlen(spv[i].name) + 1 + strlen(spv[i].value) + 1; // ':' and ';'
     }
 
-    if (mr_calloc((void **)&printable, sz, 1)) return -1;
+    if (mr_calloc((void **)&printable, sz + 1, 1)) return -1; // sprintf writes a trailing NUL
 
     char *pc = printable;
     for (int i = 0; i < mdata->vlen; i++) {
@@ -1095,7 +1972,7 @@ static int mr_printable_tfv(mr_packet_ctx *pctx, mr_mdata *mdata) {
         sz += strlen(tfv[i].topic_filter) + 9; // ':' and 'x x x x;'
     }
 
-    if (mr_calloc((void **)&printable, sz, 1)) return -1;
+    if (mr_calloc((void **)&printable, sz + 1, 1)) return -1; // sprintf writes a trailing NUL
 
     char *pc = printable;
     for (int i = 0; i < mdata->vlen; i++) {
@@ -1160,6 +2037,7 @@ static const char NOT_PRINTABLE[] = "***";
  * @param pcv the address of a c-string that will be the printable metadata.
  */
 int mr_get_printable(mr_packet_ctx *pctx, const bool all_flag, char **pcv) {
+    if (pctx->lazy_count && mr_unpack_lazy_properties(pctx)) return -1;
     if (mr_free(pctx->printable)) return -1;
     const mr_mdata_fn vbi_count_fn = DATA_TYPE[MR_VBI_DTYPE].count_fn;
 
@@ -1175,6 +2053,7 @@ int mr_get_printable(mr_packet_ctx *pctx, const bool all_flag, char **pcv) {
         // printf("packet: %s; field: %s\n", pctx->mqtt_packet_name, mdata->name);
         mr_mdata_fn print_fn = DATA_TYPE[mdata->dtype].print_fn;
         if (print_fn && mr_free(mdata->printable)) return -1;
+        mdata->printable = NULL;
 
         if (mdata->vexists && print_fn) {
             if (print_fn(pctx, mdata)) return -1;
@@ -1183,7 +2062,7 @@ int mr_get_printable(mr_packet_ctx *pctx, const bool all_flag, char **pcv) {
     }
 
     char *printable;
-    if (mr_calloc((void **)&printable, len, 1)) return -1;
+    if (mr_calloc((void **)&printable, len + 1, 1)) return -1;
 
     char *pc = printable;
     mdata = pctx->mdata0;
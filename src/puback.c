@@ -8,40 +8,23 @@
 
 #include "mister_internal.h"
 
-enum PUBACK_MDATA_FIELDS { // Same order as PUBACK_MDATA_TEMPLATE
-    PUBACK_PACKET_TYPE,
-    PUBACK_RESERVED_HEADER,
-    PUBACK_MR_HEADER,
-    PUBACK_REMAINING_LENGTH,
-    PUBACK_PACKET_IDENTIFIER,
-    PUBACK_PUBACK_REASON_CODE,
-    PUBACK_PROPERTY_LENGTH,
-    PUBACK_MR_PROPERTIES,
-    PUBACK_REASON_STRING,
-    PUBACK_USER_PROPERTIES
+static const bool VALID_PUBACK_REASON_CODES[256] = { // indexed by reason code
+    [MQTT_RC_SUCCESS]                 = true,
+    [MQTT_RC_NO_MATCHING_SUBSCRIBERS] = true,
+    [MQTT_RC_UNSPECIFIED]             = true,
+    [MQTT_RC_IMPLEMENTATION_SPECIFIC] = true,
+    [MQTT_RC_NOT_AUTHORIZED]          = true,
+    [MQTT_RC_TOPIC_NAME_INVALID]      = true,
+    [MQTT_RC_PACKET_ID_IN_USE]        = true,
+    [MQTT_RC_QUOTA_EXCEEDED]          = true,
+    [MQTT_RC_PAYLOAD_FORMAT_INVALID]  = true
 };
 
-static const uint8_t VALID_PUBACK_REASON_CODES[] = {
-    MQTT_RC_SUCCESS,
-    MQTT_RC_NO_MATCHING_SUBSCRIBERS,
-    MQTT_RC_UNSPECIFIED,
-    MQTT_RC_IMPLEMENTATION_SPECIFIC,
-    MQTT_RC_NOT_AUTHORIZED,
-    MQTT_RC_TOPIC_NAME_INVALID,
-    MQTT_RC_PACKET_ID_IN_USE,
-    MQTT_RC_QUOTA_EXCEEDED,
-    MQTT_RC_PAYLOAD_FORMAT_INVALID
+static const uint8_t PROP_IDX[256] = { // property id -> mdata idx; 0: not a PUBACK property
+    [MQTT_PROP_REASON_STRING] = PUBACK_REASON_STRING,
+    [MQTT_PROP_USER_PROPERTY] = PUBACK_USER_PROPERTIES
 };
 
-static const size_t CCRCSZ = sizeof(VALID_PUBACK_REASON_CODES) / sizeof(VALID_PUBACK_REASON_CODES[0]);
-
-static const uint8_t PROPS[] = {
-    MQTT_PROP_REASON_STRING,
-    MQTT_PROP_USER_PROPERTY,
-};
-
-static const size_t PSZ = sizeof(PROPS) / sizeof(PROPS[0]);
-
 #define NA 0
 
 static const char S0L[] = "";
@@ -56,7 +39,7 @@ static const mr_mdata PUBACK_MDATA_TEMPLATE[] = {
     {"packet_identifier",   MR_U16_DTYPE,       0,                  NA,     2,      2,      true,   NA,                     NA,                     NA,                     PUBACK_PACKET_IDENTIFIER,   NULL},
     {"puback_reason_code",  MR_U8_DTYPE,        0,                  NA,     1,      1,      false,  NA,                     NA,                     PUBACK_REMAINING_LENGTH,PUBACK_PUBACK_REASON_CODE,  NULL},
     {"property_length",     MR_VBI_DTYPE,       0,                  NA,     0,      0,      false,  PUBACK_USER_PROPERTIES, NA,                     PUBACK_REMAINING_LENGTH,PUBACK_PROPERTY_LENGTH,     NULL},
-    {"mr_properties",       MR_PROPERTIES_DTYPE,(uintptr_t)PROPS,   NA,     PSZ,    NA,     false,  NA,                     NA,                     NA,                     PUBACK_MR_PROPERTIES,       NULL},
+    {"mr_properties",       MR_PROPERTIES_DTYPE,(uintptr_t)PROP_IDX,NA,     NA,     NA,     false,  NA,                     NA,                     NA,                     PUBACK_MR_PROPERTIES,       NULL},
     {"reason_string",       MR_STR_DTYPE,       (uintptr_t)NULL,    false,  0,      0,      false,  NA,                     MQTT_PROP_REASON_STRING,NA,                     PUBACK_REASON_STRING,       NULL},
     {"user_properties",     MR_SPV_DTYPE,       (uintptr_t)NULL,    false,  0,      0,      false,  NA,                     MQTT_PROP_USER_PROPERTY,NA,                     PUBACK_USER_PROPERTIES,     NULL},
 //   name                   dtype               value               valloc  vlen    u8vlen  vexists link                    propid                  flagid                  idx                         printable
@@ -69,7 +52,25 @@ int mr_init_puback_packet(mr_packet_ctx **ppctx) {
 }
 
 int mr_init_unpack_puback_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen) {
-    return mr_init_unpack_packet(ppctx, PUBACK_MDATA_TEMPLATE, PUBACK_MDATA_COUNT, u8v0, u8vlen);
+    return mr_init_unpack_packet(ppctx, PUBACK_MDATA_TEMPLATE, PUBACK_MDATA_COUNT, u8v0, u8vlen, MR_UNPACK_COPY, 0);
+}
+
+int mr_init_unpack_puback_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+) {
+    return mr_init_unpack_packet(ppctx, PUBACK_MDATA_TEMPLATE, PUBACK_MDATA_COUNT, u8v0, u8vlen, unpack_flags, 0);
+}
+
+int mr_init_unpack_puback_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+) {
+    return mr_init_unpack_packet(
+        ppctx, PUBACK_MDATA_TEMPLATE, PUBACK_MDATA_COUNT, u8v0, u8vlen, unpack_flags, field_mask
+    );
+}
+
+int mr_validate_puback_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code) {
+    return mr_validate_packet(PUBACK_MDATA_TEMPLATE, PUBACK_MDATA_COUNT, u8v0, u8vlen, preason_code);
 }
 
 static int mr_check_puback_packet(mr_packet_ctx *pctx) {
@@ -77,8 +78,8 @@ static int mr_check_puback_packet(mr_packet_ctx *pctx) {
         return 0;
     }
     else {
-        dzlog_info("Packet Context is not a PUBACK packet");
-        return -1;
+        mr_log_error("Packet Context is not a PUBACK packet:: packet name: %s", pctx->mqtt_packet_name);
+        return mr_set_error(MR_ERR_PACKET_TYPE, MQTT_RC_UNSPECIFIED, pctx->mqtt_packet_type, -1, 0);
     }
 }
 
@@ -133,8 +134,8 @@ int mr_get_puback_puback_reason_code(mr_packet_ctx *pctx, uint8_t *pu8, bool *pe
 }
 
 static int mr_validate_puback_puback_reason_code(const uint8_t u8) {
-    if (!memchr(VALID_PUBACK_REASON_CODES, u8, CCRCSZ)) {
-        dzlog_error("invalid puback_reason_code: %u", u8);
+    if (!VALID_PUBACK_REASON_CODES[u8]) {
+        mr_log_error("invalid puback_reason_code: %u", u8);
         return -1;
     }
 
@@ -216,7 +217,7 @@ static int mr_validate_puback_cross(mr_packet_ctx *pctx) {
     return 0;
 }
 
-static int mr_validate_puback_pack(mr_packet_ctx *pctx) {
+int mr_validate_puback_pack(mr_packet_ctx *pctx) {
     if (mr_validate_puback_cross(pctx)) return -1;
     return 0;
 }
@@ -227,7 +228,7 @@ int mr_validate_puback_unpack(mr_packet_ctx *pctx) {
     bool exists_flag;
 
     if (mr_get_puback_puback_reason_code(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_puback_puback_reason_code(u8)) return -1;
+    if (exists_flag && mr_validate_puback_puback_reason_code(u8)) return mr_reject(pctx, PUBACK_PUBACK_REASON_CODE, MQTT_RC_PROTOCOL_ERROR);
 
     return 0;
 }
@@ -1,6 +1,7 @@
 /* connack.c */
 
 #include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 #include <stdbool.h>
 
@@ -8,41 +9,17 @@
 
 #include "mister_internal.h"
 
-enum PUBLISH_MDATA_FIELDS { // Same order as PUBLISH_MDATA_TEMPLATE
-    PUBLISH_PACKET_TYPE,
-    PUBLISH_DUP,
-    PUBLISH_QOS,
-    PUBLISH_RETAIN,
-    PUBLISH_MR_HEADER,
-    PUBLISH_REMAINING_LENGTH,
-    PUBLISH_TOPIC_NAME,
-    PUBLISH_PACKET_IDENTIFIER,
-    PUBLISH_PROPERTY_LENGTH,
-    PUBLISH_MR_PROPERTIES,
-    PUBLISH_PAYLOAD_FORMAT_INDICATOR,
-    PUBLISH_MESSAGE_EXPIRY_INTERVAL,
-    PUBLISH_TOPIC_ALIAS,
-    PUBLISH_RESPONSE_TOPIC,
-    PUBLISH_CORRELATION_DATA,
-    PUBLISH_USER_PROPERTIES,
-    PUBLISH_SUBSCRIPTION_IDENTIFIERS,
-    PUBLISH_CONTENT_TYPE,
-    PUBLISH_PAYLOAD
+static const uint8_t PROP_IDX[256] = { // property id -> mdata idx; 0: not a PUBLISH property
+    [MQTT_PROP_PAYLOAD_FORMAT_INDICATOR] = PUBLISH_PAYLOAD_FORMAT_INDICATOR,
+    [MQTT_PROP_MESSAGE_EXPIRY_INTERVAL]  = PUBLISH_MESSAGE_EXPIRY_INTERVAL,
+    [MQTT_PROP_TOPIC_ALIAS]              = PUBLISH_TOPIC_ALIAS,
+    [MQTT_PROP_RESPONSE_TOPIC]           = PUBLISH_RESPONSE_TOPIC,
+    [MQTT_PROP_CORRELATION_DATA]         = PUBLISH_CORRELATION_DATA,
+    [MQTT_PROP_USER_PROPERTY]            = PUBLISH_USER_PROPERTIES,
+    [MQTT_PROP_SUBSCRIPTION_IDENTIFIER]  = PUBLISH_SUBSCRIPTION_IDENTIFIERS,
+    [MQTT_PROP_CONTENT_TYPE]             = PUBLISH_CONTENT_TYPE
 };
 
-static const uint8_t PROPS[] = {
-    MQTT_PROP_PAYLOAD_FORMAT_INDICATOR,
-    MQTT_PROP_MESSAGE_EXPIRY_INTERVAL,
-    MQTT_PROP_TOPIC_ALIAS,
-    MQTT_PROP_RESPONSE_TOPIC,
-    MQTT_PROP_CORRELATION_DATA,
-    MQTT_PROP_USER_PROPERTY,
-    MQTT_PROP_SUBSCRIPTION_IDENTIFIER,
-    MQTT_PROP_CONTENT_TYPE,
-};
-
-static const size_t PSZ = sizeof(PROPS) / sizeof(PROPS[0]);
-
 #define NA 0
 
 static const char S0L[] = "";
@@ -59,7 +36,7 @@ static const mr_mdata PUBLISH_MDATA_TEMPLATE[] = {
     {"topic_name",              MR_STR_DTYPE,       (uintptr_t)S0L,     false,  1,      2,      true,   NA,                     NA,                                 NA,         PUBLISH_TOPIC_NAME,                 NULL},
     {"packet_identifier",       MR_U16_DTYPE,       0,                  NA,     2,      2,      false,  NA,                     NA,                                 PUBLISH_QOS,PUBLISH_PACKET_IDENTIFIER,          NULL},
     {"property_length",         MR_VBI_DTYPE,       0,                  NA,     0,      0,      true,   PUBLISH_CONTENT_TYPE,   NA,                                 NA,         PUBLISH_PROPERTY_LENGTH,            NULL},
-    {"mr_properties",           MR_PROPERTIES_DTYPE,(uintptr_t)PROPS,   NA,     PSZ,    NA,     true,   NA,                     NA,                                 NA,         PUBLISH_MR_PROPERTIES,              NULL},
+    {"mr_properties",           MR_PROPERTIES_DTYPE,(uintptr_t)PROP_IDX,NA,     NA,     NA,     true,   NA,                     NA,                                 NA,         PUBLISH_MR_PROPERTIES,              NULL},
     {"payload_format_indicator",MR_U8_DTYPE,        0,                  NA,     1,      2,      false,  NA,                     MQTT_PROP_PAYLOAD_FORMAT_INDICATOR, NA,         PUBLISH_PAYLOAD_FORMAT_INDICATOR,   NULL},
     {"message_expiry_interval", MR_U32_DTYPE,       0,                  NA,     4,      5,      false,  NA,                     MQTT_PROP_MESSAGE_EXPIRY_INTERVAL,  NA,         PUBLISH_MESSAGE_EXPIRY_INTERVAL,    NULL},
     {"topic_alias",             MR_U16_DTYPE,       0,                  NA,     2,      3,      false,  NA,                     MQTT_PROP_TOPIC_ALIAS,              NA,         PUBLISH_TOPIC_ALIAS,                NULL},
@@ -79,7 +56,25 @@ int mr_init_publish_packet(mr_packet_ctx **ppctx) {
 }
 
 int mr_init_unpack_publish_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen) {
-    return mr_init_unpack_packet(ppctx, PUBLISH_MDATA_TEMPLATE, PUBLISH_MDATA_COUNT, u8v0, u8vlen);
+    return mr_init_unpack_packet(ppctx, PUBLISH_MDATA_TEMPLATE, PUBLISH_MDATA_COUNT, u8v0, u8vlen, MR_UNPACK_COPY, 0);
+}
+
+int mr_init_unpack_publish_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+) {
+    return mr_init_unpack_packet(ppctx, PUBLISH_MDATA_TEMPLATE, PUBLISH_MDATA_COUNT, u8v0, u8vlen, unpack_flags, 0);
+}
+
+int mr_init_unpack_publish_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+) {
+    return mr_init_unpack_packet(
+        ppctx, PUBLISH_MDATA_TEMPLATE, PUBLISH_MDATA_COUNT, u8v0, u8vlen, unpack_flags, field_mask
+    );
+}
+
+int mr_validate_publish_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code) {
+    return mr_validate_packet(PUBLISH_MDATA_TEMPLATE, PUBLISH_MDATA_COUNT, u8v0, u8vlen, preason_code);
 }
 
 static int mr_check_publish_packet(mr_packet_ctx *pctx) {
@@ -87,8 +82,8 @@ static int mr_check_publish_packet(mr_packet_ctx *pctx) {
         return 0;
     }
     else {
-        dzlog_info("Packet Context is not a PUBLISH packet");
-        return -1;
+        mr_log_error("Packet Context is not a PUBLISH packet:: packet name: %s", pctx->mqtt_packet_name);
+        return mr_set_error(MR_ERR_PACKET_TYPE, MQTT_RC_UNSPECIFIED, pctx->mqtt_packet_type, -1, 0);
     }
 }
 
@@ -131,7 +126,7 @@ int mr_get_publish_qos(mr_packet_ctx *pctx, uint8_t *pu8) {
 
 static int mr_validate_publish_qos(const uint8_t u8) {
     if (u8 > 2) {
-        dzlog_error("qos must be in range (0..2): %u", u8);
+        mr_log_error("qos must be in range (0..2): %u", u8);
         return -1;
     }
 
@@ -170,9 +165,9 @@ int mr_get_publish_topic_name(mr_packet_ctx *pctx, char **pcv0) {
     return mr_get_str(pctx, PUBLISH_TOPIC_NAME, pcv0, &exists_flag);
 }
 
-static int mr_validate_publish_topic_name(const char *cv0) {
-    if (mr_wildcard_found(cv0)) {
-        dzlog_error("topic_name must not contain wildcard characters");
+static int mr_validate_publish_topic_name(const char *cv0, const size_t len) {
+    if (mr_wildcard_found(cv0, len)) {
+        mr_log_error("topic_name must not contain wildcard characters");
         return -1;
     }
 
@@ -181,7 +176,7 @@ static int mr_validate_publish_topic_name(const char *cv0) {
 
 int mr_set_publish_topic_name(mr_packet_ctx *pctx, const char *cv0) {
     if (mr_check_publish_packet(pctx)) return -1;
-    if (mr_validate_publish_topic_name(cv0)) return -1;
+    if (mr_validate_publish_topic_name(cv0, strlen(cv0))) return -1;
     return mr_set_vector(pctx, PUBLISH_TOPIC_NAME, cv0, strlen(cv0) + 1);
 }
 
@@ -193,7 +188,7 @@ int mr_get_publish_packet_identifier(mr_packet_ctx *pctx, uint16_t *pu16, bool *
 
 static int mr_validate_publish_packet_identifier(const uint16_t u16) {
     if (u16 == 0) {
-        dzlog_error("packet_identifier must be > 0");
+        mr_log_error("packet_identifier must be > 0");
         return -1;
     }
 
@@ -226,7 +221,7 @@ int mr_get_publish_payload_format_indicator(mr_packet_ctx *pctx, uint8_t *pu8, b
 
 static int mr_validate_publish_payload_format_indicator(const uint8_t u8) {
     if (u8 > 1) {
-        dzlog_error("payload_format_indicator out of range (0..1): %u", u8);
+        mr_log_error("payload_format_indicator out of range (0..1): %u", u8);
         return -1;
     }
 
@@ -263,12 +258,12 @@ int mr_reset_publish_message_expiry_interval(mr_packet_ctx *pctx) {
 // uint16_t topic_alias
 int mr_get_publish_topic_alias(mr_packet_ctx *pctx, uint16_t *pu16, bool *pexists_flag) {
     if (mr_check_publish_packet(pctx)) return -1;
-    return mr_get_u16(pctx, PUBLISH_PACKET_IDENTIFIER, pu16, pexists_flag);
+    return mr_get_u16(pctx, PUBLISH_TOPIC_ALIAS, pu16, pexists_flag);
 }
 
 static int mr_validate_publish_topic_alias(const uint16_t u16) {
     if (u16 == 0) {
-        dzlog_error("topic_alias must be > 0");
+        mr_log_error("topic_alias must be > 0");
         return -1;
     }
 
@@ -278,12 +273,12 @@ static int mr_validate_publish_topic_alias(const uint16_t u16) {
 int mr_set_publish_topic_alias(mr_packet_ctx *pctx, const uint16_t u16) {
     if (mr_check_publish_packet(pctx)) return -1;
     if (mr_validate_publish_topic_alias(u16)) return -1;
-    return mr_set_scalar(pctx, PUBLISH_PACKET_IDENTIFIER, u16);
+    return mr_set_scalar(pctx, PUBLISH_TOPIC_ALIAS, u16);
 }
 
 int mr_reset_publish_topic_alias(mr_packet_ctx *pctx) {
     if (mr_check_publish_packet(pctx)) return -1;
-    return mr_reset_scalar(pctx, PUBLISH_PACKET_IDENTIFIER);
+    return mr_reset_scalar(pctx, PUBLISH_TOPIC_ALIAS);
 }
 
 // char *response_topic
@@ -292,9 +287,9 @@ int mr_get_publish_response_topic(mr_packet_ctx *pctx, char **pcv0, bool *pexist
     return mr_get_str(pctx, PUBLISH_RESPONSE_TOPIC, pcv0, pexists_flag);
 }
 
-static int mr_validate_publish_response_topic(const char *cv0) {
-    if (mr_wildcard_found(cv0)) {
-        dzlog_error("response_topic must not contain wildcard characters");
+static int mr_validate_publish_response_topic(const char *cv0, const size_t len) {
+    if (mr_wildcard_found(cv0, len)) {
+        mr_log_error("response_topic must not contain wildcard characters");
         return -1;
     }
 
@@ -303,7 +298,7 @@ static int mr_validate_publish_response_topic(const char *cv0) {
 
 int mr_set_publish_response_topic(mr_packet_ctx *pctx, const char *cv0) {
     if (mr_check_publish_packet(pctx)) return -1;
-    if (mr_validate_publish_response_topic(cv0)) return -1;
+    if (mr_validate_publish_response_topic(cv0, strlen(cv0))) return -1;
     return mr_set_vector(pctx, PUBLISH_RESPONSE_TOPIC, cv0, strlen(cv0) + 1);
 }
 
@@ -402,19 +397,21 @@ static int mr_validate_publish_cross(mr_packet_ctx *pctx) {
         if (mr_get_publish_packet_identifier(pctx, &u16, &exists_flag)) return -1;
 
         if (!exists_flag || u16 == 0) {
-            dzlog_error("qos > 0 but packet_identifier does not exist or equals 0");
-            return -1;
+            mr_log_error("qos > 0 but packet_identifier does not exist or equals 0");
+            return mr_reject(pctx, PUBLISH_PACKET_IDENTIFIER, MQTT_RC_PROTOCOL_ERROR);
         }
     }
 
     // payload_format_indicator & payload
     if (mr_get_publish_payload_format_indicator(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && u8 && mr_validate_u8v_utf8(pctx, PUBLISH_PAYLOAD)) return -1;
+    if (exists_flag && u8 && mr_validate_u8v_utf8(pctx, PUBLISH_PAYLOAD)) {
+        return mr_reject(pctx, PUBLISH_PAYLOAD, MQTT_RC_PAYLOAD_FORMAT_INVALID);
+    }
 
     return 0;
 }
 
-static int mr_validate_publish_pack(mr_packet_ctx *pctx) {
+int mr_validate_publish_pack(mr_packet_ctx *pctx) {
     if (mr_validate_publish_cross(pctx)) return -1;
     return 0;
 }
@@ -423,26 +420,34 @@ static int mr_validate_publish_pack(mr_packet_ctx *pctx) {
 int mr_validate_publish_unpack(mr_packet_ctx *pctx) {
     uint8_t u8;
     uint16_t u16;
-    char *cv0;
+    uint8_t *u8v0;
+    size_t len;
     bool exists_flag;
 
     if (mr_get_publish_qos(pctx, &u8)) return -1;
-    if (mr_validate_publish_qos(u8)) return -1;
+    if (mr_validate_publish_qos(u8)) return mr_reject(pctx, PUBLISH_QOS, MQTT_RC_MALFORMED_PACKET);
 
-    if (mr_get_publish_topic_name(pctx, &cv0)) return -1;
-    if (mr_validate_publish_topic_name(cv0)) return -1;
+    // strings by length: when only validating they are views into the packet without a NUL
+    if (mr_check_publish_packet(pctx)) return -1;
+    if (mr_get_u8v(pctx, PUBLISH_TOPIC_NAME, &u8v0, &len, &exists_flag)) return -1;
+    if (exists_flag && mr_validate_publish_topic_name((char *)u8v0, len - 1)) {
+        return mr_reject(pctx, PUBLISH_TOPIC_NAME, MQTT_RC_TOPIC_NAME_INVALID);
+    }
 
     if (mr_get_publish_packet_identifier(pctx, &u16, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_publish_packet_identifier(u16)) return -1;
+    if (exists_flag && mr_validate_publish_packet_identifier(u16)) return mr_reject(pctx, PUBLISH_PACKET_IDENTIFIER, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_publish_payload_format_indicator(pctx, &u8, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_publish_payload_format_indicator(u8)) return -1;
+    if (exists_flag && mr_validate_publish_payload_format_indicator(u8)) return mr_reject(pctx, PUBLISH_PAYLOAD_FORMAT_INDICATOR, MQTT_RC_PROTOCOL_ERROR);
 
     if (mr_get_publish_topic_alias(pctx, &u16, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_publish_topic_alias(u16)) return -1;
+    if (exists_flag && mr_validate_publish_topic_alias(u16)) return mr_reject(pctx, PUBLISH_TOPIC_ALIAS, MQTT_RC_TOPIC_ALIAS_INVALID);
 
-    if (mr_get_publish_response_topic(pctx, &cv0, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_publish_response_topic(cv0)) return -1;
+    const char *cv0;
+    if (mr_get_str_view(pctx, PUBLISH_RESPONSE_TOPIC, &cv0, &len, &exists_flag)) return -1; // lazy stays lazy
+    if (exists_flag && mr_validate_publish_response_topic(cv0, len)) {
+        return mr_reject(pctx, PUBLISH_RESPONSE_TOPIC, MQTT_RC_PROTOCOL_ERROR);
+    }
 
     if (mr_validate_publish_cross(pctx)) return -1;
 
@@ -453,3 +458,367 @@ int mr_get_publish_printable(mr_packet_ctx *pctx, const bool all_flag, char **pc
     if (mr_check_publish_packet(pctx)) return -1;
     return mr_get_printable(pctx, all_flag, pcv);
 }
+
+// peek: routing fields straight from the packet bytes
+
+/**
+ * @brief Get the routing fields of a raw PUBLISH packet without building a packet context.
+ *
+ * Validate the framing only: the packet type & flags, that the remaining length spans exactly
+ * u8vlen, that the topic name, packet identifier & property block fit, and that the topic name
+ * has no wildcards. The topic name is not UTF-8 validated and the properties are not decoded;
+ * unpack the packet for those.
+ */
+int mr_peek_publish(const uint8_t *u8v0, const size_t u8vlen, mr_publish_peek *ppeek) {
+    if (u8vlen < 2 || u8v0[0] >> 4 != MQTT_PUBLISH) {
+        mr_log_error("not a PUBLISH packet");
+        return -1;
+    }
+
+    ppeek->dup = (u8v0[0] >> 3) & 0x01;
+    ppeek->qos = (u8v0[0] >> 1) & 0x03;
+    ppeek->retain = u8v0[0] & 0x01;
+    if (mr_validate_publish_qos(ppeek->qos)) return -1;
+
+    uint32_t remaining_length;
+    int vbilen = mr_extract_VBI(&remaining_length, u8v0 + 1, u8vlen - 1);
+
+    if (vbilen <= 0 || 1 + vbilen + remaining_length != u8vlen) {
+        mr_log_error("remaining length does not match the packet length: %lu", u8vlen);
+        return -1;
+    }
+
+    size_t pos = 1 + vbilen;
+
+    if (pos + 2 > u8vlen) {
+        mr_log_error("topic name beyond the packet");
+        return -1;
+    }
+
+    ppeek->topic_name_len = (u8v0[pos] << 8) + u8v0[pos + 1];
+    ppeek->topic_name = (const char *)u8v0 + pos + 2;
+    pos += 2 + ppeek->topic_name_len;
+
+    if (pos > u8vlen) {
+        mr_log_error("topic name beyond the packet");
+        return -1;
+    }
+
+    if (
+        memchr(ppeek->topic_name, '+', ppeek->topic_name_len) ||
+        memchr(ppeek->topic_name, '#', ppeek->topic_name_len)
+    ) {
+        mr_log_error("topic_name must not contain wildcard characters");
+        return -1;
+    }
+
+    ppeek->packet_identifier = 0;
+
+    if (ppeek->qos) {
+        if (pos + 2 > u8vlen) {
+            mr_log_error("packet identifier beyond the packet");
+            return -1;
+        }
+
+        ppeek->packet_identifier = (u8v0[pos] << 8) + u8v0[pos + 1];
+        if (mr_validate_publish_packet_identifier(ppeek->packet_identifier)) return -1;
+        pos += 2;
+    }
+
+    vbilen = mr_extract_VBI(&ppeek->property_length, u8v0 + pos, u8vlen - pos);
+
+    if (vbilen <= 0 || pos + vbilen + ppeek->property_length > u8vlen) {
+        mr_log_error("property block beyond the packet");
+        return -1;
+    }
+
+    ppeek->properties_offset = pos + vbilen;
+    ppeek->payload_offset = ppeek->properties_offset + ppeek->property_length;
+    ppeek->payload_len = u8vlen - ppeek->payload_offset;
+    return 0;
+}
+
+// rewrite: header fields changed on the packed bytes
+
+/**
+ * @brief Rewrite the qos, dup & retain flags and the packet identifier of a packed PUBLISH in place.
+ *
+ * The qos may only be lowered. Dropping to qos 0 removes the packet identifier: the fixed header
+ * & topic name move up over it, so the rewritten packet starts *poffset bytes into u8v0 and the
+ * properties & payload are not moved. Set the rewritten length in *pu8vlen. The packet is checked
+ * as for mr_peek_publish(); on error it is unchanged.
+ */
+int mr_rewrite_publish(
+    uint8_t *u8v0, const size_t u8vlen, const mr_publish_rewrite *prw, size_t *poffset, size_t *pu8vlen
+) {
+    mr_publish_peek peek;
+    if (mr_peek_publish(u8v0, u8vlen, &peek)) return -1;
+
+    if (prw->qos > peek.qos) {
+        mr_log_error("qos can only be lowered: %u > %u", prw->qos, peek.qos);
+        return -1;
+    }
+
+    size_t topic_pos = (const uint8_t *)peek.topic_name - u8v0 - 2;
+    size_t pid_pos = topic_pos + 2 + peek.topic_name_len;
+    size_t offset = 0;
+
+    if (prw->qos) {
+        if (prw->packet_identifier) {
+            u8v0[pid_pos] = prw->packet_identifier >> 8;
+            u8v0[pid_pos + 1] = prw->packet_identifier & 0xFF;
+        }
+    }
+    else if (peek.qos) { // drop the packet identifier
+        uint32_t remaining_length = u8vlen - topic_pos - 2;
+        int vbilen = mr_bytecount_VBI(remaining_length);
+        offset = topic_pos + 2 - 1 - vbilen;
+        memmove(u8v0 + topic_pos + 2, u8v0 + topic_pos, 2 + peek.topic_name_len);
+        mr_make_VBI(remaining_length, u8v0 + offset + 1);
+    }
+
+    u8v0[offset] = MQTT_PUBLISH << 4 | (prw->qos && prw->dup) << 3 | prw->qos << 1 | prw->retain;
+    *poffset = offset;
+    *pu8vlen = u8vlen - offset;
+    return 0;
+}
+
+// fan-out: one PUBLISH encoded once, then framed per subscriber
+
+#define MR_VBI_MAX 268435455
+
+// length of a packed property value, after its propid
+static size_t mr_fanout_value_len(const int dtype, const uint8_t *u8v) {
+    switch (dtype) {
+        case MR_U8_DTYPE:
+            return 1;
+        case MR_U16_DTYPE:
+            return 2;
+        case MR_U32_DTYPE:
+            return 4;
+        case MR_VBIV_DTYPE: {
+            size_t len = 1;
+            while (*u8v++ & 0x80) len++;
+            return len;
+        }
+        case MR_SPV_DTYPE: { // name then value
+            size_t len = 2 + (u8v[0] << 8) + u8v[1];
+            return len + 2 + (u8v[len] << 8) + u8v[len + 1];
+        }
+        default: // MR_STR_DTYPE & MR_U8V_DTYPE
+            return 2 + (u8v[0] << 8) + u8v[1];
+    }
+}
+
+/**
+ * @brief Encode a PUBLISH once for fan-out to many subscribers, setting the fan-out's address.
+ *
+ * Pack pctx and keep the parts every outbound copy shares: the topic name and the properties
+ * other than topic_alias & subscription_identifiers. The payload is referenced, not copied, so
+ * pctx and its payload must outlive the fan-out. Later changes to pctx do not affect the fan-out.
+ */
+int mr_init_publish_fanout(mr_publish_fanout **ppfo, mr_packet_ctx *pctx) {
+    if (mr_check_publish_packet(pctx)) return -1;
+    struct iovec iov[2];
+    int iovcnt;
+    if (mr_pack_packet_iov(pctx, iov, &iovcnt)) return -1;
+
+    // our own packing: well formed
+    const uint8_t *u8v = iov[0].iov_base;
+    const size_t u8vlen = iov[0].iov_len;
+    uint32_t u32;
+    size_t pos = 1 + mr_extract_VBI(&u32, u8v + 1, u8vlen - 1);
+    size_t topic_pos = pos;
+    pos += 2 + (u8v[pos] << 8) + u8v[pos + 1];
+    size_t topic_len = pos - topic_pos;
+    if ((u8v[0] >> 1) & 0x03) pos += 2; // packet_identifier
+    uint32_t property_length;
+    pos += mr_extract_VBI(&property_length, u8v + pos, u8vlen - pos);
+
+    mr_publish_fanout *pfo;
+    if (mr_calloc((void **)&pfo, 1, sizeof(mr_publish_fanout))) return -1;
+    if (mr_malloc((void **)&pfo->u8v0, topic_len + property_length)) {
+        mr_free(pfo);
+        return -1;
+    }
+
+    memcpy(pfo->u8v0, u8v + topic_pos, topic_len);
+    pfo->topic_len = topic_len;
+    uint8_t *props = pfo->u8v0 + topic_len;
+    const uint8_t *pu8 = u8v + pos;
+    const uint8_t *pu8end = pu8 + property_length;
+
+    while (pu8 < pu8end) { // properties are packed in template order
+        const int idx = PROP_IDX[*pu8];
+        size_t len = 1 + mr_fanout_value_len(PUBLISH_MDATA_TEMPLATE[idx].dtype, pu8 + 1);
+
+        if (idx != PUBLISH_TOPIC_ALIAS && idx != PUBLISH_SUBSCRIPTION_IDENTIFIERS) {
+            memcpy(props + pfo->props_len, pu8, len);
+            pfo->props_len += len;
+            if (idx < PUBLISH_TOPIC_ALIAS) pfo->topic_alias_pos = pfo->props_len;
+            if (idx < PUBLISH_SUBSCRIPTION_IDENTIFIERS) pfo->subscription_identifiers_pos = pfo->props_len;
+        }
+
+        pu8 += len;
+    }
+
+    if (iovcnt == 2) {
+        pfo->payload = iov[1].iov_base;
+        pfo->payload_len = iov[1].iov_len;
+    }
+
+    *ppfo = pfo;
+    return 0;
+}
+
+int mr_free_publish_fanout(mr_publish_fanout *pfo) {
+    if (mr_free(pfo->u8v0)) return -1;
+    return mr_free(pfo);
+}
+
+/**
+ * @brief Set *pvalue_pos to the offset of a property's value in a packed PUBLISH, or to 0 when absent.
+ *
+ * The property block is walked, not decoded, so the packet must be well formed: packed by this
+ * library or already validated.
+ */
+int mr_find_publish_property(const uint8_t *u8v0, const size_t u8vlen, const uint8_t propid, size_t *pvalue_pos) {
+    mr_publish_peek peek;
+    if (mr_peek_publish(u8v0, u8vlen, &peek)) return -1;
+    const uint8_t *pu8 = u8v0 + peek.properties_offset;
+    const uint8_t *pu8end = pu8 + peek.property_length;
+    *pvalue_pos = 0;
+
+    while (pu8 < pu8end) {
+        const int idx = PROP_IDX[*pu8];
+        if (!idx) return mr_set_error(MR_ERR_PROPERTY_ID, MQTT_RC_MALFORMED_PACKET, MQTT_PUBLISH, -1, pu8 - u8v0);
+
+        if (*pu8 == propid) {
+            *pvalue_pos = pu8 + 1 - u8v0;
+            return 0;
+        }
+
+        pu8 += 1 + mr_fanout_value_len(PUBLISH_MDATA_TEMPLATE[idx].dtype, pu8 + 1);
+    }
+
+    return 0;
+}
+
+static int mr_validate_publish_target(const mr_publish_target *ptarget) {
+    if (mr_validate_publish_qos(ptarget->qos)) return -1;
+    if (ptarget->qos && mr_validate_publish_packet_identifier(ptarget->packet_identifier)) return -1;
+
+    if (ptarget->dup && !ptarget->qos) { // MQTT-3.3.1-2
+        mr_log_error("dup must be false for qos 0");
+        return -1;
+    }
+
+    if (ptarget->topic_alias_only && !ptarget->topic_alias) {
+        mr_log_error("topic_alias_only requires a topic_alias");
+        return -1;
+    }
+
+    for (size_t i = 0; i < ptarget->subscription_identifiers_len; i++) {
+        uint32_t u32 = ptarget->subscription_identifiers[i];
+
+        if (!u32 || mr_bytecount_VBI(u32) < 0) {
+            mr_log_error("subscription_identifier must be in range (1..268435455): %u", u32);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Frame the fan-out PUBLISH for one subscriber for writev.
+ *
+ * Splice the subscriber's fixed header, packet identifier, topic_alias & subscription identifiers
+ * around the shared segments into the caller's buffer u8v0 of u8vcap bytes, which becomes iov[0];
+ * the shared payload is iov[1]. iov must have room for 2 segments; set the count used, 1 if there
+ * is no payload. If the buffer is too small set the required length in iov[0].iov_len, set mr_errno
+ * to ENOBUFS and return -1.
+ */
+int mr_pack_publish_fanout(
+    mr_publish_fanout *pfo,
+    const mr_publish_target *ptarget,
+    uint8_t *u8v0,
+    const size_t u8vcap,
+    struct iovec *iov,
+    int *piovcnt
+) {
+    if (mr_validate_publish_target(ptarget)) return -1;
+
+    size_t property_length = pfo->props_len + (ptarget->topic_alias ? 3 : 0);
+    for (size_t i = 0; i < ptarget->subscription_identifiers_len; i++) {
+        property_length += 1 + mr_bytecount_VBI(ptarget->subscription_identifiers[i]);
+    }
+
+    size_t topic_len = ptarget->topic_alias_only ? 2 : pfo->topic_len;
+    size_t remaining_length = topic_len + (ptarget->qos ? 2 : 0) + property_length + pfo->payload_len;
+
+    if (remaining_length + 4 > MR_VBI_MAX) { // room for the property length VBI
+        mr_log_error("packet too big: remaining_length: %lu", remaining_length);
+        return -1;
+    }
+
+    remaining_length += mr_bytecount_VBI(property_length);
+    int rlbytes = mr_bytecount_VBI(remaining_length);
+    size_t head_len = 1 + rlbytes + remaining_length - pfo->payload_len;
+    iov[0].iov_len = head_len;
+
+    if (head_len > u8vcap) {
+        mr_errno = ENOBUFS;
+        return mr_set_error(MR_ERR_NOBUFS, MQTT_RC_SUCCESS, MQTT_PUBLISH, -1, u8vcap);
+    }
+
+    uint8_t *pu8 = u8v0;
+    *pu8++ = MQTT_PUBLISH << 4 | ptarget->dup << 3 | ptarget->qos << 1 | ptarget->retain;
+    pu8 += mr_make_VBI(remaining_length, pu8);
+
+    if (ptarget->topic_alias_only) {
+        *pu8++ = 0;
+        *pu8++ = 0;
+    }
+    else {
+        memcpy(pu8, pfo->u8v0, pfo->topic_len);
+        pu8 += pfo->topic_len;
+    }
+
+    if (ptarget->qos) {
+        *pu8++ = ptarget->packet_identifier >> 8;
+        *pu8++ = ptarget->packet_identifier & 0xFF;
+    }
+
+    pu8 += mr_make_VBI(property_length, pu8);
+    const uint8_t *props = pfo->u8v0 + pfo->topic_len;
+    memcpy(pu8, props, pfo->topic_alias_pos);
+    pu8 += pfo->topic_alias_pos;
+
+    if (ptarget->topic_alias) {
+        *pu8++ = MQTT_PROP_TOPIC_ALIAS;
+        *pu8++ = ptarget->topic_alias >> 8;
+        *pu8++ = ptarget->topic_alias & 0xFF;
+    }
+
+    memcpy(pu8, props + pfo->topic_alias_pos, pfo->subscription_identifiers_pos - pfo->topic_alias_pos);
+    pu8 += pfo->subscription_identifiers_pos - pfo->topic_alias_pos;
+
+    for (size_t i = 0; i < ptarget->subscription_identifiers_len; i++) {
+        *pu8++ = MQTT_PROP_SUBSCRIPTION_IDENTIFIER;
+        pu8 += mr_make_VBI(ptarget->subscription_identifiers[i], pu8);
+    }
+
+    memcpy(pu8, props + pfo->subscription_identifiers_pos, pfo->props_len - pfo->subscription_identifiers_pos);
+
+    iov[0].iov_base = u8v0;
+    *piovcnt = 1;
+
+    if (pfo->payload_len) {
+        iov[1].iov_base = (void *)pfo->payload;
+        iov[1].iov_len = pfo->payload_len;
+        *piovcnt = 2;
+    }
+
+    return 0;
+}
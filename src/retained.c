@@ -0,0 +1,539 @@
+// retained.c
+
+/**
+ * @file
+ * @brief Retained messages: the last retained PUBLISH per topic name, found by topic filter.
+ *
+ * Messages are kept packed, ready to resend, in a trie with one node per topic level, so a filter
+ * lookup only visits the nodes its levels can match. Messages with a message_expiry_interval are
+ * also kept in a min-heap by expiry. A store is not thread-safe: the caller serializes access.
+*/
+
+#include <string.h>
+
+#include <zlog.h>
+
+#include "mister_internal.h"
+
+#define MR_NO_EXPIRY SIZE_MAX // heap_idx of a message without a message_expiry_interval
+
+static int mr_retained_invalid(const int field_idx, const uint8_t reason_code, const char *reason) {
+    mr_log_error("cannot retain PUBLISH: %s", reason);
+    return mr_set_error(MR_ERR_VALUE, reason_code, MQTT_PUBLISH, field_idx, 0);
+}
+
+static mr_retained_node *mr_find_retained_child(
+    const mr_retained_node *node, const char *level, const size_t len, const uint32_t hash, size_t *pi
+) {
+    if (!node->children_cap) return NULL;
+    const size_t mask = node->children_cap - 1;
+
+    for (size_t i = hash & mask; node->children[i]; i = (i + 1) & mask) {
+        mr_retained_node *child = node->children[i];
+
+        if (child->level_hash == hash && child->level_len == len && !memcmp(child->level, level, len)) {
+            *pi = i;
+            return child;
+        }
+    }
+
+    return NULL;
+}
+
+static void mr_put_retained_child(mr_retained_node **children, const size_t cap, mr_retained_node *child) {
+    size_t i = child->level_hash & (cap - 1);
+    while (children[i]) i = (i + 1) & (cap - 1);
+    children[i] = child;
+}
+
+static int mr_insert_retained_child(mr_retained_node *node, mr_retained_node *child) {
+    if ((node->children_count + 1) * 4 > node->children_cap * 3) { // load factor 3/4
+        size_t cap = node->children_cap ? node->children_cap * 2 : 4;
+        mr_retained_node **children;
+        if (mr_calloc((void **)&children, cap, sizeof(mr_retained_node *))) return -1;
+
+        for (size_t i = 0; i < node->children_cap; i++) {
+            if (node->children[i]) mr_put_retained_child(children, cap, node->children[i]);
+        }
+
+        mr_free(node->children);
+        node->children = children;
+        node->children_cap = cap;
+    }
+
+    mr_put_retained_child(node->children, node->children_cap, child);
+    node->children_count++;
+    return 0;
+}
+
+// backward-shift deletion: later entries of the probe run move up, so no tombstones are needed
+static void mr_remove_retained_child(mr_retained_node *node, size_t i) {
+    const size_t mask = node->children_cap - 1;
+    node->children[i] = NULL;
+
+    for (size_t j = (i + 1) & mask; node->children[j]; j = (j + 1) & mask) {
+        size_t home = node->children[j]->level_hash & mask;
+
+        if (((j - home) & mask) >= ((j - i) & mask)) { // i lies on the probe path from home to j
+            node->children[i] = node->children[j];
+            node->children[j] = NULL;
+            i = j;
+        }
+    }
+
+    node->children_count--;
+}
+
+static int mr_init_retained_node(
+    mr_retained_store *prs, mr_retained_node **pnode, mr_retained_node *parent, const char *level, const size_t len
+) {
+    mr_retained_node *node;
+    if (mr_calloc((void **)&node, 1, sizeof(mr_retained_node) + len)) return -1;
+    node->parent = parent;
+    node->level_hash = mr_level_hash(level, len);
+    node->level_len = len;
+    memcpy(node->level, level, len);
+    prs->node_count++;
+    *pnode = node;
+    return 0;
+}
+
+// unlink & free nodes left without a message or children, from node up to the root
+static void mr_prune_retained_nodes(mr_retained_store *prs, mr_retained_node *node) {
+    while (node != prs->root && !node->pentry && !node->children_count) {
+        mr_retained_node *parent = node->parent;
+        size_t i;
+        mr_find_retained_child(parent, node->level, node->level_len, node->level_hash, &i);
+        mr_remove_retained_child(parent, i);
+        mr_free(node->children);
+        mr_free(node);
+        prs->node_count--;
+        node = parent;
+    }
+}
+
+// expiry heap: soonest first
+
+static void mr_place_retained_entry(mr_retained_store *prs, mr_retained_entry *pre, const size_t i) {
+    prs->heap[i] = pre;
+    pre->heap_idx = i;
+}
+
+static void mr_sift_retained_entry(mr_retained_store *prs, size_t i) {
+    mr_retained_entry *pre = prs->heap[i];
+
+    while (i && prs->heap[(i - 1) / 2]->expiry > pre->expiry) { // up
+        mr_place_retained_entry(prs, prs->heap[(i - 1) / 2], i);
+        i = (i - 1) / 2;
+    }
+
+    while (true) { // down
+        size_t child = 2 * i + 1;
+        if (child >= prs->heap_len) break;
+        if (child + 1 < prs->heap_len && prs->heap[child + 1]->expiry < prs->heap[child]->expiry) child++;
+        if (prs->heap[child]->expiry >= pre->expiry) break;
+        mr_place_retained_entry(prs, prs->heap[child], i);
+        i = child;
+    }
+
+    mr_place_retained_entry(prs, pre, i);
+}
+
+static int mr_reserve_retained_heap(mr_retained_store *prs) {
+    if (prs->heap_len < prs->heap_cap) return 0;
+    size_t cap = prs->heap_cap ? prs->heap_cap * 2 : 16;
+    void *pv = prs->heap; // realloc failing leaves the heap as it was
+    if (mr_realloc(&pv, cap * sizeof(mr_retained_entry *))) return -1;
+    prs->heap = pv;
+    prs->heap_cap = cap;
+    return 0;
+}
+
+// unlink a message from its node & the heap, then free it; the node is left for the caller to prune
+static void mr_remove_retained_entry(mr_retained_store *prs, mr_retained_entry *pre) {
+    if (pre->heap_idx != MR_NO_EXPIRY) {
+        mr_retained_entry *last = prs->heap[--prs->heap_len];
+
+        if (last != pre) {
+            mr_place_retained_entry(prs, last, pre->heap_idx);
+            mr_sift_retained_entry(prs, last->heap_idx);
+        }
+    }
+
+    pre->node->pentry = NULL;
+    prs->message_count--;
+    prs->byte_count -= pre->u8vlen;
+    mr_free(pre);
+}
+
+int mr_init_retained_store(mr_retained_store **pprs) {
+    mr_retained_store *prs;
+    if (mr_calloc((void **)&prs, 1, sizeof(mr_retained_store))) return -1;
+
+    if (mr_init_retained_node(prs, &prs->root, NULL, "", 0)) {
+        mr_free(prs);
+        return -1;
+    }
+
+    *pprs = prs;
+    return 0;
+}
+
+/**
+ * @brief Free the store & its messages.
+ *
+ * A persistent store's log is closed, not synced. Iterative, as topic names may have tens of
+ * thousands of levels: the nodes still to free are chained through their parent pointers.
+ */
+int mr_free_retained_store(mr_retained_store *prs) {
+    if (prs->plog) mr_close_retained_log(prs);
+    mr_retained_node *pending = prs->root;
+    pending->parent = NULL;
+
+    while (pending) {
+        mr_retained_node *node = pending;
+        pending = node->parent;
+
+        for (size_t i = 0; i < node->children_cap; i++) {
+            if (node->children[i]) {
+                node->children[i]->parent = pending;
+                pending = node->children[i];
+            }
+        }
+
+        mr_free(node->pentry);
+        mr_free(node->children);
+        mr_free(node);
+    }
+
+    mr_free(prs->heap);
+    return mr_free(prs);
+}
+
+int mr_get_retained_store_counts(
+    mr_retained_store *prs, size_t *pmessage_count, size_t *pnode_count, size_t *pbyte_count
+) {
+    *pmessage_count = prs->message_count;
+    *pnode_count = prs->node_count;
+    *pbyte_count = prs->byte_count;
+    return 0;
+}
+
+// the node for a topic name, created as needed; NULL on error, with the new nodes pruned
+static mr_retained_node *mr_make_retained_node(mr_retained_store *prs, const char *topic_name, const size_t len) {
+    mr_retained_node *node = prs->root;
+    const char *level = topic_name;
+    const char *end = topic_name + len;
+
+    while (true) {
+        const char *slash = memchr(level, '/', end - level);
+        size_t level_len = (slash ? slash : end) - level;
+        uint32_t hash = mr_level_hash(level, level_len);
+        size_t i;
+        mr_retained_node *child = mr_find_retained_child(node, level, level_len, hash, &i);
+
+        if (!child) {
+            if (mr_init_retained_node(prs, &child, node, level, level_len)) {
+                mr_prune_retained_nodes(prs, node);
+                return NULL;
+            }
+
+            if (mr_insert_retained_child(node, child)) {
+                mr_free(child);
+                prs->node_count--;
+                mr_prune_retained_nodes(prs, node);
+                return NULL;
+            }
+        }
+
+        node = child;
+        if (!slash) return node;
+        level = slash + 1;
+    }
+}
+
+// the node for a topic name if it exists
+static mr_retained_node *mr_find_retained_node(mr_retained_store *prs, const char *topic_name, const size_t len) {
+    mr_retained_node *node = prs->root;
+    const char *level = topic_name;
+    const char *end = topic_name + len;
+
+    while (node) {
+        const char *slash = memchr(level, '/', end - level);
+        size_t level_len = (slash ? slash : end) - level;
+        size_t i;
+        node = mr_find_retained_child(node, level, level_len, mr_level_hash(level, level_len), &i);
+        if (!slash) break;
+        level = slash + 1;
+    }
+
+    return node;
+}
+
+/**
+ * @brief Make pre the topic's retained message, replacing any; set *premoved if one was replaced.
+ *
+ * pre's frame fields, expiry_pos & expiry are set by the caller; on error pre is not freed.
+ */
+int mr_put_retained_entry(
+    mr_retained_store *prs, const char *topic_name, const size_t len, mr_retained_entry *pre, bool *premoved
+) {
+    if (pre->expiry_pos && mr_reserve_retained_heap(prs)) return -1;
+    mr_retained_node *node = mr_make_retained_node(prs, topic_name, len);
+    if (!node) return -1;
+    *premoved = false;
+
+    if (node->pentry) {
+        mr_remove_retained_entry(prs, node->pentry);
+        *premoved = true;
+    }
+
+    pre->node = node;
+    pre->heap_idx = MR_NO_EXPIRY;
+    node->pentry = pre;
+    prs->message_count++;
+    prs->byte_count += pre->u8vlen;
+
+    if (pre->expiry_pos) {
+        pre->heap_idx = prs->heap_len++;
+        prs->heap[pre->heap_idx] = pre;
+        mr_sift_retained_entry(prs, pre->heap_idx);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Remove the topic's retained message if it has one; set *premoved if so.
+ */
+void mr_drop_retained_topic(mr_retained_store *prs, const char *topic_name, const size_t len, bool *premoved) {
+    mr_retained_node *node = mr_find_retained_node(prs, topic_name, len);
+    *premoved = node && node->pentry;
+
+    if (*premoved) {
+        mr_remove_retained_entry(prs, node->pentry);
+        mr_prune_retained_nodes(prs, node);
+    }
+}
+
+// pack a PUBLISH as retained: retain set, dup cleared, with its topic name & without a topic alias
+static int mr_pack_retained_entry(mr_packet_ctx *pctx, mr_retained_entry **ppre) {
+    size_t u8vlen;
+    if (mr_get_packed_size(pctx, &u8vlen)) return -1;
+    mr_retained_entry *pre;
+    if (mr_malloc((void **)&pre, sizeof(mr_retained_entry) + u8vlen)) return -1;
+    pre->u8v0 = pre->u8v;
+
+    size_t alias_pos;
+    mr_publish_peek peek;
+
+    if (
+        mr_pack_any_packet_into(pctx, pre->u8v, u8vlen, &pre->u8vlen)
+        || mr_find_publish_property(pre->u8v, pre->u8vlen, MQTT_PROP_TOPIC_ALIAS, &alias_pos)
+        || mr_find_publish_property(pre->u8v, pre->u8vlen, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, &pre->expiry_pos)
+        || mr_peek_publish(pre->u8v, pre->u8vlen, &peek)
+    ) {
+        mr_free(pre);
+        return -1;
+    }
+
+    if (alias_pos) {
+        mr_free(pre);
+        return mr_retained_invalid(PUBLISH_TOPIC_ALIAS, MQTT_RC_PROTOCOL_ERROR, "topic alias present");
+    }
+
+    pre->u8v[0] = (pre->u8v[0] & ~0x08) | 0x01; // dup off, retain on
+    pre->topic_name_pos = peek.topic_name - (const char *)pre->u8v;
+    pre->topic_name_len = peek.topic_name_len;
+    pre->expiry = 0;
+    *ppre = pre;
+    return 0;
+}
+
+/**
+ * @brief Retain a PUBLISH, replacing the topic's retained message; an empty payload removes it.
+ *
+ * The packet is packed once into the store with retain set & dup cleared, ready to resend. It must
+ * carry its topic name: a topic alias is per connection, so reset it first. Set *premoved when an
+ * existing message was replaced or removed. now is in seconds on the caller's clock, e.g. time(NULL);
+ * every call on a store must use the same clock. A persistent store logs the change first.
+ */
+int mr_retain_publish_packet(mr_retained_store *prs, mr_packet_ctx *pctx, const uint64_t now, bool *premoved) {
+    char *topic_name;
+    uint8_t *payload;
+    size_t payload_len;
+    if (mr_get_publish_topic_name(pctx, &topic_name)) return -1;
+    if (mr_get_publish_payload(pctx, &payload, &payload_len)) return -1;
+    const size_t topic_len = topic_name ? strlen(topic_name) : 0;
+
+    if (!topic_len) {
+        return mr_retained_invalid(PUBLISH_TOPIC_NAME, MQTT_RC_TOPIC_NAME_INVALID, "no topic name");
+    }
+
+    mr_retained_entry *pre;
+
+    if (!payload_len) { // a zero-length retained message removes the topic's
+        mr_retained_node *node = mr_find_retained_node(prs, topic_name, topic_len);
+        *premoved = false;
+        if (!node || !node->pentry) return 0;
+
+        if (prs->plog) { // log the removal as the empty PUBLISH itself
+            if (mr_pack_retained_entry(pctx, &pre)) return -1;
+            int rc = mr_append_retained_record(prs, pre);
+            mr_free(pre);
+            if (rc) return -1;
+        }
+
+        mr_drop_retained_topic(prs, topic_name, topic_len, premoved);
+        return 0;
+    }
+
+    if (mr_pack_retained_entry(pctx, &pre)) return -1;
+
+    if (pre->expiry_pos) {
+        const uint8_t *pu8 = pre->u8v + pre->expiry_pos;
+        pre->expiry = now + ((uint32_t)pu8[0] << 24 | pu8[1] << 16 | pu8[2] << 8 | pu8[3]);
+    }
+
+    if ((prs->plog && mr_append_retained_record(prs, pre)) || mr_put_retained_entry(prs, topic_name, topic_len, pre, premoved)) {
+        mr_free(pre);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Remove the messages expired at now; set their number in *pexpired_count.
+ */
+int mr_expire_retained(mr_retained_store *prs, const uint64_t now, size_t *pexpired_count) {
+    *pexpired_count = 0;
+
+    while (prs->heap_len && prs->heap[0]->expiry <= now) {
+        mr_retained_node *node = prs->heap[0]->node;
+        mr_remove_retained_entry(prs, prs->heap[0]);
+        mr_prune_retained_nodes(prs, node);
+        (*pexpired_count)++;
+    }
+
+    return 0;
+}
+
+// match: filter levels through the trie
+
+// call fn for a node's message unless it has expired, first setting its remaining expiry interval
+static int mr_match_retained_entry(const mr_retained_match_ctx *pmc, const mr_retained_node *node) {
+    mr_retained_entry *pre = node->pentry;
+    if (!pre) return 0;
+
+    if (pre->expiry_pos) {
+        if (pre->expiry <= pmc->now) return 0;
+        uint64_t remaining = pre->expiry - pmc->now;
+        uint8_t *pu8 = pre->u8v0 + pre->expiry_pos;
+        pu8[0] = remaining >> 24;
+        pu8[1] = remaining >> 16;
+        pu8[2] = remaining >> 8;
+        pu8[3] = remaining;
+    }
+
+    mr_retained_message rm = {
+        pre->u8v0, pre->u8vlen, (const char *)pre->u8v0 + pre->topic_name_pos, pre->topic_name_len
+    };
+
+    return pmc->fn(&rm, pmc->arg);
+}
+
+/**
+ * @brief Call visit for top & every node below it, stopping at a nonzero return, which is returned.
+ *
+ * skip_dollar skips top's children whose level starts with '$'. Iterative, as topic names may have
+ * tens of thousands of levels: back at a parent, its child is found again to resume after its slot.
+ */
+int mr_walk_retained_nodes(
+    const mr_retained_node *top, const bool skip_dollar, mr_retained_visit_fn visit, void *arg
+) {
+    const mr_retained_node *node = top;
+    size_t i = 0; // the next slot of node's children to visit
+    int rc;
+    if ((rc = visit(node, arg))) return rc;
+
+    while (true) {
+        const mr_retained_node *child = NULL;
+
+        for (; i < node->children_cap; i++) {
+            child = node->children[i];
+            if (child && !(skip_dollar && node == top && child->level_len && child->level[0] == '$')) break;
+            child = NULL;
+        }
+
+        if (child) {
+            node = child;
+            i = 0;
+            if ((rc = visit(node, arg))) return rc;
+            continue;
+        }
+
+        if (node == top) return 0;
+        mr_find_retained_child(node->parent, node->level, node->level_len, node->level_hash, &i);
+        i++;
+        node = node->parent;
+    }
+}
+
+static int mr_match_retained_visit(const mr_retained_node *node, void *arg) {
+    return mr_match_retained_entry((const mr_retained_match_ctx *)arg, node);
+}
+
+// level: the start of the next filter level to match; NULL once every level has been matched
+static int mr_match_retained_node(
+    const mr_retained_match_ctx *pmc, const mr_retained_node *node, const char *level
+) {
+    if (!level) return mr_match_retained_entry(pmc, node);
+    const char *slash = memchr(level, '/', pmc->end - level);
+    size_t level_len = (slash ? slash : pmc->end) - level;
+    const char *next = slash ? slash + 1 : NULL;
+
+    if (level_len == 1 && *level == '#') { // top's message & every one below it
+        return mr_walk_retained_nodes(node, node == pmc->root, mr_match_retained_visit, (void *)pmc);
+    }
+
+    if (level_len == 1 && *level == '+') {
+        for (size_t i = 0; i < node->children_cap; i++) {
+            const mr_retained_node *child = node->children[i];
+            if (!child || (node == pmc->root && child->level_len && child->level[0] == '$')) continue;
+            int rc = mr_match_retained_node(pmc, child, next);
+            if (rc) return rc;
+        }
+
+        return 0;
+    }
+
+    size_t i;
+    const mr_retained_node *child = mr_find_retained_child(
+        node, level, level_len, mr_level_hash(level, level_len), &i
+    );
+
+    return child ? mr_match_retained_node(pmc, child, next) : 0;
+}
+
+/**
+ * @brief Call fn for each unexpired retained message whose topic name matches a topic filter.
+ *
+ * Only the nodes the filter's levels can match are visited. Wildcards in the first level do not
+ * match topic names starting with '$'. Each message's message_expiry_interval is set to its
+ * remaining interval before fn is called, so the packed bytes can be sent as they are. fn returning
+ * nonzero stops the match & is returned. fn must not change the store, and the message is only
+ * valid until the store next changes. The topic filter is not NUL-terminated.
+ */
+int mr_match_retained(
+    mr_retained_store *prs,
+    const char *topic_filter,
+    const size_t len,
+    const uint64_t now,
+    mr_retained_fn fn,
+    void *arg
+) {
+    if (mr_check_topic_filter(topic_filter, len)) return -1;
+    mr_retained_match_ctx mc = {prs->root, topic_filter + len, now, fn, arg};
+    return mr_match_retained_node(&mc, prs->root, topic_filter);
+}
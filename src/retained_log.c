@@ -0,0 +1,678 @@
+// retained_log.c
+
+#define _POSIX_C_SOURCE 200809L // openat, fdopendir, fdatasync & mmap under strict C
+
+/**
+ * @file
+ * @brief Crash-safe persistence for a retained store: its PUBLISH frames in append-only segment files.
+ *
+ * Each change to a persistent store is appended to the active segment as a record: a small header,
+ * then the frame as packed, an empty payload recording a removal. Opening the store maps its
+ * segments & rebuilds the trie from the record headers & topic names, each message referencing its
+ * frame in the mapping rather than being unpacked or copied. A full segment is synced & sealed
+ * before the next one starts, so only the active segment can end in a torn record: only its records
+ * are checksummed at open, & a torn tail is cut off. Compaction rewrites the live messages to new
+ * sealed segments, the first marked as the base that supersedes every older segment.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <zlog.h>
+
+#include "mister_internal.h"
+
+#define MR_SEGMENT_MAGIC "MRRETSEG"
+#define MR_SEGMENT_VERSION 1
+#define MR_SEGMENT_SEALED 0x01  // synced & complete: data_len is set
+#define MR_SEGMENT_BASE 0x02    // written by compaction: supersedes every older segment
+#define MR_RECORD_MAGIC 0x4652524D // "MRRF" in little-endian order
+#define MR_SEGMENT_NAME_LEN 20  // 16 hex digits & ".seg"; ".tmp" follows while compaction writes it
+
+#define MR_RECORD_PAD(len) ((8 - (len) % 8) % 8)
+
+static int mr_retained_io_error(const char *op, const uint64_t seq) {
+    mr_errno = errno;
+    mr_log_error("retained log: %s failed: segment: %016llx; %d %s", op, (unsigned long long)seq, errno, strerror(errno));
+    return mr_set_error(MR_ERR_IO, MQTT_RC_UNSPECIFIED, MQTT_PUBLISH, -1, 0);
+}
+
+static int mr_retained_corrupt(const char *reason, const uint64_t seq, const size_t offset) {
+    mr_log_error("retained log: %s: segment: %016llx; offset: %lu", reason, (unsigned long long)seq, offset);
+    return mr_set_error(MR_ERR_VALUE, MQTT_RC_UNSPECIFIED, MQTT_PUBLISH, -1, offset);
+}
+
+static int mr_retained_not_persistent(void) {
+    mr_log_error("retained store is not persistent");
+    return mr_set_error(MR_ERR_VALUE, MQTT_RC_UNSPECIFIED, MQTT_PUBLISH, -1, 0);
+}
+
+static void mr_segment_name(char *name, const uint64_t seq, const bool tmp) {
+    snprintf(name, MR_SEGMENT_NAME_LEN + 5, "%016llx.seg%s", (unsigned long long)seq, tmp ? ".tmp" : "");
+}
+
+static bool mr_parse_segment_name(const char *name, uint64_t *pseq, bool *ptmp) {
+    size_t len = strlen(name);
+    if (len != MR_SEGMENT_NAME_LEN && len != MR_SEGMENT_NAME_LEN + 4) return false;
+    if (memcmp(name + 16, ".seg", 4) || (len > MR_SEGMENT_NAME_LEN && strcmp(name + 20, ".tmp"))) return false;
+    uint64_t seq = 0;
+
+    for (int i = 0; i < 16; i++) {
+        const char c = name[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (digit < 0) return false;
+        seq = seq << 4 | digit;
+    }
+
+    *pseq = seq;
+    *ptmp = len > MR_SEGMENT_NAME_LEN;
+    return true;
+}
+
+// create a segment with its header synced, the file offset after it; tmp: for compaction to publish
+static int mr_create_retained_segment(mr_retained_log *plog, const uint64_t seq, const bool tmp, int *pfd) {
+    char name[32];
+    mr_segment_name(name, seq, tmp);
+    int fd = openat(plog->dirfd, name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1) return mr_retained_io_error("create", seq);
+
+    mr_retained_segment_header hdr = {.version = MR_SEGMENT_VERSION, .seq = seq};
+    memcpy(hdr.magic, MR_SEGMENT_MAGIC, sizeof(hdr.magic));
+
+    if (
+        write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+        || fsync(fd)
+        || (!tmp && fsync(plog->dirfd))
+    ) {
+        int rc = mr_retained_io_error("create", seq);
+        close(fd);
+        unlinkat(plog->dirfd, name, 0);
+        return rc;
+    }
+
+    *pfd = fd;
+    return 0;
+}
+
+static int mr_start_retained_segment(mr_retained_log *plog, const uint64_t seq) {
+    if (mr_create_retained_segment(plog, seq, false, &plog->fd)) return -1;
+    plog->seq = seq;
+    plog->size = sizeof(mr_retained_segment_header);
+    plog->log_bytes += plog->size;
+    return 0;
+}
+
+// sync a segment's records, then mark it sealed with their length
+static int mr_seal_retained_segment(const int fd, const uint64_t seq, const uint32_t flags, const size_t size) {
+    mr_retained_segment_header hdr = {
+        .version = MR_SEGMENT_VERSION,
+        .flags = flags | MR_SEGMENT_SEALED,
+        .seq = seq,
+        .data_len = size - sizeof(mr_retained_segment_header)
+    };
+
+    memcpy(hdr.magic, MR_SEGMENT_MAGIC, sizeof(hdr.magic));
+
+    if (fdatasync(fd) || pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || fdatasync(fd)) {
+        return mr_retained_io_error("seal", seq);
+    }
+
+    return 0;
+}
+
+// append a message's record at the file offset, *psize; a partial record is cut off again
+static int mr_write_retained_record(const int fd, const uint64_t seq, const mr_retained_entry *pre, size_t *psize) {
+    static const uint8_t PAD[8];
+    mr_retained_record rec = {MR_RECORD_MAGIC, pre->u8vlen, pre->expiry_pos ? pre->expiry : 0, pre->expiry_pos, 0};
+    rec.crc = mr_crc32c(mr_crc32c(0, (const uint8_t *)&rec, sizeof(rec)), pre->u8v0, pre->u8vlen);
+
+    struct iovec iov[3] = {
+        {&rec, sizeof(rec)},
+        {pre->u8v0, pre->u8vlen},
+        {(void *)PAD, MR_RECORD_PAD(pre->u8vlen)}
+    };
+
+    const size_t len = sizeof(rec) + pre->u8vlen + MR_RECORD_PAD(pre->u8vlen);
+    ssize_t written = writev(fd, iov, 3);
+
+    if (written < 0 || (size_t)written != len) {
+        if (written >= 0) errno = ENOSPC;
+        int rc = mr_retained_io_error("append", seq);
+        if (!ftruncate(fd, *psize)) lseek(fd, *psize, SEEK_SET);
+        return rc;
+    }
+
+    *psize += len;
+    return 0;
+}
+
+/**
+ * @brief Log a message of a persistent store, or the removal of its topic's when the payload is empty.
+ *
+ * Once the active segment reaches the segment size it is sealed & the next one started; should
+ * that fail, the record still stands & the next append retries.
+ */
+int mr_append_retained_record(mr_retained_store *prs, const mr_retained_entry *pre) {
+    mr_retained_log *plog = prs->plog;
+    if (plog->fd == -1 && mr_start_retained_segment(plog, plog->seq + 1)) return -1;
+    const size_t size = plog->size;
+    if (mr_write_retained_record(plog->fd, plog->seq, pre, &plog->size)) return -1;
+    plog->log_bytes += plog->size - size;
+
+    if (plog->size >= plog->segment_size && !mr_seal_retained_segment(plog->fd, plog->seq, 0, plog->size)) {
+        close(plog->fd);
+        plog->fd = -1;
+        mr_start_retained_segment(plog, plog->seq + 1);
+    }
+
+    return 0;
+}
+
+// check the record at pos: its bounds & frame header, & its checksum if verify
+static int mr_check_retained_record(
+    const uint8_t *u8v0, const size_t pos, const size_t end, const bool verify, mr_retained_record *prec,
+    mr_publish_peek *ppeek
+) {
+    if (end - pos < sizeof(mr_retained_record)) return -1;
+    memcpy(prec, u8v0 + pos, sizeof(mr_retained_record));
+    const size_t avail = end - pos - sizeof(mr_retained_record);
+    if (prec->magic != MR_RECORD_MAGIC || (size_t)prec->u8vlen + MR_RECORD_PAD(prec->u8vlen) > avail) return -1;
+    const uint8_t *frame = u8v0 + pos + sizeof(mr_retained_record);
+
+    if (verify) {
+        mr_retained_record rec = *prec;
+        rec.crc = 0;
+        if (mr_crc32c(mr_crc32c(0, (const uint8_t *)&rec, sizeof(rec)), frame, rec.u8vlen) != prec->crc) return -1;
+    }
+
+    if (mr_peek_publish(frame, prec->u8vlen, ppeek) || !ppeek->topic_name_len) return -1;
+
+    if (
+        prec->expiry_pos
+        && (prec->expiry_pos < ppeek->properties_offset || prec->expiry_pos + 4 > ppeek->payload_offset)
+    ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// apply a record to the store: the topic's message becomes the frame, or is removed
+static int mr_replay_retained_record(
+    mr_retained_store *prs, uint8_t *frame, const mr_retained_record *prec, const mr_publish_peek *ppeek,
+    const uint64_t now
+) {
+    bool removed;
+
+    if (!ppeek->payload_len || (prec->expiry_pos && prec->expiry <= now)) {
+        mr_drop_retained_topic(prs, ppeek->topic_name, ppeek->topic_name_len, &removed);
+        return 0;
+    }
+
+    mr_retained_entry *pre;
+    if (mr_malloc((void **)&pre, sizeof(mr_retained_entry))) return -1;
+    pre->u8v0 = frame;
+    pre->u8vlen = prec->u8vlen;
+    pre->topic_name_pos = ppeek->topic_name - (const char *)frame;
+    pre->topic_name_len = ppeek->topic_name_len;
+    pre->expiry_pos = prec->expiry_pos;
+    pre->expiry = prec->expiry;
+
+    if (mr_put_retained_entry(prs, ppeek->topic_name, ppeek->topic_name_len, pre, &removed)) {
+        mr_free(pre);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int mr_add_retained_mapping(mr_retained_log *plog, uint8_t *u8v0, const size_t u8vlen) {
+    void *pv = plog->mappings;
+
+    if (mr_realloc(&pv, (plog->mapping_count + 1) * sizeof(mr_retained_mapping))) {
+        munmap(u8v0, u8vlen);
+        return -1;
+    }
+
+    plog->mappings = pv;
+    plog->mappings[plog->mapping_count++] = (mr_retained_mapping){u8v0, u8vlen};
+    return 0;
+}
+
+/**
+ * Map a segment & replay its records. A sealed segment's records are only checked for their bounds
+ * & frame headers. The last segment, unless sealed, stays open as the active one, its torn tail cut off.
+ */
+static int mr_load_retained_segment(mr_retained_store *prs, const uint64_t seq, const bool last, const uint64_t now) {
+    mr_retained_log *plog = prs->plog;
+    char name[32];
+    mr_segment_name(name, seq, false);
+    int fd = openat(plog->dirfd, name, O_RDWR | O_CLOEXEC);
+    if (fd == -1) return mr_retained_io_error("open", seq);
+    struct stat st;
+
+    if (fstat(fd, &st)) {
+        int rc = mr_retained_io_error("stat", seq);
+        close(fd);
+        return rc;
+    }
+
+    const size_t size = st.st_size;
+    mr_retained_segment_header hdr;
+
+    if (size < sizeof(hdr)) {
+        close(fd);
+        if (!last) return mr_retained_corrupt("no segment header", seq, 0);
+        unlinkat(plog->dirfd, name, 0); // its creation was interrupted
+        return 0;
+    }
+
+    uint8_t *u8v0 = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0); // writes stay private
+
+    if (u8v0 == MAP_FAILED) {
+        int rc = mr_retained_io_error("mmap", seq);
+        close(fd);
+        return rc;
+    }
+
+    if (mr_add_retained_mapping(plog, u8v0, size)) {
+        close(fd);
+        return -1;
+    }
+
+    memcpy(&hdr, u8v0, sizeof(hdr));
+    const bool sealed = hdr.flags & MR_SEGMENT_SEALED;
+
+    if (
+        memcmp(hdr.magic, MR_SEGMENT_MAGIC, sizeof(hdr.magic)) || hdr.version != MR_SEGMENT_VERSION
+        || hdr.seq != seq || (sealed && hdr.data_len > size - sizeof(hdr))
+    ) {
+        close(fd);
+        return mr_retained_corrupt("invalid segment header", seq, 0);
+    }
+
+    const size_t end = sealed ? sizeof(hdr) + hdr.data_len : size;
+    size_t pos = sizeof(hdr);
+
+    while (pos < end) {
+        mr_retained_record rec;
+        mr_publish_peek peek;
+
+        if (mr_check_retained_record(u8v0, pos, end, !sealed, &rec, &peek)) {
+            if (sealed || !last) {
+                close(fd);
+                return mr_retained_corrupt("invalid record", seq, pos);
+            }
+
+            dzlog_warn("retained log: torn tail cut off: segment: %016llx; offset: %lu", (unsigned long long)seq, pos);
+
+            if (ftruncate(fd, pos)) {
+                int rc = mr_retained_io_error("truncate", seq);
+                close(fd);
+                return rc;
+            }
+
+            break;
+        }
+
+        uint8_t *frame = u8v0 + pos + sizeof(rec);
+
+        if (mr_replay_retained_record(prs, frame, &rec, &peek, now)) {
+            close(fd);
+            return -1;
+        }
+
+        pos += sizeof(rec) + rec.u8vlen + MR_RECORD_PAD(rec.u8vlen);
+    }
+
+    plog->seq = seq;
+    plog->log_bytes += pos;
+
+    if (last && !sealed) {
+        if (lseek(fd, pos, SEEK_SET) == -1) {
+            int rc = mr_retained_io_error("seek", seq);
+            close(fd);
+            return rc;
+        }
+
+        plog->fd = fd;
+        plog->size = pos;
+        return 0;
+    }
+
+    close(fd);
+    return 0;
+}
+
+static int mr_compare_seqs(const void *pv1, const void *pv2) {
+    const uint64_t seq1 = *(const uint64_t *)pv1;
+    const uint64_t seq2 = *(const uint64_t *)pv2;
+    return (seq1 > seq2) - (seq1 < seq2);
+}
+
+// the segments in the directory, in order; the files of an interrupted compaction are removed
+static int mr_list_retained_segments(mr_retained_log *plog, uint64_t **pseqs, size_t *pseq_count) {
+    int fd = dup(plog->dirfd);
+    DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+
+    if (!dir) {
+        int rc = mr_retained_io_error("list", 0);
+        if (fd != -1) close(fd);
+        return rc;
+    }
+
+    uint64_t *seqs = NULL;
+    size_t seq_count = 0;
+    struct dirent *de;
+
+    while ((de = readdir(dir))) {
+        uint64_t seq;
+        bool tmp;
+        if (!mr_parse_segment_name(de->d_name, &seq, &tmp)) continue;
+
+        if (tmp) {
+            unlinkat(plog->dirfd, de->d_name, 0);
+            continue;
+        }
+
+        void *pv = seqs;
+
+        if (mr_realloc(&pv, (seq_count + 1) * sizeof(uint64_t))) {
+            mr_free(seqs);
+            closedir(dir);
+            return -1;
+        }
+
+        seqs = pv;
+        seqs[seq_count++] = seq;
+    }
+
+    closedir(dir);
+    if (seq_count) qsort(seqs, seq_count, sizeof(uint64_t), mr_compare_seqs);
+    *pseqs = seqs;
+    *pseq_count = seq_count;
+    return 0;
+}
+
+// a segment's header flags; 0 if it cannot be read, for loading to report
+static uint32_t mr_retained_segment_flags(mr_retained_log *plog, const uint64_t seq) {
+    char name[32];
+    mr_segment_name(name, seq, false);
+    int fd = openat(plog->dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+    mr_retained_segment_header hdr;
+    bool ok = pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && !memcmp(hdr.magic, MR_SEGMENT_MAGIC, sizeof(hdr.magic));
+    close(fd);
+    return ok ? hdr.flags : 0;
+}
+
+/**
+ * @brief Open a persistent retained store in an existing directory, loading the messages saved there.
+ *
+ * Messages that expired by now are not loaded. Each change to the store is then appended to the
+ * directory's active segment; a segment is sealed & the next started once it reaches segment_size
+ * bytes, 0 for MR_RETAINED_SEGMENT_SIZE. Appends survive the process crashing; call
+ * mr_sync_retained_store() for them to survive the system crashing. now & every expiry must be on a
+ * clock that persists too, e.g. time(NULL). Only one store may have the directory open.
+ */
+int mr_open_retained_store(mr_retained_store **pprs, const char *dir, const size_t segment_size, const uint64_t now) {
+    mr_retained_store *prs;
+    if (mr_init_retained_store(&prs)) return -1;
+
+    if (mr_calloc((void **)&prs->plog, 1, sizeof(mr_retained_log))) {
+        mr_free_retained_store(prs);
+        return -1;
+    }
+
+    mr_retained_log *plog = prs->plog;
+    plog->fd = -1;
+    plog->segment_size = segment_size ? segment_size : MR_RETAINED_SEGMENT_SIZE;
+    plog->dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    uint64_t *seqs = NULL;
+    size_t seq_count = 0;
+
+    if (plog->dirfd == -1) {
+        int rc = mr_retained_io_error("open directory", 0);
+        mr_free_retained_store(prs);
+        return rc;
+    }
+
+    if (mr_list_retained_segments(plog, &seqs, &seq_count)) {
+        mr_free_retained_store(prs);
+        return -1;
+    }
+
+    size_t first = seq_count ? seq_count - 1 : 0; // the newest base supersedes every older segment
+    while (first && !(mr_retained_segment_flags(plog, seqs[first]) & MR_SEGMENT_BASE)) first--;
+    for (size_t i = 0; i < first; i++) mr_unlink_retained_segments(plog, seqs[i], seqs[i], false);
+    plog->first_seq = seq_count ? seqs[first] : 1;
+
+    for (size_t i = first; i < seq_count; i++) {
+        if (mr_load_retained_segment(prs, seqs[i], i == seq_count - 1, now)) {
+            mr_free(seqs);
+            mr_free_retained_store(prs);
+            return -1;
+        }
+    }
+
+    mr_free(seqs);
+
+    if (plog->fd == -1 && mr_start_retained_segment(plog, plog->seq + 1)) {
+        mr_free_retained_store(prs);
+        return -1;
+    }
+
+    *pprs = prs;
+    return 0;
+}
+
+// close the files & unmap the segments; the store's messages must not be used after
+void mr_close_retained_log(mr_retained_store *prs) {
+    mr_retained_log *plog = prs->plog;
+    if (plog->fd != -1) close(plog->fd);
+    if (plog->dirfd != -1) close(plog->dirfd);
+    for (size_t i = 0; i < plog->mapping_count; i++) munmap(plog->mappings[i].u8v0, plog->mappings[i].u8vlen);
+    mr_free(plog->mappings);
+    mr_free(plog);
+    prs->plog = NULL;
+}
+
+/**
+ * @brief Sync the active segment, so the changes logged so far survive a system crash.
+ */
+int mr_sync_retained_store(mr_retained_store *prs) {
+    if (!prs->plog) return mr_retained_not_persistent();
+    if (prs->plog->fd != -1 && fdatasync(prs->plog->fd)) return mr_retained_io_error("sync", prs->plog->seq);
+    return 0;
+}
+
+/**
+ * @brief Set the bytes in the store's segment files; compare with the store's byte count to decide
+ * when to compact.
+ */
+int mr_get_retained_log_size(mr_retained_store *prs, size_t *plog_bytes) {
+    if (!prs->plog) return mr_retained_not_persistent();
+    *plog_bytes = prs->plog->log_bytes;
+    return 0;
+}
+
+// compaction: the live messages rewritten in trie order, then referenced in the new segments
+
+static int mr_compact_retained_visit(const mr_retained_node *node, void *arg) {
+    mr_retained_compaction *pcn = (mr_retained_compaction *)arg;
+    if (!node->pentry) return 0;
+
+    if (pcn->size >= pcn->plog->segment_size) {
+        if (mr_seal_retained_segment(pcn->fd, pcn->seq, pcn->flags, pcn->size)) return -1;
+        close(pcn->fd);
+        pcn->fd = -1;
+        pcn->log_bytes += pcn->size;
+        pcn->flags = 0;
+        if (mr_create_retained_segment(pcn->plog, ++pcn->seq, true, &pcn->fd)) return -1;
+        pcn->size = sizeof(mr_retained_segment_header);
+    }
+
+    return mr_write_retained_record(pcn->fd, pcn->seq, node->pentry, &pcn->size);
+}
+
+// point a message at its frame in the new segments, shrinking it if it held its own copy
+static int mr_repoint_retained_visit(const mr_retained_node *node, void *arg) {
+    mr_retained_repoint *prp = (mr_retained_repoint *)arg;
+    mr_retained_entry *pre = node->pentry;
+    if (!pre) return 0;
+
+    if (prp->pos >= prp->prs->plog->segment_size) { // as compaction moved to its next segment
+        prp->mapping_idx++;
+        prp->pos = sizeof(mr_retained_segment_header);
+    }
+
+    uint8_t *frame = prp->mappings[prp->mapping_idx].u8v0 + prp->pos + sizeof(mr_retained_record);
+    prp->pos += sizeof(mr_retained_record) + pre->u8vlen + MR_RECORD_PAD(pre->u8vlen);
+
+    if (pre->u8v0 == pre->u8v) {
+        void *pv = pre;
+
+        if (!mr_realloc(&pv, sizeof(mr_retained_entry))) {
+            pre = pv;
+            pre->node->pentry = pre;
+            if (pre->expiry_pos) prp->prs->heap[pre->heap_idx] = pre;
+        }
+    }
+
+    pre->u8v0 = frame;
+    return 0;
+}
+
+static int mr_map_retained_segments(
+    mr_retained_log *plog, const uint64_t first_seq, const uint64_t last_seq, mr_retained_mapping **pmappings
+) {
+    mr_retained_mapping *mappings;
+    if (mr_calloc((void **)&mappings, last_seq - first_seq + 1, sizeof(mr_retained_mapping))) return -1;
+
+    for (uint64_t seq = first_seq; seq <= last_seq; seq++) {
+        char name[32];
+        mr_segment_name(name, seq, false);
+        int fd = openat(plog->dirfd, name, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        mr_retained_mapping *pmap = mappings + (seq - first_seq);
+        int rc = fd == -1 || fstat(fd, &st) ? -1 : 0;
+
+        if (!rc) {
+            pmap->u8vlen = st.st_size;
+            pmap->u8v0 = mmap(NULL, pmap->u8vlen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (pmap->u8v0 == MAP_FAILED) rc = -1;
+        }
+
+        if (rc) {
+            rc = mr_retained_io_error("map", seq);
+            if (fd != -1) close(fd);
+
+            for (mr_retained_mapping *pm = mappings; pm < pmap; pm++) munmap(pm->u8v0, pm->u8vlen);
+            mr_free(mappings);
+            return rc;
+        }
+
+        close(fd);
+    }
+
+    *pmappings = mappings;
+    return 0;
+}
+
+static void mr_unlink_retained_segments(
+    mr_retained_log *plog, const uint64_t first_seq, const uint64_t last_seq, const bool tmp
+) {
+    for (uint64_t seq = first_seq; seq <= last_seq; seq++) {
+        char name[32];
+        mr_segment_name(name, seq, tmp);
+        unlinkat(plog->dirfd, name, 0);
+    }
+}
+
+/**
+ * @brief Rewrite the store's live messages to new segments & remove the old ones.
+ *
+ * Expired messages are removed first & the active segment is sealed. The new segments are written &
+ * synced under temporary names, then published newest first, the directory synced before the first,
+ * the base, is published: until then the old segments stay in force, & once it is they are
+ * superseded. The messages then reference their frames in the new segments, so those they held
+ * copies of shrink to their headers. Should publishing fail, appends go to a segment after the new
+ * ones, which stand in for the old ones whether or not the base was published.
+ */
+int mr_compact_retained_store(mr_retained_store *prs, const uint64_t now) {
+    if (!prs->plog) return mr_retained_not_persistent();
+    mr_retained_log *plog = prs->plog;
+    size_t expired_count;
+    if (mr_expire_retained(prs, now, &expired_count)) return -1;
+
+    if (plog->fd != -1) { // else a rollover failed & the last segment is sealed
+        if (mr_seal_retained_segment(plog->fd, plog->seq, 0, plog->size)) return -1;
+        close(plog->fd);
+        plog->fd = -1; // the next append starts a segment, should compaction fail
+    }
+
+    const uint64_t first_seq = plog->seq + 1;
+    mr_retained_compaction cn = {plog, -1, first_seq, sizeof(mr_retained_segment_header), MR_SEGMENT_BASE, 0};
+
+    if (
+        mr_create_retained_segment(plog, cn.seq, true, &cn.fd)
+        || mr_walk_retained_nodes(prs->root, false, mr_compact_retained_visit, &cn)
+        || mr_seal_retained_segment(cn.fd, cn.seq, cn.flags, cn.size)
+    ) {
+        if (cn.fd != -1) close(cn.fd);
+        mr_unlink_retained_segments(plog, first_seq, cn.seq, true);
+        return -1;
+    }
+
+    close(cn.fd);
+    cn.log_bytes += cn.size;
+
+    for (uint64_t seq = cn.seq; seq >= first_seq; seq--) { // the base last, once the others are durable
+        char tmp_name[32], name[32];
+        mr_segment_name(tmp_name, seq, true);
+        mr_segment_name(name, seq, false);
+
+        if (
+            (seq == first_seq && seq < cn.seq && fsync(plog->dirfd))
+            || renameat(plog->dirfd, tmp_name, plog->dirfd, name)
+        ) {
+            int rc = mr_retained_io_error("publish", seq);
+            mr_unlink_retained_segments(plog, first_seq, seq, true);
+            plog->seq = cn.seq; // after any of the new segments a crash leaves behind
+            plog->log_bytes += cn.log_bytes;
+            return rc;
+        }
+    }
+
+    if (fsync(plog->dirfd)) { // the base may or may not survive a crash: the old segments stay too
+        plog->seq = cn.seq;
+        plog->log_bytes += cn.log_bytes;
+        return mr_retained_io_error("publish", first_seq);
+    }
+
+    // the base is in force: the old segments go, though their mappings stay while referenced
+    mr_unlink_retained_segments(plog, plog->first_seq, plog->seq, false);
+    plog->first_seq = first_seq;
+    plog->seq = cn.seq;
+    plog->log_bytes = cn.log_bytes;
+    mr_retained_mapping *mappings = NULL;
+
+    if (!mr_map_retained_segments(plog, first_seq, cn.seq, &mappings)) {
+        mr_retained_repoint rp = {prs, mappings, 0, sizeof(mr_retained_segment_header)};
+        mr_walk_retained_nodes(prs->root, false, mr_repoint_retained_visit, &rp);
+        for (size_t i = 0; i < plog->mapping_count; i++) munmap(plog->mappings[i].u8v0, plog->mappings[i].u8vlen);
+        mr_free(plog->mappings);
+        plog->mappings = mappings;
+        plog->mapping_count = cn.seq - first_seq + 1;
+    }
+
+    return mr_start_retained_segment(plog, cn.seq + 1);
+}
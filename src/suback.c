@@ -8,42 +8,26 @@
 
 #include "mister_internal.h"
 
-enum SUBACK_MDATA_FIELDS { // Same order as SUBACK_MDATA_TEMPLATE
-    SUBACK_PACKET_TYPE,
-    SUBACK_RESERVED_HEADER,
-    SUBACK_MR_HEADER,
-    SUBACK_REMAINING_LENGTH,
-    SUBACK_PROPERTY_LENGTH,
-    SUBACK_MR_PROPERTIES,
-    SUBACK_REASON_STRING,
-    SUBACK_USER_PROPERTIES,
-    SUBACK_SUBSCRIBE_REASON_CODES
+static const bool VALID_SUBSCRIBE_REASON_CODES[256] = { // indexed by reason code
+    [MQTT_RC_SUCCESS]                                = true,
+    [MQTT_RC_GRANTED_QOS1]                           = true,
+    [MQTT_RC_GRANTED_QOS2]                           = true,
+    [MQTT_RC_UNSPECIFIED]                            = true,
+    [MQTT_RC_IMPLEMENTATION_SPECIFIC]                = true,
+    [MQTT_RC_NOT_AUTHORIZED]                         = true,
+    [MQTT_RC_TOPIC_FILTER_INVALID]                   = true,
+    [MQTT_RC_PACKET_ID_IN_USE]                       = true,
+    [MQTT_RC_QUOTA_EXCEEDED]                         = true,
+    [MQTT_RC_SHARED_SUBSCRIPTIONS_NOT_SUPPORTED]     = true,
+    [MQTT_RC_SUBSCRIPTION_IDENTIFIERS_NOT_SUPPORTED] = true,
+    [MQTT_RC_WILDCARD_SUBSCRIPTIONS_NOT_SUPPORTED]   = true
 };
 
-static const uint8_t VALID_SUBSCRIBE_REASON_CODES[] = {
-    MQTT_RC_SUCCESS,
-    MQTT_RC_GRANTED_QOS1,
-    MQTT_RC_GRANTED_QOS2,
-    MQTT_RC_UNSPECIFIED,
-    MQTT_RC_IMPLEMENTATION_SPECIFIC,
-    MQTT_RC_NOT_AUTHORIZED,
-    MQTT_RC_TOPIC_FILTER_INVALID,
-    MQTT_RC_PACKET_ID_IN_USE,
-    MQTT_RC_QUOTA_EXCEEDED,
-    MQTT_RC_SHARED_SUBSCRIPTIONS_NOT_SUPPORTED,
-    MQTT_RC_SUBSCRIPTION_IDENTIFIERS_NOT_SUPPORTED,
-    MQTT_RC_WILDCARD_SUBSCRIPTIONS_NOT_SUPPORTED,
+static const uint8_t PROP_IDX[256] = { // property id -> mdata idx; 0: not a SUBACK property
+    [MQTT_PROP_REASON_STRING] = SUBACK_REASON_STRING,
+    [MQTT_PROP_USER_PROPERTY] = SUBACK_USER_PROPERTIES
 };
 
-static const size_t VSRCSZ = sizeof(VALID_SUBSCRIBE_REASON_CODES) / sizeof(VALID_SUBSCRIBE_REASON_CODES[0]);
-
-static const uint8_t PROPS[] = {
-    MQTT_PROP_REASON_STRING,
-    MQTT_PROP_USER_PROPERTY,
-};
-
-static const size_t PSZ = sizeof(PROPS) / sizeof(PROPS[0]);
-
 #define NA 0
 
 static const uintptr_t MR_SUBACK_HEADER = MQTT_SUBACK << 4;
@@ -59,7 +43,7 @@ static const mr_mdata SUBACK_MDATA_TEMPLATE[] = {
     {"mr_header",               MR_BITFLD_DTYPE,    MR_SUBACK_HEADER,   NA,     1,      1,      true,   NA,                             NA,                     NA,                     SUBACK_MR_HEADER,               NULL},
     {"remaining_length",        MR_VBI_DTYPE,       0,                  NA,     0,      0,      true,   SUBACK_SUBSCRIBE_REASON_CODES,  NA,                     NA,                     SUBACK_REMAINING_LENGTH,        NULL},
     {"property_length",         MR_VBI_DTYPE,       0,                  NA,     0,      0,      true,   SUBACK_USER_PROPERTIES,         NA,                     NA,                     SUBACK_PROPERTY_LENGTH,         NULL},
-    {"mr_properties",           MR_PROPERTIES_DTYPE,(uintptr_t)PROPS,   NA,     PSZ,    NA,     true,   NA,                             NA,                     NA,                     SUBACK_MR_PROPERTIES,           NULL},
+    {"mr_properties",           MR_PROPERTIES_DTYPE,(uintptr_t)PROP_IDX,NA,     NA,     NA,     true,   NA,                             NA,                     NA,                     SUBACK_MR_PROPERTIES,           NULL},
     {"reason_string",           MR_STR_DTYPE,       (uintptr_t)NULL,    false,  0,      0,      false,  NA,                             MQTT_PROP_REASON_STRING,NA,                     SUBACK_REASON_STRING,           NULL},
     {"user_properties",         MR_SPV_DTYPE,       (uintptr_t)NULL,    false,  0,      0,      false,  NA,                             MQTT_PROP_USER_PROPERTY,NA,                     SUBACK_USER_PROPERTIES,         NULL},
     {"subscribe_reason_codes",  MR_PAYLOAD_DTYPE,   (uintptr_t)MR_RCV,  false,  RCVSZ,  RCVSZ,  true,   NA,                             NA,                     NA,                     SUBACK_SUBSCRIBE_REASON_CODES,  NULL},
@@ -73,7 +57,25 @@ int mr_init_suback_packet(mr_packet_ctx **ppctx) {
 }
 
 int mr_init_unpack_suback_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen) {
-    return mr_init_unpack_packet(ppctx, SUBACK_MDATA_TEMPLATE, SUBACK_MDATA_COUNT, u8v0, u8vlen);
+    return mr_init_unpack_packet(ppctx, SUBACK_MDATA_TEMPLATE, SUBACK_MDATA_COUNT, u8v0, u8vlen, MR_UNPACK_COPY, 0);
+}
+
+int mr_init_unpack_suback_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+) {
+    return mr_init_unpack_packet(ppctx, SUBACK_MDATA_TEMPLATE, SUBACK_MDATA_COUNT, u8v0, u8vlen, unpack_flags, 0);
+}
+
+int mr_init_unpack_suback_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+) {
+    return mr_init_unpack_packet(
+        ppctx, SUBACK_MDATA_TEMPLATE, SUBACK_MDATA_COUNT, u8v0, u8vlen, unpack_flags, field_mask
+    );
+}
+
+int mr_validate_suback_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code) {
+    return mr_validate_packet(SUBACK_MDATA_TEMPLATE, SUBACK_MDATA_COUNT, u8v0, u8vlen, preason_code);
 }
 
 static int mr_check_suback_packet(mr_packet_ctx *pctx) {
@@ -81,8 +83,8 @@ static int mr_check_suback_packet(mr_packet_ctx *pctx) {
         return 0;
     }
     else {
-        dzlog_info("Packet Context is not a SUBACK packet");
-        return -1;
+        mr_log_error("Packet Context is not a SUBACK packet:: packet name: %s", pctx->mqtt_packet_name);
+        return mr_set_error(MR_ERR_PACKET_TYPE, MQTT_RC_UNSPECIFIED, pctx->mqtt_packet_type, -1, 0);
     }
 }
 
@@ -164,14 +166,14 @@ int mr_get_suback_subscribe_reason_codes(mr_packet_ctx *pctx, uint8_t **pu8v0, s
 
 static int mr_validate_suback_subscribe_reason_codes(const uint8_t *u8v0, const size_t len) {
     if (!u8v0 || len < 1) {
-        dzlog_error("subscribe_reason_codes must exist and there must be at least 1");
+        mr_log_error("subscribe_reason_codes must exist and there must be at least 1");
         return -1;
     }
 
     uint8_t *pu8 = (uint8_t *)u8v0;
     for (int i = 0; i < len; i++, pu8++) {
-        if (!memchr(VALID_SUBSCRIBE_REASON_CODES, *pu8, VSRCSZ)) {
-            dzlog_error("invalid puback_reason_code: offset: %u; value: %u", i, *pu8);
+        if (!VALID_SUBSCRIBE_REASON_CODES[*pu8]) {
+            mr_log_error("invalid puback_reason_code: offset: %u; value: %u", i, *pu8);
             return -1;
         }
     }
@@ -196,14 +198,14 @@ static int mr_validate_suback_cross(mr_packet_ctx *pctx) {
     if (mr_get_suback_subscribe_reason_codes(pctx, &u8v0, &len, &exists_flag)) return -1;
 
     if (!exists_flag || !u8v0 || len < 1) {
-        dzlog_error("subscribe_reason_codes must exist and there must be at least 1");
+        mr_log_error("subscribe_reason_codes must exist and there must be at least 1");
         return -1;
     }
 
     return 0;
 }
  */
-static int mr_validate_suback_pack(mr_packet_ctx *pctx) {
+int mr_validate_suback_pack(mr_packet_ctx *pctx) {
     // if (mr_validate_suback_cross(pctx)) return -1;
     return 0;
 }
@@ -215,7 +217,7 @@ int mr_validate_suback_unpack(mr_packet_ctx *pctx) {
     bool exists_flag;
 
     if (mr_get_suback_subscribe_reason_codes(pctx, &u8v0, &len, &exists_flag)) return -1;
-    if (mr_validate_suback_subscribe_reason_codes(u8v0, len)) return -1;
+    if (mr_validate_suback_subscribe_reason_codes(u8v0, len)) return mr_reject(pctx, SUBACK_SUBSCRIBE_REASON_CODES, MQTT_RC_PROTOCOL_ERROR);
     // if (mr_validate_suback_cross(pctx)) return -1;
     return 0;
 }
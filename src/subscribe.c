@@ -8,25 +8,11 @@
 
 #include "mister_internal.h"
 
-enum SUBSCRIBE_MDATA_FIELDS { // Same order as SUBSCRIBE_MDATA_TEMPLATE
-    SUBSCRIBE_PACKET_TYPE,
-    SUBSCRIBE_RESERVED_HEADER,
-    SUBSCRIBE_MR_HEADER,
-    SUBSCRIBE_REMAINING_LENGTH,
-    SUBSCRIBE_PACKET_IDENTIFIER,
-    SUBSCRIBE_PROPERTY_LENGTH,
-    SUBSCRIBE_MR_PROPERTIES,
-    SUBSCRIBE_SUBSCRIPTION_IDENTIFIER,
-    SUBSCRIBE_USER_PROPERTIES,
-    SUBSCRIBE_TOPIC_FILTERS
+static const uint8_t PROP_IDX[256] = { // property id -> mdata idx; 0: not a SUBSCRIBE property
+    [MQTT_PROP_SUBSCRIPTION_IDENTIFIER] = SUBSCRIBE_SUBSCRIPTION_IDENTIFIER,
+    [MQTT_PROP_USER_PROPERTY]           = SUBSCRIBE_USER_PROPERTIES
 };
 
-static const uint8_t PROPS[] = {
-    MQTT_PROP_SUBSCRIPTION_IDENTIFIER,
-    MQTT_PROP_USER_PROPERTY
-};
-static const size_t PSZ = sizeof(PROPS) / sizeof(PROPS[0]);
-
 #define NA 0
 
 static const uintptr_t MR_SUBSCRIBE_HEADER = (MQTT_SUBSCRIBE << 4) | 0x02;
@@ -53,7 +39,7 @@ static const mr_mdata SUBSCRIBE_MDATA_TEMPLATE[] = {
     {"remaining_length",        MR_VBI_DTYPE,       0,                  NA,     0,      0,      true,   SUBSCRIBE_TOPIC_FILTERS,    NA,                                 NA,     SUBSCRIBE_REMAINING_LENGTH,         NULL},
     {"packet_identifier",       MR_U16_DTYPE,       0,                  NA,     2,      2,      true,   NA,                         NA,                                 NA,     SUBSCRIBE_PACKET_IDENTIFIER,        NULL},
     {"property_length",         MR_VBI_DTYPE,       0,                  NA,     0,      0,      true,   SUBSCRIBE_USER_PROPERTIES,  NA,                                 NA,     SUBSCRIBE_PROPERTY_LENGTH,          NULL},
-    {"mr_properties",           MR_PROPERTIES_DTYPE,(uintptr_t)PROPS,   NA,     PSZ,    NA,     true,   NA,                         NA,                                 NA,     SUBSCRIBE_MR_PROPERTIES,            NULL},
+    {"mr_properties",           MR_PROPERTIES_DTYPE,(uintptr_t)PROP_IDX,NA,     NA,     NA,     true,   NA,                         NA,                                 NA,     SUBSCRIBE_MR_PROPERTIES,            NULL},
     {"subscription_identifier", MR_VBI_DTYPE,       0,                  NA,     0,      0,      false,  NA,                         MQTT_PROP_SUBSCRIPTION_IDENTIFIER,  NA,     SUBSCRIBE_SUBSCRIPTION_IDENTIFIER,  NULL},
     {"user_properties",         MR_SPV_DTYPE,       (uintptr_t)NULL,    false,  0,      0,      false,  NA,                         MQTT_PROP_USER_PROPERTY,            NA,     SUBSCRIBE_USER_PROPERTIES,          NULL},
     {"topic_filters",           MR_TFV_DTYPE,       (uintptr_t)MR_TFS,  false,  TFSSZ,  TFSU8,  true,   NA,                         NA,                                 NA,     SUBSCRIBE_TOPIC_FILTERS,            NULL},
@@ -67,7 +53,25 @@ int mr_init_subscribe_packet(mr_packet_ctx **ppctx) {
 }
 
 int mr_init_unpack_subscribe_packet(mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen) {
-    return mr_init_unpack_packet(ppctx, SUBSCRIBE_MDATA_TEMPLATE, SUBSCRIBE_MDATA_COUNT, u8v0, u8vlen);
+    return mr_init_unpack_packet(ppctx, SUBSCRIBE_MDATA_TEMPLATE, SUBSCRIBE_MDATA_COUNT, u8v0, u8vlen, MR_UNPACK_COPY, 0);
+}
+
+int mr_init_unpack_subscribe_packet_flags(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags
+) {
+    return mr_init_unpack_packet(ppctx, SUBSCRIBE_MDATA_TEMPLATE, SUBSCRIBE_MDATA_COUNT, u8v0, u8vlen, unpack_flags, 0);
+}
+
+int mr_init_unpack_subscribe_packet_fields(
+    mr_packet_ctx **ppctx, const uint8_t *u8v0, const size_t u8vlen, const int unpack_flags, const uint64_t field_mask
+) {
+    return mr_init_unpack_packet(
+        ppctx, SUBSCRIBE_MDATA_TEMPLATE, SUBSCRIBE_MDATA_COUNT, u8v0, u8vlen, unpack_flags, field_mask
+    );
+}
+
+int mr_validate_subscribe_packet_bytes(const uint8_t *u8v0, const size_t u8vlen, uint8_t *preason_code) {
+    return mr_validate_packet(SUBSCRIBE_MDATA_TEMPLATE, SUBSCRIBE_MDATA_COUNT, u8v0, u8vlen, preason_code);
 }
 
 static int mr_check_subscribe_packet(mr_packet_ctx *pctx) {
@@ -75,8 +79,8 @@ static int mr_check_subscribe_packet(mr_packet_ctx *pctx) {
         return 0;
     }
     else {
-        dzlog_info("Packet Context is not a SUBSCRIBE packet");
-        return -1;
+        mr_log_error("Packet Context is not a SUBSCRIBE packet:: packet name: %s", pctx->mqtt_packet_name);
+        return mr_set_error(MR_ERR_PACKET_TYPE, MQTT_RC_UNSPECIFIED, pctx->mqtt_packet_type, -1, 0);
     }
 }
 
@@ -138,7 +142,7 @@ int mr_get_subscribe_subscription_identifier(mr_packet_ctx *pctx, uint32_t *pu32
 
 static int mr_validate_subscribe_subscription_identifier(const uint32_t u32) {
     if (u32 == 0) {
-        dzlog_error("subscription_identifier must be > 0");
+        mr_log_error("subscription_identifier must be > 0");
         return -1;
     }
 
@@ -192,14 +196,14 @@ static int mr_validate_subscribe_cross(mr_packet_ctx *pctx) {
     if (mr_get_subscribe_topic_filters(pctx, &tfv0, &len, &exists_flag)) return -1;
 
     if (!exists_flag || len < 1) {
-        dzlog_error("topic_filters must exist and be > 0");
+        mr_log_error("topic_filters must exist and be > 0");
         return -1;
     }
 
     return 0;
 }
 
-static int mr_validate_subscribe_pack(mr_packet_ctx *pctx) {
+int mr_validate_subscribe_pack(mr_packet_ctx *pctx) {
     if (mr_validate_subscribe_cross(pctx)) return -1;
     return 0;
 }
@@ -210,7 +214,7 @@ int mr_validate_subscribe_unpack(mr_packet_ctx *pctx) {
     bool exists_flag;
 
     if (mr_get_subscribe_subscription_identifier(pctx, &u32, &exists_flag)) return -1;
-    if (exists_flag && mr_validate_subscribe_subscription_identifier(u32)) return -1;
+    if (exists_flag && mr_validate_subscribe_subscription_identifier(u32)) return mr_reject(pctx, SUBSCRIBE_SUBSCRIPTION_IDENTIFIER, MQTT_RC_PROTOCOL_ERROR);
 
     return 0;
 }
@@ -0,0 +1,637 @@
+// subscription.c
+
+/**
+ * @file
+ * @brief Subscription index: topic filters with their subscribers, matched against topic names.
+ *
+ * Filters are stored in a trie with one node per topic level. A node finds its literal children by
+ * hashing the level, and keeps its '+' & '#' children aside, so matching a topic name of n levels
+ * visits at most the nodes along the matching paths. Matching calls back per subscription and does
+ * not allocate.
+ *
+ * The index is read-mostly: matching takes no lock, while subscribes & unsubscribes take the
+ * index's writer lock. A writer never changes memory a reader may be traversing except by atomic
+ * pointer stores: a grown slot table, a replaced subscription or a pruned node is published whole
+ * & the old one retired. Retired memory is freed after a grace period: the writer advances the
+ * index's epoch & waits until no reader that entered under the previous epoch is still matching.
+ * Readers announce themselves in one of several counter stripes, so they do not share a cache line.
+*/
+
+#define _POSIX_C_SOURCE 200809L // sched_yield under strict C
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <zlog.h>
+
+#include "mister_internal.h"
+
+#define MR_LOAD(a) atomic_load_explicit(&(a), memory_order_acquire)
+#define MR_STORE(a, v) atomic_store_explicit(&(a), (v), memory_order_release)
+
+static char tombstone; // marks a removed slot so probes continue past it
+#define MR_SLOT_TOMBSTONE ((void *)&tombstone)
+
+// each stripe, & the epoch every match reads, on a cache line of its own
+_Static_assert(sizeof(mr_reader_stripe) == MR_CACHE_LINE, "a reader stripe is one cache line");
+_Static_assert(offsetof(mr_subscription_index, epoch) % MR_CACHE_LINE == 0, "epoch starts a cache line");
+_Static_assert(offsetof(mr_subscription_index, stripes) % MR_CACHE_LINE == 0, "stripes start a cache line");
+
+static atomic_uint next_reader_stripe;
+static _Thread_local int reader_stripe = -1;
+
+static uint32_t mr_subscriber_hash(const void *subscriber) {
+    uint64_t u64 = (uintptr_t)subscriber * UINT64_C(0x9E3779B97F4A7C15);
+    return u64 >> 32;
+}
+
+static uint32_t mr_slot_hash(const mr_slot_table *pst, const void *pv) {
+    return pst->by_subscriber
+        ? mr_subscriber_hash(((const mr_subscription *)pv)->subscriber)
+        : ((const mr_topic_node *)pv)->level_hash;
+}
+
+// readers
+
+static atomic_uint_fast64_t *mr_read_enter(mr_subscription_index *psi) {
+    if (reader_stripe < 0) reader_stripe = atomic_fetch_add(&next_reader_stripe, 1) % MR_READER_STRIPES;
+    mr_reader_stripe *prs = psi->stripes + reader_stripe;
+
+    while (true) { // if the epoch moved on before our count was seen, count again under the new one
+        uint64_t epoch = atomic_load(&psi->epoch);
+        atomic_uint_fast64_t *pactive = prs->active + (epoch & 1);
+        atomic_fetch_add(pactive, 1);
+        if (atomic_load(&psi->epoch) == epoch) return pactive;
+        atomic_fetch_sub(pactive, 1);
+    }
+}
+
+static void mr_read_exit(atomic_uint_fast64_t *pactive) {
+    atomic_fetch_sub_explicit(pactive, 1, memory_order_release);
+}
+
+// writers: called with the writer lock held
+
+// wait out the readers that may still see retired memory, then free it
+static void mr_synchronize(mr_subscription_index *psi) {
+    uint64_t epoch = atomic_fetch_add(&psi->epoch, 1);
+
+    for (size_t i = 0; i < MR_READER_STRIPES; i++) {
+        while (atomic_load(&psi->stripes[i].active[epoch & 1])) sched_yield();
+    }
+
+    for (size_t i = 0; i < psi->retired_count; i++) mr_free(psi->retired[i]);
+    psi->retired_count = 0;
+}
+
+static void mr_retire(mr_subscription_index *psi, void *pv) {
+    if (psi->retired_count == MR_RETIRE_BATCH) mr_synchronize(psi);
+    psi->retired[psi->retired_count++] = pv;
+}
+
+// rehash into a table at most half full, dropping the tombstones
+static int mr_grow_slot_table(mr_subscription_index *psi, mr_slot_table *pst) {
+    mr_slots *ps = atomic_load_explicit(&pst->pslots, memory_order_relaxed);
+    size_t cap = 4;
+    while ((pst->count + 1) * 2 > cap) cap <<= 1;
+    mr_slots *pnew;
+    if (mr_calloc((void **)&pnew, 1, sizeof(mr_slots) + cap * sizeof(pnew->slots[0]))) return -1;
+    pnew->cap = cap;
+
+    for (size_t i = 0; ps && i < ps->cap; i++) {
+        void *pv = atomic_load_explicit(&ps->slots[i], memory_order_relaxed);
+        if (!pv || pv == MR_SLOT_TOMBSTONE) continue;
+        size_t j = mr_slot_hash(pst, pv) & (cap - 1);
+        while (atomic_load_explicit(&pnew->slots[j], memory_order_relaxed)) j = (j + 1) & (cap - 1);
+        atomic_store_explicit(&pnew->slots[j], pv, memory_order_relaxed);
+    }
+
+    MR_STORE(pst->pslots, pnew);
+    if (ps) mr_retire(psi, ps);
+    pst->used = pst->count;
+    return 0;
+}
+
+static int mr_slot_insert(mr_subscription_index *psi, mr_slot_table *pst, void *pv) {
+    mr_slots *ps = atomic_load_explicit(&pst->pslots, memory_order_relaxed);
+
+    if ((pst->used + 1) * 4 > (ps ? ps->cap : 0) * 3) {
+        if (mr_grow_slot_table(psi, pst)) return -1;
+        ps = atomic_load_explicit(&pst->pslots, memory_order_relaxed);
+    }
+
+    size_t mask = ps->cap - 1;
+    size_t i = mr_slot_hash(pst, pv) & mask;
+    void *pslot;
+
+    while ((pslot = atomic_load_explicit(&ps->slots[i], memory_order_relaxed)) && pslot != MR_SLOT_TOMBSTONE) {
+        i = (i + 1) & mask;
+    }
+
+    if (!pslot) pst->used++;
+    MR_STORE(ps->slots[i], pv);
+    pst->count++;
+    return 0;
+}
+
+static void mr_slot_remove(mr_subscription_index *psi, mr_slot_table *pst, const size_t i) {
+    mr_slots *ps = atomic_load_explicit(&pst->pslots, memory_order_relaxed);
+    MR_STORE(ps->slots[i], MR_SLOT_TOMBSTONE);
+    pst->count--;
+
+    if (!pst->count) { // an empty table costs nothing
+        MR_STORE(pst->pslots, NULL);
+        mr_retire(psi, ps);
+        pst->used = 0;
+    }
+}
+
+// readers & writers
+
+// find the child for a level & the slot holding it
+static mr_topic_node *mr_find_child(
+    const mr_topic_node *node, const char *level, const size_t len, const uint32_t hash, size_t *pi
+) {
+    mr_slots *ps = MR_LOAD(((mr_topic_node *)node)->children.pslots);
+    if (!ps) return NULL;
+    size_t mask = ps->cap - 1;
+    mr_topic_node *child;
+
+    for (size_t i = hash & mask; (child = MR_LOAD(ps->slots[i])); i = (i + 1) & mask) {
+        if (child == MR_SLOT_TOMBSTONE) continue;
+
+        if (child->level_hash == hash && child->level_len == len && !memcmp(child->level, level, len)) {
+            *pi = i;
+            return child;
+        }
+    }
+
+    return NULL;
+}
+
+// find a subscriber's subscription & the slot holding it
+static mr_subscription *mr_find_subscription(const mr_topic_node *node, const void *subscriber, size_t *pi) {
+    mr_slots *ps = MR_LOAD(((mr_topic_node *)node)->subscriptions.pslots);
+    if (!ps) return NULL;
+    size_t mask = ps->cap - 1;
+    mr_subscription *psub;
+
+    for (size_t i = mr_subscriber_hash(subscriber) & mask; (psub = MR_LOAD(ps->slots[i])); i = (i + 1) & mask) {
+        if (psub != MR_SLOT_TOMBSTONE && psub->subscriber == subscriber) {
+            *pi = i;
+            return psub;
+        }
+    }
+
+    return NULL;
+}
+
+static int mr_init_topic_node(
+    mr_subscription_index *psi, mr_topic_node **pnode, mr_topic_node *parent, const char *level, const size_t len
+) {
+    mr_topic_node *node;
+    if (mr_calloc((void **)&node, 1, sizeof(mr_topic_node) + len)) return -1;
+    node->parent = parent;
+    node->subscriptions.by_subscriber = true;
+    node->level_hash = mr_level_hash(level, len);
+    node->level_len = len;
+    memcpy(node->level, level, len);
+    psi->node_count++;
+    *pnode = node;
+    return 0;
+}
+
+// free a node & its subtree now: no reader can reach it
+static void mr_free_topic_node(mr_subscription_index *psi, mr_topic_node *node) {
+    mr_slots *ps = atomic_load_explicit(&node->children.pslots, memory_order_relaxed);
+
+    for (size_t i = 0; ps && i < ps->cap; i++) {
+        mr_topic_node *child = atomic_load_explicit(&ps->slots[i], memory_order_relaxed);
+        if (child && child != MR_SLOT_TOMBSTONE) mr_free_topic_node(psi, child);
+    }
+
+    mr_free(ps);
+    ps = atomic_load_explicit(&node->subscriptions.pslots, memory_order_relaxed);
+
+    for (size_t i = 0; ps && i < ps->cap; i++) {
+        mr_subscription *psub = atomic_load_explicit(&ps->slots[i], memory_order_relaxed);
+        if (psub && psub != MR_SLOT_TOMBSTONE) mr_free(psub);
+    }
+
+    mr_free(ps);
+    mr_topic_node *child = atomic_load_explicit(&node->plus, memory_order_relaxed);
+    if (child) mr_free_topic_node(psi, child);
+    child = atomic_load_explicit(&node->hash, memory_order_relaxed);
+    if (child) mr_free_topic_node(psi, child);
+    mr_free(node);
+    psi->node_count--;
+}
+
+int mr_init_subscription_index(mr_subscription_index **ppsi) {
+    mr_subscription_index *psi;
+    if (mr_aligned_calloc((void **)&psi, _Alignof(mr_subscription_index), sizeof(mr_subscription_index))) return -1;
+
+    if (pthread_mutex_init(&psi->writer_lock, NULL)) {
+        mr_log_error("pthread_mutex_init failed");
+        mr_free(psi);
+        return -1;
+    }
+
+    if (mr_init_topic_node(psi, &psi->root, NULL, "", 0)) {
+        pthread_mutex_destroy(&psi->writer_lock);
+        mr_free(psi);
+        return -1;
+    }
+
+    *ppsi = psi;
+    return 0;
+}
+
+/**
+ * @brief Free the index; no thread may be matching or writing.
+ */
+int mr_free_subscription_index(mr_subscription_index *psi) {
+    for (size_t i = 0; i < psi->retired_count; i++) mr_free(psi->retired[i]);
+    mr_free_topic_node(psi, psi->root);
+    pthread_mutex_destroy(&psi->writer_lock);
+    return mr_free(psi);
+}
+
+int mr_get_subscription_index_counts(mr_subscription_index *psi, size_t *psubscription_count, size_t *pnode_count) {
+    pthread_mutex_lock(&psi->writer_lock);
+    *psubscription_count = psi->subscription_count;
+    *pnode_count = psi->node_count;
+    pthread_mutex_unlock(&psi->writer_lock);
+    return 0;
+}
+
+/**
+ * @brief Free the memory retired by subscribes & unsubscribes, once the readers that may see it are done.
+ *
+ * Writers do this themselves every MR_RETIRE_BATCH retirements; call it to release memory sooner.
+ */
+int mr_synchronize_subscription_index(mr_subscription_index *psi) {
+    pthread_mutex_lock(&psi->writer_lock);
+    mr_synchronize(psi);
+    pthread_mutex_unlock(&psi->writer_lock);
+    return 0;
+}
+
+static int mr_topic_filter_invalid(const size_t offset, const uint8_t reason_code, const char *reason) {
+    mr_log_error("invalid topic filter: %s; offset: %lu", reason, offset);
+    return mr_set_error(MR_ERR_VALUE, reason_code, MQTT_SUBSCRIBE, -1, offset);
+}
+
+/**
+ * @brief Check a topic filter: '+' & '#' each fill a whole level and '#' is the last level.
+ *
+ * Shared subscriptions ($share/...) are not supported. The filter is not NUL-terminated.
+ */
+int mr_check_topic_filter(const char *cv, const size_t len) {
+    if (!len || len > 65535) return mr_topic_filter_invalid(0, MQTT_RC_TOPIC_FILTER_INVALID, "length");
+
+    if (mr_utf8_validation((const uint8_t *)cv, len) || memchr(cv, '\0', len)) {
+        return mr_topic_filter_invalid(0, MQTT_RC_TOPIC_FILTER_INVALID, "utf8");
+    }
+
+    if (len >= 7 && !memcmp(cv, "$share/", 7)) {
+        return mr_topic_filter_invalid(0, MQTT_RC_SHARED_SUBSCRIPTIONS_NOT_SUPPORTED, "shared subscription");
+    }
+
+    size_t levels = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (cv[i] == '/') {
+            if (++levels > MR_TOPIC_LEVELS_MAX) {
+                return mr_topic_filter_invalid(i, MQTT_RC_TOPIC_FILTER_INVALID, "too many levels");
+            }
+        }
+        else if (cv[i] == '+' || cv[i] == '#') {
+            bool alone = (i == 0 || cv[i - 1] == '/') && (i + 1 == len || cv[i + 1] == '/');
+            if (!alone) return mr_topic_filter_invalid(i, MQTT_RC_TOPIC_FILTER_INVALID, "wildcard in a level");
+
+            if (cv[i] == '#' && i + 1 != len) {
+                return mr_topic_filter_invalid(i, MQTT_RC_TOPIC_FILTER_INVALID, "'#' before the last level");
+            }
+        }
+    }
+
+    return 0;
+}
+
+// unlink & retire nodes left without subscriptions or children, from node up to the root
+static void mr_prune_topic_nodes(mr_subscription_index *psi, mr_topic_node *node) {
+    while (
+        node != psi->root && !node->subscriptions.count && !node->children.count
+        && !atomic_load_explicit(&node->plus, memory_order_relaxed)
+        && !atomic_load_explicit(&node->hash, memory_order_relaxed)
+    ) {
+        mr_topic_node *parent = node->parent;
+
+        if (atomic_load_explicit(&parent->plus, memory_order_relaxed) == node) {
+            MR_STORE(parent->plus, NULL);
+        }
+        else if (atomic_load_explicit(&parent->hash, memory_order_relaxed) == node) {
+            MR_STORE(parent->hash, NULL);
+        }
+        else {
+            size_t i;
+            mr_find_child(parent, node->level, node->level_len, node->level_hash, &i);
+            mr_slot_remove(psi, &parent->children, i);
+        }
+
+        mr_retire(psi, node);
+        psi->node_count--;
+        node = parent;
+    }
+}
+
+// the node for a filter's last level, created as needed
+static mr_topic_node *mr_make_filter_node(mr_subscription_index *psi, const char *topic_filter, const size_t len) {
+    mr_topic_node *node = psi->root;
+    const char *level = topic_filter;
+    const char *end = topic_filter + len;
+
+    while (true) {
+        const char *slash = memchr(level, '/', end - level);
+        size_t level_len = (slash ? slash : end) - level;
+        _Atomic(mr_topic_node *) *pchild = NULL;
+        mr_topic_node *child;
+
+        if (level_len == 1 && *level == '+') {
+            pchild = &node->plus;
+        }
+        else if (level_len == 1 && *level == '#') {
+            pchild = &node->hash;
+        }
+
+        if (pchild) {
+            child = atomic_load_explicit(pchild, memory_order_relaxed);
+
+            if (!child) {
+                if (mr_init_topic_node(psi, &child, node, level, level_len)) {
+                    mr_prune_topic_nodes(psi, node);
+                    return NULL;
+                }
+
+                MR_STORE(*pchild, child);
+            }
+        }
+        else {
+            uint32_t hash = mr_level_hash(level, level_len);
+            size_t i;
+            child = mr_find_child(node, level, level_len, hash, &i);
+
+            if (!child) {
+                if (mr_init_topic_node(psi, &child, node, level, level_len)) {
+                    mr_prune_topic_nodes(psi, node);
+                    return NULL;
+                }
+
+                if (mr_slot_insert(psi, &node->children, child)) {
+                    mr_free_topic_node(psi, child); // never published
+                    mr_prune_topic_nodes(psi, node);
+                    return NULL;
+                }
+            }
+        }
+
+        node = child;
+        if (!slash) return node;
+        level = slash + 1;
+    }
+}
+
+static int mr_add_subscription_locked(
+    mr_subscription_index *psi,
+    const char *topic_filter,
+    const size_t len,
+    const mr_subscription *psub,
+    bool *preplaced
+) {
+    mr_topic_node *node = mr_make_filter_node(psi, topic_filter, len);
+    if (!node) return -1;
+    mr_subscription *pnew;
+
+    if (mr_malloc((void **)&pnew, sizeof(mr_subscription))) {
+        mr_prune_topic_nodes(psi, node);
+        return -1;
+    }
+
+    *pnew = *psub;
+    size_t i;
+    mr_subscription *pold = mr_find_subscription(node, psub->subscriber, &i);
+    *preplaced = pold;
+
+    if (pold) { // readers may be looking at the old one
+        mr_slots *ps = atomic_load_explicit(&node->subscriptions.pslots, memory_order_relaxed);
+        MR_STORE(ps->slots[i], pnew);
+        mr_retire(psi, pold);
+        return 0;
+    }
+
+    if (mr_slot_insert(psi, &node->subscriptions, pnew)) {
+        mr_free(pnew);
+        mr_prune_topic_nodes(psi, node);
+        return -1;
+    }
+
+    psi->subscription_count++;
+    return 0;
+}
+
+/**
+ * @brief Add a subscriber's subscription to a topic filter, or replace its options.
+ *
+ * The subscription is copied. A subscriber has at most one subscription per filter; *preplaced is
+ * set when one already existed.
+ */
+int mr_add_subscription(
+    mr_subscription_index *psi,
+    const char *topic_filter,
+    const size_t len,
+    const mr_subscription *psub,
+    bool *preplaced
+) {
+    if (mr_check_topic_filter(topic_filter, len)) return -1;
+    pthread_mutex_lock(&psi->writer_lock);
+    int rc = mr_add_subscription_locked(psi, topic_filter, len, psub, preplaced);
+    pthread_mutex_unlock(&psi->writer_lock);
+    return rc;
+}
+
+static void mr_remove_subscription_locked(
+    mr_subscription_index *psi, const char *topic_filter, const size_t len, const void *subscriber, bool *premoved
+) {
+    mr_topic_node *node = psi->root;
+    const char *level = topic_filter;
+    const char *end = topic_filter + len;
+
+    while (node) {
+        const char *slash = memchr(level, '/', end - level);
+        size_t level_len = (slash ? slash : end) - level;
+        size_t i;
+
+        if (level_len == 1 && *level == '+') {
+            node = atomic_load_explicit(&node->plus, memory_order_relaxed);
+        }
+        else if (level_len == 1 && *level == '#') {
+            node = atomic_load_explicit(&node->hash, memory_order_relaxed);
+        }
+        else {
+            node = mr_find_child(node, level, level_len, mr_level_hash(level, level_len), &i);
+        }
+
+        if (!slash) break;
+        level = slash + 1;
+    }
+
+    size_t i;
+    mr_subscription *psub = node ? mr_find_subscription(node, subscriber, &i) : NULL;
+    if (!psub) return;
+    mr_slot_remove(psi, &node->subscriptions, i);
+    mr_retire(psi, psub);
+    psi->subscription_count--;
+    *premoved = true;
+    mr_prune_topic_nodes(psi, node);
+}
+
+/**
+ * @brief Remove a subscriber's subscription to a topic filter; *premoved is false if there was none.
+ */
+int mr_remove_subscription(
+    mr_subscription_index *psi, const char *topic_filter, const size_t len, const void *subscriber, bool *premoved
+) {
+    *premoved = false;
+    if (mr_check_topic_filter(topic_filter, len)) return -1;
+    pthread_mutex_lock(&psi->writer_lock);
+    mr_remove_subscription_locked(psi, topic_filter, len, subscriber, premoved);
+    pthread_mutex_unlock(&psi->writer_lock);
+    return 0;
+}
+
+/**
+ * @brief Add a subscription per topic filter of an unpacked SUBSCRIBE, setting a SUBACK reason code for each.
+ *
+ * A filter that cannot be subscribed gets its failure reason code, e.g. MQTT_RC_TOPIC_FILTER_INVALID,
+ * & the rest are still added; the reason codes can be set into the SUBACK as they are. Return -1 only
+ * if reason_codes is too short or memory runs out.
+ */
+int mr_add_subscribe_packet(
+    mr_subscription_index *psi,
+    mr_packet_ctx *pctx,
+    void *subscriber,
+    uint8_t *reason_codes,
+    const size_t reason_codes_len
+) {
+    mr_topic_filter *tfv0;
+    size_t tfcount;
+    uint32_t subscription_identifier;
+    bool exists_flag;
+
+    if (mr_get_subscribe_topic_filters(pctx, &tfv0, &tfcount, &exists_flag)) return -1;
+    if (!exists_flag) tfcount = 0;
+
+    if (reason_codes_len < tfcount) {
+        mr_log_error("reason_codes too short: %lu for %lu topic filters", reason_codes_len, tfcount);
+        return mr_set_error(MR_ERR_NOBUFS, MQTT_RC_UNSPECIFIED, MQTT_SUBSCRIBE, SUBSCRIBE_TOPIC_FILTERS, 0);
+    }
+
+    if (mr_get_subscribe_subscription_identifier(pctx, &subscription_identifier, &exists_flag)) return -1;
+    if (!exists_flag) subscription_identifier = 0;
+
+    for (size_t i = 0; i < tfcount; i++) {
+        mr_topic_filter *ptf = tfv0 + i;
+        mr_subscription sub = {
+            subscriber, ptf->maximum_qos, ptf->no_local, ptf->retain_as_published, ptf->retain_handling,
+            subscription_identifier
+        };
+        bool replaced;
+
+        if (mr_add_subscription(psi, ptf->topic_filter, strlen(ptf->topic_filter), &sub, &replaced)) {
+            mr_error err;
+            mr_get_error(&err);
+            if (err.code == MR_ERR_NOMEM) return -1;
+            reason_codes[i] = err.reason_code;
+        }
+        else {
+            reason_codes[i] = ptf->maximum_qos; // MQTT_RC_GRANTED_QOS0..2
+        }
+    }
+
+    return 0;
+}
+
+static int mr_match_subscriptions_of(const mr_match_ctx *pmc, const mr_topic_node *node) {
+    mr_slots *ps = MR_LOAD(((mr_topic_node *)node)->subscriptions.pslots);
+
+    for (size_t i = 0; ps && i < ps->cap; i++) {
+        const mr_subscription *psub = MR_LOAD(ps->slots[i]);
+        if (!psub || psub == MR_SLOT_TOMBSTONE) continue;
+        if (psub->no_local && pmc->publisher && psub->subscriber == pmc->publisher) continue;
+        int rc = pmc->fn(psub, pmc->arg);
+        if (rc) return rc;
+    }
+
+    return 0;
+}
+
+// level: the start of the next level to match; NULL once every level has been matched
+static int mr_match_topic_node(const mr_match_ctx *pmc, const mr_topic_node *node, const char *level) {
+    mr_topic_node *hash = MR_LOAD(((mr_topic_node *)node)->hash);
+    int rc;
+
+    if (!level) { // "a/#" also matches "a"
+        if ((rc = mr_match_subscriptions_of(pmc, node))) return rc;
+        return hash ? mr_match_subscriptions_of(pmc, hash) : 0;
+    }
+
+    const char *slash = memchr(level, '/', pmc->end - level);
+    size_t level_len = (slash ? slash : pmc->end) - level;
+    const char *next = slash ? slash + 1 : NULL;
+    size_t i;
+    mr_topic_node *child = mr_find_child(node, level, level_len, mr_level_hash(level, level_len), &i);
+    if (child && (rc = mr_match_topic_node(pmc, child, next))) return rc;
+
+    // wildcards in the first level do not match topic names starting with '$'
+    if (node == pmc->root && *level == '$') return 0;
+    mr_topic_node *plus = MR_LOAD(((mr_topic_node *)node)->plus);
+    if (plus && (rc = mr_match_topic_node(pmc, plus, next))) return rc;
+    return hash ? mr_match_subscriptions_of(pmc, hash) : 0;
+}
+
+/**
+ * @brief Call fn for each subscription whose topic filter matches a topic name.
+ *
+ * Subscriptions with no_local set are skipped for the publisher; pass NULL to skip none. A subscriber
+ * whose filters overlap is called once per matching subscription. fn returning nonzero stops the
+ * match & is returned. Nothing is allocated; the topic name is not NUL-terminated.
+ *
+ * Any number of threads may match while others subscribe & unsubscribe; a match sees each
+ * subscription as it was either before or after a concurrent change. fn must not subscribe or
+ * unsubscribe on the same index, and psub is only valid until fn returns.
+ */
+int mr_match_subscriptions(
+    mr_subscription_index *psi,
+    const char *topic_name,
+    const size_t len,
+    const void *publisher,
+    mr_subscription_fn fn,
+    void *arg
+) {
+    if (!len || mr_wildcard_found(topic_name, len)) {
+        mr_log_error("invalid topic name for matching");
+        return mr_set_error(MR_ERR_VALUE, MQTT_RC_TOPIC_NAME_INVALID, MQTT_PUBLISH, -1, 0);
+    }
+
+    mr_match_ctx mc = {psi->root, topic_name + len, publisher, fn, arg};
+    atomic_uint_fast64_t *pactive = mr_read_enter(psi);
+    int rc = mr_match_topic_node(&mc, psi->root, topic_name);
+    mr_read_exit(pactive);
+    return rc;
+}
@@ -0,0 +1,328 @@
+// topic_alias.c
+
+/**
+ * @file
+ * @brief Topic aliases: one connection's alias mappings, inbound & outbound.
+ *
+ * Inbound, a PUBLISH carrying a topic name & a topic_alias sets the alias; one carrying only the
+ * alias is resolved to the topic name last set for it. Aliases above the inbound maximum, the
+ * topic_alias_maximum this side sent, are rejected.
+ *
+ * Outbound, at most the peer's topic_alias_maximum aliases are assigned. A topic name with an alias
+ * is sent as an empty topic name & the alias. Once every alias is taken, a topic name takes one over
+ * only if it has been sent more often of late than the name holding it: recent sends are counted by
+ * hash in a small table of counters, halved from time to time, and the candidate to give up its
+ * alias is chosen by a clock sweep, skipping names sent since the hand last passed. A burst of
+ * one-off topic names then leaves the aliases of the frequent ones alone.
+ *
+ * Aliases belong to one network connection & are not thread-safe: the caller serializes access.
+*/
+
+#include <string.h>
+
+#include <zlog.h>
+
+#include "mister_internal.h"
+
+#define MR_TOPIC_ALIAS_MIN_LEN 4        // a topic_alias property takes 3 bytes: shorter names are sent as is
+#define MR_TOPIC_ALIAS_SKETCH_MAX 8192  // counters of recent sends, at most
+#define MR_TOPIC_ALIAS_COUNT_MAX 15     // a counter saturates here
+
+static int mr_copy_topic_name(char **pcv, const char *topic_name, const size_t len) {
+    char *cv = *pcv;
+    if (mr_realloc((void **)&cv, len + 1)) return -1;
+    memcpy(cv, topic_name, len);
+    cv[len] = '\0';
+    *pcv = cv;
+    return 0;
+}
+
+static int mr_init_topic_alias_sketch(mr_topic_aliases *pta) {
+    size_t cap = 256;
+    while (cap < pta->outbound_maximum * 8 && cap < MR_TOPIC_ALIAS_SKETCH_MAX) cap *= 2;
+    if (mr_calloc((void **)&pta->sketch, cap, sizeof(uint8_t))) return -1;
+    pta->sketch_cap = cap;
+    return 0;
+}
+
+int mr_init_topic_aliases(mr_topic_aliases **ppta, const uint16_t inbound_maximum, const uint16_t outbound_maximum) {
+    mr_topic_aliases *pta;
+    if (mr_calloc((void **)&pta, 1, sizeof(mr_topic_aliases))) return -1;
+    pta->inbound_maximum = inbound_maximum;
+    pta->outbound_maximum = outbound_maximum;
+
+    if (outbound_maximum && mr_init_topic_alias_sketch(pta)) {
+        mr_free(pta);
+        return -1;
+    }
+
+    *ppta = pta;
+    return 0;
+}
+
+/**
+ * @brief Make a connection's topic aliases from the topic_alias_maximum of its CONNECT & CONNACK.
+ *
+ * The CONNECT's maximum bounds the aliases the server sends, the CONNACK's those the client sends;
+ * an absent maximum is 0, no aliases. server_flag tells which side this is.
+ */
+int mr_init_topic_aliases_handshake(
+    mr_topic_aliases **ppta, mr_packet_ctx *pconnect, mr_packet_ctx *pconnack, const bool server_flag
+) {
+    uint16_t connect_maximum, connack_maximum;
+    bool exists_flag;
+
+    if (mr_get_connect_topic_alias_maximum(pconnect, &connect_maximum, &exists_flag)) return -1;
+    if (!exists_flag) connect_maximum = 0;
+    if (mr_get_connack_topic_alias_maximum(pconnack, &connack_maximum, &exists_flag)) return -1;
+    if (!exists_flag) connack_maximum = 0;
+
+    if (server_flag) return mr_init_topic_aliases(ppta, connack_maximum, connect_maximum);
+    return mr_init_topic_aliases(ppta, connect_maximum, connack_maximum);
+}
+
+int mr_free_topic_aliases(mr_topic_aliases *pta) {
+    for (size_t i = 0; i < pta->inbound_cap; i++) mr_free(pta->inbound[i].topic_name);
+    for (size_t i = 0; i < pta->outbound_count; i++) mr_free(pta->outbound[i].topic_name);
+    mr_free(pta->inbound);
+    mr_free(pta->outbound);
+    mr_free(pta->table);
+    mr_free(pta->sketch);
+    return mr_free(pta);
+}
+
+// inbound
+
+static int mr_set_inbound_alias(mr_topic_aliases *pta, const uint16_t alias, const char *topic_name, const size_t len) {
+    if (alias > pta->inbound_cap) {
+        size_t cap = pta->inbound_cap ? pta->inbound_cap * 2 : 8;
+        if (cap < alias) cap = alias;
+        if (cap > pta->inbound_maximum) cap = pta->inbound_maximum;
+        mr_inbound_alias *inbound = pta->inbound;
+        if (mr_realloc((void **)&inbound, cap * sizeof(mr_inbound_alias))) return -1;
+        memset(inbound + pta->inbound_cap, 0, (cap - pta->inbound_cap) * sizeof(mr_inbound_alias));
+        pta->inbound = inbound;
+        pta->inbound_cap = cap;
+    }
+
+    mr_inbound_alias *pia = pta->inbound + alias - 1;
+    if (mr_copy_topic_name(&pia->topic_name, topic_name, len)) return -1;
+    pia->topic_name_len = len;
+    return 0;
+}
+
+/**
+ * @brief Resolve a received PUBLISH's topic_alias, leaving pctx with its topic name & no alias.
+ *
+ * A topic name with an alias sets the alias; an empty topic name takes the alias's. On a protocol
+ * violation record the reason code in pctx & as this thread's error and return -1: the connection
+ * must then be closed with a DISCONNECT carrying it.
+ */
+int mr_resolve_topic_alias(mr_topic_aliases *pta, mr_packet_ctx *pctx) {
+    uint16_t alias;
+    uint8_t *u8v0;
+    size_t len;
+    bool exists_flag;
+
+    if (mr_get_u8v(pctx, PUBLISH_TOPIC_NAME, &u8v0, &len, &exists_flag)) return -1;
+    len = exists_flag ? len - 1 : 0; // strings by length: they may be views into the packet
+    if (mr_get_publish_topic_alias(pctx, &alias, &exists_flag)) return -1;
+
+    if (!exists_flag) {
+        if (len) return 0;
+        mr_log_error("empty topic_name without a topic_alias");
+        return mr_reject(pctx, PUBLISH_TOPIC_NAME, MQTT_RC_PROTOCOL_ERROR);
+    }
+
+    if (alias > pta->inbound_maximum) {
+        mr_log_error("topic_alias: %u > topic_alias_maximum: %u", alias, pta->inbound_maximum);
+        return mr_reject(pctx, PUBLISH_TOPIC_ALIAS, MQTT_RC_TOPIC_ALIAS_INVALID);
+    }
+
+    if (len) {
+        if (mr_set_inbound_alias(pta, alias, (char *)u8v0, len)) return -1;
+    }
+    else {
+        if (alias > pta->inbound_cap || !pta->inbound[alias - 1].topic_name) {
+            mr_log_error("topic_alias: %u not set", alias);
+            return mr_reject(pctx, PUBLISH_TOPIC_ALIAS, MQTT_RC_PROTOCOL_ERROR);
+        }
+
+        // a copy: the alias may be set again while pctx is still in use
+        mr_inbound_alias *pia = pta->inbound + alias - 1;
+        if (mr_set_vector_copy(pctx, PUBLISH_TOPIC_NAME, pia->topic_name, pia->topic_name_len + 1)) return -1;
+    }
+
+    return mr_reset_publish_topic_alias(pctx);
+}
+
+// outbound
+
+static uint16_t *mr_find_outbound_slot(
+    mr_topic_aliases *pta, const char *topic_name, const size_t len, const uint32_t hash
+) {
+    if (!pta->table_cap) return NULL;
+    const size_t mask = pta->table_cap - 1;
+
+    for (size_t i = hash & mask; pta->table[i]; i = (i + 1) & mask) {
+        mr_outbound_alias *poa = pta->outbound + pta->table[i] - 1;
+
+        if (poa->hash == hash && poa->topic_name_len == len && !memcmp(poa->topic_name, topic_name, len)) {
+            return pta->table + i;
+        }
+    }
+
+    return NULL;
+}
+
+static void mr_put_outbound_slot(mr_topic_aliases *pta, const uint16_t alias) {
+    const size_t mask = pta->table_cap - 1;
+    size_t i = pta->outbound[alias - 1].hash & mask;
+    while (pta->table[i]) i = (i + 1) & mask;
+    pta->table[i] = alias;
+}
+
+// backward-shift deletion, as for the retained store's children
+static void mr_remove_outbound_slot(mr_topic_aliases *pta, uint16_t *pslot) {
+    const size_t mask = pta->table_cap - 1;
+    size_t i = pslot - pta->table;
+    pta->table[i] = 0;
+
+    for (size_t j = (i + 1) & mask; pta->table[j]; j = (j + 1) & mask) {
+        size_t home = pta->outbound[pta->table[j] - 1].hash & mask;
+
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            pta->table[i] = pta->table[j];
+            pta->table[j] = 0;
+            i = j;
+        }
+    }
+}
+
+static int mr_add_outbound_alias(
+    mr_topic_aliases *pta, const char *topic_name, const size_t len, const uint32_t hash, uint16_t *palias
+) {
+    if (pta->outbound_count == pta->outbound_cap) {
+        size_t cap = pta->outbound_cap ? pta->outbound_cap * 2 : 8;
+        if (cap > pta->outbound_maximum) cap = pta->outbound_maximum;
+        mr_outbound_alias *outbound = pta->outbound;
+        if (mr_realloc((void **)&outbound, cap * sizeof(mr_outbound_alias))) return -1;
+        pta->outbound = outbound;
+        pta->outbound_cap = cap;
+    }
+
+    if ((pta->outbound_count + 1) * 4 > pta->table_cap * 3) { // load factor 3/4
+        size_t cap = pta->table_cap ? pta->table_cap * 2 : 16;
+        uint16_t *table;
+        if (mr_calloc((void **)&table, cap, sizeof(uint16_t))) return -1;
+        mr_free(pta->table);
+        pta->table = table;
+        pta->table_cap = cap;
+        for (size_t i = 0; i < pta->outbound_count; i++) mr_put_outbound_slot(pta, i + 1);
+    }
+
+    mr_outbound_alias *poa = pta->outbound + pta->outbound_count;
+    poa->topic_name = NULL;
+    if (mr_copy_topic_name(&poa->topic_name, topic_name, len)) return -1;
+    poa->topic_name_len = len;
+    poa->hash = hash;
+    poa->referenced = false;
+    *palias = ++pta->outbound_count;
+    mr_put_outbound_slot(pta, *palias);
+    return 0;
+}
+
+static uint8_t mr_count_topic_send(mr_topic_aliases *pta, const uint32_t hash) {
+    uint8_t *pcount = pta->sketch + (hash & (pta->sketch_cap - 1));
+    if (*pcount < MR_TOPIC_ALIAS_COUNT_MAX) (*pcount)++;
+
+    if (++pta->sketch_sends == pta->sketch_cap * 8) { // age: halve every counter
+        for (size_t i = 0; i < pta->sketch_cap; i++) pta->sketch[i] >>= 1;
+        pta->sketch_sends = 0;
+    }
+
+    return *pcount;
+}
+
+// clock sweep: the next alias not sent since the hand last passed
+static mr_outbound_alias *mr_sweep_outbound_aliases(mr_topic_aliases *pta) {
+    while (true) {
+        mr_outbound_alias *poa = pta->outbound + pta->hand;
+        if (!poa->referenced) return poa;
+        poa->referenced = false;
+        pta->hand = (pta->hand + 1) % pta->outbound_count;
+    }
+}
+
+/**
+ * @brief Set the topic_alias & topic_alias_only of a subscriber's copy of a PUBLISH to topic_name.
+ *
+ * A topic name with an alias is sent as the alias only. Otherwise, if an alias is free or the name
+ * wins one over, it is sent with its new alias, which the peer then keeps; if not, without an alias.
+ */
+int mr_assign_topic_alias(
+    mr_topic_aliases *pta, const char *topic_name, const size_t len, mr_publish_target *ptarget
+) {
+    ptarget->topic_alias = 0;
+    ptarget->topic_alias_only = false;
+    if (!pta->outbound_maximum || len < MR_TOPIC_ALIAS_MIN_LEN) return 0;
+
+    const uint32_t hash = mr_level_hash(topic_name, len);
+    const uint8_t count = mr_count_topic_send(pta, hash);
+    uint16_t *pslot = mr_find_outbound_slot(pta, topic_name, len, hash);
+
+    if (pslot) {
+        pta->outbound[*pslot - 1].referenced = true;
+        ptarget->topic_alias = *pslot;
+        ptarget->topic_alias_only = true;
+        return 0;
+    }
+
+    if (pta->outbound_count < pta->outbound_maximum) {
+        return mr_add_outbound_alias(pta, topic_name, len, hash, &ptarget->topic_alias);
+    }
+
+    mr_outbound_alias *poa = mr_sweep_outbound_aliases(pta);
+    if (count <= pta->sketch[poa->hash & (pta->sketch_cap - 1)]) return 0; // sent no more often: no alias
+
+    char *cv = NULL;
+    if (mr_copy_topic_name(&cv, topic_name, len)) return -1;
+    mr_remove_outbound_slot(pta, mr_find_outbound_slot(pta, poa->topic_name, poa->topic_name_len, poa->hash));
+    mr_free(poa->topic_name);
+    poa->topic_name = cv;
+    poa->topic_name_len = len;
+    poa->hash = hash;
+    ptarget->topic_alias = poa - pta->outbound + 1;
+    mr_put_outbound_slot(pta, ptarget->topic_alias);
+    pta->hand = (pta->hand + 1) % pta->outbound_count;
+    return 0;
+}
+
+/**
+ * @brief Give a PUBLISH to be sent on this connection its topic alias, rewriting pctx.
+ *
+ * With an established alias the topic name is emptied, so pctx is then only fit for this
+ * connection. pctx must not already have a topic_alias.
+ */
+int mr_alias_publish_packet(mr_topic_aliases *pta, mr_packet_ctx *pctx) {
+    uint16_t alias;
+    uint8_t *u8v0;
+    size_t len;
+    bool exists_flag;
+
+    if (mr_get_publish_topic_alias(pctx, &alias, &exists_flag)) return -1;
+
+    if (exists_flag) {
+        mr_log_error("topic_alias already set: %u", alias);
+        return -1;
+    }
+
+    mr_publish_target target;
+    if (mr_get_u8v(pctx, PUBLISH_TOPIC_NAME, &u8v0, &len, &exists_flag)) return -1;
+    if (mr_assign_topic_alias(pta, (char *)u8v0, exists_flag ? len - 1 : 0, &target)) return -1;
+    if (!target.topic_alias) return 0;
+
+    if (mr_set_publish_topic_alias(pctx, target.topic_alias)) return -1;
+    if (target.topic_alias_only) return mr_set_publish_topic_name(pctx, "");
+    return 0;
+}
@@ -6,12 +6,17 @@
 #include <uuid/uuid.h>
 #include <math.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #include <zlog.h>
 
 #include "mister/mister.h"
 #include "mister_internal.h"
 
-// MQTT unicode validation using a reasonably fast and portable naïve method
+// MQTT unicode validation: a vectorized scan over runs of printable ASCII, then a reasonably fast
+// and portable naïve method for everything else
 /*
  * http://www.unicode.org/versions/Unicode6.0.0/ch03.pdf - page 94
  *
@@ -40,13 +45,100 @@
  * +--------------------+------------+-------------+------------+-------------+
  */
 
+
+/*
+ * Length of the leading run of printable ASCII (20..7E), i.e. bytes needing no further checks.
+ * The SSE2 & AVX2 versions compare as signed bytes so 80..FF fail the > 1F test along with the
+ * control chars; the portable SWAR version tests 8 bytes at a time in a uint64_t.
+ */
+static size_t mr_utf8_ascii_span_scalar(const uint8_t *u8v, size_t len) {
+    size_t i = 0;
+    while (i < len && u8v[i] >= 0x20 && u8v[i] <= 0x7E) i++;
+    return i;
+}
+
+static size_t mr_utf8_ascii_span_swar(const uint8_t *u8v, size_t len) {
+    const uint64_t ones = 0x0101010101010101;
+    const uint64_t highs = 0x8080808080808080;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t u64;
+        memcpy(&u64, u8v + i, 8);
+        if (u64 & highs) break;                         // 80..FF
+        if (((u64 + 0x60 * ones) & highs) != highs) break;  // 00..1F
+        if ((u64 + ones) & highs) break;                // 7F
+    }
+
+    return i + mr_utf8_ascii_span_scalar(u8v + i, len - i);
+}
+
+static _Thread_local int utf8_impl = MR_UTF8_AUTO; // mr_utf8_impls
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static size_t mr_utf8_ascii_span_sse2(const uint8_t *u8v, size_t len) {
+    const __m128i lo = _mm_set1_epi8(0x1F);
+    const __m128i hi = _mm_set1_epi8(0x7F);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(u8v + i));
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+        unsigned mask = ~_mm_movemask_epi8(ok) & 0xFFFF;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+
+    return i + mr_utf8_ascii_span_scalar(u8v + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t mr_utf8_ascii_span_avx2(const uint8_t *u8v, size_t len) {
+    const __m256i lo = _mm256_set1_epi8(0x1F);
+    const __m256i hi = _mm256_set1_epi8(0x7F);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(u8v + i));
+        __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(ok);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+
+    return i + mr_utf8_ascii_span_sse2(u8v + i, len - i);
+}
+
+static bool mr_utf8_impl_supported(const int impl) {
+    return impl != MR_UTF8_AVX2 || __builtin_cpu_supports("avx2");
+}
+
+static size_t mr_utf8_ascii_span(const uint8_t *u8v, size_t len) {
+    switch (utf8_impl) {
+        case MR_UTF8_AUTO:
+            if (len >= 32 && __builtin_cpu_supports("avx2")) return mr_utf8_ascii_span_avx2(u8v, len);
+            return mr_utf8_ascii_span_sse2(u8v, len);
+        case MR_UTF8_AVX2: return mr_utf8_ascii_span_avx2(u8v, len);
+        case MR_UTF8_SSE2: return mr_utf8_ascii_span_sse2(u8v, len);
+        default: return mr_utf8_ascii_span_swar(u8v, len);
+    }
+}
+
+#else
+
+static bool mr_utf8_impl_supported(const int impl) {
+    return impl == MR_UTF8_AUTO || impl == MR_UTF8_SWAR;
+}
+
+static size_t mr_utf8_ascii_span(const uint8_t *u8v, size_t len) {
+    return mr_utf8_ascii_span_swar(u8v, len);
+}
+
+#endif
+
 /* Return 0 - success,  >0 - index(1-based) of first error char */
 /* MQTT: error on "Disallowed Unicode code points" (control chars) and U+0000 */
-int mr_utf8_validation(const uint8_t *u8v, size_t len) {
-    //mr_print_hexdump(u8v, len);
-    //dzlog_debug("int mr_utf8_validation:: *ubv: %02hhX; len: %lu", u8v[0], len);
+static int mr_utf8_span_validation(const uint8_t *u8v, size_t len) {
     int err_pos = 1;
-    if (len > 65536) return err_pos; // MQTT: vector too large
 
     while (len) { // 0-length is valid
         int bytes;
@@ -54,7 +146,7 @@ int mr_utf8_validation(const uint8_t *u8v, size_t len) {
 
         if (byte1 <= 0x7F) { /* 00..7F */
             if (byte1 <= 0x1F || byte1 == 0x7F) return err_pos; // MQTT: U+0000 or control char
-            bytes = 1;
+            bytes = mr_utf8_ascii_span(u8v, len);
         }
         else if (
             len >= 2
@@ -118,64 +210,210 @@ int mr_utf8_validation(const uint8_t *u8v, size_t len) {
     return 0;
 }
 
-static const uint8_t WILDCARDS[] = {'#', '+'};
+/* MQTT UTF-8 encoded string: at most 65535 bytes */
+int mr_utf8_validation(const uint8_t *u8v, size_t len) {
+    if (len > 65535) return 1; // MQTT: vector too large
+    return mr_utf8_span_validation(u8v, len);
+}
+
+/* UTF-8 payload with payload_format_indicator set: no length limit beyond the packet's */
+int mr_utf8_payload_validation(const uint8_t *u8v, size_t len) {
+    return mr_utf8_span_validation(u8v, len);
+}
+
+/**
+ * @brief Check an MQTT UTF-8 string, setting *perr_pos to 0 or to the 1-based position of its first bad byte.
+ */
+int mr_validate_utf8_string(const uint8_t *u8v, const size_t len, size_t *perr_pos) {
+    *perr_pos = mr_utf8_validation(u8v, len);
+    if (!*perr_pos) return 0;
+    mr_log_error("invalid utf8:: len: %lu; pos: %lu", len, *perr_pos);
+    return mr_set_error(MR_ERR_UTF8, MQTT_RC_MALFORMED_PACKET, MQTT_RESERVED, -1, *perr_pos - 1);
+}
+
+/**
+ * @brief Select this thread's scan over runs of printable ASCII in UTF-8 validation.
+ *
+ * MR_UTF8_AUTO, the default, picks the widest the CPU supports; an implementation this build or CPU
+ * lacks is refused.
+ */
+int mr_set_utf8_impl(const int impl) {
+    if (impl < MR_UTF8_AUTO || impl > MR_UTF8_AVX2 || !mr_utf8_impl_supported(impl)) {
+        mr_log_error("UTF-8 implementation not available:: impl: %d", impl);
+        return mr_set_error(MR_ERR_VALUE, MQTT_RC_UNSPECIFIED, MQTT_RESERVED, -1, 0);
+    }
 
-int mr_wildcard_found(const char *cv) {
-    size_t cvlen = strlen(cv);
+    utf8_impl = impl;
+    return 0;
+}
 
+static const uint8_t WILDCARDS[] = {'#', '+'};
+
+int mr_wildcard_found(const char *cv, const size_t cvlen) {
     for (int i = 0; i < sizeof(WILDCARDS); i++) {
-        char *pc = memchr(cv, WILDCARDS[i], cvlen);
-        if (pc) return pc - cv;
+        if (memchr(cv, WILDCARDS[i], cvlen)) return 1; // not its position: a wildcard may be at 0
     }
 
     return 0;
 }
 
-int mr_bytecount_VBI(uint32_t u32) {
-    if (u32 >> (7 * 4)) return -1; // overflow: too big for 4 bytes
+// hash of one topic level, shared by the topic tries
+uint32_t mr_level_hash(const char *cv, const size_t len) { // FNV-1a
+    uint32_t u32 = 2166136261u;
 
-    int i = 0;
-    do {
-        u32 = u32 >> 7;
-        i++;
-    } while (u32);
+    for (size_t i = 0; i < len; i++) {
+        u32 ^= (uint8_t)cv[i];
+        u32 *= 16777619u;
+    }
 
-    return i;
+    return u32;
 }
 
-int mr_make_VBI(uint32_t u32, uint8_t *u8v0) {
+// CRC-32C (Castagnoli), as checksums the persisted retained messages: the SSE4.2 instruction where
+// the CPU has it, else a byte table
+
+static const uint32_t CRC32C_TABLE[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c, 0x26a1e7e8, 0xd4ca64eb,
+    0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b, 0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24,
+    0x105ec76f, 0xe235446c, 0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc, 0xbc267848, 0x4e4dfb4b,
+    0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a, 0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35,
+    0xaa64d611, 0x580f5512, 0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad, 0x1642ae59, 0xe4292d5a,
+    0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a, 0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595,
+    0x417b1dbc, 0xb3109ebf, 0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f, 0xed03a29b, 0x1f682198,
+    0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927, 0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38,
+    0xdbfc821c, 0x2997011f, 0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e, 0x4767748a, 0xb50cf789,
+    0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859, 0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46,
+    0x7198540d, 0x83f3d70e, 0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de, 0xdde0eb2a, 0x2f8b6829,
+    0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c, 0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93,
+    0x082f63b7, 0xfa44e0b4, 0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b, 0xb4091bff, 0x466298fc,
+    0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c, 0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033,
+    0xa24bb5a6, 0x502036a5, 0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975, 0x0e330a81, 0xfc588982,
+    0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d, 0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622,
+    0x38cc2a06, 0xcaa7a905, 0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8, 0xe52cc12c, 0x1747422f,
+    0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff, 0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0,
+    0xd3d3e1ab, 0x21b862a8, 0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78, 0x7fab5e8c, 0x8dc0dd8f,
+    0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee, 0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1,
+    0x69e9f0d5, 0x9b8273d6, 0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69, 0xd5cf889d, 0x27a40b9e,
+    0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e, 0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+};
+
+static uint32_t mr_crc32c_table(uint32_t crc, const uint8_t *u8v, size_t len) {
+    for (size_t i = 0; i < len; i++) crc = CRC32C_TABLE[(crc ^ u8v[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static uint32_t mr_crc32c_sse42(uint32_t crc, const uint8_t *u8v, size_t len) {
+    uint64_t crc64 = crc;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t u64;
+        memcpy(&u64, u8v + i, 8);
+        crc64 = _mm_crc32_u64(crc64, u64);
+    }
+
+    for (crc = crc64; i < len; i++) crc = _mm_crc32_u8(crc, u8v[i]);
+    return crc;
+}
+
+#endif
+
+// continue a CRC-32C over len more bytes; start with crc 0
+uint32_t mr_crc32c(uint32_t crc, const uint8_t *u8v, const size_t len) {
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) return ~mr_crc32c_sse42(crc, u8v, len);
+#endif
+    return ~mr_crc32c_table(crc, u8v, len);
+}
+
+// VBI: 7 bits per byte, least significant first, high bit set on all but the last byte
+
+int mr_bytecount_VBI(uint32_t u32) {
     if (u32 >> (7 * 4)) return -1; // overflow: too big for 4 bytes
+    int bits = 32 - __builtin_clz(u32 | 1);
+    return (bits + 6) / 7;
+}
 
-    uint8_t *pu8 = u8v0;
-    int i = 0;
-    do {
-        *pu8 = u32 & 0x7F;
-        u32 = u32 >> 7;
-        if (u32) *pu8 |= 0x80;
-        i++;
-        pu8++;
-    } while (u32);
+int mr_make_VBI(uint32_t u32, uint8_t *u8v0) {
+    if (u32 < 128) { // the common case
+        u8v0[0] = u32;
+        return 1;
+    }
 
-    return i;
+    int bytecount = mr_bytecount_VBI(u32);
+
+    switch (bytecount) { // unrolled from the last byte
+        case 4:
+            u8v0[3] = u32 >> 21;
+            // fall through
+        case 3:
+            u8v0[2] = (u32 >> 14 & 0x7F) | (bytecount > 3) << 7;
+            // fall through
+        case 2:
+            u8v0[1] = (u32 >> 7 & 0x7F) | (bytecount > 2) << 7;
+            u8v0[0] = u32 | 0x80;
+    }
+
+    return bytecount;
 }
 
-int mr_extract_VBI(uint32_t *pu32, uint8_t *u8v0) {
-    uint8_t *pu8 = u8v0;
-    uint32_t result_u32 = 0;
-    int i;
+/**
+ * @brief Decode the VBI at u8v, reading no more than avail bytes.
+ *
+ * Return its byte count, 0 if it continues beyond avail, or -1 on overflow: byte[3] has a
+ * continuation bit.
+ */
+int mr_extract_VBI(uint32_t *pu32, const uint8_t *u8v, const size_t avail) {
+    if (avail >= 2) { // the common 1 & 2 byte VBIs from one 16 bit load
+        uint32_t u16 = u8v[0] | (uint32_t)u8v[1] << 8;
+
+        if (!(u16 & 0x80)) {
+            *pu32 = u16 & 0x7F;
+            return 1;
+        }
 
-    for (i = 0; i < 4; pu8++, i++){
-        result_u32 += (*pu8 & 0x7F) << (7 * i);
-        if (!(*pu8 & 0x80)) break;
+        if (!(u16 & 0x8000)) {
+            *pu32 = (u16 & 0x7F) | (u16 >> 1 & 0x3F80);
+            return 2;
+        }
     }
 
-    if (i == 4) { // overflow: byte[3] has a continuation bit
-        return -1;
+    if (avail >= 4) { // one 32 bit load: the first clear high bit ends the VBI
+        uint32_t u32 = u8v[0] | (uint32_t)u8v[1] << 8 | (uint32_t)u8v[2] << 16 | (uint32_t)u8v[3] << 24;
+        uint32_t ends = ~u32 & 0x80808080;
+        if (!ends) return -1;
+        int bytecount = __builtin_ctz(ends) / 8 + 1;
+        u32 = (u32 & 0x7F) | (u32 >> 1 & 0x3F80) | (u32 >> 2 & 0x1FC000) | (u32 >> 3 & 0xFE00000);
+        *pu32 = u32 & ((1u << (7 * bytecount)) - 1);
+        return bytecount;
     }
-    else {
-        *pu32 = result_u32;
-        return i + 1;
+
+    uint32_t u32 = 0;
+
+    for (int i = 0; i < avail; i++) {
+        u32 |= (uint32_t)(u8v[i] & 0x7F) << (7 * i);
+
+        if (!(u8v[i] & 0x80)) {
+            *pu32 = u32;
+            return i + 1;
+        }
     }
+
+    return 0;
 }
 
 int mr_print_hexdump(uint8_t *u8v, const size_t u8vlen) {
@@ -1,3 +1,5 @@
+#include <vector>
+
 #include <catch2/catch.hpp>
 #include <zlog.h>
 
@@ -174,6 +176,8 @@ TEST_CASE("unhappy PUBLISH packet", "[publish][unhappy]") {
         CHECK(mr_set_publish_topic_name(pctx, "$/foo/*/bar//") == 0);
         CHECK(mr_set_publish_topic_name(pctx, "foobar/#") == -1);
         CHECK(mr_set_publish_topic_name(pctx, "foo/+/bar") == -1);
+        CHECK(mr_set_publish_topic_name(pctx, "#") == -1);
+        CHECK(mr_set_publish_topic_name(pctx, "+/foo") == -1);
     }
 
     SECTION("publish_packet_identifier") {
@@ -194,6 +198,26 @@ TEST_CASE("unhappy PUBLISH packet", "[publish][unhappy]") {
         CHECK(mr_set_publish_response_topic(pctx, "foo/+/bar") == -1);
     }
 
+    SECTION("publish_payload_utf8") { // complex packet has payload_format_indicator set
+        uint8_t *packet_u8v0;
+        size_t packet_u8vlen;
+        size_t payload_len = 70000; // more than a string may hold
+        uint8_t *payload = (uint8_t *)malloc(payload_len);
+        memset(payload, 'x', payload_len);
+        REQUIRE(mr_set_publish_payload(pctx, payload, payload_len) == 0);
+        CHECK(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == 0);
+        memcpy(payload + 700, "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80", 9);
+        CHECK(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == 0);
+        payload[65600] = 0x01;
+        CHECK(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == -1);
+        payload[65600] = 'x';
+        memcpy(payload + 700, "\xed\xa0\x80", 3); // surrogate
+        CHECK(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == -1);
+        memcpy(payload + 700, "\xc2\x85", 2); // C1 control
+        CHECK(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == -1);
+        free(payload);
+    }
+
     // common test epilog
 
     // free packet context
@@ -202,4 +226,764 @@ TEST_CASE("unhappy PUBLISH packet", "[publish][unhappy]") {
 
     zlog_fini();
 
-}
\ No newline at end of file
+}
+TEST_CASE("unhappy PUBLISH unpack", "[publish][unhappy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    // corrupt the properties of the complex packet
+    mr_packet_ctx *pctx = NULL;
+    uint8_t *u8v0;
+    size_t u8vlen;
+    REQUIRE(get_binary_file_content("fixtures/complex_publish_packet.bin", &u8v0, &u8vlen) == 0);
+    REQUIRE(u8v0[0x11] == 0x01); // payload_format_indicator
+    REQUIRE(u8v0[0x13] == 0x02); // message_expiry_interval, then topic_alias at 0x18
+    REQUIRE(u8v0[0x1B] == 0x08); // response_topic
+
+    // *** test sections ***
+
+    SECTION("unknown property id") {
+        u8v0[0x11] = 0x7F;
+    }
+
+    SECTION("property not allowed in PUBLISH") {
+        u8v0[0x11] = 0x24; // maximum_qos: CONNACK only
+    }
+
+    SECTION("duplicate property") {
+        u8v0[0x13] = 0x01; // a second payload_format_indicator
+    }
+
+    SECTION("invalid utf8 property string") {
+        u8v0[0x1E] = 0xFF;
+    }
+
+    SECTION("string beyond the property block") {
+        REQUIRE(u8v0[0x51] == 0x0C); // content_type length: the last property
+        u8v0[0x51] = 0x0D; // into the payload
+    }
+
+    SECTION("string pair beyond the packet") {
+        REQUIRE(u8v0[0x39] == 0x03); // user property value length
+        u8v0[0x38] = 0xFF;
+    }
+
+    SECTION("property block beyond the packet") {
+        REQUIRE(u8v0[0x10] == 0x4D); // property_length
+        u8v0[0x10] = 0x51;
+    }
+
+    // *** common test epilog ***
+
+    CHECK(mr_init_unpack_publish_packet(&pctx, u8v0, u8vlen) == -1);
+    if (pctx) mr_free_publish_packet(pctx);
+    free(u8v0);
+
+    zlog_fini();
+}
+
+TEST_CASE("borrowed PUBLISH packet", "[publish][borrow]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_packet_ctx *pctx;
+    uint8_t *u8v0;
+    size_t u8vlen;
+    REQUIRE(get_binary_file_content("fixtures/complex_publish_packet.bin", &u8v0, &u8vlen) == 0);
+    REQUIRE(mr_init_unpack_publish_packet_flags(&pctx, u8v0, u8vlen, MR_UNPACK_BORROW) == 0);
+
+    // *** test sections ***
+
+    SECTION("views into the packet") {
+        uint8_t *correlation_data;
+        size_t correlation_data_len;
+        bool exists_flag;
+        REQUIRE(mr_get_publish_correlation_data(pctx, &correlation_data, &correlation_data_len, &exists_flag) == 0);
+        CHECK(exists_flag);
+        CHECK(correlation_data_len == 3);
+        CHECK(memcmp(correlation_data, "abc", 3) == 0);
+        CHECK(correlation_data > u8v0);
+        CHECK(correlation_data + correlation_data_len < u8v0 + u8vlen);
+
+        uint8_t *payload;
+        size_t payload_len;
+        REQUIRE(mr_get_publish_payload(pctx, &payload, &payload_len) == 0);
+        CHECK(payload_len == 3);
+        CHECK(payload == u8v0 + u8vlen - 3);
+
+        char *topic_name;
+        REQUIRE(mr_get_publish_topic_name(pctx, &topic_name) == 0);
+        CHECK(strcmp(topic_name, "topic_name") == 0);
+    }
+
+    SECTION("repack") {
+        uint8_t *packet_u8v0;
+        size_t packet_u8vlen;
+        REQUIRE(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == 0);
+        REQUIRE(packet_u8vlen == u8vlen);
+        CHECK(memcmp(packet_u8v0, u8v0, u8vlen) == 0);
+    }
+
+    SECTION("replace borrowed value") {
+        uint8_t correlation_data[] = {'x', 'y'};
+        REQUIRE(mr_set_publish_correlation_data(pctx, correlation_data, 2) == 0);
+        REQUIRE(mr_reset_publish_correlation_data(pctx) == 0);
+    }
+
+    // *** common test epilog ***
+
+    // free packet context before the buffer it borrows from
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+    free(u8v0);
+
+    zlog_fini();
+}
+
+// a PUBLISH to "a" with count copies of one property, e.g. an empty user property
+static std::vector<uint8_t> repeated_property_publish(const std::vector<uint8_t> &property, const size_t count) {
+    std::vector<uint8_t> properties;
+    for (size_t i = 0; i < count; i++) properties.insert(properties.end(), property.begin(), property.end());
+    std::vector<uint8_t> body = {0x00, 0x01, 'a'};
+
+    for (size_t len = properties.size(); ; len >>= 7) { // property length VBI
+        body.push_back((len & 0x7F) | (len >> 7 ? 0x80 : 0));
+        if (!(len >> 7)) break;
+    }
+
+    body.insert(body.end(), properties.begin(), properties.end());
+    std::vector<uint8_t> u8v = {0x30};
+
+    for (size_t len = body.size(); ; len >>= 7) { // remaining length VBI
+        u8v.push_back((len & 0x7F) | (len >> 7 ? 0x80 : 0));
+        if (!(len >> 7)) break;
+    }
+
+    u8v.insert(u8v.end(), body.begin(), body.end());
+    return u8v;
+}
+
+TEST_CASE("arena PUBLISH packet with many properties", "[publish][arena]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_packet_ctx *pctx;
+    std::vector<uint8_t> u8v;
+    size_t vlen;
+    bool exists_flag;
+
+    // *** test sections ***
+
+    SECTION("user properties") {
+        u8v = repeated_property_publish({0x26, 0x00, 0x00, 0x00, 0x00}, 10000);
+        REQUIRE(mr_init_unpack_publish_packet_flags(&pctx, u8v.data(), u8v.size(), MR_UNPACK_ARENA) == 0);
+        mr_string_pair *spv;
+        REQUIRE(mr_get_publish_user_properties(pctx, &spv, &vlen, &exists_flag) == 0);
+    }
+
+    SECTION("subscription identifiers") {
+        u8v = repeated_property_publish({0x0B, 0x01}, 10000);
+        REQUIRE(mr_init_unpack_publish_packet_flags(&pctx, u8v.data(), u8v.size(), MR_UNPACK_ARENA) == 0);
+        uint32_t *u32v;
+        REQUIRE(mr_get_publish_subscription_identifiers(pctx, &u32v, &vlen, &exists_flag) == 0);
+    }
+
+    // *** common test epilog ***
+
+    CHECK(vlen == 10000);
+    size_t arena_size;
+    REQUIRE(mr_get_packet_arena_size(pctx, &arena_size) == 0);
+    CHECK(arena_size < 64 * u8v.size()); // linear in the packet, not quadratic
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+
+    zlog_fini();
+}
+
+TEST_CASE("lazy PUBLISH packet", "[publish][lazy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_packet_ctx *pctx;
+    uint8_t *u8v0;
+    size_t u8vlen;
+    REQUIRE(get_binary_file_content("fixtures/complex_publish_packet.bin", &u8v0, &u8vlen) == 0);
+    bool exists_flag;
+
+    // *** test sections ***
+
+    SECTION("decoded on get") {
+        REQUIRE(mr_init_unpack_publish_packet_flags(&pctx, u8v0, u8vlen, MR_UNPACK_LAZY) == 0);
+
+        char *content_type;
+        REQUIRE(mr_get_publish_content_type(pctx, &content_type, &exists_flag) == 0);
+        CHECK(exists_flag);
+        CHECK(strcmp(content_type, "content_type") == 0);
+
+        mr_string_pair *user_properties;
+        size_t user_properties_len;
+        REQUIRE(mr_get_publish_user_properties(pctx, &user_properties, &user_properties_len, &exists_flag) == 0);
+        CHECK(exists_flag);
+        REQUIRE(user_properties_len == 2);
+        CHECK(strcmp(user_properties[0].name, "baz") == 0);
+        CHECK(strcmp(user_properties[1].value, "boop") == 0);
+
+        uint32_t *subscription_identifiers;
+        size_t subscription_identifiers_len;
+        REQUIRE(mr_get_publish_subscription_identifiers(
+            pctx, &subscription_identifiers, &subscription_identifiers_len, &exists_flag
+        ) == 0);
+        REQUIRE(subscription_identifiers_len == 2);
+        CHECK(subscription_identifiers[1] == 1000000);
+    }
+
+    SECTION("repack & printable") {
+        REQUIRE(mr_init_unpack_publish_packet_flags(&pctx, u8v0, u8vlen, MR_UNPACK_LAZY | MR_UNPACK_ARENA) == 0);
+        uint8_t *packet_u8v0;
+        size_t packet_u8vlen;
+        REQUIRE(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == 0);
+        REQUIRE(packet_u8vlen == u8vlen);
+        CHECK(memcmp(packet_u8v0, u8v0, u8vlen) == 0);
+
+        char *file_printable;
+        size_t mdsz;
+        REQUIRE(get_binary_file_content("fixtures/complex_publish_printable.txt", (uint8_t **)&file_printable, &mdsz) == 0);
+        char *packet_printable;
+        REQUIRE(mr_get_publish_printable(pctx, false, &packet_printable) == 0);
+        CHECK(strcmp(file_printable, packet_printable) == 0);
+        free(file_printable);
+    }
+
+    SECTION("setter replaces the undecoded value") {
+        REQUIRE(mr_init_unpack_publish_packet_flags(&pctx, u8v0, u8vlen, MR_UNPACK_LAZY) == 0);
+        mr_string_pair user_properties[] = {{(char *)"foo", (char *)"bar"}};
+        REQUIRE(mr_set_publish_user_properties(pctx, user_properties, 1) == 0);
+        uint8_t *packet_u8v0;
+        size_t packet_u8vlen;
+        REQUIRE(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == 0);
+        CHECK(packet_u8vlen == u8vlen - 12); // one string pair fewer
+    }
+
+    SECTION("response topic checked in place") {
+        uint64_t allocs, frees, decode_allocs;
+        REQUIRE(mr_init_unpack_publish_packet_flags(&pctx, u8v0, u8vlen, MR_UNPACK_LAZY) == 0);
+        REQUIRE(mr_get_alloc_stats(&allocs, &frees) == 0);
+        char *response_topic;
+        REQUIRE(mr_get_publish_response_topic(pctx, &response_topic, &exists_flag) == 0);
+        CHECK(strcmp(response_topic, "response_topic") == 0);
+        REQUIRE(mr_get_alloc_stats(&decode_allocs, &frees) == 0);
+        CHECK(decode_allocs == allocs + 1); // decoded on get, not at unpack
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+
+        REQUIRE(u8v0[0x1B] == 0x08); // response_topic
+        u8v0[0x1E] = '#';
+        pctx = NULL;
+        CHECK(mr_init_unpack_publish_packet_flags(&pctx, u8v0, u8vlen, MR_UNPACK_LAZY) == -1);
+        if (!pctx) REQUIRE(mr_init_publish_packet(&pctx) == 0); // for the epilog
+    }
+
+    SECTION("invalid utf8 found on get") {
+        REQUIRE(u8v0[0x4F] == 0x03); // content_type
+        u8v0[0x52] = 0xFF;
+        REQUIRE(mr_init_unpack_publish_packet_flags(&pctx, u8v0, u8vlen, MR_UNPACK_LAZY) == 0);
+        char *content_type;
+        CHECK(mr_get_publish_content_type(pctx, &content_type, &exists_flag) == -1);
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+
+        REQUIRE(mr_init_unpack_publish_packet_flags(&pctx, u8v0, u8vlen, MR_UNPACK_LAZY) == 0);
+        uint8_t *packet_u8v0;
+        size_t packet_u8vlen;
+        CHECK(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == -1);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+    free(u8v0);
+
+    zlog_fini();
+}
+
+TEST_CASE("unhappy lazy PUBLISH packet", "[publish][lazy][unhappy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_packet_ctx *pctx = NULL;
+    uint8_t u8v[8] = {0x30, 0x06, 0x00, 0x01, 'a', 0x02, 0x00, 0x00}; // a property block of 2 bytes
+
+    // *** test sections ***
+
+    SECTION("user property cut off inside its name length") {
+        u8v[6] = u8v[7] = 0x26;
+    }
+
+    SECTION("string cut off inside its length") {
+        u8v[6] = 0x03; // content_type
+    }
+
+    // *** common test epilog ***
+
+    CHECK(mr_init_unpack_publish_packet_flags(&pctx, u8v, sizeof(u8v), MR_UNPACK_LAZY) == -1);
+    if (pctx) mr_free_publish_packet(pctx);
+
+    zlog_fini();
+}
+
+TEST_CASE("projected PUBLISH packet", "[publish][fields]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_packet_ctx *pctx;
+    uint8_t *u8v0;
+    size_t u8vlen;
+    REQUIRE(get_binary_file_content("fixtures/complex_publish_packet.bin", &u8v0, &u8vlen) == 0);
+    const uint64_t field_mask = MR_FIELD(PUBLISH_TOPIC_NAME) | MR_FIELD(PUBLISH_SUBSCRIPTION_IDENTIFIERS);
+    bool exists_flag;
+
+    // *** test sections ***
+
+    SECTION("requested fields only") {
+        REQUIRE(mr_init_unpack_publish_packet_fields(&pctx, u8v0, u8vlen, MR_UNPACK_COPY, field_mask) == 0);
+
+        char *topic_name;
+        REQUIRE(mr_get_publish_topic_name(pctx, &topic_name) == 0);
+        CHECK(strlen(topic_name) > 0);
+
+        uint16_t packet_identifier; // fixed size: always decoded
+        REQUIRE(mr_get_publish_packet_identifier(pctx, &packet_identifier, &exists_flag) == 0);
+        CHECK(exists_flag);
+
+        uint32_t *subscription_identifiers;
+        size_t subscription_identifiers_len;
+        REQUIRE(mr_get_publish_subscription_identifiers(
+            pctx, &subscription_identifiers, &subscription_identifiers_len, &exists_flag
+        ) == 0);
+        CHECK(exists_flag);
+        REQUIRE(subscription_identifiers_len == 2);
+        CHECK(subscription_identifiers[1] == 1000000);
+
+        mr_string_pair *user_properties;
+        size_t user_properties_len;
+        REQUIRE(mr_get_publish_user_properties(pctx, &user_properties, &user_properties_len, &exists_flag) == 0);
+        CHECK(!exists_flag);
+        char *content_type;
+        REQUIRE(mr_get_publish_content_type(pctx, &content_type, &exists_flag) == 0);
+        CHECK(!exists_flag);
+
+        uint8_t *packet_u8v0;
+        size_t packet_u8vlen;
+        CHECK(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == -1);
+    }
+
+    SECTION("unrequested fields are not validated") {
+        REQUIRE(u8v0[0x4F] == 0x03); // content_type
+        u8v0[0x52] = 0xFF;
+        CHECK(mr_init_unpack_publish_packet_fields(&pctx, u8v0, u8vlen, MR_UNPACK_COPY, field_mask) == 0);
+    }
+
+    SECTION("framing still verified") {
+        CHECK(mr_init_unpack_publish_packet_fields(&pctx, u8v0, u8vlen - 1, MR_UNPACK_COPY, field_mask) == -1);
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+        u8v0[0x50] = 0xFF; // content_type length beyond the property block
+        CHECK(mr_init_unpack_publish_packet_fields(&pctx, u8v0, u8vlen, MR_UNPACK_COPY, field_mask) == -1);
+    }
+
+    SECTION("any packet") {
+        REQUIRE(mr_init_unpack_any_packet_fields(&pctx, u8v0, u8vlen, MR_UNPACK_BORROW, field_mask) == 0);
+        char *content_type;
+        REQUIRE(mr_get_publish_content_type(pctx, &content_type, &exists_flag) == 0);
+        CHECK(!exists_flag);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+    free(u8v0);
+
+    zlog_fini();
+}
+
+TEST_CASE("peek PUBLISH packet", "[publish][peek]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    uint8_t *u8v0;
+    size_t u8vlen;
+    mr_publish_peek peek;
+
+    // *** test sections ***
+
+    SECTION("complex packet") {
+        REQUIRE(get_binary_file_content("fixtures/complex_publish_packet.bin", &u8v0, &u8vlen) == 0);
+        REQUIRE(mr_peek_publish(u8v0, u8vlen, &peek) == 0);
+        CHECK(peek.qos == 2);
+        CHECK(peek.dup);
+        CHECK(peek.retain);
+        CHECK(peek.topic_name_len == 10);
+        CHECK(memcmp(peek.topic_name, "topic_name", 10) == 0);
+        CHECK(peek.packet_identifier == 1000);
+        CHECK(peek.property_length == 77);
+        CHECK(peek.payload_len == 3);
+        CHECK(memcmp(u8v0 + peek.payload_offset, "def", 3) == 0);
+        CHECK(u8v0[peek.properties_offset] == 0x01); // payload_format_indicator
+    }
+
+    SECTION("default packet") {
+        REQUIRE(get_binary_file_content("fixtures/default_publish_packet.bin", &u8v0, &u8vlen) == 0);
+        REQUIRE(mr_peek_publish(u8v0, u8vlen, &peek) == 0);
+        CHECK(peek.qos == 0);
+        CHECK(!peek.dup);
+        CHECK(!peek.retain);
+        CHECK(peek.topic_name_len == 0);
+        CHECK(peek.packet_identifier == 0);
+        CHECK(peek.property_length == 0);
+        CHECK(peek.payload_offset == u8vlen);
+        CHECK(peek.payload_len == 0);
+    }
+
+    SECTION("malformed packets") {
+        REQUIRE(get_binary_file_content("fixtures/complex_publish_packet.bin", &u8v0, &u8vlen) == 0);
+        CHECK(mr_peek_publish(u8v0, u8vlen - 1, &peek) == -1); // truncated
+        CHECK(mr_peek_publish(u8v0, 1, &peek) == -1);
+
+        u8v0[0] = (MQTT_PUBLISH << 4) | 0x06; // qos 3
+        CHECK(mr_peek_publish(u8v0, u8vlen, &peek) == -1);
+        u8v0[0] = MQTT_PUBACK << 4;
+        CHECK(mr_peek_publish(u8v0, u8vlen, &peek) == -1);
+        u8v0[0] = 0x3D;
+
+        u8v0[4] = '+'; // wildcard in the topic name
+        CHECK(mr_peek_publish(u8v0, u8vlen, &peek) == -1);
+        u8v0[4] = 't';
+
+        u8v0[0x0F] = 0x00; // packet identifier 0
+        u8v0[0x0E] = 0x00;
+        CHECK(mr_peek_publish(u8v0, u8vlen, &peek) == -1);
+        u8v0[0x0E] = 0x03;
+        u8v0[0x0F] = 0xE8;
+
+        u8v0[0x10] = 0x7F; // property length beyond the packet
+        CHECK(mr_peek_publish(u8v0, u8vlen, &peek) == -1);
+        u8v0[0x10] = 0x4D;
+
+        CHECK(mr_peek_publish(u8v0, u8vlen, &peek) == 0);
+    }
+
+    // *** common test epilog ***
+
+    free(u8v0);
+
+    zlog_fini();
+}
+
+TEST_CASE("rewrite PUBLISH packet", "[publish][rewrite]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_packet_ctx *pctx;
+    uint8_t *u8v0;
+    size_t u8vlen;
+    REQUIRE(get_binary_file_content("fixtures/complex_publish_packet.bin", &u8v0, &u8vlen) == 0);
+    size_t offset;
+    size_t packet_u8vlen;
+    uint8_t u8;
+    uint16_t u16;
+    bool exists_flag;
+
+    // *** test sections ***
+
+    SECTION("qos 1 with a new packet identifier") {
+        mr_publish_rewrite rewrite = {1, false, true, 7};
+        REQUIRE(mr_rewrite_publish(u8v0, u8vlen, &rewrite, &offset, &packet_u8vlen) == 0);
+        CHECK(offset == 0);
+        CHECK(packet_u8vlen == u8vlen);
+        REQUIRE(mr_init_unpack_publish_packet(&pctx, u8v0 + offset, packet_u8vlen) == 0);
+        REQUIRE(mr_get_publish_qos(pctx, &u8) == 0);
+        CHECK(u8 == 1);
+        bool dup;
+        REQUIRE(mr_get_publish_dup(pctx, &dup) == 0);
+        CHECK(!dup);
+        REQUIRE(mr_get_publish_packet_identifier(pctx, &u16, &exists_flag) == 0);
+        CHECK(u16 == 7);
+    }
+
+    SECTION("qos 0 matches a repack") {
+        REQUIRE(mr_init_unpack_publish_packet(&pctx, u8v0, u8vlen) == 0);
+        REQUIRE(mr_set_publish_qos(pctx, 0) == 0);
+        REQUIRE(mr_reset_publish_packet_identifier(pctx) == 0);
+        REQUIRE(mr_set_publish_dup(pctx, false) == 0);
+        REQUIRE(mr_set_publish_retain(pctx, false) == 0);
+        uint8_t *repacked_u8v0;
+        size_t repacked_u8vlen;
+        REQUIRE(mr_pack_publish_packet(pctx, &repacked_u8v0, &repacked_u8vlen) == 0);
+
+        mr_publish_rewrite rewrite = {0, true, false, 0};
+        REQUIRE(mr_rewrite_publish(u8v0, u8vlen, &rewrite, &offset, &packet_u8vlen) == 0);
+        CHECK(offset == 2);
+        REQUIRE(packet_u8vlen == repacked_u8vlen);
+        CHECK(memcmp(u8v0 + offset, repacked_u8v0, packet_u8vlen) == 0);
+    }
+
+    SECTION("qos cannot be raised") {
+        mr_publish_rewrite rewrite = {0, false, false, 0};
+        REQUIRE(mr_rewrite_publish(u8v0, u8vlen, &rewrite, &offset, &packet_u8vlen) == 0);
+        rewrite = {1, false, false, 1};
+        CHECK(mr_rewrite_publish(u8v0 + offset, packet_u8vlen, &rewrite, &offset, &packet_u8vlen) == -1);
+        REQUIRE(mr_init_publish_packet(&pctx) == 0);
+    }
+
+    SECTION("malformed packet") {
+        mr_publish_rewrite rewrite = {0, false, false, 0};
+        CHECK(mr_rewrite_publish(u8v0, u8vlen - 1, &rewrite, &offset, &packet_u8vlen) == -1);
+        REQUIRE(mr_init_publish_packet(&pctx) == 0);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+    free(u8v0);
+
+    zlog_fini();
+}
+
+TEST_CASE("pooled PUBLISH packet", "[publish][pool]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    uint8_t *u8v0;
+    size_t u8vlen;
+    REQUIRE(get_binary_file_content("fixtures/complex_publish_packet.bin", &u8v0, &u8vlen) == 0);
+    char *file_printable;
+    size_t mdsz;
+    REQUIRE(get_binary_file_content("fixtures/default_publish_printable.txt", (uint8_t **)&file_printable, &mdsz) == 0);
+
+    uint64_t hits0, misses0, hits, misses;
+    REQUIRE(mr_set_packet_pool_depth(2) == 0);
+    REQUIRE(mr_get_packet_pool_stats(&hits0, &misses0) == 0);
+
+    // *** test sections ***
+
+    SECTION("reused context is reset") {
+        mr_packet_ctx *pctx;
+        REQUIRE(mr_init_unpack_publish_packet(&pctx, u8v0, u8vlen) == 0);
+        char *packet_printable;
+        REQUIRE(mr_get_publish_printable(pctx, false, &packet_printable) == 0);
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+
+        REQUIRE(mr_init_publish_packet(&pctx) == 0);
+        REQUIRE(mr_get_publish_printable(pctx, false, &packet_printable) == 0);
+        CHECK(strcmp(file_printable, packet_printable) == 0);
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+
+        REQUIRE(mr_get_packet_pool_stats(&hits, &misses) == 0);
+        CHECK(hits - hits0 == 1);
+        CHECK(misses - misses0 == 1);
+    }
+
+    SECTION("depth") {
+        mr_packet_ctx *pctxv[3];
+        for (int i = 0; i < 3; i++) REQUIRE(mr_init_unpack_publish_packet(pctxv + i, u8v0, u8vlen) == 0);
+        for (int i = 0; i < 3; i++) REQUIRE(mr_free_publish_packet(pctxv[i]) == 0); // 1 is freed
+        for (int i = 0; i < 3; i++) REQUIRE(mr_init_publish_packet(pctxv + i) == 0);
+        for (int i = 0; i < 3; i++) REQUIRE(mr_free_publish_packet(pctxv[i]) == 0);
+
+        REQUIRE(mr_get_packet_pool_stats(&hits, &misses) == 0);
+        CHECK(hits - hits0 == 2);
+        CHECK(misses - misses0 == 4);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_set_packet_pool_depth(0) == 0); // drains
+    free(file_printable);
+    free(u8v0);
+
+    zlog_fini();
+}
+
+TEST_CASE("PUBLISH packed into a caller buffer or iovec", "[publish][pack]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_packet_ctx *pctx;
+    uint8_t *u8v0;
+    size_t u8vlen;
+    REQUIRE(get_binary_file_content("fixtures/complex_publish_packet.bin", &u8v0, &u8vlen) == 0);
+    REQUIRE(mr_init_unpack_publish_packet(&pctx, u8v0, u8vlen) == 0);
+    uint8_t buf[256];
+    size_t packet_u8vlen;
+
+    // *** test sections ***
+
+    SECTION("buffer") {
+        CHECK(mr_pack_any_packet_into(pctx, buf, u8vlen - 1, &packet_u8vlen) == -1);
+        CHECK(packet_u8vlen == u8vlen); // required length
+        REQUIRE(mr_pack_any_packet_into(pctx, buf, sizeof(buf), &packet_u8vlen) == 0);
+        REQUIRE(packet_u8vlen == u8vlen);
+        CHECK(memcmp(buf, u8v0, u8vlen) == 0);
+    }
+
+    SECTION("iovec") {
+        struct iovec iov[2];
+        int iovcnt;
+        REQUIRE(mr_pack_any_packet_iov(pctx, iov, &iovcnt) == 0);
+        REQUIRE(iovcnt == 2);
+        REQUIRE(iov[0].iov_len + iov[1].iov_len == u8vlen);
+        CHECK(memcmp(iov[0].iov_base, u8v0, iov[0].iov_len) == 0);
+        CHECK(memcmp(iov[1].iov_base, u8v0 + iov[0].iov_len, iov[1].iov_len) == 0);
+
+        uint8_t *payload;
+        size_t payload_len;
+        REQUIRE(mr_get_publish_payload(pctx, &payload, &payload_len) == 0);
+        CHECK(iov[1].iov_base == payload); // not copied
+
+        REQUIRE(mr_set_publish_payload(pctx, NULL, 0) == 0);
+        REQUIRE(mr_pack_any_packet_iov(pctx, iov, &iovcnt) == 0);
+        CHECK(iovcnt == 1);
+        CHECK(iov[0].iov_len == u8vlen - 3);
+    }
+
+    SECTION("packed size") {
+        size_t packed_size;
+        REQUIRE(mr_get_packed_size(pctx, &packed_size) == 0);
+        CHECK(packed_size == u8vlen);
+        REQUIRE(mr_set_publish_qos(pctx, 2) == 0); // unchanged
+        REQUIRE(mr_get_packed_size(pctx, &packed_size) == 0);
+        CHECK(packed_size == u8vlen);
+        REQUIRE(mr_set_publish_topic_name(pctx, "topic_name/longer") == 0);
+        REQUIRE(mr_get_packed_size(pctx, &packed_size) == 0);
+        CHECK(packed_size == u8vlen + 7);
+        REQUIRE(mr_reset_publish_message_expiry_interval(pctx) == 0);
+        REQUIRE(mr_get_packed_size(pctx, &packed_size) == 0);
+        CHECK(packed_size == u8vlen + 7 - 5);
+        REQUIRE(mr_pack_any_packet_into(pctx, buf, sizeof(buf), &packet_u8vlen) == 0);
+        CHECK(packet_u8vlen == packed_size);
+    }
+
+    SECTION("repeated packs") {
+        uint8_t *packet_u8v0;
+        REQUIRE(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == 0);
+        REQUIRE(mr_pack_publish_packet(pctx, &packet_u8v0, &packet_u8vlen) == 0);
+        REQUIRE(packet_u8vlen == u8vlen);
+        CHECK(memcmp(packet_u8v0, u8v0, u8vlen) == 0);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+    free(u8v0);
+
+    zlog_fini();
+}
+
+TEST_CASE("fan-out PUBLISH packet", "[publish][fanout]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_packet_ctx *pctx;
+    uint8_t *u8v0;
+    size_t u8vlen;
+    REQUIRE(get_binary_file_content("fixtures/complex_publish_packet.bin", &u8v0, &u8vlen) == 0);
+    REQUIRE(mr_init_unpack_publish_packet(&pctx, u8v0, u8vlen) == 0);
+    mr_publish_fanout *pfo;
+    REQUIRE(mr_init_publish_fanout(&pfo, pctx) == 0);
+    uint8_t buf[256];
+    struct iovec iov[2];
+    int iovcnt;
+    const uint32_t subscription_identifiers[] = {1, 1000000};
+
+    // *** test sections ***
+
+    SECTION("same fields as the source") {
+        mr_publish_target target = {2, true, true, 1000, 1000, false, subscription_identifiers, 2};
+        REQUIRE(mr_pack_publish_fanout(pfo, &target, buf, sizeof(buf), iov, &iovcnt) == 0);
+        REQUIRE(iovcnt == 2);
+        REQUIRE(iov[0].iov_len + iov[1].iov_len == u8vlen);
+        CHECK(memcmp(iov[0].iov_base, u8v0, iov[0].iov_len) == 0);
+        CHECK(memcmp(iov[1].iov_base, u8v0 + iov[0].iov_len, iov[1].iov_len) == 0);
+
+        uint8_t *payload;
+        size_t payload_len;
+        REQUIRE(mr_get_publish_payload(pctx, &payload, &payload_len) == 0);
+        CHECK(iov[1].iov_base == payload); // not copied
+    }
+
+    SECTION("per subscriber fields") {
+        mr_publish_target target = {0, false, false, 0, 7, false, subscription_identifiers + 1, 1};
+        REQUIRE(mr_pack_publish_fanout(pfo, &target, buf, sizeof(buf), iov, &iovcnt) == 0);
+        memcpy(buf + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+        size_t packet_u8vlen = iov[0].iov_len + iov[1].iov_len;
+        CHECK(packet_u8vlen == u8vlen - 2 - 2); // no packet_identifier, topic_alias 7 for 1000, one id fewer
+
+        mr_publish_peek peek;
+        REQUIRE(mr_peek_publish(buf, packet_u8vlen, &peek) == 0);
+        CHECK(peek.qos == 0);
+        CHECK(!peek.retain);
+        CHECK(peek.topic_name_len == 10);
+        CHECK(buf[peek.properties_offset + 7] == 0x23); // topic_alias after message_expiry_interval
+        CHECK(buf[peek.properties_offset + 9] == 7);
+
+        mr_packet_ctx *fo_pctx;
+        REQUIRE(mr_init_unpack_publish_packet(&fo_pctx, buf, packet_u8vlen) == 0);
+        bool exists_flag;
+        uint32_t *fo_subscription_identifiers;
+        size_t fo_subscription_identifiers_len;
+        REQUIRE(mr_get_publish_subscription_identifiers(
+            fo_pctx, &fo_subscription_identifiers, &fo_subscription_identifiers_len, &exists_flag
+        ) == 0);
+        REQUIRE(fo_subscription_identifiers_len == 1);
+        CHECK(fo_subscription_identifiers[0] == 1000000);
+        char *content_type;
+        REQUIRE(mr_get_publish_content_type(fo_pctx, &content_type, &exists_flag) == 0);
+        CHECK(strcmp(content_type, "content_type") == 0);
+        REQUIRE(mr_free_publish_packet(fo_pctx) == 0);
+    }
+
+    SECTION("topic alias only") {
+        mr_publish_target target = {1, false, false, 1, 7, true, NULL, 0};
+        REQUIRE(mr_pack_publish_fanout(pfo, &target, buf, sizeof(buf), iov, &iovcnt) == 0);
+        memcpy(buf + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+        mr_publish_peek peek;
+        REQUIRE(mr_peek_publish(buf, iov[0].iov_len + iov[1].iov_len, &peek) == 0);
+        CHECK(peek.topic_name_len == 0);
+        CHECK(peek.packet_identifier == 1);
+    }
+
+    SECTION("invalid targets") {
+        mr_publish_target target = {1, false, false, 0, 0, false, NULL, 0};
+        CHECK(mr_pack_publish_fanout(pfo, &target, buf, sizeof(buf), iov, &iovcnt) == -1);
+        target = {3, false, false, 1, 0, false, NULL, 0};
+        CHECK(mr_pack_publish_fanout(pfo, &target, buf, sizeof(buf), iov, &iovcnt) == -1);
+        target = {0, false, false, 0, 0, true, NULL, 0};
+        CHECK(mr_pack_publish_fanout(pfo, &target, buf, sizeof(buf), iov, &iovcnt) == -1);
+        target = {0, true, false, 0, 0, false, NULL, 0}; // dup with qos 0
+        CHECK(mr_pack_publish_fanout(pfo, &target, buf, sizeof(buf), iov, &iovcnt) == -1);
+        const uint32_t bad_identifiers[] = {0};
+        target = {0, false, false, 0, 0, false, bad_identifiers, 1};
+        CHECK(mr_pack_publish_fanout(pfo, &target, buf, sizeof(buf), iov, &iovcnt) == -1);
+    }
+
+    SECTION("buffer too small") {
+        mr_publish_target target = {2, true, true, 1000, 1000, false, subscription_identifiers, 2};
+        CHECK(mr_pack_publish_fanout(pfo, &target, buf, 10, iov, &iovcnt) == -1);
+        CHECK(mr_errno == ENOBUFS);
+        CHECK(iov[0].iov_len == u8vlen - 3); // required length
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_publish_fanout(pfo) == 0);
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+    free(u8v0);
+
+    zlog_fini();
+}
@@ -159,6 +159,14 @@ TEST_CASE("unhappy SUBSCRIBE packet", "[subscribe][unhappy]") {
         CHECK(mr_set_subscribe_topic_filters(pctx, NULL, 0) == -1);
     }
 
+    SECTION("topic filter beyond the packet") {
+        mr_packet_ctx *bad_pctx;
+        REQUIRE(u8v0[0x31] == 0x16); // the last topic filter's length
+        u8v0[0x31] = 0x17;
+        CHECK(mr_init_unpack_subscribe_packet(&bad_pctx, u8v0, u8vlen) == -1);
+        REQUIRE(mr_free_subscribe_packet(bad_pctx) == 0);
+    }
+
     // common test epilog
 
     // free packet context
@@ -167,3 +175,55 @@ TEST_CASE("unhappy SUBSCRIBE packet", "[subscribe][unhappy]") {
     zlog_fini();
 
 }
+
+TEST_CASE("arena SUBSCRIBE packet", "[subscribe][arena]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_packet_ctx *pctx;
+    uint8_t *u8v0;
+    size_t u8vlen;
+    REQUIRE(get_binary_file_content("fixtures/complex_subscribe_packet.bin", &u8v0, &u8vlen) == 0);
+    char *file_printable;
+    size_t mdsz;
+    REQUIRE(get_binary_file_content("fixtures/complex_subscribe_printable.txt", (uint8_t **)&file_printable, &mdsz) == 0);
+
+    // *** test sections ***
+
+    SECTION("unpack") {
+        REQUIRE(mr_init_unpack_subscribe_packet_flags(&pctx, u8v0, u8vlen, MR_UNPACK_ARENA) == 0);
+    }
+
+    SECTION("unpack pooled") {
+        REQUIRE(mr_set_packet_pool_depth(1) == 0);
+        REQUIRE(mr_init_unpack_subscribe_packet_flags(&pctx, u8v0, u8vlen, MR_UNPACK_ARENA) == 0);
+        REQUIRE(mr_free_subscribe_packet(pctx) == 0);
+        REQUIRE(mr_init_unpack_subscribe_packet_flags(&pctx, u8v0, u8vlen, MR_UNPACK_ARENA) == 0); // reuses the arena
+    }
+
+    // *** common test epilog ***
+
+    char *packet_printable;
+    REQUIRE(mr_get_subscribe_printable(pctx, false, &packet_printable) == 0);
+    CHECK(strcmp(file_printable, packet_printable) == 0);
+
+    uint8_t *packet_u8v0;
+    size_t packet_u8vlen;
+    REQUIRE(mr_pack_subscribe_packet(pctx, &packet_u8v0, &packet_u8vlen) == 0);
+    REQUIRE(packet_u8vlen == u8vlen);
+    CHECK(memcmp(packet_u8v0, u8v0, u8vlen) == 0);
+
+    // replacing an arena value leaves it to the arena
+    char topic_filter_string[] = "replacement";
+    mr_topic_filter topic_filter = {topic_filter_string, 0, 0, 0, 0};
+    REQUIRE(mr_set_subscribe_topic_filters(pctx, &topic_filter, 1) == 0);
+    REQUIRE(mr_reset_subscribe_user_properties(pctx) == 0);
+
+    REQUIRE(mr_free_subscribe_packet(pctx) == 0);
+    REQUIRE(mr_set_packet_pool_depth(0) == 0);
+    free(file_printable);
+    free(u8v0);
+
+    zlog_fini();
+}
@@ -0,0 +1,696 @@
+#include <catch2/catch.hpp>
+#include <zlog.h>
+
+#include "mister/mister.h"
+#include "test_util.h"
+
+TEST_CASE("happy frame decoder", "[frame][happy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    // build a stream of packets from the fixtures
+    const char *packet_filenames[] = {
+        "fixtures/complex_connect_packet.bin",
+        "fixtures/complex_publish_packet.bin",
+        "fixtures/default_puback_packet.bin",
+        "fixtures/complex_subscribe_packet.bin",
+        "fixtures/default_publish_packet.bin"
+    };
+    const size_t packet_count = sizeof(packet_filenames) / sizeof(packet_filenames[0]);
+    size_t packet_offsets[packet_count];
+    size_t packet_lengths[packet_count];
+    uint8_t stream[4096];
+    size_t stream_len = 0;
+
+    for (size_t i = 0; i < packet_count; i++) {
+        uint8_t *u8v0;
+        size_t u8vlen;
+        REQUIRE(get_binary_file_content(packet_filenames[i], &u8v0, &u8vlen) == 0);
+        REQUIRE(stream_len + u8vlen < sizeof(stream));
+        memcpy(stream + stream_len, u8v0, u8vlen);
+        packet_offsets[i] = stream_len;
+        packet_lengths[i] = u8vlen;
+        stream_len += u8vlen;
+        free(u8v0);
+    }
+
+    mr_frame_decoder *pfd;
+    REQUIRE(mr_init_frame_decoder(&pfd, 0) == 0);
+    mr_frame frames[packet_count];
+    size_t frame_count = 0;
+    size_t frame_count_part;
+    size_t consumed;
+
+    // *** test sections ***
+
+    SECTION("one read") {
+        REQUIRE(mr_decode_frames(pfd, stream, stream_len, frames, packet_count, &frame_count, &consumed) == 0);
+        CHECK(consumed == stream_len);
+    }
+
+    SECTION("byte at a time") {
+        for (size_t i = 0; i < stream_len; i++) {
+            REQUIRE(mr_decode_frames(
+                pfd, stream + i, 1, frames + frame_count, packet_count - frame_count, &frame_count_part, &consumed
+            ) == 0);
+            REQUIRE(consumed == 1);
+            frame_count += frame_count_part;
+        }
+    }
+
+    SECTION("one frame at a time") {
+        size_t pos = 0;
+        while (pos < stream_len) {
+            REQUIRE(mr_decode_frames(pfd, stream + pos, stream_len - pos, frames + frame_count, 1, &frame_count_part, &consumed) == 0);
+            REQUIRE(frame_count_part == 1);
+            frame_count++;
+            pos += consumed;
+        }
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(frame_count == packet_count);
+    for (size_t i = 0; i < packet_count; i++) {
+        CHECK(frames[i].offset == packet_offsets[i]);
+        CHECK(frames[i].length == packet_lengths[i]);
+        CHECK(frames[i].header_len + frames[i].remaining_length == frames[i].length);
+        CHECK(frames[i].packet_type == stream[packet_offsets[i]] >> 4);
+    }
+
+    // frames are unpackable in place
+    for (size_t i = 0; i < packet_count; i++) {
+        mr_packet_ctx *pctx;
+        uint8_t packet_type;
+        REQUIRE(mr_init_unpack_any_packet(&pctx, stream + frames[i].offset, frames[i].length, MR_UNPACK_COPY) == 0);
+        REQUIRE(mr_get_any_packet_type(pctx, &packet_type) == 0);
+        CHECK(packet_type == frames[i].packet_type);
+        REQUIRE(mr_free_any_packet(pctx) == 0);
+    }
+
+    size_t offset;
+    REQUIRE(mr_get_frame_decoder_offset(pfd, &offset) == 0);
+    CHECK(offset == stream_len);
+    REQUIRE(mr_free_frame_decoder(pfd) == 0);
+
+    zlog_fini();
+}
+
+TEST_CASE("unhappy frame decoder", "[frame][unhappy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_frame_decoder *pfd;
+    REQUIRE(mr_init_frame_decoder(&pfd, 128) == 0);
+    mr_frame frames[4];
+    size_t frame_count;
+    size_t consumed;
+
+    // *** test sections ***
+
+    SECTION("reserved packet type") {
+        uint8_t u8v[] = {0x40, 0x02, 0x00, 0x01, 0x00, 0x00};
+        CHECK(mr_decode_frames(pfd, u8v, sizeof(u8v), frames, 4, &frame_count, &consumed) == -1);
+        CHECK(frame_count == 1);
+        CHECK(consumed == 4);
+    }
+
+    SECTION("VBI overflow") {
+        uint8_t u8v[] = {0x30, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+        CHECK(mr_decode_frames(pfd, u8v, sizeof(u8v), frames, 4, &frame_count, &consumed) == -1);
+        CHECK(frame_count == 0);
+        CHECK(mr_reset_frame_decoder(pfd) == 0);
+        CHECK(mr_decode_frames(pfd, u8v, 2, frames, 4, &frame_count, &consumed) == 0);
+        CHECK(mr_decode_frames(pfd, u8v + 2, 3, frames, 4, &frame_count, &consumed) == -1);
+    }
+
+    SECTION("unsupported packet type") {
+        mr_packet_ctx *pctx;
+        uint8_t u8v[] = {MQTT_PINGREQ << 4, 0x00};
+        CHECK(mr_decode_frames(pfd, u8v, sizeof(u8v), frames, 4, &frame_count, &consumed) == 0);
+        CHECK(frame_count == 1);
+        CHECK(mr_init_unpack_any_packet(&pctx, u8v, frames[0].length, MR_UNPACK_COPY) == -1);
+    }
+
+    SECTION("maximum packet size") {
+        uint8_t u8v[] = {0x30, 0x80, 0x01};
+        CHECK(mr_decode_frames(pfd, u8v, sizeof(u8v), frames, 4, &frame_count, &consumed) == -1);
+        CHECK(mr_decode_frames(pfd, u8v, sizeof(u8v), frames, 4, &frame_count, &consumed) == -1); // until reset
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_frame_decoder(pfd) == 0);
+
+    zlog_fini();
+}
+
+TEST_CASE("batch unpack", "[frame][batch]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    const char *packet_filenames[] = {
+        "fixtures/default_puback_packet.bin",
+        "fixtures/complex_publish_packet.bin",
+        "fixtures/complex_puback_packet.bin",
+        "fixtures/default_publish_packet.bin"
+    };
+    const size_t packet_count = sizeof(packet_filenames) / sizeof(packet_filenames[0]);
+    size_t packet_offsets[packet_count];
+    uint8_t stream[1024];
+    size_t stream_len = 0;
+
+    for (size_t i = 0; i < packet_count; i++) {
+        uint8_t *u8v0;
+        size_t u8vlen;
+        REQUIRE(get_binary_file_content(packet_filenames[i], &u8v0, &u8vlen) == 0);
+        memcpy(stream + stream_len, u8v0, u8vlen);
+        packet_offsets[i] = stream_len;
+        stream_len += u8vlen;
+        free(u8v0);
+    }
+
+    mr_packet_ctx *pctxv[packet_count];
+    size_t count;
+    size_t consumed;
+    uint8_t reason_code = MQTT_RC_SUCCESS;
+
+    // *** test sections ***
+
+    SECTION("whole buffer") {
+        REQUIRE(mr_init_unpack_packets(pctxv, packet_count, stream, stream_len, MR_UNPACK_COPY, &count, &consumed, &reason_code) == 0);
+        CHECK(count == packet_count);
+        CHECK(consumed == stream_len);
+    }
+
+    SECTION("partial trailing packet") {
+        REQUIRE(mr_init_unpack_packets(pctxv, packet_count, stream, stream_len - 1, MR_UNPACK_COPY, &count, &consumed, &reason_code) == 0);
+        CHECK(count == packet_count - 1);
+        CHECK(consumed == packet_offsets[packet_count - 1]);
+    }
+
+    SECTION("partial trailing header") {
+        REQUIRE(mr_init_unpack_packets(pctxv, packet_count, stream, packet_offsets[2] + 1, MR_UNPACK_COPY, &count, &consumed, &reason_code) == 0);
+        CHECK(count == 2);
+        CHECK(consumed == packet_offsets[2]);
+    }
+
+    SECTION("contexts full") {
+        REQUIRE(mr_init_unpack_packets(pctxv, 3, stream, stream_len, MR_UNPACK_BORROW, &count, &consumed, &reason_code) == 0);
+        CHECK(count == 3);
+        CHECK(consumed == packet_offsets[3]);
+    }
+
+    SECTION("runs of one type") {
+        // complex PUBLISH, default PUBLISH, complex PUBLISH, default PUBACK: a run of 3 then a new type
+        const int order[] = {1, 3, 1, 0};
+        uint8_t runs[1024];
+        size_t runs_offsets[packet_count];
+        size_t runs_len = 0;
+
+        for (size_t i = 0; i < packet_count; i++) {
+            const int j = order[i];
+            const size_t len = (j + 1 < packet_count ? packet_offsets[j + 1] : stream_len) - packet_offsets[j];
+            memcpy(runs + runs_len, stream + packet_offsets[j], len);
+            runs_offsets[i] = runs_len;
+            runs_len += len;
+        }
+
+        memcpy(stream, runs, runs_len);
+        memcpy(packet_offsets, runs_offsets, sizeof(packet_offsets));
+        stream_len = runs_len;
+
+        SECTION("whole buffer") {
+            REQUIRE(mr_init_unpack_packets(pctxv, packet_count, stream, stream_len, MR_UNPACK_COPY, &count, &consumed, &reason_code) == 0);
+            CHECK(count == packet_count);
+            CHECK(consumed == stream_len);
+
+            char *topic_name0, *topic_name1, *topic_name2;
+            REQUIRE(mr_get_publish_topic_name(pctxv[0], &topic_name0) == 0);
+            REQUIRE(mr_get_publish_topic_name(pctxv[1], &topic_name1) == 0);
+            REQUIRE(mr_get_publish_topic_name(pctxv[2], &topic_name2) == 0);
+            CHECK(strcmp(topic_name0, topic_name2) == 0);
+            CHECK(topic_name0 != topic_name2); // each context owns its values
+        }
+
+        SECTION("packet with an invalid value in a run") {
+            stream[packet_offsets[1]] |= 0x06; // qos 3
+            CHECK(mr_init_unpack_packets(pctxv, packet_count, stream, stream_len, MR_UNPACK_COPY, &count, &consumed, &reason_code) == -1);
+            CHECK(count == 1);
+            CHECK(consumed == packet_offsets[1]);
+            CHECK(reason_code == MQTT_RC_MALFORMED_PACKET);
+        }
+    }
+
+    SECTION("malformed packet") {
+        stream[packet_offsets[2]] = 0x00; // reserved packet type
+        CHECK(mr_init_unpack_packets(pctxv, packet_count, stream, stream_len, MR_UNPACK_COPY, &count, &consumed, &reason_code) == -1);
+        CHECK(count == 2);
+        CHECK(consumed == packet_offsets[2]);
+        CHECK(reason_code == MQTT_RC_MALFORMED_PACKET);
+    }
+
+    SECTION("packet with an invalid value") {
+        stream[packet_offsets[1]] |= 0x06; // qos 3
+        CHECK(mr_init_unpack_packets(pctxv, packet_count, stream, stream_len, MR_UNPACK_COPY, &count, &consumed, &reason_code) == -1);
+        CHECK(count == 1);
+        CHECK(consumed == packet_offsets[1]);
+        CHECK(reason_code == MQTT_RC_MALFORMED_PACKET);
+    }
+
+    SECTION("unsupported packet") {
+        stream[packet_offsets[2]] = MQTT_PINGREQ << 4;
+        CHECK(mr_init_unpack_packets(pctxv, packet_count, stream, stream_len, MR_UNPACK_COPY, &count, &consumed, &reason_code) == -1);
+        CHECK(count == 2);
+        CHECK(reason_code == MQTT_RC_IMPLEMENTATION_SPECIFIC);
+    }
+
+    // *** common test epilog ***
+
+    for (size_t i = 0; i < count; i++) {
+        uint8_t packet_type;
+        REQUIRE(mr_get_any_packet_type(pctxv[i], &packet_type) == 0);
+        CHECK(packet_type == stream[packet_offsets[i]] >> 4);
+        REQUIRE(mr_free_any_packet(pctxv[i]) == 0);
+    }
+
+    zlog_fini();
+}
+
+TEST_CASE("remaining length VBIs", "[frame][vbi]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_frame_decoder *pfd;
+    REQUIRE(mr_init_frame_decoder(&pfd, 0) == 0);
+    mr_frame frames[1];
+    size_t frame_count;
+    size_t consumed;
+    const size_t remaining_lengths[] = {0, 127, 128, 16383, 16384, 2097151, 2097152};
+    const size_t header_lens[] = {2, 2, 3, 3, 4, 4, 5};
+    const uint8_t vbis[][4] = {
+        {0x00}, {0x7F}, {0x80, 0x01}, {0xFF, 0x7F}, {0x80, 0x80, 0x01}, {0xFF, 0xFF, 0x7F}, {0x80, 0x80, 0x80, 0x01}
+    };
+
+    // *** test sections ***
+
+    SECTION("whole packet") {
+        for (size_t i = 0; i < sizeof(remaining_lengths) / sizeof(remaining_lengths[0]); i++) {
+            size_t u8vlen = header_lens[i] + remaining_lengths[i];
+            uint8_t *u8v = (uint8_t *)calloc(u8vlen, 1);
+            u8v[0] = 0x30;
+            memcpy(u8v + 1, vbis[i], header_lens[i] - 1);
+            REQUIRE(mr_decode_frames(pfd, u8v, u8vlen, frames, 1, &frame_count, &consumed) == 0);
+            REQUIRE(frame_count == 1);
+            CHECK(frames[0].header_len == header_lens[i]);
+            CHECK(frames[0].remaining_length == remaining_lengths[i]);
+            free(u8v);
+        }
+    }
+
+    SECTION("header split after its first VBI byte") {
+        for (size_t i = 2; i < sizeof(remaining_lengths) / sizeof(remaining_lengths[0]); i++) {
+            size_t u8vlen = header_lens[i] + remaining_lengths[i];
+            uint8_t *u8v = (uint8_t *)calloc(u8vlen, 1);
+            u8v[0] = 0x30;
+            memcpy(u8v + 1, vbis[i], header_lens[i] - 1);
+            REQUIRE(mr_decode_frames(pfd, u8v, 2, frames, 1, &frame_count, &consumed) == 0);
+            REQUIRE(mr_decode_frames(pfd, u8v + 2, u8vlen - 2, frames, 1, &frame_count, &consumed) == 0);
+            REQUIRE(frame_count == 1);
+            CHECK(frames[0].header_len == header_lens[i]);
+            CHECK(frames[0].remaining_length == remaining_lengths[i]);
+            free(u8v);
+        }
+    }
+
+    SECTION("VBI truncated by the packet end") {
+        mr_packet_ctx *pctx;
+        uint8_t u8v[] = {0x30, 0x80};
+        CHECK(mr_init_unpack_any_packet(&pctx, u8v, sizeof(u8v), MR_UNPACK_COPY) == -1);
+        REQUIRE(mr_free_any_packet(pctx) == 0);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_frame_decoder(pfd) == 0);
+
+    zlog_fini();
+}
+
+TEST_CASE("hostile packets", "[frame][hostile]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    // every byte of every fixture set to values that stress lengths & VBIs: each unpack must
+    // fail or succeed cleanly, never read outside the packet, and agree with validate-only
+    const char *packet_filenames[] = {
+        "fixtures/complex_connect_packet.bin",
+        "fixtures/will_connect_packet.bin",
+        "fixtures/complex_connack_packet.bin",
+        "fixtures/complex_publish_packet.bin",
+        "fixtures/complex_puback_packet.bin",
+        "fixtures/complex_subscribe_packet.bin",
+        "fixtures/complex_suback_packet.bin"
+    };
+    const uint8_t values[] = {0x00, 0x01, 0x7F, 0x80, 0xFF};
+    int unpack_flags = MR_UNPACK_COPY;
+
+    // *** test sections ***
+
+    SECTION("copy") {
+        unpack_flags = MR_UNPACK_COPY;
+    }
+
+    SECTION("borrow & lazy") {
+        unpack_flags = MR_UNPACK_BORROW | MR_UNPACK_LAZY;
+    }
+
+    // *** common test epilog ***
+
+    for (size_t f = 0; f < sizeof(packet_filenames) / sizeof(packet_filenames[0]); f++) {
+        uint8_t *u8v0;
+        size_t u8vlen;
+        REQUIRE(get_binary_file_content(packet_filenames[f], &u8v0, &u8vlen) == 0);
+
+        for (size_t i = 1; i < u8vlen; i++) { // the packet type selects the module: keep it
+            for (size_t v = 0; v < sizeof(values); v++) {
+                uint8_t *u8v = (uint8_t *)malloc(u8vlen); // exact size so over-reads are caught
+                memcpy(u8v, u8v0, u8vlen);
+                u8v[i] = values[v];
+                mr_packet_ctx *pctx = NULL;
+                int rc = mr_init_unpack_any_packet(&pctx, u8v, u8vlen, unpack_flags);
+                size_t packed_size;
+                if (!rc) rc = mr_get_packed_size(pctx, &packed_size); // decodes lazy values
+                if (pctx) REQUIRE(mr_free_any_packet(pctx) == 0);
+
+                // validate-only agrees with unpacking and never allocates
+                uint64_t allocs0, allocs1, frees;
+                uint8_t reason_code;
+                REQUIRE(mr_get_alloc_stats(&allocs0, &frees) == 0);
+                int vrc = mr_validate_packet_bytes(u8v, u8vlen, &reason_code);
+                REQUIRE(mr_get_alloc_stats(&allocs1, &frees) == 0);
+                REQUIRE(allocs1 == allocs0);
+                REQUIRE(vrc == (rc ? -1 : 0));
+                REQUIRE((reason_code == MQTT_RC_SUCCESS) == !rc);
+                free(u8v);
+            }
+        }
+
+        free(u8v0);
+    }
+
+    zlog_fini();
+}
+
+TEST_CASE("validate packet bytes", "[frame][validate]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    uint8_t *u8v0 = NULL;
+    size_t u8vlen = 0;
+    bool free_u8v0 = false;
+    int expected_rc = 0;
+    uint8_t expected_reason_code = MQTT_RC_SUCCESS;
+
+    // a PUBLISH: topic "a/b", a property block & a 1 byte payload
+    uint8_t publish_packet[] = {
+        0x30, 0x0C, 0x00, 0x03, 'a', '/', 'b', 0x05, 0x02, 0x00, 0x00, 0x00, 0x0A, 'x'
+    };
+
+    // *** test sections ***
+
+    SECTION("complex fixtures") {
+        const char *packet_filenames[] = {
+            "fixtures/complex_connect_packet.bin",
+            "fixtures/will_connect_packet.bin",
+            "fixtures/complex_connack_packet.bin",
+            "fixtures/complex_publish_packet.bin",
+            "fixtures/complex_puback_packet.bin",
+            "fixtures/complex_subscribe_packet.bin",
+            "fixtures/complex_suback_packet.bin"
+        };
+
+        for (size_t f = 0; f < sizeof(packet_filenames) / sizeof(packet_filenames[0]) - 1; f++) {
+            uint8_t *u8v;
+            size_t len;
+            uint8_t reason_code = 0xFF;
+            REQUIRE(get_binary_file_content(packet_filenames[f], &u8v, &len) == 0);
+            REQUIRE(mr_validate_packet_bytes(u8v, len, &reason_code) == 0);
+            REQUIRE(reason_code == MQTT_RC_SUCCESS);
+            free(u8v);
+        }
+
+        REQUIRE(get_binary_file_content(packet_filenames[6], &u8v0, &u8vlen) == 0);
+        free_u8v0 = true;
+    }
+
+    SECTION("the PUBLISH") {
+        u8v0 = publish_packet;
+        u8vlen = sizeof(publish_packet);
+    }
+
+    SECTION("truncated") {
+        u8v0 = publish_packet;
+        u8vlen = sizeof(publish_packet) - 1;
+        expected_rc = -1;
+        expected_reason_code = MQTT_RC_MALFORMED_PACKET;
+    }
+
+    SECTION("unknown property id") {
+        publish_packet[8] = 0x04;
+        u8v0 = publish_packet;
+        u8vlen = sizeof(publish_packet);
+        expected_rc = -1;
+        expected_reason_code = MQTT_RC_MALFORMED_PACKET;
+    }
+
+    SECTION("topic name not UTF-8") {
+        publish_packet[5] = 0xFF;
+        u8v0 = publish_packet;
+        u8vlen = sizeof(publish_packet);
+        expected_rc = -1;
+        expected_reason_code = MQTT_RC_MALFORMED_PACKET;
+    }
+
+    SECTION("wildcard in the topic name") {
+        publish_packet[6] = '+';
+        u8v0 = publish_packet;
+        u8vlen = sizeof(publish_packet);
+        expected_rc = -1;
+        expected_reason_code = MQTT_RC_TOPIC_NAME_INVALID;
+    }
+
+    SECTION("duplicate property") {
+        static uint8_t packet[] = {
+            0x30, 0x10, 0x00, 0x03, 'a', '/', 'b',
+            0x0A, 0x02, 0x00, 0x00, 0x00, 0x0A, 0x02, 0x00, 0x00, 0x00, 0x0B
+        };
+
+        u8v0 = packet;
+        u8vlen = sizeof(packet);
+        expected_rc = -1;
+        expected_reason_code = MQTT_RC_PROTOCOL_ERROR;
+    }
+
+    SECTION("payload not UTF-8 with payload_format_indicator set") {
+        static uint8_t packet[] = {0x30, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x02, 0x01, 0x01, 0xFF};
+        u8v0 = packet;
+        u8vlen = sizeof(packet);
+        expected_rc = -1;
+        expected_reason_code = MQTT_RC_PAYLOAD_FORMAT_INVALID;
+    }
+
+    SECTION("zero packet identifier") {
+        static uint8_t packet[] = {0x32, 0x08, 0x00, 0x03, 'a', '/', 'b', 0x00, 0x00, 0x00};
+        u8v0 = packet;
+        u8vlen = sizeof(packet);
+        expected_rc = -1;
+        expected_reason_code = MQTT_RC_PROTOCOL_ERROR;
+    }
+
+    SECTION("SUBSCRIBE without topic filters") {
+        static uint8_t packet[] = {0x82, 0x03, 0x00, 0x01, 0x00};
+        u8v0 = packet;
+        u8vlen = sizeof(packet);
+        expected_rc = -1;
+        expected_reason_code = MQTT_RC_PROTOCOL_ERROR;
+    }
+
+    SECTION("reserved packet type") {
+        static uint8_t packet[] = {0x00, 0x00};
+        u8v0 = packet;
+        u8vlen = sizeof(packet);
+        expected_rc = -1;
+        expected_reason_code = MQTT_RC_MALFORMED_PACKET;
+    }
+
+    SECTION("unsupported packet type") {
+        static uint8_t packet[] = {0xC0, 0x00}; // PINGREQ
+        u8v0 = packet;
+        u8vlen = sizeof(packet);
+        expected_rc = -1;
+        expected_reason_code = MQTT_RC_IMPLEMENTATION_SPECIFIC;
+    }
+
+    // *** common test epilog ***
+
+    uint64_t allocs0, allocs1, frees;
+    uint8_t reason_code = 0xFF;
+    REQUIRE(mr_get_alloc_stats(&allocs0, &frees) == 0);
+    REQUIRE(mr_validate_packet_bytes(u8v0, u8vlen, &reason_code) == expected_rc);
+    REQUIRE(mr_get_alloc_stats(&allocs1, &frees) == 0);
+    REQUIRE(allocs1 == allocs0);
+    REQUIRE(reason_code == expected_reason_code);
+
+    if (expected_rc == 0) { // unpacking agrees
+        mr_packet_ctx *pctx;
+        REQUIRE(mr_init_unpack_any_packet(&pctx, u8v0, u8vlen, MR_UNPACK_COPY) == 0);
+        REQUIRE(mr_free_any_packet(pctx) == 0);
+    }
+
+    if (free_u8v0) free(u8v0);
+    zlog_fini();
+}
+
+TEST_CASE("structured errors", "[frame][error]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    // a PUBLISH: topic "a/b", a property block & a 1 byte payload
+    uint8_t publish_packet[] = {
+        0x30, 0x0C, 0x00, 0x03, 'a', '/', 'b', 0x05, 0x02, 0x00, 0x00, 0x00, 0x0A, 'x'
+    };
+
+    uint8_t *u8v0 = publish_packet;
+    size_t u8vlen = sizeof(publish_packet);
+    mr_error expected = {MR_ERR_NONE, MQTT_RC_SUCCESS, MQTT_PUBLISH, -1, 0};
+    REQUIRE(mr_set_error_log_rate(0) == 0); // the errors are recorded without logging
+
+    // *** test sections ***
+
+    SECTION("remaining length") {
+        u8vlen--;
+        expected = {MR_ERR_LENGTH, MQTT_RC_MALFORMED_PACKET, MQTT_PUBLISH, PUBLISH_REMAINING_LENGTH, 2};
+    }
+
+    SECTION("unknown property id") {
+        publish_packet[8] = 0x04;
+        expected = {MR_ERR_PROPERTY_ID, MQTT_RC_MALFORMED_PACKET, MQTT_PUBLISH, PUBLISH_MR_PROPERTIES, 8};
+    }
+
+    SECTION("duplicate property") {
+        static uint8_t packet[] = {
+            0x30, 0x10, 0x00, 0x03, 'a', '/', 'b',
+            0x0A, 0x02, 0x00, 0x00, 0x00, 0x0A, 0x02, 0x00, 0x00, 0x00, 0x0B
+        };
+
+        u8v0 = packet;
+        u8vlen = sizeof(packet);
+        expected = {MR_ERR_DUPLICATE, MQTT_RC_PROTOCOL_ERROR, MQTT_PUBLISH, PUBLISH_MESSAGE_EXPIRY_INTERVAL, 13};
+    }
+
+    SECTION("wildcard in the topic name") {
+        publish_packet[6] = '#';
+        expected = {MR_ERR_VALUE, MQTT_RC_TOPIC_NAME_INVALID, MQTT_PUBLISH, PUBLISH_TOPIC_NAME, 14};
+    }
+
+    // *** common test epilog ***
+
+    mr_error err;
+    REQUIRE(mr_clear_error() == 0);
+    REQUIRE(mr_get_error(&err) == 0);
+    CHECK(err.code == MR_ERR_NONE);
+
+    for (int validate = 0; validate < 2; validate++) { // both paths record the same error
+        if (validate) {
+            uint8_t reason_code;
+            REQUIRE(mr_validate_packet_bytes(u8v0, u8vlen, &reason_code) == -1);
+            CHECK(reason_code == expected.reason_code);
+        }
+        else {
+            mr_packet_ctx *pctx = NULL;
+            REQUIRE(mr_init_unpack_any_packet(&pctx, u8v0, u8vlen, MR_UNPACK_COPY) == -1);
+            if (pctx) REQUIRE(mr_free_any_packet(pctx) == 0);
+        }
+
+        REQUIRE(mr_get_error(&err) == 0);
+        CHECK(err.code == expected.code);
+        CHECK(err.reason_code == expected.reason_code);
+        CHECK(err.packet_type == expected.packet_type);
+        CHECK(err.field_idx == expected.field_idx);
+        CHECK(err.offset == expected.offset);
+
+        const char *name;
+        REQUIRE(mr_get_error_name(err.code, &name) == 0);
+        CHECK(strlen(name) > 0);
+    }
+
+    REQUIRE(mr_set_error_log_rate(100) == 0);
+    zlog_fini();
+}
+
+TEST_CASE("structured frame errors", "[frame][error]") {
+    dzlog_init("", "mr_init");
+
+    mr_frame_decoder *pfd;
+    REQUIRE(mr_init_frame_decoder(&pfd, 0) == 0);
+    const uint8_t stream[] = {0xC0, 0x00, 0x00, 0x00}; // PINGREQ then a reserved packet type
+    mr_frame frames[4];
+    size_t frame_count, consumed;
+    REQUIRE(mr_decode_frames(pfd, stream, sizeof(stream), frames, 4, &frame_count, &consumed) == -1);
+    CHECK(frame_count == 1);
+
+    mr_error err;
+    REQUIRE(mr_get_error(&err) == 0);
+    CHECK(err.code == MR_ERR_PACKET_TYPE);
+    CHECK(err.reason_code == MQTT_RC_MALFORMED_PACKET);
+    CHECK(err.packet_type == MQTT_RESERVED);
+    CHECK(err.field_idx == -1);
+    CHECK(err.offset == 2);
+
+    REQUIRE(mr_free_frame_decoder(pfd) == 0);
+    zlog_fini();
+}
+
+TEST_CASE("structured API errors", "[frame][error]") {
+    dzlog_init("", "mr_init");
+    REQUIRE(mr_set_error_log_rate(0) == 0);
+
+    mr_packet_ctx *pctx;
+    REQUIRE(mr_init_puback_packet(&pctx) == 0);
+    mr_error err;
+
+    // a PUBLISH getter on a PUBACK context
+    char *topic_name;
+    REQUIRE(mr_clear_error() == 0);
+    CHECK(mr_get_publish_topic_name(pctx, &topic_name) == -1);
+    REQUIRE(mr_get_error(&err) == 0);
+    CHECK(err.code == MR_ERR_PACKET_TYPE);
+    CHECK(err.packet_type == MQTT_PUBACK);
+    CHECK(err.field_idx == -1);
+
+    // an unknown error code replaces the last error
+    const char *name;
+    CHECK(mr_get_error_name(MR_ERR_IO + 1, &name) == -1);
+    REQUIRE(mr_get_error(&err) == 0);
+    CHECK(err.code == MR_ERR_VALUE);
+
+    REQUIRE(mr_clear_error() == 0);
+    REQUIRE(mr_get_error(&err) == 0);
+    CHECK(err.code == MR_ERR_NONE);
+    CHECK(err.reason_code == MQTT_RC_SUCCESS);
+    CHECK(err.packet_type == MQTT_RESERVED);
+    CHECK(err.field_idx == -1);
+    CHECK(err.offset == 0);
+
+    REQUIRE(mr_free_puback_packet(pctx) == 0);
+    REQUIRE(mr_set_error_log_rate(100) == 0);
+    zlog_fini();
+}
@@ -0,0 +1,422 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <zlog.h>
+
+#include "mister/mister.h"
+#include "test_util.h"
+
+#define SUBSCRIBER(n) ((void *)(uintptr_t)(n))
+
+typedef struct match_result {
+    uintptr_t subscribers[64];
+    uint8_t maximum_qos[64];
+    size_t count;
+    size_t stop_after;  // 0: never stop
+} match_result;
+
+static int collect_match(const mr_subscription *psub, void *arg) {
+    match_result *pmr = (match_result *)arg;
+    if (pmr->count == 64) return -1;
+    pmr->subscribers[pmr->count] = (uintptr_t)psub->subscriber;
+    pmr->maximum_qos[pmr->count++] = psub->maximum_qos;
+    return pmr->count == pmr->stop_after ? 1 : 0;
+}
+
+// match a topic name & return the sum of the matched subscriber numbers, each a distinct power of 2
+static uintptr_t match_mask(mr_subscription_index *psi, const char *topic_name, const void *publisher) {
+    match_result mr = {};
+    REQUIRE(mr_match_subscriptions(psi, topic_name, strlen(topic_name), publisher, collect_match, &mr) == 0);
+    uintptr_t mask = 0;
+    for (size_t i = 0; i < mr.count; i++) mask += mr.subscribers[i];
+    return mask;
+}
+
+static int add_filter(mr_subscription_index *psi, const char *topic_filter, uintptr_t n, uint8_t maximum_qos) {
+    mr_subscription sub = {SUBSCRIBER(n), maximum_qos, 0, 0, 0, 0};
+    bool replaced;
+    return mr_add_subscription(psi, topic_filter, strlen(topic_filter), &sub, &replaced);
+}
+
+TEST_CASE("happy subscription index", "[subscription][happy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_subscription_index *psi;
+    REQUIRE(mr_init_subscription_index(&psi) == 0);
+    REQUIRE(add_filter(psi, "a/b/c", 1 << 0, 0) == 0);
+    REQUIRE(add_filter(psi, "a/+/c", 1 << 1, 0) == 0);
+    REQUIRE(add_filter(psi, "a/#", 1 << 2, 0) == 0);
+    REQUIRE(add_filter(psi, "#", 1 << 3, 0) == 0);
+    REQUIRE(add_filter(psi, "+/b/#", 1 << 4, 0) == 0);
+    REQUIRE(add_filter(psi, "a/b", 1 << 5, 0) == 0);
+    REQUIRE(add_filter(psi, "$SYS/#", 1 << 6, 0) == 0);
+    REQUIRE(add_filter(psi, "+/+", 1 << 7, 0) == 0);
+    REQUIRE(add_filter(psi, "a//c", 1 << 8, 0) == 0);
+
+    size_t subscription_count, node_count;
+    REQUIRE(mr_get_subscription_index_counts(psi, &subscription_count, &node_count) == 0);
+    CHECK(subscription_count == 9);
+    CHECK(node_count == 16); // the root & one node per distinct filter prefix
+
+    // *** test sections ***
+
+    SECTION("literal & wildcard levels") {
+        CHECK(match_mask(psi, "a/b/c", NULL) == ((1 << 0) | (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4)));
+        CHECK(match_mask(psi, "a/x/c", NULL) == ((1 << 1) | (1 << 2) | (1 << 3)));
+        CHECK(match_mask(psi, "a//c", NULL) == ((1 << 1) | (1 << 2) | (1 << 3) | (1 << 8)));
+        CHECK(match_mask(psi, "x/y/z", NULL) == (1 << 3));
+    }
+
+    SECTION("'#' matches its parent level") {
+        CHECK(match_mask(psi, "a", NULL) == ((1 << 2) | (1 << 3)));
+        CHECK(match_mask(psi, "a/b", NULL) == ((1 << 2) | (1 << 3) | (1 << 4) | (1 << 5) | (1 << 7)));
+    }
+
+    SECTION("topic names starting with '$'") {
+        CHECK(match_mask(psi, "$SYS/broker/load", NULL) == (1 << 6));
+        CHECK(match_mask(psi, "$SYS", NULL) == (1 << 6));
+        CHECK(match_mask(psi, "$other/b", NULL) == 0);
+    }
+
+    SECTION("replace options") {
+        mr_subscription sub = {SUBSCRIBER(1 << 5), 2, 0, 0, 0, 42};
+        bool replaced;
+        REQUIRE(mr_add_subscription(psi, "a/b", 3, &sub, &replaced) == 0);
+        CHECK(replaced);
+        REQUIRE(mr_get_subscription_index_counts(psi, &subscription_count, &node_count) == 0);
+        CHECK(subscription_count == 9);
+
+        match_result mr = {};
+        REQUIRE(mr_match_subscriptions(psi, "a/b", 3, NULL, collect_match, &mr) == 0);
+        bool found = false;
+
+        for (size_t i = 0; i < mr.count; i++) {
+            if (mr.subscribers[i] == 1 << 5) {
+                found = true;
+                CHECK(mr.maximum_qos[i] == 2);
+            }
+        }
+
+        CHECK(found);
+    }
+
+    SECTION("remove & prune") {
+        bool removed;
+        REQUIRE(mr_remove_subscription(psi, "a/+/c", 5, SUBSCRIBER(1 << 1), &removed) == 0);
+        CHECK(removed);
+        REQUIRE(mr_get_subscription_index_counts(psi, &subscription_count, &node_count) == 0);
+        CHECK(subscription_count == 8);
+        CHECK(node_count == 14); // a/+ & a/+/c are gone
+        CHECK(match_mask(psi, "a/x/c", NULL) == ((1 << 2) | (1 << 3)));
+
+        REQUIRE(mr_remove_subscription(psi, "a/+/c", 5, SUBSCRIBER(1 << 1), &removed) == 0);
+        CHECK_FALSE(removed);
+        REQUIRE(mr_remove_subscription(psi, "a/b", 3, SUBSCRIBER(1 << 1), &removed) == 0);
+        CHECK_FALSE(removed);
+        REQUIRE(mr_remove_subscription(psi, "x/y", 3, SUBSCRIBER(1 << 1), &removed) == 0);
+        CHECK_FALSE(removed);
+
+        const char *filters[] = {"a/b/c", "a/#", "#", "+/b/#", "a/b", "$SYS/#", "+/+", "a//c"};
+        const int bits[] = {0, 2, 3, 4, 5, 6, 7, 8};
+
+        for (size_t i = 0; i < 8; i++) {
+            REQUIRE(mr_remove_subscription(psi, filters[i], strlen(filters[i]), SUBSCRIBER(1 << bits[i]), &removed) == 0);
+            CHECK(removed);
+        }
+
+        REQUIRE(mr_get_subscription_index_counts(psi, &subscription_count, &node_count) == 0);
+        CHECK(subscription_count == 0);
+        CHECK(node_count == 1);
+        CHECK(match_mask(psi, "a/b/c", NULL) == 0);
+    }
+
+    SECTION("no_local") {
+        mr_subscription sub = {SUBSCRIBER(1 << 9), 1, 1, 0, 0, 0};
+        bool replaced;
+        REQUIRE(mr_add_subscription(psi, "x/y", 3, &sub, &replaced) == 0);
+        CHECK_FALSE(replaced);
+        CHECK(match_mask(psi, "x/y", SUBSCRIBER(1 << 9)) == ((1 << 3) | (1 << 7)));
+        CHECK(match_mask(psi, "x/y", SUBSCRIBER(1 << 7)) == ((1 << 3) | (1 << 7) | (1 << 9)));
+        CHECK(match_mask(psi, "x/y", NULL) == ((1 << 3) | (1 << 7) | (1 << 9)));
+    }
+
+    SECTION("stop early") {
+        match_result mr = {};
+        mr.stop_after = 2;
+        CHECK(mr_match_subscriptions(psi, "a/b/c", 5, NULL, collect_match, &mr) == 1);
+        CHECK(mr.count == 2);
+    }
+
+    SECTION("no allocation when matching") {
+        uint64_t allocs, frees, allocs2, frees2;
+        REQUIRE(mr_get_alloc_stats(&allocs, &frees) == 0);
+        match_mask(psi, "a/b/c", NULL);
+        REQUIRE(mr_get_alloc_stats(&allocs2, &frees2) == 0);
+        CHECK(allocs2 == allocs);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_subscription_index(psi) == 0);
+    zlog_fini();
+}
+
+TEST_CASE("unhappy subscription index", "[subscription][unhappy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_subscription_index *psi;
+    REQUIRE(mr_init_subscription_index(&psi) == 0);
+    REQUIRE(mr_set_error_log_rate(0) == 0);
+    mr_error err;
+
+    // *** test sections ***
+
+    SECTION("invalid topic filters") {
+        const char *filters[] = {"a/b#", "a/#/b", "a+/b", "+a", "##", "a/b/++"};
+
+        for (size_t i = 0; i < sizeof(filters) / sizeof(filters[0]); i++) {
+            CHECK(add_filter(psi, filters[i], 1, 0) == -1);
+            REQUIRE(mr_get_error(&err) == 0);
+            CHECK(err.code == MR_ERR_VALUE);
+            CHECK(err.reason_code == MQTT_RC_TOPIC_FILTER_INVALID);
+        }
+
+        CHECK(add_filter(psi, "", 1, 0) == -1);
+        REQUIRE(mr_get_error(&err) == 0);
+        CHECK(err.reason_code == MQTT_RC_TOPIC_FILTER_INVALID);
+    }
+
+    SECTION("shared subscriptions") {
+        CHECK(add_filter(psi, "$share/group/a/b", 1, 0) == -1);
+        REQUIRE(mr_get_error(&err) == 0);
+        CHECK(err.reason_code == MQTT_RC_SHARED_SUBSCRIPTIONS_NOT_SUPPORTED);
+    }
+
+    SECTION("too many levels") {
+        char filter[2 * 129];
+        for (size_t i = 0; i < 129; i++) memcpy(filter + 2 * i, "a/", 2);
+        filter[2 * 129 - 1] = '\0'; // 129 levels
+        CHECK(add_filter(psi, filter, 1, 0) == -1);
+        filter[2 * 128 - 1] = '\0'; // 128 levels
+        CHECK(add_filter(psi, filter, 1, 0) == 0);
+    }
+
+    SECTION("invalid topic names") {
+        const char *topic_names[] = {"#", "a/+", "a/#", ""};
+        match_result mr = {};
+
+        for (size_t i = 0; i < sizeof(topic_names) / sizeof(topic_names[0]); i++) {
+            CHECK(mr_match_subscriptions(psi, topic_names[i], strlen(topic_names[i]), NULL, collect_match, &mr) == -1);
+            REQUIRE(mr_get_error(&err) == 0);
+            CHECK(err.reason_code == MQTT_RC_TOPIC_NAME_INVALID);
+        }
+    }
+
+    SECTION("invalid filters leave no nodes") {
+        size_t subscription_count, node_count;
+        CHECK(add_filter(psi, "a/b/c#", 1, 0) == -1);
+        REQUIRE(mr_get_subscription_index_counts(psi, &subscription_count, &node_count) == 0);
+        CHECK(subscription_count == 0);
+        CHECK(node_count == 1);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_set_error_log_rate(100) == 0);
+    REQUIRE(mr_free_subscription_index(psi) == 0);
+    zlog_fini();
+}
+
+TEST_CASE("subscribe packet", "[subscription][packet]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_subscription_index *psi;
+    REQUIRE(mr_init_subscription_index(&psi) == 0);
+    mr_packet_ctx *pctx;
+    uint8_t reason_codes[4];
+    size_t subscription_count, node_count;
+
+    // *** test sections ***
+
+    SECTION("complex fixture") {
+        uint8_t *u8v0;
+        size_t u8vlen;
+        REQUIRE(get_binary_file_content("fixtures/complex_subscribe_packet.bin", &u8v0, &u8vlen) == 0);
+        REQUIRE(mr_init_unpack_subscribe_packet(&pctx, u8v0, u8vlen) == 0);
+        free(u8v0);
+
+        REQUIRE(mr_add_subscribe_packet(psi, pctx, SUBSCRIBER(7), reason_codes, 4) == 0);
+        CHECK(reason_codes[0] == MQTT_RC_GRANTED_QOS0);
+        CHECK(reason_codes[1] == MQTT_RC_GRANTED_QOS1);
+        REQUIRE(mr_get_subscription_index_counts(psi, &subscription_count, &node_count) == 0);
+        CHECK(subscription_count == 2);
+
+        match_result mr = {};
+        REQUIRE(mr_match_subscriptions(psi, "my_second_topic_filter", 22, NULL, collect_match, &mr) == 0);
+        REQUIRE(mr.count == 1);
+        CHECK(mr.subscribers[0] == 7);
+        CHECK(mr.maximum_qos[0] == 1);
+    }
+
+    SECTION("a filter that cannot be subscribed") {
+        REQUIRE(mr_init_subscribe_packet(&pctx) == 0);
+        REQUIRE(mr_set_error_log_rate(0) == 0);
+        char tf0[] = "good/+", tf1[] = "bad#", tf2[] = "$share/g/t";
+        mr_topic_filter tfv[] = {{tf0, 2, 0, 0, 0}, {tf1, 1, 0, 0, 0}, {tf2, 0, 0, 0, 0}};
+        REQUIRE(mr_set_subscribe_topic_filters(pctx, tfv, 3) == 0);
+        REQUIRE(mr_set_subscribe_subscription_identifier(pctx, 9) == 0);
+
+        CHECK(mr_add_subscribe_packet(psi, pctx, SUBSCRIBER(1), reason_codes, 2) == -1); // too short
+
+        REQUIRE(mr_add_subscribe_packet(psi, pctx, SUBSCRIBER(1), reason_codes, 3) == 0);
+        CHECK(reason_codes[0] == MQTT_RC_GRANTED_QOS2);
+        CHECK(reason_codes[1] == MQTT_RC_TOPIC_FILTER_INVALID);
+        CHECK(reason_codes[2] == MQTT_RC_SHARED_SUBSCRIPTIONS_NOT_SUPPORTED);
+        REQUIRE(mr_get_subscription_index_counts(psi, &subscription_count, &node_count) == 0);
+        CHECK(subscription_count == 1);
+        REQUIRE(mr_set_error_log_rate(100) == 0);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_subscribe_packet(pctx) == 0);
+    REQUIRE(mr_free_subscription_index(psi) == 0);
+    zlog_fini();
+}
+
+TEST_CASE("many subscriptions", "[subscription][scale]") {
+    dzlog_init("", "mr_init");
+
+    mr_subscription_index *psi;
+    REQUIRE(mr_init_subscription_index(&psi) == 0);
+    const size_t filter_count = 100000;
+    char filter[64];
+
+    for (size_t i = 1; i <= filter_count; i++) {
+        snprintf(filter, sizeof(filter), "devices/%lu/temperature", i);
+        REQUIRE(add_filter(psi, filter, i, 0) == 0);
+    }
+
+    REQUIRE(add_filter(psi, "devices/+/temperature", filter_count + 1, 1) == 0);
+
+    size_t subscription_count, node_count;
+    REQUIRE(mr_get_subscription_index_counts(psi, &subscription_count, &node_count) == 0);
+    CHECK(subscription_count == filter_count + 1);
+    CHECK(node_count == 2 * filter_count + 4);
+
+    match_result mr = {};
+    REQUIRE(mr_match_subscriptions(psi, "devices/4242/temperature", 24, NULL, collect_match, &mr) == 0);
+    REQUIRE(mr.count == 2);
+    CHECK(mr.subscribers[0] + mr.subscribers[1] == 4242 + filter_count + 1);
+
+    bool removed;
+
+    for (size_t i = 1; i <= filter_count; i++) {
+        snprintf(filter, sizeof(filter), "devices/%lu/temperature", i);
+        REQUIRE(mr_remove_subscription(psi, filter, strlen(filter), SUBSCRIBER(i), &removed) == 0);
+        REQUIRE(removed);
+    }
+
+    REQUIRE(mr_get_subscription_index_counts(psi, &subscription_count, &node_count) == 0);
+    CHECK(subscription_count == 1);
+    CHECK(node_count == 4);
+
+    REQUIRE(mr_free_subscription_index(psi) == 0);
+    zlog_fini();
+}
+
+typedef struct concurrent_reader {
+    mr_subscription_index *psi;
+    std::atomic<bool> *pdone;
+    std::atomic<size_t> *pmisses;
+    size_t matches;
+} concurrent_reader;
+
+static int find_stable(const mr_subscription *psub, void *arg) {
+    if (psub->subscriber == SUBSCRIBER(1)) *(bool *)arg = true;
+    return 0;
+}
+
+static void read_concurrently(concurrent_reader *pcr) {
+    while (!pcr->pdone->load()) {
+        bool found = false;
+        if (mr_match_subscriptions(pcr->psi, "stable/topic", 12, NULL, find_stable, &found) || !found) {
+            (*pcr->pmisses)++;
+        }
+
+        pcr->matches++;
+    }
+}
+
+TEST_CASE("concurrent readers & writers", "[subscription][concurrent]") {
+    dzlog_init("", "mr_init");
+
+    mr_subscription_index *psi;
+    REQUIRE(mr_init_subscription_index(&psi) == 0);
+    REQUIRE(add_filter(psi, "stable/topic", 1, 1) == 0);
+
+    std::atomic<bool> done(false);
+    std::atomic<size_t> misses(0);
+    const size_t reader_count = 4;
+    std::vector<concurrent_reader> readers(reader_count, concurrent_reader{psi, &done, &misses, 0});
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < reader_count; i++) threads.emplace_back(read_concurrently, &readers[i]);
+
+    // churn the nodes & tables the readers traverse: siblings, wildcards, replaced options & pruning
+    const char *filters[] = {"stable/+", "stable/#", "#", "+/topic", "stable/topic/deeper", "other/topic"};
+    const size_t filter_count = sizeof(filters) / sizeof(filters[0]);
+    char filter[64];
+    bool flag;
+    size_t failures = 0;
+
+    for (size_t round = 0; round < 2000; round++) {
+        for (size_t i = 0; i < filter_count; i++) {
+            failures += add_filter(psi, filters[i], 2 + round % 16, round % 3) != 0;
+        }
+
+        for (size_t i = 0; i < 16; i++) {
+            snprintf(filter, sizeof(filter), "stable/%lu", i + round);
+            failures += add_filter(psi, filter, 100 + i, 0) != 0;
+        }
+
+        failures += add_filter(psi, "stable/topic", 1, round % 3) != 0; // replaced under the readers
+
+        for (size_t i = 0; i < filter_count; i++) {
+            failures += mr_remove_subscription(psi, filters[i], strlen(filters[i]), SUBSCRIBER(2 + round % 16), &flag) != 0;
+        }
+
+        for (size_t i = 0; i < 16; i++) {
+            snprintf(filter, sizeof(filter), "stable/%lu", i + round);
+            failures += mr_remove_subscription(psi, filter, strlen(filter), SUBSCRIBER(100 + i), &flag) != 0;
+        }
+    }
+
+    done = true;
+    size_t matches = 0;
+
+    for (size_t i = 0; i < reader_count; i++) {
+        threads[i].join();
+        matches += readers[i].matches;
+    }
+
+    CHECK(failures == 0);
+    CHECK(misses == 0);
+    CHECK(matches > 0);
+
+    size_t subscription_count, node_count;
+    REQUIRE(mr_synchronize_subscription_index(psi) == 0);
+    REQUIRE(mr_get_subscription_index_counts(psi, &subscription_count, &node_count) == 0);
+    CHECK(subscription_count == 1);
+    CHECK(node_count == 3);
+
+    REQUIRE(mr_free_subscription_index(psi) == 0);
+    zlog_fini();
+}
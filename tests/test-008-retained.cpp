@@ -0,0 +1,329 @@
+#include <set>
+#include <string>
+
+#include <catch2/catch.hpp>
+#include <zlog.h>
+
+#include "mister/mister.h"
+#include "test_util.h"
+
+typedef struct retained_result {
+    std::set<std::string> topic_names;
+    size_t count;
+    size_t stop_after;  // 0: never stop
+    uint32_t message_expiry_interval; // of the last message, 0 for none
+    bool retain_set;    // on every message
+} retained_result;
+
+static int collect_retained(const mr_retained_message *prm, void *arg) {
+    retained_result *prr = (retained_result *)arg;
+    prr->topic_names.insert(std::string(prm->topic_name, prm->topic_name_len));
+    prr->retain_set = (prr->count ? prr->retain_set : true) && (prm->u8v0[0] & 0x01);
+
+    mr_packet_ctx *pctx;
+    REQUIRE(mr_init_unpack_publish_packet(&pctx, prm->u8v0, prm->u8vlen) == 0);
+    bool exists;
+    REQUIRE(mr_get_publish_message_expiry_interval(pctx, &prr->message_expiry_interval, &exists) == 0);
+    if (!exists) prr->message_expiry_interval = 0;
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+
+    prr->count++;
+    return prr->count == prr->stop_after ? 1 : 0;
+}
+
+static std::set<std::string> match_topics(mr_retained_store *prs, const char *topic_filter, uint64_t now) {
+    retained_result rr = {};
+    REQUIRE(mr_match_retained(prs, topic_filter, strlen(topic_filter), now, collect_retained, &rr) == 0);
+    CHECK(rr.count == rr.topic_names.size());
+    if (rr.count) CHECK(rr.retain_set);
+    return rr.topic_names;
+}
+
+// retain a qos 1 PUBLISH; payload NULL retains an empty payload
+static int retain(
+    mr_retained_store *prs, const char *topic_name, const char *payload, uint32_t expiry, uint64_t now, bool *premoved
+) {
+    mr_packet_ctx *pctx;
+    REQUIRE(mr_init_publish_packet(&pctx) == 0);
+    REQUIRE(mr_set_publish_qos(pctx, 1) == 0);
+    REQUIRE(mr_set_publish_dup(pctx, true) == 0);
+    REQUIRE(mr_set_publish_packet_identifier(pctx, 7) == 0);
+    REQUIRE(mr_set_publish_topic_name(pctx, topic_name) == 0);
+    if (expiry) REQUIRE(mr_set_publish_message_expiry_interval(pctx, expiry) == 0);
+    if (payload) REQUIRE(mr_set_publish_payload(pctx, (const uint8_t *)payload, strlen(payload)) == 0);
+    int rc = mr_retain_publish_packet(prs, pctx, now, premoved);
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+    return rc;
+}
+
+TEST_CASE("happy retained store", "[retained][happy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_retained_store *prs;
+    REQUIRE(mr_init_retained_store(&prs) == 0);
+    const char *topic_names[] = {"a/b/c", "a/x/c", "a/b", "a", "a//c", "b", "$SYS/load"};
+    bool removed;
+
+    for (const char *topic_name : topic_names) {
+        REQUIRE(retain(prs, topic_name, "payload", 0, 100, &removed) == 0);
+        CHECK(!removed);
+    }
+
+    size_t message_count, node_count, byte_count;
+    REQUIRE(mr_get_retained_store_counts(prs, &message_count, &node_count, &byte_count) == 0);
+    CHECK(message_count == 7);
+    CHECK(node_count == 11); // the root & one node per distinct topic prefix
+    CHECK(byte_count > 7 * strlen("payload"));
+
+    typedef std::set<std::string> topics;
+
+    // *** test sections ***
+
+    SECTION("literal & wildcard levels") {
+        CHECK(match_topics(prs, "a/b/c", 100) == topics{"a/b/c"});
+        CHECK(match_topics(prs, "a/+/c", 100) == topics{"a/b/c", "a/x/c", "a//c"});
+        CHECK(match_topics(prs, "+/b", 100) == topics{"a/b"});
+        CHECK(match_topics(prs, "+", 100) == topics{"a", "b"});
+        CHECK(match_topics(prs, "a/y", 100).empty());
+        CHECK(match_topics(prs, "+/+/+/+", 100).empty());
+    }
+
+    SECTION("'#' matches its parent level & the whole subtree") {
+        CHECK(match_topics(prs, "a/#", 100) == topics{"a", "a/b", "a/b/c", "a/x/c", "a//c"});
+        CHECK(match_topics(prs, "a/b/#", 100) == topics{"a/b", "a/b/c"});
+        CHECK(match_topics(prs, "+/+/#", 100) == topics{"a/b", "a/b/c", "a/x/c", "a//c"});
+        CHECK(match_topics(prs, "#", 100) == topics{"a", "a/b", "a/b/c", "a/x/c", "a//c", "b"});
+    }
+
+    SECTION("topic names starting with '$'") {
+        CHECK(match_topics(prs, "$SYS/#", 100) == topics{"$SYS/load"});
+        CHECK(match_topics(prs, "$SYS/+", 100) == topics{"$SYS/load"});
+        CHECK(match_topics(prs, "+/load", 100).empty());
+    }
+
+    SECTION("stored for resending") {
+        retained_result rr = {};
+        REQUIRE(mr_match_retained(prs, "a/b", 3, 100, collect_retained, &rr) == 0);
+        REQUIRE(rr.count == 1);
+
+        struct capture {
+            const uint8_t *u8v0;
+            size_t u8vlen;
+        } cap = {};
+
+        auto fn = [](const mr_retained_message *prm, void *arg) -> int {
+            ((capture *)arg)->u8v0 = prm->u8v0;
+            ((capture *)arg)->u8vlen = prm->u8vlen;
+            return 0;
+        };
+
+        REQUIRE(mr_match_retained(prs, "a/b", 3, 100, fn, &cap) == 0);
+        mr_publish_peek peek;
+        REQUIRE(mr_peek_publish(cap.u8v0, cap.u8vlen, &peek) == 0);
+        CHECK(peek.retain);
+        CHECK(!peek.dup);
+        CHECK(peek.qos == 1);
+        CHECK(peek.packet_identifier == 7);
+        CHECK(std::string(peek.topic_name, peek.topic_name_len) == "a/b");
+        CHECK(std::string((const char *)cap.u8v0 + peek.payload_offset, peek.payload_len) == "payload");
+    }
+
+    SECTION("replace & remove") {
+        REQUIRE(retain(prs, "a/b", "newer payload", 0, 100, &removed) == 0);
+        CHECK(removed);
+        REQUIRE(mr_get_retained_store_counts(prs, &message_count, &node_count, &byte_count) == 0);
+        CHECK(message_count == 7);
+
+        REQUIRE(retain(prs, "a/b/c", NULL, 0, 100, &removed) == 0); // an empty payload removes
+        CHECK(removed);
+        REQUIRE(retain(prs, "a/x/c", NULL, 0, 100, &removed) == 0);
+        CHECK(removed);
+        REQUIRE(retain(prs, "nothing/here", NULL, 0, 100, &removed) == 0);
+        CHECK(!removed);
+        REQUIRE(mr_get_retained_store_counts(prs, &message_count, &node_count, &byte_count) == 0);
+        CHECK(message_count == 5);
+        CHECK(node_count == 8); // a/b/c, a/x/c & a/x pruned
+        CHECK(match_topics(prs, "a/#", 100) == topics{"a", "a/b", "a//c"});
+    }
+
+    SECTION("a nonzero return stops the match") {
+        retained_result rr = {};
+        rr.stop_after = 2;
+        CHECK(mr_match_retained(prs, "#", 1, 100, collect_retained, &rr) == 1);
+        CHECK(rr.count == 2);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_retained_store(prs) == 0);
+}
+
+TEST_CASE("retained message expiry", "[retained][expiry]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_retained_store *prs;
+    REQUIRE(mr_init_retained_store(&prs) == 0);
+    bool removed;
+    REQUIRE(retain(prs, "t/10", "payload", 10, 100, &removed) == 0);
+    REQUIRE(retain(prs, "t/20", "payload", 20, 100, &removed) == 0);
+    REQUIRE(retain(prs, "t/5", "payload", 5, 100, &removed) == 0);
+    REQUIRE(retain(prs, "t/never", "payload", 0, 100, &removed) == 0);
+    typedef std::set<std::string> topics;
+    size_t message_count, node_count, byte_count, expired_count;
+
+    // *** test sections ***
+
+    SECTION("the remaining interval is sent") {
+        retained_result rr = {};
+        REQUIRE(mr_match_retained(prs, "t/10", 4, 103, collect_retained, &rr) == 0);
+        REQUIRE(rr.count == 1);
+        CHECK(rr.message_expiry_interval == 7);
+
+        rr = {};
+        REQUIRE(mr_match_retained(prs, "t/never", 7, 1000, collect_retained, &rr) == 0);
+        REQUIRE(rr.count == 1);
+        CHECK(rr.message_expiry_interval == 0);
+    }
+
+    SECTION("expired messages are skipped, then removed") {
+        CHECK(match_topics(prs, "t/+", 105) == topics{"t/10", "t/20", "t/never"});
+        CHECK(match_topics(prs, "t/+", 110) == topics{"t/20", "t/never"});
+
+        REQUIRE(mr_expire_retained(prs, 109, &expired_count) == 0);
+        CHECK(expired_count == 1);
+        REQUIRE(mr_expire_retained(prs, 120, &expired_count) == 0);
+        CHECK(expired_count == 2);
+        REQUIRE(mr_expire_retained(prs, 10000, &expired_count) == 0);
+        CHECK(expired_count == 0);
+
+        REQUIRE(mr_get_retained_store_counts(prs, &message_count, &node_count, &byte_count) == 0);
+        CHECK(message_count == 1);
+        CHECK(node_count == 3);
+    }
+
+    SECTION("replacing or removing a message drops its expiry") {
+        REQUIRE(retain(prs, "t/5", "payload", 0, 100, &removed) == 0);
+        REQUIRE(retain(prs, "t/10", NULL, 0, 100, &removed) == 0);
+        REQUIRE(retain(prs, "t/20", "payload", 50, 100, &removed) == 0);
+        REQUIRE(mr_expire_retained(prs, 140, &expired_count) == 0);
+        CHECK(expired_count == 0);
+        REQUIRE(mr_expire_retained(prs, 150, &expired_count) == 0);
+        CHECK(expired_count == 1);
+        CHECK(match_topics(prs, "#", 150) == topics{"t/5", "t/never"});
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_retained_store(prs) == 0);
+}
+
+TEST_CASE("unhappy retained store", "[retained][unhappy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_retained_store *prs;
+    REQUIRE(mr_init_retained_store(&prs) == 0);
+    mr_error err;
+    bool removed;
+
+    // *** test sections ***
+
+    SECTION("invalid topic filters") {
+        retained_result rr = {};
+        const char *topic_filters[] = {"a/#/b", "a+", "", "$share/g/a"};
+
+        for (const char *topic_filter : topic_filters) {
+            CHECK(mr_match_retained(prs, topic_filter, strlen(topic_filter), 0, collect_retained, &rr) == -1);
+        }
+
+        REQUIRE(mr_get_error(&err) == 0);
+        CHECK(err.reason_code == MQTT_RC_SHARED_SUBSCRIPTIONS_NOT_SUPPORTED);
+    }
+
+    SECTION("a topic alias cannot be retained") {
+        const uint8_t u8v[] = {0x30, 10, 0, 3, 'a', '/', 'b', 3, 0x23, 0, 3, 'x'}; // topic_alias 3
+        mr_packet_ctx *pctx;
+        REQUIRE(mr_init_unpack_publish_packet(&pctx, u8v, sizeof(u8v)) == 0);
+        CHECK(mr_retain_publish_packet(prs, pctx, 0, &removed) == -1);
+        REQUIRE(mr_get_error(&err) == 0);
+        CHECK(err.code == MR_ERR_VALUE);
+        CHECK(err.reason_code == MQTT_RC_PROTOCOL_ERROR);
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+
+        size_t message_count, node_count, byte_count;
+        REQUIRE(mr_get_retained_store_counts(prs, &message_count, &node_count, &byte_count) == 0);
+        CHECK(message_count == 0);
+        CHECK(node_count == 1);
+    }
+
+    SECTION("topic names deeper than a stack can recurse") {
+        std::string deep = "d";
+        for (int i = 0; i < 20000; i++) deep += "/d";
+        REQUIRE(retain(prs, deep.c_str(), "payload", 0, 0, &removed) == 0);
+        REQUIRE(retain(prs, "d", "payload", 0, 0, &removed) == 0);
+        CHECK(match_topics(prs, "#", 0) == std::set<std::string>{"d", deep});
+        CHECK(match_topics(prs, "d/d/#", 0) == std::set<std::string>{deep});
+        REQUIRE(retain(prs, deep.c_str(), NULL, 0, 0, &removed) == 0);
+        CHECK(removed);
+
+        size_t message_count, node_count, byte_count;
+        REQUIRE(mr_get_retained_store_counts(prs, &message_count, &node_count, &byte_count) == 0);
+        CHECK(node_count == 2);
+        REQUIRE(retain(prs, deep.c_str(), "payload", 0, 0, &removed) == 0); // freed by the epilog
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_retained_store(prs) == 0);
+}
+
+TEST_CASE("many retained messages", "[retained][scale]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_retained_store *prs;
+    REQUIRE(mr_init_retained_store(&prs) == 0);
+    char topic_name[64];
+    bool removed;
+
+    for (int i = 0; i < 10000; i++) {
+        snprintf(topic_name, sizeof(topic_name), "site/%d/device/%d", i % 100, i);
+        REQUIRE(retain(prs, topic_name, "payload", i % 2 ? 60 : 0, 0, &removed) == 0);
+    }
+
+    // *** test sections ***
+
+    SECTION("a filter visits only its subtree") {
+        CHECK(match_topics(prs, "site/7/device/+", 0).size() == 100);
+        CHECK(match_topics(prs, "site/+/device/4242", 0) == std::set<std::string>{"site/42/device/4242"});
+        CHECK(match_topics(prs, "site/#", 0).size() == 10000);
+        CHECK(match_topics(prs, "site/#", 60).size() == 5000);
+    }
+
+    SECTION("removing every message prunes every node") {
+        size_t expired_count, message_count, node_count, byte_count;
+        REQUIRE(mr_expire_retained(prs, 60, &expired_count) == 0);
+        CHECK(expired_count == 5000);
+
+        for (int i = 0; i < 10000; i += 2) {
+            snprintf(topic_name, sizeof(topic_name), "site/%d/device/%d", i % 100, i);
+            REQUIRE(retain(prs, topic_name, NULL, 0, 0, &removed) == 0);
+            CHECK(removed);
+        }
+
+        REQUIRE(mr_get_retained_store_counts(prs, &message_count, &node_count, &byte_count) == 0);
+        CHECK(message_count == 0);
+        CHECK(node_count == 1);
+        CHECK(byte_count == 0);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_retained_store(prs) == 0);
+}
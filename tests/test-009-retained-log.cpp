@@ -0,0 +1,235 @@
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+
+#include <catch2/catch.hpp>
+#include <zlog.h>
+
+#include "mister/mister.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+typedef std::map<std::string, std::string> messages; // topic name -> payload
+
+static int collect_message(const mr_retained_message *prm, void *arg) {
+    mr_publish_peek peek;
+    REQUIRE(mr_peek_publish(prm->u8v0, prm->u8vlen, &peek) == 0);
+    CHECK(peek.retain);
+    std::string topic_name(prm->topic_name, prm->topic_name_len);
+    (*(messages *)arg)[topic_name] = std::string((const char *)prm->u8v0 + peek.payload_offset, peek.payload_len);
+    return 0;
+}
+
+static messages match_all(mr_retained_store *prs, const char *topic_filter, uint64_t now) {
+    messages msgs;
+    REQUIRE(mr_match_retained(prs, topic_filter, strlen(topic_filter), now, collect_message, &msgs) == 0);
+    return msgs;
+}
+
+// payload NULL retains an empty payload
+static int retain(mr_retained_store *prs, const char *topic_name, const char *payload, uint32_t expiry, uint64_t now) {
+    mr_packet_ctx *pctx;
+    bool removed;
+    REQUIRE(mr_init_publish_packet(&pctx) == 0);
+    REQUIRE(mr_set_publish_topic_name(pctx, topic_name) == 0);
+    if (expiry) REQUIRE(mr_set_publish_message_expiry_interval(pctx, expiry) == 0);
+    if (payload) REQUIRE(mr_set_publish_payload(pctx, (const uint8_t *)payload, strlen(payload)) == 0);
+    int rc = mr_retain_publish_packet(prs, pctx, now, &removed);
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+    return rc;
+}
+
+static std::vector<fs::path> segment_files(const fs::path &dir) {
+    std::vector<fs::path> paths;
+
+    for (const auto &de : fs::directory_iterator(dir)) {
+        if (de.path().extension() == ".seg") paths.push_back(de.path());
+    }
+
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+static void flip_byte(const fs::path &path, std::streamoff offset) {
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekg(offset);
+    char c;
+    f.get(c);
+    f.seekp(offset);
+    f.put(c ^ 0x5A);
+}
+
+static fs::path make_dir(void) {
+    char dir_template[] = "/tmp/mister-retained-XXXXXX";
+    REQUIRE(mkdtemp(dir_template));
+    return fs::path(dir_template);
+}
+
+TEST_CASE("happy persistent retained store", "[retained_log][happy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    fs::path dir = make_dir();
+    mr_retained_store *prs;
+    REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 0, 100) == 0);
+    size_t message_count, node_count, byte_count, log_bytes;
+
+    // *** test sections ***
+
+    SECTION("messages, removals & expiry survive reopening") {
+        REQUIRE(retain(prs, "a/b", "one", 0, 100) == 0);
+        REQUIRE(retain(prs, "a/c", "two", 10, 100) == 0);
+        REQUIRE(retain(prs, "$SYS/load", "three", 0, 100) == 0);
+        REQUIRE(retain(prs, "a/b", NULL, 0, 100) == 0);
+        REQUIRE(mr_sync_retained_store(prs) == 0);
+        REQUIRE(mr_free_retained_store(prs) == 0);
+
+        REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 0, 105) == 0);
+        CHECK(match_all(prs, "#", 105) == messages{{"a/c", "two"}});
+        CHECK(match_all(prs, "$SYS/#", 105) == messages{{"$SYS/load", "three"}});
+        REQUIRE(mr_get_retained_store_counts(prs, &message_count, &node_count, &byte_count) == 0);
+        CHECK(message_count == 2);
+        REQUIRE(mr_free_retained_store(prs) == 0);
+
+        REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 0, 110) == 0); // a/c expired
+        CHECK(match_all(prs, "#", 110).empty());
+        REQUIRE(retain(prs, "a/d", "four", 0, 110) == 0);
+        CHECK(match_all(prs, "a/+", 110) == messages{{"a/d", "four"}});
+    }
+
+    SECTION("segments are sealed at the segment size") {
+        REQUIRE(mr_free_retained_store(prs) == 0);
+        REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 256, 100) == 0);
+        char topic_name[32], payload[32];
+
+        for (int i = 0; i < 50; i++) {
+            snprintf(topic_name, sizeof(topic_name), "t/%d", i);
+            snprintf(payload, sizeof(payload), "payload %d", i);
+            REQUIRE(retain(prs, topic_name, payload, 0, 100) == 0);
+        }
+
+        CHECK(segment_files(dir).size() > 5);
+        REQUIRE(mr_free_retained_store(prs) == 0);
+
+        REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 256, 100) == 0);
+        messages msgs = match_all(prs, "t/+", 100);
+        CHECK(msgs.size() == 50);
+        CHECK(msgs["t/42"] == "payload 42");
+    }
+
+    SECTION("compaction keeps only the live messages") {
+        REQUIRE(mr_free_retained_store(prs) == 0);
+        REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 1024, 100) == 0);
+        char payload[32];
+
+        for (int i = 0; i < 100; i++) {
+            snprintf(payload, sizeof(payload), "version %d", i);
+            REQUIRE(retain(prs, "a/b", payload, 0, 100) == 0);
+            REQUIRE(retain(prs, "a/expiring", payload, 5, 100) == 0);
+        }
+
+        REQUIRE(retain(prs, "a/c", "kept", 0, 100) == 0);
+        size_t before;
+        REQUIRE(mr_get_retained_log_size(prs, &before) == 0);
+        REQUIRE(mr_compact_retained_store(prs, 105) == 0); // a/expiring expired
+        REQUIRE(mr_get_retained_log_size(prs, &log_bytes) == 0);
+        CHECK(log_bytes < before / 10);
+        CHECK(segment_files(dir).size() == 2); // the base & the new active segment
+
+        // the messages now reference the new segments
+        CHECK(match_all(prs, "#", 105) == messages{{"a/b", "version 99"}, {"a/c", "kept"}});
+        REQUIRE(retain(prs, "a/d", "after", 0, 105) == 0);
+        REQUIRE(mr_free_retained_store(prs) == 0);
+
+        REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 1024, 105) == 0);
+        CHECK(match_all(prs, "#", 105) == messages{{"a/b", "version 99"}, {"a/c", "kept"}, {"a/d", "after"}});
+        REQUIRE(mr_compact_retained_store(prs, 105) == 0); // again, from mapped messages
+        CHECK(match_all(prs, "#", 105) == messages{{"a/b", "version 99"}, {"a/c", "kept"}, {"a/d", "after"}});
+    }
+
+    SECTION("an interrupted compaction's files are ignored") {
+        REQUIRE(retain(prs, "a/b", "one", 0, 100) == 0);
+        std::ofstream(dir / "00000000000000ff.seg.tmp") << "partial";
+        REQUIRE(mr_free_retained_store(prs) == 0);
+
+        REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 0, 100) == 0);
+        CHECK(match_all(prs, "#", 100) == messages{{"a/b", "one"}});
+        CHECK(!fs::exists(dir / "00000000000000ff.seg.tmp"));
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_retained_store(prs) == 0);
+    fs::remove_all(dir);
+}
+
+TEST_CASE("unhappy persistent retained store", "[retained_log][unhappy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    fs::path dir = make_dir();
+    mr_retained_store *prs;
+    REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 0, 100) == 0);
+    REQUIRE(retain(prs, "a/1", "one", 0, 100) == 0);
+    REQUIRE(retain(prs, "a/2", "two", 0, 100) == 0);
+    REQUIRE(retain(prs, "a/3", "three", 0, 100) == 0);
+    REQUIRE(mr_free_retained_store(prs) == 0);
+    fs::path segment = segment_files(dir).back();
+    mr_error err;
+
+    // *** test sections ***
+
+    SECTION("a torn tail is cut off") {
+        fs::resize_file(segment, fs::file_size(segment) - 5);
+        REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 0, 100) == 0);
+        CHECK(match_all(prs, "#", 100) == messages{{"a/1", "one"}, {"a/2", "two"}});
+        REQUIRE(retain(prs, "a/4", "four", 0, 100) == 0);
+        REQUIRE(mr_free_retained_store(prs) == 0);
+
+        REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 0, 100) == 0);
+        CHECK(match_all(prs, "#", 100) == messages{{"a/1", "one"}, {"a/2", "two"}, {"a/4", "four"}});
+        REQUIRE(mr_free_retained_store(prs) == 0);
+    }
+
+    SECTION("a record failing its checksum ends the active segment") {
+        flip_byte(segment, fs::file_size(segment) - 12); // in a/3's frame
+        REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 0, 100) == 0);
+        CHECK(match_all(prs, "#", 100) == messages{{"a/1", "one"}, {"a/2", "two"}});
+        REQUIRE(mr_free_retained_store(prs) == 0);
+    }
+
+    SECTION("a corrupt sealed segment fails the open") {
+        REQUIRE(mr_open_retained_store(&prs, dir.c_str(), 0, 100) == 0);
+        REQUIRE(mr_compact_retained_store(prs, 100) == 0);
+        REQUIRE(mr_free_retained_store(prs) == 0);
+        fs::path base = segment_files(dir).front();
+        flip_byte(base, 32); // the first record's magic
+
+        CHECK(mr_open_retained_store(&prs, dir.c_str(), 0, 100) == -1);
+        REQUIRE(mr_get_error(&err) == 0);
+        CHECK(err.code == MR_ERR_VALUE);
+    }
+
+    SECTION("a missing directory") {
+        CHECK(mr_open_retained_store(&prs, (dir / "missing").c_str(), 0, 100) == -1);
+        REQUIRE(mr_get_error(&err) == 0);
+        CHECK(err.code == MR_ERR_IO);
+    }
+
+    SECTION("an in-memory store is not persistent") {
+        REQUIRE(mr_init_retained_store(&prs) == 0);
+        size_t log_bytes;
+        CHECK(mr_sync_retained_store(prs) == -1);
+        CHECK(mr_get_retained_log_size(prs, &log_bytes) == -1);
+        CHECK(mr_compact_retained_store(prs, 100) == -1);
+        REQUIRE(mr_free_retained_store(prs) == 0);
+    }
+
+    // *** common test epilog ***
+
+    fs::remove_all(dir);
+}
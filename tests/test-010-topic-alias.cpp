@@ -0,0 +1,239 @@
+#include <string>
+
+#include <catch2/catch.hpp>
+#include <zlog.h>
+
+#include "mister/mister.h"
+#include "test_util.h"
+
+// pack a PUBLISH as sent, topic_alias 0 for none, & unpack it as received into *ppctx
+static void receive(mr_packet_ctx **ppctx, const char *topic_name, const uint16_t topic_alias) {
+    mr_packet_ctx *pctx;
+    uint8_t *u8v0;
+    size_t u8vlen;
+    REQUIRE(mr_init_publish_packet(&pctx) == 0);
+    REQUIRE(mr_set_publish_topic_name(pctx, topic_name) == 0);
+    if (topic_alias) REQUIRE(mr_set_publish_topic_alias(pctx, topic_alias) == 0);
+    REQUIRE(mr_pack_publish_packet(pctx, &u8v0, &u8vlen) == 0);
+    REQUIRE(mr_init_unpack_publish_packet(ppctx, u8v0, u8vlen) == 0);
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+}
+
+static std::string topic_name_of(mr_packet_ctx *pctx) {
+    char *topic_name;
+    REQUIRE(mr_get_publish_topic_name(pctx, &topic_name) == 0);
+    return std::string(topic_name);
+}
+
+static uint16_t assign(mr_topic_aliases *pta, const char *topic_name, bool *ptopic_alias_only) {
+    mr_publish_target target = {};
+    REQUIRE(mr_assign_topic_alias(pta, topic_name, strlen(topic_name), &target) == 0);
+    *ptopic_alias_only = target.topic_alias_only;
+    return target.topic_alias;
+}
+
+TEST_CASE("happy topic aliases", "[topic_alias][happy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_topic_aliases *pta;
+    REQUIRE(mr_init_topic_aliases(&pta, 10, 2) == 0);
+    mr_packet_ctx *pctx;
+    uint16_t u16;
+    bool exists_flag, alias_only;
+
+    // *** test sections ***
+
+    SECTION("inbound aliases are set & resolved") {
+        receive(&pctx, "sensors/one", 1);
+        REQUIRE(mr_resolve_topic_alias(pta, pctx) == 0);
+        CHECK(topic_name_of(pctx) == "sensors/one");
+        REQUIRE(mr_get_publish_topic_alias(pctx, &u16, &exists_flag) == 0);
+        CHECK(!exists_flag);
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+
+        receive(&pctx, "", 1);
+        REQUIRE(mr_resolve_topic_alias(pta, pctx) == 0);
+        CHECK(topic_name_of(pctx) == "sensors/one");
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+
+        receive(&pctx, "sensors/two", 1); // reset
+        REQUIRE(mr_resolve_topic_alias(pta, pctx) == 0);
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+        receive(&pctx, "", 1);
+        REQUIRE(mr_resolve_topic_alias(pta, pctx) == 0);
+        CHECK(topic_name_of(pctx) == "sensors/two");
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+
+        mr_packet_ctx *pfirst;
+        receive(&pfirst, "", 1);
+        REQUIRE(mr_resolve_topic_alias(pta, pfirst) == 0);
+        receive(&pctx, "sensors/building-7/floor-3/temperature", 1); // reset while pfirst is in use
+        REQUIRE(mr_resolve_topic_alias(pta, pctx) == 0);
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+        CHECK(topic_name_of(pfirst) == "sensors/two");
+        REQUIRE(mr_free_topic_aliases(pta) == 0);
+        CHECK(topic_name_of(pfirst) == "sensors/two");
+        REQUIRE(mr_free_publish_packet(pfirst) == 0);
+        REQUIRE(mr_init_topic_aliases(&pta, 10, 2) == 0);
+
+        receive(&pctx, "sensors/three", 0); // no alias: left as is
+        REQUIRE(mr_resolve_topic_alias(pta, pctx) == 0);
+        CHECK(topic_name_of(pctx) == "sensors/three");
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+    }
+
+    SECTION("outbound aliases go to the topic names sent most") {
+        CHECK(assign(pta, "sensors/one", &alias_only) == 1);
+        CHECK(!alias_only); // the peer learns the alias
+        CHECK(assign(pta, "sensors/one", &alias_only) == 1);
+        CHECK(alias_only);
+        CHECK(assign(pta, "sensors/two", &alias_only) == 2);
+        CHECK(!alias_only);
+
+        // every alias taken: sensors/three must be sent more often than sensors/two to take its alias
+        CHECK(assign(pta, "sensors/three", &alias_only) == 0);
+        CHECK(assign(pta, "sensors/three", &alias_only) == 2);
+        CHECK(!alias_only);
+        CHECK(assign(pta, "sensors/three", &alias_only) == 2);
+        CHECK(alias_only);
+        CHECK(assign(pta, "sensors/one", &alias_only) == 1);
+        CHECK(alias_only);
+
+        CHECK(assign(pta, "a/b", &alias_only) == 0); // too short to gain from an alias
+    }
+
+    SECTION("one-off topic names leave the aliases alone") {
+        for (int i = 0; i < 8; i++) {
+            CHECK(assign(pta, "sensors/one", &alias_only) == 1);
+            CHECK(assign(pta, "sensors/two", &alias_only) == 2);
+        }
+
+        char topic_name[32];
+
+        for (int i = 0; i < 50; i++) {
+            snprintf(topic_name, sizeof(topic_name), "once/%d", i);
+            CHECK(assign(pta, topic_name, &alias_only) == 0);
+        }
+
+        CHECK(assign(pta, "sensors/one", &alias_only) == 1);
+        CHECK(alias_only);
+        CHECK(assign(pta, "sensors/two", &alias_only) == 2);
+        CHECK(alias_only);
+    }
+
+    SECTION("aliased packets round trip") {
+        mr_topic_aliases *preceiver;
+        REQUIRE(mr_init_topic_aliases(&preceiver, 2, 0) == 0);
+        const uint8_t payload[] = {'d', 'e', 'f'};
+        size_t packet_u8vlens[2];
+
+        for (int i = 0; i < 2; i++) {
+            mr_packet_ctx *psent;
+            uint8_t *u8v0;
+            REQUIRE(mr_init_publish_packet(&psent) == 0);
+            REQUIRE(mr_set_publish_topic_name(psent, "sensors/building-7/floor-3/temperature") == 0);
+            REQUIRE(mr_set_publish_payload(psent, payload, sizeof(payload)) == 0);
+            REQUIRE(mr_alias_publish_packet(pta, psent) == 0);
+            REQUIRE(mr_pack_publish_packet(psent, &u8v0, packet_u8vlens + i) == 0);
+
+            REQUIRE(mr_init_unpack_publish_packet(&pctx, u8v0, packet_u8vlens[i]) == 0);
+            REQUIRE(mr_free_publish_packet(psent) == 0);
+            REQUIRE(mr_resolve_topic_alias(preceiver, pctx) == 0);
+            CHECK(topic_name_of(pctx) == "sensors/building-7/floor-3/temperature");
+            REQUIRE(mr_free_publish_packet(pctx) == 0);
+        }
+
+        CHECK(packet_u8vlens[1] == packet_u8vlens[0] - strlen("sensors/building-7/floor-3/temperature"));
+        REQUIRE(mr_free_topic_aliases(preceiver) == 0);
+    }
+
+    SECTION("maxima from the handshake") {
+        REQUIRE(mr_free_topic_aliases(pta) == 0);
+        mr_packet_ctx *pconnect, *pconnack;
+        REQUIRE(mr_init_connect_packet(&pconnect) == 0);
+        REQUIRE(mr_set_connect_topic_alias_maximum(pconnect, 1) == 0);
+        REQUIRE(mr_init_connack_packet(&pconnack) == 0);
+        REQUIRE(mr_set_connack_topic_alias_maximum(pconnack, 3) == 0);
+
+        REQUIRE(mr_init_topic_aliases_handshake(&pta, pconnect, pconnack, true) == 0); // server
+        receive(&pctx, "sensors/one", 3);
+        CHECK(mr_resolve_topic_alias(pta, pctx) == 0);
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+        CHECK(assign(pta, "sensors/one", &alias_only) == 1);
+        CHECK(assign(pta, "sensors/two", &alias_only) == 0);
+        REQUIRE(mr_free_topic_aliases(pta) == 0);
+
+        REQUIRE(mr_init_topic_aliases_handshake(&pta, pconnect, pconnack, false) == 0); // client
+        receive(&pctx, "sensors/one", 3);
+        CHECK(mr_resolve_topic_alias(pta, pctx) == -1);
+        REQUIRE(mr_free_publish_packet(pctx) == 0);
+        CHECK(assign(pta, "sensors/one", &alias_only) == 1);
+        CHECK(assign(pta, "sensors/two", &alias_only) == 2);
+
+        REQUIRE(mr_free_connect_packet(pconnect) == 0);
+        REQUIRE(mr_free_connack_packet(pconnack) == 0);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_topic_aliases(pta) == 0);
+}
+
+TEST_CASE("unhappy topic aliases", "[topic_alias][unhappy]") {
+    dzlog_init("", "mr_init");
+
+    // *** common test prolog ***
+
+    mr_topic_aliases *pta;
+    REQUIRE(mr_init_topic_aliases(&pta, 2, 0) == 0);
+    mr_packet_ctx *pctx = NULL;
+    mr_error err;
+    bool alias_only;
+
+    // *** test sections ***
+
+    SECTION("alias beyond the maximum") {
+        receive(&pctx, "sensors/one", 3);
+        CHECK(mr_resolve_topic_alias(pta, pctx) == -1);
+        REQUIRE(mr_get_error(&err) == 0);
+        CHECK(err.code == MR_ERR_VALUE);
+        CHECK(err.reason_code == MQTT_RC_TOPIC_ALIAS_INVALID);
+        CHECK(err.field_idx == PUBLISH_TOPIC_ALIAS);
+    }
+
+    SECTION("alias never set") {
+        receive(&pctx, "", 2);
+        CHECK(mr_resolve_topic_alias(pta, pctx) == -1);
+        REQUIRE(mr_get_error(&err) == 0);
+        CHECK(err.reason_code == MQTT_RC_PROTOCOL_ERROR);
+        CHECK(err.field_idx == PUBLISH_TOPIC_ALIAS);
+    }
+
+    SECTION("empty topic name without an alias") {
+        receive(&pctx, "", 0);
+        CHECK(mr_resolve_topic_alias(pta, pctx) == -1);
+        REQUIRE(mr_get_error(&err) == 0);
+        CHECK(err.reason_code == MQTT_RC_PROTOCOL_ERROR);
+        CHECK(err.field_idx == PUBLISH_TOPIC_NAME);
+    }
+
+    SECTION("no outbound aliases allowed") {
+        CHECK(assign(pta, "sensors/one", &alias_only) == 0);
+        CHECK(assign(pta, "sensors/one", &alias_only) == 0);
+        receive(&pctx, "sensors/one", 0);
+    }
+
+    SECTION("a packet already aliased") {
+        REQUIRE(mr_free_topic_aliases(pta) == 0);
+        REQUIRE(mr_init_topic_aliases(&pta, 2, 2) == 0);
+        receive(&pctx, "sensors/one", 1);
+        CHECK(mr_alias_publish_packet(pta, pctx) == -1);
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_free_publish_packet(pctx) == 0);
+    REQUIRE(mr_free_topic_aliases(pta) == 0);
+}
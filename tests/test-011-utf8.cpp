@@ -0,0 +1,113 @@
+#include <catch2/catch.hpp>
+#include <zlog.h>
+
+#include "mister/mister.h"
+#include "test_util.h"
+
+#define UTF8_RUN 48 // past two AVX2 blocks & three SSE2 blocks
+
+// validate u8v with each ASCII scan, expecting err_pos (0 for valid) & an error at err_pos - 1
+static void check_each_impl(const uint8_t *u8v, const size_t len, const size_t expected_err_pos) {
+    const int impls[] = {MR_UTF8_SWAR, MR_UTF8_SSE2, MR_UTF8_AVX2};
+    const char *impl_names[] = {"SWAR", "SSE2", "AVX2"};
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (mr_set_utf8_impl(impls[i])) {
+            WARN(impl_names[i] << " not available");
+            continue;
+        }
+
+        INFO(impl_names[i] << ": expected err_pos: " << expected_err_pos);
+        size_t err_pos;
+        REQUIRE(mr_clear_error() == 0);
+        CHECK(mr_validate_utf8_string(u8v, len, &err_pos) == (expected_err_pos ? -1 : 0));
+        CHECK(err_pos == expected_err_pos);
+
+        mr_error err;
+        REQUIRE(mr_get_error(&err) == 0);
+
+        if (expected_err_pos) {
+            CHECK(err.code == MR_ERR_UTF8);
+            CHECK(err.offset == expected_err_pos - 1);
+        }
+        else {
+            CHECK(err.code == MR_ERR_NONE);
+        }
+    }
+
+    REQUIRE(mr_set_utf8_impl(MR_UTF8_AUTO) == 0);
+}
+
+TEST_CASE("UTF-8 error positions", "[utf8]") {
+    dzlog_init("", "mr_init");
+    REQUIRE(mr_set_error_log_rate(0) == 0);
+
+    // *** common test prolog ***
+
+    uint8_t u8v[UTF8_RUN];
+    memset(u8v, 'a', sizeof(u8v));
+    const size_t offsets[] = {15, 16, 31, 32, 33}; // each side of the SSE2 & AVX2 block boundaries
+
+    // *** test sections ***
+
+    SECTION("printable ASCII") {
+        check_each_impl(u8v, sizeof(u8v), 0);
+    }
+
+    SECTION("bad byte in an ASCII run") {
+        const uint8_t bad_bytes[] = {0x00, 0x01, 0x1F, 0x7F, 0x80, 0xFF};
+
+        for (size_t b = 0; b < sizeof(bad_bytes); b++) {
+            for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+                u8v[offsets[o]] = bad_bytes[b];
+                check_each_impl(u8v, sizeof(u8v), offsets[o] + 1);
+                u8v[offsets[o]] = 'a';
+            }
+        }
+    }
+
+    SECTION("multibyte sequence across a block boundary") {
+        const uint8_t sequences[][4] = {
+            {0xC3, 0xA9},                   // U+00E9
+            {0xE2, 0x82, 0xAC},             // U+20AC
+            {0xF0, 0x9F, 0x98, 0x80}        // U+1F600
+        };
+        const size_t sequence_lens[] = {2, 3, 4};
+
+        for (size_t s = 0; s < sizeof(sequence_lens) / sizeof(sequence_lens[0]); s++) {
+            for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+                const size_t start = offsets[o] - 1; // the sequence straddles the boundary
+                memcpy(u8v + start, sequences[s], sequence_lens[s]);
+                check_each_impl(u8v, sizeof(u8v), 0);
+
+                for (size_t cut = 1; cut < sequence_lens[s]; cut++) { // truncated by ASCII
+                    memset(u8v + start + cut, 'a', sequence_lens[s] - cut);
+                    check_each_impl(u8v, sizeof(u8v), start + 1);
+                    memcpy(u8v + start, sequences[s], sequence_lens[s]);
+                }
+
+                // truncated by the end of the string
+                check_each_impl(u8v, start + sequence_lens[s] - 1, start + 1);
+                memset(u8v + start, 'a', sequence_lens[s]);
+            }
+        }
+    }
+
+    // *** common test epilog ***
+
+    REQUIRE(mr_set_error_log_rate(100) == 0);
+    zlog_fini();
+}
+
+TEST_CASE("UTF-8 implementation selection", "[utf8]") {
+    dzlog_init("", "mr_init");
+    REQUIRE(mr_set_error_log_rate(0) == 0);
+
+    CHECK(mr_set_utf8_impl(MR_UTF8_SWAR) == 0);
+    CHECK(mr_set_utf8_impl(MR_UTF8_AVX2 + 1) == -1);
+    CHECK(mr_set_utf8_impl(-1) == -1);
+    CHECK(mr_set_utf8_impl(MR_UTF8_AUTO) == 0);
+
+    REQUIRE(mr_set_error_log_rate(100) == 0);
+    zlog_fini();
+}